@@ -1,8 +1,28 @@
+#define _POSIX_C_SOURCE 200809L // clock_gettime
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <string.h>
 #include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <errno.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// The golden image comparator is vectorized for the SIMD extension every x86-64 and arm64 CPU
+// has, anything else takes the scalar path
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
 
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
@@ -20,6 +40,141 @@
 const uint32_t WIDTH = 800;
 const uint32_t HEIGHT = 600;
 const char *TITLE = "Vulkan Probe";
+const uint32_t DEFAULT_FRAMES_IN_FLIGHT = 2;
+const uint64_t DEFAULT_HEADLESS_FRAME_COUNT = 1000;
+const char *DEFAULT_PIPELINE_CACHE_PATH = "pipeline_cache.bin";
+const char *DEFAULT_DEVICE_CACHE_PATH = "device_cache.bin";
+const char *DEFAULT_DEVICE_BENCHMARK_PATH = "device_benchmark.txt";
+const char *DEFAULT_SHADER_DIRECTORY = "shaders";
+const uint32_t DEFAULT_GOLDEN_TOLERANCE = 2;
+const uint32_t DEFAULT_STREAM_FPS = 60;
+
+// Upper bound for the --frames-in-flight option, it sizes the per-frame arrays of the App
+#define MAX_FRAMES_IN_FLIGHT 8
+
+// Upper bound for the --swapchain-images option, well above what a present mode needs
+#define MAX_SWAPCHAIN_IMAGES 16
+
+// Capacity of the per-device capability record, more than any driver reports in practice
+#define MAX_DEVICE_SURFACE_FORMATS 64
+#define MAX_DEVICE_PRESENT_MODES 8
+#define MAX_DEVICE_QUEUE_FAMILIES 16
+
+// The device cache is a DeviceCacheHeader followed by the DeviceCacheRecord of the selected
+// device, the version has to change with the record layout
+#define DEVICE_CACHE_MAGIC "VKPRBDEV"
+#define DEVICE_CACHE_VERSION 5
+
+// Size of the micro-benchmark run on every suitable device with --benchmark-devices, a
+// fraction of a second on an integrated GPU
+#define BENCHMARK_COMPUTE_INVOCATIONS (1024 * 1024)
+#define BENCHMARK_COMPUTE_ITERATIONS 256
+#define BENCHMARK_FILL_EXTENT 2048
+#define BENCHMARK_FILL_PASSES 8
+#define BENCHMARK_RUNS 3
+
+// Upper bound for the --record-threads option
+#define MAX_RECORD_THREADS 16
+
+// The frame stream has a readback buffer for every frame in flight plus FRAME_STREAM_QUEUE_DEPTH
+// frames the writer thread can lag behind before frames are dropped
+#define FRAME_STREAM_QUEUE_DEPTH 4
+#define FRAME_STREAM_MAX_BUFFERS (MAX_FRAMES_IN_FLIGHT + FRAME_STREAM_QUEUE_DEPTH)
+
+// Upper bound for the --compile-threads option and number of pipelines that can be compiled
+// at startup
+#define MAX_JOB_THREADS 16
+#define MAX_PIPELINE_BUILDS 32
+
+// Features a graphics pipeline variant is specialized for, the bit index is the constant_id of
+// the specialization constant in the shaders. The variants are keyed by their feature mask
+#define PIPELINE_FEATURE_ROTATION (1u << 0) // instances have a rotation
+#define PIPELINE_FEATURE_CAMERA (1u << 1) // the view of the frame uniforms is not the identity
+#define PIPELINE_FEATURE_TEXTURES (1u << 2) // materials can have a texture
+#define PIPELINE_FEATURE_COUNT 3
+#define MAX_PIPELINE_VARIANTS (1 << PIPELINE_FEATURE_COUNT)
+// The lookup table has twice as many slots as there can be variants
+#define PIPELINE_VARIANT_TABLE_BITS (PIPELINE_FEATURE_COUNT + 1)
+
+// Number of distinct named scopes the GPU profiler can track and how many of the last
+// samples of each scope are kept for the rolling statistics
+#define MAX_GPU_PROFILER_SCOPES 16
+#define GPU_PROFILER_HISTORY 256
+
+// Device memory is carved out of large blocks by a buddy allocator, every block is a tree of
+// power of two chunks from the block size down to MEMORY_MIN_ALLOCATION_SIZE
+#define MEMORY_BLOCK_SIZE ((VkDeviceSize)32 * 1024 * 1024)
+#define MEMORY_MIN_ALLOCATION_SIZE ((VkDeviceSize)256)
+#define MEMORY_BUDDY_ORDERS 18 // log2(MEMORY_BLOCK_SIZE / MEMORY_MIN_ALLOCATION_SIZE) + 1
+#define MAX_MEMORY_BLOCKS_PER_POOL 64
+
+// Uploads are staged in a persistently mapped ring and copied by the transfer queue in batches,
+// MAX_UPLOAD_BATCHES of which can be in flight at once
+#define UPLOAD_RING_SIZE ((VkDeviceSize)16 * 1024 * 1024)
+#define UPLOAD_ALIGNMENT ((VkDeviceSize)16)
+#define MAX_UPLOAD_BATCHES 4
+#define MAX_UPLOAD_COPIES 64
+#define MAX_UPLOAD_BUFFERS 16 // buffers whose uploaded range is tracked, see Uploader
+
+// Limits of the --instances stress mode, the instance data is streamed to the GPU in chunks
+// of INSTANCE_UPLOAD_CHUNK instances
+#define MAX_INSTANCE_COUNT 10000000
+#define INSTANCE_UPLOAD_CHUNK 65536
+
+// Size of the descriptor arrays of the bindless set, lowered to the update after bind limits
+// of the device. The first two storage buffers are the per object material IDs and the
+// materials, bindless.frag reads them from these slots
+#define MAX_BINDLESS_STORAGE_BUFFERS 1024
+#define MAX_BINDLESS_SAMPLED_IMAGES 16384
+#define BINDLESS_OBJECT_MATERIALS_SLOT 0
+#define BINDLESS_MATERIALS_SLOT 1
+#define BINDLESS_NO_TEXTURE UINT32_MAX
+#define BINDLESS_MATERIAL_COUNT 8
+
+// Texture streaming of --textures. The mips of at most TEXTURE_TAIL_SIZE texels a side are the
+// tail of a texture, uploaded before any finer mip and never evicted. The finer mips are copied
+// in strips of at most TEXTURE_UPLOAD_STRIP bytes, about TEXTURE_FRAME_UPLOAD_SIZE bytes per
+// frame, and at most MAX_DECODED_TEXTURES textures are decoded in host memory at once. The
+// coverage follows a moving camera every TEXTURE_COVERAGE_INTERVAL frames
+#define MAX_TEXTURES 4096
+#define MAX_TEXTURE_SIZE 16384
+#define MAX_TEXTURE_MIPS 15
+#define TEXTURE_TAIL_SIZE 32
+#define TEXTURE_UPLOAD_STRIP ((VkDeviceSize)4 * 1024 * 1024)
+#define TEXTURE_FRAME_UPLOAD_SIZE ((VkDeviceSize)8 * 1024 * 1024)
+#define TEXTURE_COVERAGE_INTERVAL 15
+#define MAX_DECODED_TEXTURES 4
+#define DEFAULT_TEXTURE_BUDGET_MB 256
+
+// The mesh drawn by every instance is a single triangle, its vertices are at most
+// TRIANGLE_BOUNDING_RADIUS away from its origin
+#define TRIANGLE_INDEX_COUNT 3
+#define TRIANGLE_BOUNDING_RADIUS 0.7071f
+
+// In GPU driven mode the objects are spread over a world GPU_DRIVEN_WORLD_SCALE times larger
+// than the viewport on each axis, so that the culling has objects to reject
+#define GPU_DRIVEN_WORLD_SCALE 2.0f
+#define CULLING_WORKGROUP_SIZE 256 // must match local_size_x in cull.comp
+
+// With --animate-camera the view circles the centre of the world once every CAMERA_ORBIT_FRAMES
+// frames and zooms in and out twice on the way. It only depends on the frame count so that runs
+// with the same options render the same frames
+#define CAMERA_ORBIT_FRAMES 600
+#define CAMERA_ORBIT_RADIUS 0.5f
+#define CAMERA_ZOOM_AMPLITUDE 0.25f
+
+// The async compute simulation, one thread per particle. Nothing draws the particles, the
+// simulation is only a load the compute queue runs next to the graphics work
+#define SIMULATION_PARTICLE_COUNT 65536
+#define SIMULATION_WORKGROUP_SIZE 256 // must match local_size_x in simulate.comp
+
+// Number of frames kept verbatim by the telemetry and the resolution of its histograms:
+// buckets are log spaced, TELEMETRY_BUCKETS_PER_DECADE per power of ten starting at
+// TELEMETRY_HISTOGRAM_MIN_MS, which covers 1 us to 10 s
+#define TELEMETRY_RING_SIZE 4096
+#define TELEMETRY_BUCKETS_PER_DECADE 20
+#define TELEMETRY_HISTOGRAM_BUCKETS (7 * TELEMETRY_BUCKETS_PER_DECADE)
+#define TELEMETRY_HISTOGRAM_MIN_MS 0.001
 
 const char *validationLayers[1] = {
     "VK_LAYER_KHRONOS_validation",
@@ -34,6 +189,12 @@ const char *requiredInstanceExtensions[2] = {
 #endif
 };
 
+// Instance extensions replacing the GLFW ones when running without a window
+const char *headlessInstanceExtensions[2] = {
+    VK_KHR_SURFACE_EXTENSION_NAME,
+    VK_EXT_HEADLESS_SURFACE_EXTENSION_NAME,
+};
+
 #ifdef __APPLE__
 const char *requiredDeviceExtensions[2] = {
     VK_KHR_PORTABILITY_SUBSET_EXTENSION_NAME,
@@ -60,34 +221,591 @@ const bool verbose = true;
 #else
 const bool verbose = false;
 #endif
-typedef struct App
+
+const char *startupPhaseNames[21] = {
+    "glfw",
+    "vulkan instance",
+    "surface",
+    "physical device",
+    "logical device",
+    "uploader",
+    "swap chain",
+    "image views",
+    "render pass",
+    "pipeline cache",
+    "job pool",
+    "graphics pipeline",
+    "compute pipeline",
+    "texture streamer",
+    "vertex buffers",
+    "culling pipeline",
+    "pipeline compilation",
+    "framebuffers",
+    "frame resources",
+    "gpu profiler",
+    "cleanup",
+};
+
+const char *telemetryMetricNames[3] = {
+    "frame_interval_ms",
+    "acquire_wait_ms",
+    "present_ms",
+};
+
+// Set by SIGUSR1, the telemetry is dumped by the main loop since file I/O is not allowed
+// in a signal handler
+volatile sig_atomic_t telemetryDumpRequested = 0;
+
+// SPIR-V compiled into the binary by the Makefile, see embedded_shaders.h
+typedef struct EmbeddedShader
 {
-    GLFWwindow *window;
-    VkInstance instance;
-    VkPhysicalDevice physicalDevice;
-    VkSurfaceKHR surface;
-    VkQueue graphicsQueue;
-    uint32_t graphicsQueueFamilyIndex;
-    float graphicsQueuePriority;
-    VkQueue presentationQueue;
-    uint32_t presentationQueueFamilyIndex;
-    float presentationQueuePriority;
-    VkDeviceQueueCreateInfo pQueueCreateInfos[2];
-    uint32_t queueCreateInfoCount;
-    VkDevice logicalDevice;
-    VkSurfaceFormatKHR selectedDeviceSurfaceFormat;
-    VkPresentModeKHR selectedDevicePresentMode;
-    VkSurfaceCapabilitiesKHR selectedDeviceSurfaceCapabilities;
-    VkExtent2D swapChainExtent;
-    VkSwapchainKHR swapChain;
-    VkImage *swapChainImages;
-    uint32_t swapChainImageCount;
-    VkImageView *swapChainImageViews;
-    VkRenderPass renderPass;
+    const char *name;
+    const unsigned char *code;
+    size_t codeSize;
+} EmbeddedShader;
+
+// Generated from shaders/*.spv, it defines the embeddedShaders array
+#include "embedded_shaders.h"
+
+typedef enum ShaderSource
+{
+    SHADER_SOURCE_EMBEDDED = 0, // SPIR-V linked into the binary, no file I/O at all
+    SHADER_SOURCE_MMAP = 1,     // the .spv files are memory-mapped and handed to the driver
+    SHADER_SOURCE_READ = 2,     // the .spv files are read into a heap buffer
+} ShaderSource;
+
+// Everything the device selection and the swap chain setup need to know about a physical
+// device, queried once per device
+typedef struct DeviceCapabilities
+{
+    VkPhysicalDevice device;
+    VkPhysicalDeviceProperties properties;
+    VkPhysicalDeviceFeatures features;
+    bool hasRequiredExtensions;
+    bool hasDrawIndirectCount;
+    bool hasDynamicRendering; // VK_KHR_dynamic_rendering, core since Vulkan 1.3
+    bool hasDescriptorIndexing; // VK_EXT_descriptor_indexing, core since Vulkan 1.2
+    uint32_t surfaceFormatCount;
+    VkSurfaceFormatKHR surfaceFormats[MAX_DEVICE_SURFACE_FORMATS];
+    uint32_t presentModeCount;
+    VkPresentModeKHR presentModes[MAX_DEVICE_PRESENT_MODES];
+    uint32_t queueFamilyCount;
+    VkQueueFamilyProperties queueFamilies[MAX_DEVICE_QUEUE_FAMILIES];
+    VkBool32 presentationSupport[MAX_DEVICE_QUEUE_FAMILIES];
+} DeviceCapabilities;
+
+// Throughput measured by benchmarkDevice
+typedef struct DeviceBenchmark
+{
+    double computeGflops;
+    double fillGBps; // clear bandwidth of an RGBA8 image
+} DeviceBenchmark;
+
+// Temporary device and resources the benchmark runs on, destroyed before the real logical
+// device is created
+typedef struct DeviceBenchmarkContext
+{
+    VkDevice device;
+    VkQueue queue;
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    VkFence fence;
+    VkBuffer buffer;
+    VkDeviceMemory bufferMemory;
+    VkImage image;
+    VkDeviceMemory imageMemory;
+    VkDescriptorSetLayout descriptorSetLayout;
+    VkDescriptorPool descriptorPool;
+    VkDescriptorSet descriptorSet;
     VkPipelineLayout pipelineLayout;
-    VkPipeline graphicsPipeline;
-    VkFramebuffer *swapChainFramebuffers;
-} App;
+    VkPipeline pipeline;
+} DeviceBenchmarkContext;
+
+typedef struct DeviceCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize;
+} DeviceCacheHeader;
+
+// What identifies the selected device and driver and how it was scored, the surface it
+// presents to may change between runs and is always queried again
+typedef struct DeviceCacheRecord
+{
+    uint32_t vendorID;
+    uint32_t deviceID;
+    uint32_t driverVersion;
+    uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+    uint32_t score;
+    bool benchmarkScored; // selected by the measured throughput rather than the device type
+} DeviceCacheRecord;
+
+typedef enum PresentPolicy
+{
+    PRESENT_POLICY_DEFAULT = 0,    // mailbox when available, one image more than the minimum
+    PRESENT_POLICY_LATENCY = 1,    // newest frame shown as soon as possible with as few images as possible
+    PRESENT_POLICY_THROUGHPUT = 2, // uncapped frame rate, tearing allowed
+    PRESENT_POLICY_POWER = 3,      // capped to the display refresh rate
+    PRESENT_POLICY_COUNT = 4,
+} PresentPolicy;
+
+// Present modes of every policy in order of preference, FIFO is the fallback of them all
+// since it is always supported
+typedef struct PresentPolicyInfo
+{
+    const char *name;
+    VkPresentModeKHR presentModes[2];
+    uint32_t presentModeCount;
+    uint32_t extraImageCount; // swap chain images on top of the surface minimum
+} PresentPolicyInfo;
+
+const PresentPolicyInfo presentPolicies[PRESENT_POLICY_COUNT] = {
+    [PRESENT_POLICY_DEFAULT] = {"default", {VK_PRESENT_MODE_MAILBOX_KHR}, 1, 1},
+    [PRESENT_POLICY_LATENCY] = {"latency", {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR}, 2, 0},
+    [PRESENT_POLICY_THROUGHPUT] = {"throughput", {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR}, 2, 1},
+    [PRESENT_POLICY_POWER] = {"power", {VK_PRESENT_MODE_FIFO_RELAXED_KHR}, 1, 0},
+};
+
+// What is done with the frames read back from the swap chain
+typedef enum CaptureMode
+{
+    CAPTURE_MODE_NONE = 0,
+    CAPTURE_MODE_WRITE_GOLDEN = 1,   // the captures are saved as the golden images
+    CAPTURE_MODE_COMPARE_GOLDEN = 2, // the captures are checked against the golden images
+} CaptureMode;
+
+typedef enum StreamFormat
+{
+    STREAM_FORMAT_Y4M = 0, // YUV 4:2:0 with full range BT.601, what video encoders take as is
+    STREAM_FORMAT_PAM = 1, // one RGBA PAM image per frame, no conversion at all
+} StreamFormat;
+
+typedef struct AppConfig
+{
+    uint32_t framesInFlight;
+    bool headless;
+    uint64_t maxFrameCount; // 0 means run until the window is closed
+    bool gpuProfiler;
+    bool compute;
+    uint32_t instanceCount;
+    uint32_t drawCallCount; // the instances are split evenly between the draw calls
+    uint32_t recordThreadCount; // 0 records the draws on the main thread
+    uint32_t compileThreadCount; // 0 compiles the pipelines on the main thread
+    bool gpuDriven;
+    bool animateCamera;
+    bool dynamicRendering; // render to the swap chain image views without render pass and framebuffers
+    bool bindless; // the fragment shader reads the materials from the bindless descriptor set
+    const char *textureDirectory; // NULL disables the texture streaming
+    uint32_t textureBudgetMB; // device memory the streamed textures may take
+    const char *telemetryPath; // NULL means the telemetry is only printed on SIGUSR1
+    bool telemetryJson;
+    uint32_t benchStartupRuns; // 0 means a normal run
+    const char *pipelineCachePath; // NULL disables the on-disk pipeline cache
+    const char *deviceCachePath; // NULL disables the on-disk device cache
+    bool benchmarkDevices;
+    const char *deviceBenchmarkPath; // NULL disables the on-disk benchmark results
+    ShaderSource shaderSource;
+    const char *shaderDirectory; // only used when the shaders are loaded from files
+    PresentPolicy presentPolicy;
+    uint32_t swapChainImageCount; // 0 lets the present policy decide
+    CaptureMode captureMode;
+    const char *goldenDirectory;
+    uint32_t goldenTolerance; // largest difference of a color channel still considered a match
+    uint32_t captureInterval; // every n-th frame is captured
+    const char *streamPath; // NULL disables the frame stream, "-" streams to stdout
+    StreamFormat streamFormat;
+    uint32_t streamFps; // only written to the y4m header, the frames are streamed as they come
+} AppConfig;
+
+// Everything a single frame in flight needs to be recorded and submitted independently
+// of the others
+typedef struct FrameData
+{
+    VkCommandPool commandPool;
+    VkCommandBuffer commandBuffer;
+    VkSemaphore imageAvailableSemaphore;
+    VkFence inFlightFence;
+    // The simulation runs on the compute queue independently of the graphics submissions,
+    // computeFence tells when its command buffer can be recorded again
+    VkCommandPool computeCommandPool;
+    VkCommandBuffer computeCommandBuffer;
+    VkFence computeFence;
+    double submittedFrameStartMs; // start of the last frame submitted from this slot, 0 if none
+} FrameData;
+
+// Vertex and instance layouts of vert.vert
+typedef struct Vertex
+{
+    float position[2];
+    float color[3];
+} Vertex;
+
+typedef struct InstanceData
+{
+    float offset[2];
+    float scale;
+    float rotation; // radians
+} InstanceData;
+
+// Where the instances are placed on their grid, shared by createVertexBuffers which fills the
+// instance buffer and the CPU side code that needs to know what it holds
+typedef struct InstanceLayout
+{
+    uint32_t instanceCount;
+    uint32_t gridSize;
+    float worldScale;
+    float cellSize;
+} InstanceLayout;
+
+// Matches the Material struct of bindless.frag
+typedef struct Material
+{
+    float color[4]; // multiplied with the vertex color
+    uint32_t textureIndex; // slot in the sampled image array, BINDLESS_NO_TEXTURE if untextured
+    uint32_t padding[3];
+} Material;
+
+// Matches the FrameUniforms block of vert.vert (std140): the camera, as a pan and a zoom of
+// the 2D world
+typedef struct FrameUniforms
+{
+    float viewOffset[2];
+    float viewScale[2];
+} FrameUniforms;
+
+// Matches the push constant block of vert.vert: where the instances of a draw are placed in the
+// world
+typedef struct DrawPushConstants
+{
+    float offset[2];
+    float scale;
+} DrawPushConstants;
+
+// A descriptor set holding every buffer and image the shaders can reach, which they index by
+// the slot the resource was added at. It is bound once per command buffer and stays bound while
+// descriptors are added (update after bind), only the main thread adds them. There is one copy
+// per frame in flight so that a slot can be pointed to another image once the frame is done
+typedef struct BindlessTable
+{
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool pool;
+    VkDescriptorSet sets[MAX_FRAMES_IN_FLIGHT];
+    uint32_t setCount; // 0 without --bindless
+    VkSampler sampler; // immutable, shared by every image
+    uint32_t maxStorageBuffers;
+    uint32_t maxSampledImages;
+    uint32_t storageBufferCount;
+    uint32_t sampledImageCount;
+} BindlessTable;
+
+// Matches the push constant block of cull.comp
+typedef struct CullingPushConstants
+{
+    float viewOffset[2]; // camera of the frame uniforms
+    float viewScale[2];
+    uint32_t objectCount;
+    uint32_t indexCount;
+    float boundingRadius;
+} CullingPushConstants;
+
+// Matches the push constant block of simulate.comp
+typedef struct SimulationPushConstants
+{
+    float deltaTime;
+    uint32_t particleCount;
+    uint32_t initialize;
+} SimulationPushConstants;
+
+// A swap chain and everything created from it, kept alive after a recreation until the
+// frames still using it are done
+typedef struct SwapChainResources
+{
+    VkSwapchainKHR swapChain;
+    VkImage *images;
+    VkImageView *imageViews;
+    VkFramebuffer *framebuffers;
+    VkSemaphore *renderFinishedSemaphores;
+    uint32_t imageCount;
+} SwapChainResources;
+
+// Rolling GPU timings of one named scope
+typedef struct GpuProfilerScope
+{
+    const char *name;
+    double samplesMs[GPU_PROFILER_HISTORY]; // ring buffer of the last samples
+    uint32_t sampleCount;                   // number of valid samples, at most GPU_PROFILER_HISTORY
+    uint32_t nextSample;
+} GpuProfilerScope;
+
+// Timestamp queries written around named scopes of the command buffers. Every frame in
+// flight owns a slice of the query pool, which is read back when that frame's fence has been
+// waited on, i.e. framesInFlight frames later, so reading the results never stalls
+typedef struct GpuProfiler
+{
+    bool enabled;
+    VkQueryPool queryPool;
+    double timestampPeriodNs;
+    uint64_t timestampMask;
+    GpuProfilerScope scopes[MAX_GPU_PROFILER_SCOPES];
+    uint32_t scopeCount;
+    uint32_t frameScopeIndices[MAX_FRAMES_IN_FLIGHT][MAX_GPU_PROFILER_SCOPES]; // scope of each begin/end query pair
+    uint32_t frameQueryPairCount[MAX_FRAMES_IN_FLIGHT];
+} GpuProfiler;
+
+// Buffers and linear images never share a block with optimal images, so two neighbouring
+// allocations can never break bufferImageGranularity and no padding is needed for it
+typedef enum MemoryResourceKind
+{
+    MEMORY_RESOURCE_LINEAR = 0,
+    MEMORY_RESOURCE_OPTIMAL = 1,
+    MEMORY_RESOURCE_KIND_COUNT = 2,
+} MemoryResourceKind;
+
+typedef struct MemoryBlock
+{
+    VkDeviceMemory memory;
+    VkDeviceSize size;
+    void *mapped; // host visible blocks stay mapped for their whole lifetime
+    uint32_t orderCount;
+    // One bit per node of the buddy tree, set while the node is free. Order 0 nodes are
+    // MEMORY_MIN_ALLOCATION_SIZE large and the only node of the last order is the whole block
+    uint64_t *freeBits;
+    uint32_t freeBitOffsets[MEMORY_BUDDY_ORDERS]; // first word of every order in freeBits
+    uint32_t freeCounts[MEMORY_BUDDY_ORDERS];
+    VkDeviceSize usedSize;
+    uint32_t allocationCount;
+} MemoryBlock;
+
+typedef struct MemoryPool
+{
+    MemoryBlock *blocks[MAX_MEMORY_BLOCKS_PER_POOL];
+    uint32_t blockCount;
+    VkDeviceSize blockSize;
+} MemoryPool;
+
+typedef struct MemoryAllocation
+{
+    VkDeviceMemory memory;
+    VkDeviceSize offset;
+    VkDeviceSize size; // the requested size rounded up to a chunk of the buddy tree
+    VkDeviceSize requestedSize;
+    void *mapped; // NULL unless the memory is host visible
+    MemoryBlock *block; // NULL for dedicated allocations
+    uint32_t memoryTypeIndex;
+    MemoryResourceKind kind;
+    uint32_t order;
+} MemoryAllocation;
+
+// One pool of blocks per memory type and resource kind, created with the logical device
+typedef struct MemoryAllocator
+{
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    MemoryPool pools[VK_MAX_MEMORY_TYPES][MEMORY_RESOURCE_KIND_COUNT];
+    uint32_t deviceAllocationCount; // live vkAllocateMemory allocations, bounded by maxMemoryAllocationCount
+    uint32_t dedicatedAllocationCount;
+    uint64_t totalAllocationCount;
+    uint64_t liveAllocationCount;
+    VkDeviceSize liveRequestedSize;
+    VkDeviceSize liveReservedSize;
+} MemoryAllocator;
+
+typedef struct UploadBatch
+{
+    VkCommandBuffer transferCommandBuffer;
+    VkCommandBuffer acquireCommandBuffer;
+    VkSemaphore transferFinishedSemaphore;
+    VkFence fence; // signaled once the graphics queue acquired the results of the copies
+    bool submitted;
+    VkDeviceSize ringEnd; // staging ring head when the batch was submitted
+    uint32_t copyCount;
+    VkBuffer dstBuffers[MAX_UPLOAD_COPIES];
+    VkBufferCopy regions[MAX_UPLOAD_COPIES];
+    VkPipelineStageFlags dstStageMask; // stages that consume the uploaded data
+    VkAccessFlags dstAccessMask;
+    // Images move to the transfer layout before the copies of the batch and to the shader read
+    // layout after them, so the copies of one image can span several batches
+    uint32_t beginImageCount;
+    VkImage beginImages[MAX_UPLOAD_COPIES];
+    uint32_t imageCopyCount;
+    VkImage dstImages[MAX_UPLOAD_COPIES];
+    VkBufferImageCopy imageRegions[MAX_UPLOAD_COPIES];
+    uint32_t levelCopyCount; // image to image copies, run on the graphics queue
+    VkImage levelSrcImages[MAX_UPLOAD_COPIES];
+    VkImage levelDstImages[MAX_UPLOAD_COPIES];
+    VkImageCopy levelRegions[MAX_UPLOAD_COPIES];
+    uint32_t finishImageCount;
+    VkImage finishImages[MAX_UPLOAD_COPIES];
+} UploadBatch;
+
+typedef struct UploaderStats
+{
+    uint64_t totalBytes;
+    uint64_t copyCount;
+    uint64_t batchCount;
+    uint64_t stallCount;
+    double totalStallMs;
+} UploaderStats;
+
+// Streams data to device local buffers through the transfer queue. Copies are queued into the
+// current batch and submitted together, by uploaderFlush or at the latest with the next frame
+typedef struct Uploader
+{
+    VkBuffer stagingBuffer;
+    MemoryAllocation stagingAllocation;
+    VkDeviceSize head; // ring offsets, they only grow and are taken modulo UPLOAD_RING_SIZE
+    VkDeviceSize tail;
+    VkCommandPool transferCommandPool;
+    VkCommandPool acquireCommandPool;
+    UploadBatch batches[MAX_UPLOAD_BATCHES];
+    uint32_t currentBatch;
+    uint32_t imageRowGranularity; // rows a partial image copy is aligned to, 0 for whole mips only
+    // With a dedicated transfer family, the copies only release the buffers to the graphics
+    // family and nothing ever gives them back, so every range is uploaded once. The ranges
+    // already handed over are kept here, the uploads of a buffer being contiguous
+    VkBuffer releasedBuffers[MAX_UPLOAD_BUFFERS];
+    VkDeviceSize releasedStarts[MAX_UPLOAD_BUFFERS];
+    VkDeviceSize releasedEnds[MAX_UPLOAD_BUFFERS];
+    uint32_t releasedBufferCount;
+    UploaderStats stats;
+} Uploader;
+
+// One slot of frame uniforms per frame in flight in a single persistently mapped buffer. The
+// descriptor set is written once and bound with a dynamic offset picking the slot of the frame,
+// so updating the uniforms is one memcpy
+typedef struct UniformRing
+{
+    VkBuffer buffer;
+    MemoryAllocation allocation;
+    VkDeviceSize slotSize; // sizeof(FrameUniforms) rounded up to minUniformBufferOffsetAlignment
+    uint32_t slotCount;
+    VkDescriptorSetLayout setLayout;
+    VkDescriptorPool pool;
+    VkDescriptorSet set;
+} UniformRing;
+
+// Difference between a capture and its golden image, over the color channels only
+typedef struct ImageDiff
+{
+    uint64_t squaredErrorSum;
+    uint64_t exceedingChannelCount; // channels further than the tolerance from the golden value
+    uint32_t maxChannelDiff;
+} ImageDiff;
+
+typedef enum GoldenComparison
+{
+    GOLDEN_MATCH = 0,
+    GOLDEN_MISMATCH = 1, // at least one channel is further than the tolerance
+    GOLDEN_MISSING = 2,  // no readable golden image of the size of the capture
+} GoldenComparison;
+
+typedef struct FrameCaptureStats
+{
+    uint64_t captureCount;
+    uint64_t identicalCount;
+    uint64_t mismatchCount;
+    uint64_t missingCount;
+    uint64_t firstMismatchFrame;
+    uint64_t firstMissingFrame;
+    uint32_t maxChannelDiff;
+    double minPsnrDb;
+    double totalPsnrDb; // of the frames that are not identical, the others have an infinite PSNR
+    double totalProcessMs; // writing or comparing the captures on the job pool
+    double maxProcessMs;
+} FrameCaptureStats;
+
+typedef struct FrameStreamStats
+{
+    uint64_t writtenCount;
+    uint64_t droppedCount; // no free buffer, the writer was too far behind
+    uint64_t skippedCount; // the swap chain was resized away from the size of the stream
+    uint64_t writtenBytes;
+    double totalWriteMs; // conversion included
+    double maxWriteMs;
+} FrameStreamStats;
+
+// The frames are read back into a pool of buffers, handed to a writer thread once the fence of
+// their frame signaled and given back to the pool once written. A frame finding no free buffer
+// is dropped rather than waited for, a slow reader never slows the rendering down
+typedef struct FrameStream
+{
+    bool enabled;
+    bool outputOpen;
+    int fd;
+    bool swapRedBlue;
+    VkExtent2D extent; // fixed for the whole stream, y4m has no way to change it
+    uint32_t bufferCount;
+    VkBuffer buffers[FRAME_STREAM_MAX_BUFFERS];
+    MemoryAllocation allocations[FRAME_STREAM_MAX_BUFFERS];
+    int32_t frameBuffers[MAX_FRAMES_IN_FLIGHT]; // buffer the copy of each frame slot went to, -1 if none
+    uint8_t *scratch; // conversion output, only touched by the writer
+    pthread_t thread;
+    bool threadStarted;
+    bool synchronizationCreated;
+    pthread_mutex_t mutex;
+    pthread_cond_t workReady;
+    uint32_t freeBuffers[FRAME_STREAM_MAX_BUFFERS];
+    uint32_t freeCount;
+    uint32_t queue[FRAME_STREAM_MAX_BUFFERS]; // ring of the buffers waiting to be written
+    uint32_t queueHead;
+    uint32_t queueCount;
+    bool quit; // the writer exits once the queue is empty
+    bool failed; // the writer printed why
+    FrameStreamStats stats; // the writer updates it under the mutex
+} FrameStream;
+
+// Every step of the startup, timed individually so that --bench-startup can tell which one
+// dominates the time to first frame
+typedef enum StartupPhase
+{
+    STARTUP_PHASE_GLFW = 0,
+    STARTUP_PHASE_VULKAN_INSTANCE = 1,
+    STARTUP_PHASE_SURFACE = 2,
+    STARTUP_PHASE_PHYSICAL_DEVICE = 3,
+    STARTUP_PHASE_LOGICAL_DEVICE = 4,
+    STARTUP_PHASE_UPLOADER = 5,
+    STARTUP_PHASE_SWAP_CHAIN = 6,
+    STARTUP_PHASE_IMAGE_VIEWS = 7,
+    STARTUP_PHASE_RENDER_PASS = 8,
+    STARTUP_PHASE_PIPELINE_CACHE = 9,
+    STARTUP_PHASE_JOB_POOL = 10,
+    STARTUP_PHASE_GRAPHICS_PIPELINE = 11,
+    STARTUP_PHASE_COMPUTE_PIPELINE = 12,
+    STARTUP_PHASE_TEXTURE_STREAMER = 13,
+    STARTUP_PHASE_VERTEX_BUFFERS = 14,
+    STARTUP_PHASE_CULLING_PIPELINE = 15,
+    STARTUP_PHASE_PIPELINE_COMPILATION = 16,
+    STARTUP_PHASE_FRAMEBUFFERS = 17,
+    STARTUP_PHASE_FRAME_RESOURCES = 18,
+    STARTUP_PHASE_GPU_PROFILER = 19,
+    STARTUP_PHASE_CLEANUP = 20,
+    STARTUP_PHASE_COUNT = 21,
+} StartupPhase;
+
+typedef enum TelemetryMetric
+{
+    TELEMETRY_FRAME_INTERVAL = 0,
+    TELEMETRY_ACQUIRE_WAIT = 1,
+    TELEMETRY_PRESENT_TIME = 2,
+    TELEMETRY_METRIC_COUNT = 3,
+} TelemetryMetric;
+
+typedef struct TelemetryHistogram
+{
+    uint64_t buckets[TELEMETRY_HISTOGRAM_BUCKETS];
+    uint64_t count;
+    double sumMs;
+    double maxMs;
+} TelemetryHistogram;
+
+// Per-frame timings, everything is preallocated so recording a frame never allocates. The
+// ring keeps the most recent frames verbatim while the histograms cover the whole run
+typedef struct Telemetry
+{
+    double ringMs[TELEMETRY_RING_SIZE][TELEMETRY_METRIC_COUNT];
+    uint32_t ringNext;
+    uint32_t ringCount;
+    TelemetryHistogram histograms[TELEMETRY_METRIC_COUNT];
+} Telemetry;
 
 typedef enum AppResult
 {
@@ -123,33 +841,610 @@ typedef enum AppResult
     APP_ERROR_VULKAN_CREATE_GRAPHICS_PIPELINE = 29,
     APP_ERROR_VULKAN_ALLOC_SWAP_CHAIN_FRAMEBUFFERS = 30,
     APP_ERROR_VULKAN_CREATE_FRAMEBUFFER = 31,
+    APP_ERROR_INVALID_ARGUMENT = 32,
+    APP_ERROR_VULKAN_CREATE_COMMAND_POOL = 33,
+    APP_ERROR_VULKAN_ALLOC_COMMAND_BUFFER = 34,
+    APP_ERROR_VULKAN_CREATE_SYNC_OBJECTS = 35,
+    APP_ERROR_ALLOC_IMAGES_IN_FLIGHT = 36,
+    APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER = 37,
+    APP_ERROR_VULKAN_WAIT_FOR_FENCE = 38,
+    APP_ERROR_VULKAN_ACQUIRE_NEXT_IMAGE = 39,
+    APP_ERROR_VULKAN_QUEUE_SUBMIT = 40,
+    APP_ERROR_VULKAN_QUEUE_PRESENT = 41,
+    APP_ERROR_VULKAN_HEADLESS_SURFACE_NOT_SUPPORTED = 42,
+    APP_ERROR_VULKAN_CREATE_HEADLESS_SURFACE = 43,
+    APP_ERROR_VULKAN_CREATE_PIPELINE_CACHE = 44,
+    APP_ERROR_EMBEDDED_SHADER_NOT_FOUND = 45,
+    APP_ERROR_MAP_SHADER_FILE = 46,
+    APP_ERROR_ALLOC_SWAP_CHAIN_IMAGES = 47,
+    APP_ERROR_VULKAN_CREATE_QUERY_POOL = 48,
+    APP_ERROR_WRITE_TELEMETRY = 49,
+    APP_ERROR_ALLOC_STARTUP_SAMPLES = 50,
+    APP_ERROR_VULKAN_ALLOC_DEVICE_MEMORY = 51,
+    APP_ERROR_VULKAN_MAP_MEMORY = 52,
+    APP_ERROR_VULKAN_NO_SUITABLE_MEMORY_TYPE = 53,
+    APP_ERROR_ALLOC_MEMORY_BLOCK = 54,
+    APP_ERROR_VULKAN_CREATE_BUFFER = 55,
+    APP_ERROR_VULKAN_BIND_BUFFER_MEMORY = 56,
+    APP_ERROR_UPLOAD_TOO_LARGE = 57,
+    APP_ERROR_VULKAN_CREATE_DESCRIPTOR_SET_LAYOUT = 58,
+    APP_ERROR_VULKAN_CREATE_DESCRIPTOR_POOL = 59,
+    APP_ERROR_VULKAN_ALLOC_DESCRIPTOR_SET = 60,
+    APP_ERROR_VULKAN_CREATE_COMPUTE_PIPELINE = 61,
+    APP_ERROR_ALLOC_INSTANCE_DATA = 62,
+    APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED = 63,
+    APP_ERROR_CREATE_THREAD = 64,
+    APP_ERROR_TOO_MANY_PIPELINES = 65,
+    APP_ERROR_ALLOC_PIPELINE_BUILD = 66,
+    APP_ERROR_WRITE_GOLDEN_IMAGE = 67,
+    APP_ERROR_GOLDEN_MISMATCH = 68,
+    APP_ERROR_OPEN_FRAME_STREAM = 69,
+    APP_ERROR_WRITE_FRAME_STREAM = 70,
+    APP_ERROR_ALLOC_FRAME_STREAM = 71,
+    APP_ERROR_BINDLESS_TABLE_FULL = 72,
+    APP_ERROR_VULKAN_CREATE_SAMPLER = 73,
+    APP_ERROR_VULKAN_CREATE_IMAGE = 74,
+    APP_ERROR_VULKAN_BIND_IMAGE_MEMORY = 75,
+    APP_ERROR_LOAD_TEXTURE = 76,
+    APP_ERROR_ALLOC_TEXTURE = 77,
+    APP_ERROR_UPLOAD_OWNED_BY_GRAPHICS = 78,
+    APP_ERROR_ALLOC_MATERIALS = 79,
 } AppResult;
 
+// A worker thread recording a slice of the draw list into a secondary command buffer
+typedef struct RecordWorker
+{
+    struct App *app;
+    pthread_t thread;
+    bool started;
+    uint32_t index;
+    VkCommandPool commandPools[MAX_FRAMES_IN_FLIGHT];
+    VkCommandBuffer commandBuffers[MAX_FRAMES_IN_FLIGHT];
+    bool recorded; // false when the slice of the last frame was empty
+    bool failed; // the worker printed why
+} RecordWorker;
+
+// The main thread hands a frame to every worker at once by bumping the generation, then waits
+// for pendingCount to drop to zero
+typedef struct RecordWorkers
+{
+    RecordWorker workers[MAX_RECORD_THREADS];
+    uint32_t workerCount;
+    bool synchronizationCreated;
+    pthread_mutex_t mutex;
+    pthread_cond_t workReady;
+    pthread_cond_t workDone;
+    uint64_t generation;
+    uint32_t pendingCount;
+    bool quit;
+    uint32_t frameIndex;
+    uint32_t imageIndex;
+} RecordWorkers;
+
+typedef AppResult (*JobFunction)(void *argument);
+
+// A job doubles as the future of its result, it must stay alive until it has been waited for
+typedef struct Job
+{
+    JobFunction function;
+    void *argument;
+    AppResult result;
+    bool submitted;
+    bool done;
+    struct Job *next;
+} Job;
+
+// Fixed set of threads running the jobs of a FIFO queue
+typedef struct JobPool
+{
+    pthread_t threads[MAX_JOB_THREADS];
+    uint32_t threadCount; // 0 runs the jobs on the submitting thread
+    bool synchronizationCreated;
+    pthread_mutex_t mutex;
+    pthread_cond_t jobAvailable;
+    pthread_cond_t jobFinished;
+    Job *head;
+    Job *tail;
+    bool quit;
+} JobPool;
+
+// What the job of a capture produces, only the job touches it until the main thread has waited
+// for it and folds it into the stats
+typedef struct FrameCaptureResult
+{
+    GoldenComparison comparison;
+    ImageDiff diff;
+    double processMs;
+} FrameCaptureResult;
+
+// One readback buffer and the job writing or comparing its copy
+typedef struct FrameCaptureReadback
+{
+    VkBuffer buffer;
+    MemoryAllocation allocation;
+    VkDeviceSize size;
+    bool pending; // a copy was recorded and not handed to a job yet
+    bool processing; // a job reads the buffer, it cannot be recorded into until it is done
+    uint64_t frameNumber;
+    VkExtent2D extent;
+    // Read by the job, set when it is submitted
+    char path[4096];
+    bool writeGolden;
+    bool swapRedBlue;
+    uint8_t tolerance;
+    Job job;
+    FrameCaptureResult result;
+} FrameCaptureReadback;
+
+// The swap chain image of every captured frame is copied into a readback buffer of its frame
+// slot at the end of its command buffer. Once the fence of that slot has been waited on,
+// framesInFlight frames later, the copy goes to a job that writes or compares it while the slot
+// records into its other buffer, so capturing stalls neither the queue nor the render thread
+typedef struct FrameCapture
+{
+    bool enabled;
+    bool swapRedBlue; // the swap chain is BGRA while the golden images are RGBA
+    VkMemoryPropertyFlags memoryProperties;
+    FrameCaptureReadback readbacks[MAX_FRAMES_IN_FLIGHT][2];
+    uint32_t currentReadbacks[MAX_FRAMES_IN_FLIGHT]; // the one the next copy of the slot goes to
+    FrameCaptureStats stats;
+} FrameCapture;
+
+// What the decoding job of a texture produces, only the job touches it until isJobDone says
+// it is done and the main thread takes the pixels
+typedef struct TextureDecodeResult
+{
+    uint8_t *pixels; // mips firstMip to the last one, tightly packed RGBA
+    VkDeviceSize mipOffsets[MAX_TEXTURE_MIPS];
+    double decodeMs;
+} TextureDecodeResult;
+
+// One image file of --textures. Its image holds the mips from residentMip to the last one, any
+// change of residency creates a new image and retires the previous one, which in flight frames
+// may still sample
+typedef struct Texture
+{
+    char *path;
+    uint32_t width;
+    uint32_t height;
+    uint32_t mipCount;
+    uint32_t finestMip; // finer mips are too large to be uploaded
+    uint32_t tailMip; // first mip of the tail
+    uint32_t slot; // in the sampled image array of the bindless set
+    // Updated from the instances when the swap chain is resized or the camera moves
+    double coveragePixels; // screen area of the visible instances using the texture, the priority
+    uint32_t desiredMip; // finest mip that still has at most one texel per pixel
+    uint64_t finestMipUsedFrame; // last frame the finest resident mip was not finer than needed
+    bool stalled; // the budget has no room for its next mip, until the coverage changes
+    // The decoded mips pixelsFirstMip to the last one, tightly packed RGBA. They are taken from
+    // decodeResult once the job is done, pixelsFirstMip does not change while it runs
+    Job decodeJob;
+    bool decoding;
+    TextureDecodeResult decodeResult;
+    uint8_t *pixels;
+    uint32_t pixelsFirstMip;
+    VkDeviceSize mipOffsets[MAX_TEXTURE_MIPS];
+    VkImage image; // VK_NULL_HANDLE until the tail is resident
+    VkImageView imageView;
+    MemoryAllocation allocation;
+    uint32_t residentMip;
+    VkImage retiredImage;
+    VkImageView retiredImageView;
+    MemoryAllocation retiredAllocation;
+    uint64_t retiredFrame;
+    uint32_t staleSets; // bit per frame in flight whose descriptor still points to the retired view
+    VkDeviceSize imageSizes[MAX_TEXTURE_MIPS]; // allocation size of an image from that mip on, 0 until known
+} Texture;
+
+typedef struct TextureStreamerStats
+{
+    uint64_t decodeCount;
+    double totalDecodeMs;
+    uint64_t uploadedMipCount;
+    uint64_t uploadedBytes;
+    uint64_t evictedMipCount;
+    uint64_t stallCount; // textures left coarser than desired for lack of budget
+} TextureStreamerStats;
+
+// Decodes the textures on the job pool and streams their mips in by priority within a device
+// memory budget. Every texture slot starts out pointing to a 1x1 white placeholder
+typedef struct TextureStreamer
+{
+    Texture *textures;
+    uint32_t textureCount;
+    VkImage placeholderImage;
+    VkImageView placeholderImageView;
+    MemoryAllocation placeholderAllocation;
+    VkDeviceSize budget;
+    VkDeviceSize usedSize; // allocation size of the current and retired images, never above the budget
+    VkDeviceSize peakUsedSize;
+    uint32_t decodedCount; // textures decoding or holding decoded pixels
+    VkExtent2D coverageExtent; // swap chain extent the coverage was computed for
+    FrameUniforms coverageView; // and camera
+    uint64_t coverageFrame;
+    TextureStreamerStats stats;
+} TextureStreamer;
+
+// All the state a graphics pipeline create info points to
+typedef struct GraphicsPipelineState
+{
+    VkPipelineShaderStageCreateInfo shaderStages[2];
+    VkDynamicState dynamicStates[2];
+    VkPipelineDynamicStateCreateInfo dynamicState;
+    VkVertexInputBindingDescription bindingDescriptions[2];
+    VkVertexInputAttributeDescription attributeDescriptions[3];
+    VkPipelineVertexInputStateCreateInfo vertexInput;
+    VkPipelineInputAssemblyStateCreateInfo inputAssembly;
+    VkViewport viewport;
+    VkRect2D scissor;
+    VkPipelineViewportStateCreateInfo viewportState;
+    VkPipelineRasterizationStateCreateInfo rasterization;
+    VkPipelineMultisampleStateCreateInfo multisample;
+    VkPipelineColorBlendAttachmentState colorBlendAttachment;
+    VkPipelineColorBlendStateCreateInfo colorBlend;
+    VkFormat colorAttachmentFormat;
+    VkPipelineRenderingCreateInfoKHR rendering; // only chained with dynamic rendering
+} GraphicsPipelineState;
+
+// The specialization constants of a graphics pipeline variant, both of its stages point to them
+typedef struct PipelineVariantBuild
+{
+    VkPipelineShaderStageCreateInfo shaderStages[2];
+    VkSpecializationMapEntry mapEntries[PIPELINE_FEATURE_COUNT];
+    VkBool32 constants[PIPELINE_FEATURE_COUNT];
+    VkSpecializationInfo specializationInfo;
+} PipelineVariantBuild;
+
+// A pipeline compiled by the job pool, the create info and shader modules are kept until the
+// compilation is done
+typedef struct PipelineBuild
+{
+    Job job;
+    struct App *app;
+    const char *name;
+    VkPipeline *pipeline; // where the compiled pipelines are written
+    uint32_t pipelineCount; // more than one for the variants of a graphics pipeline
+    bool compute;
+    VkShaderModule shaderModules[2];
+    GraphicsPipelineState graphicsState;
+    VkGraphicsPipelineCreateInfo graphicsCreateInfo; // shared by the variants
+    PipelineVariantBuild variants[MAX_PIPELINE_VARIANTS];
+    VkGraphicsPipelineCreateInfo variantCreateInfos[MAX_PIPELINE_VARIANTS];
+    VkComputePipelineCreateInfo computeCreateInfo;
+    double compileMs;
+} PipelineBuild;
+
+// The graphics pipeline specialized for every feature mask a run can draw with, compiled from
+// the same modules. The draws find theirs through a small open addressing hash table
+typedef struct PipelineVariants
+{
+    VkPipeline pipelines[MAX_PIPELINE_VARIANTS]; // the first one is the base of the others
+    uint32_t features[MAX_PIPELINE_VARIANTS];
+    uint32_t count;
+    uint32_t staticFeatures; // set in every variant, they do not change during a run
+    uint8_t table[1 << PIPELINE_VARIANT_TABLE_BITS]; // index + 1 of the variant, 0 when empty
+} PipelineVariants;
+
+// Accumulated CPU side timings of the frame loop, used to report how much of the frame the CPU
+// spends blocked on the GPU
+typedef struct FrameStats
+{
+    uint64_t frameCount;
+    double totalFrameTimeMs;
+    double totalFenceWaitMs;
+    double totalCpuWorkMs;
+    double totalRecordMs;
+    uint32_t swapChainRecreationCount;
+    double totalSwapChainRecreationMs;
+    double maxSwapChainRecreationMs;
+    uint64_t gpuCompletionSampleCount;
+    double totalGpuCompletionMs;
+    double maxGpuCompletionMs;
+} FrameStats;
+
+typedef struct App
+{
+    AppConfig config;
+    GLFWwindow *window;
+    VkInstance instance;
+    uint32_t instanceApiVersion;
+    VkPhysicalDevice physicalDevice;
+    VkPhysicalDeviceProperties physicalDeviceProperties;
+    DeviceCapabilities deviceCapabilities; // of the selected device
+    VkSurfaceKHR surface;
+    VkQueue graphicsQueue;
+    uint32_t graphicsQueueFamilyIndex;
+    uint32_t graphicsQueueTimestampValidBits;
+    float graphicsQueuePriority;
+    VkQueue presentationQueue;
+    uint32_t presentationQueueFamilyIndex;
+    float presentationQueuePriority;
+    VkQueue transferQueue;
+    uint32_t transferQueueFamilyIndex;
+    float transferQueuePriority;
+    VkQueue computeQueue;
+    uint32_t computeQueueFamilyIndex;
+    float computeQueuePriority;
+    VkDeviceQueueCreateInfo pQueueCreateInfos[4];
+    uint32_t queueCreateInfoCount;
+    VkDevice logicalDevice;
+    MemoryAllocator memoryAllocator;
+    JobPool jobPool;
+    PipelineBuild *pipelineBuilds[MAX_PIPELINE_BUILDS]; // pending until waitForPipelineBuilds
+    uint32_t pipelineBuildCount;
+    Uploader uploader;
+    VkSurfaceFormatKHR selectedDeviceSurfaceFormat;
+    VkPresentModeKHR selectedDevicePresentMode;
+    VkSurfaceCapabilitiesKHR selectedDeviceSurfaceCapabilities;
+    VkExtent2D swapChainExtent;
+    VkSwapchainKHR swapChain;
+    VkImage *swapChainImages;
+    uint32_t swapChainImageCount;
+    VkImageView *swapChainImageViews;
+    VkRenderPass renderPass;
+    VkPipelineCache pipelineCache;
+    VkPipelineLayout pipelineLayout;
+    PipelineVariants graphicsVariants;
+    VkDescriptorSetLayout computeDescriptorSetLayout;
+    VkDescriptorPool computeDescriptorPool;
+    VkDescriptorSet computeDescriptorSet;
+    VkPipelineLayout computePipelineLayout;
+    VkPipeline computePipeline;
+    VkBuffer particleBuffer;
+    MemoryAllocation particleAllocation;
+    bool particlesInitialized;
+    VkBuffer vertexBuffer;
+    MemoryAllocation vertexAllocation;
+    VkBuffer instanceBuffer;
+    MemoryAllocation instanceAllocation;
+    VkBuffer indexBuffer;
+    MemoryAllocation indexAllocation;
+    UniformRing uniformRing;
+    FrameUniforms frameUniforms; // copied to the slot of the frame in the uniform ring every frame
+    BindlessTable bindless; // only created with --bindless
+    VkBuffer objectMaterialBuffer; // material ID of every instance
+    MemoryAllocation objectMaterialAllocation;
+    VkBuffer materialBuffer;
+    MemoryAllocation materialAllocation;
+    uint32_t materialCount;
+    TextureStreamer textureStreamer; // only created with --textures
+    VkDescriptorSetLayout cullingDescriptorSetLayout;
+    VkDescriptorPool cullingDescriptorPool;
+    VkDescriptorSet cullingDescriptorSet;
+    VkPipelineLayout cullingPipelineLayout;
+    VkPipeline cullingPipeline;
+    VkBuffer drawCommandBuffer; // VkDrawIndexedIndirectCommand of the objects that survived the culling
+    MemoryAllocation drawCommandAllocation;
+    VkBuffer drawCountBuffer;
+    MemoryAllocation drawCountAllocation;
+    PFN_vkCmdDrawIndexedIndirectCountKHR vkCmdDrawIndexedIndirectCount; // NULL without VK_KHR_draw_indirect_count
+    bool dynamicRendering; // the main pass renders without renderPass and swapChainFramebuffers
+    PFN_vkCmdBeginRenderingKHR vkCmdBeginRendering;
+    PFN_vkCmdEndRenderingKHR vkCmdEndRendering;
+    VkFramebuffer *swapChainFramebuffers;
+    SwapChainResources retiredSwapChain;
+    uint64_t retiredSwapChainFrame; // frame count at the time the swap chain was retired
+    bool framebufferResized;
+    FrameData frames[MAX_FRAMES_IN_FLIGHT];
+    RecordWorkers recordWorkers;
+    uint32_t currentFrame;
+    VkFence *imagesInFlight; // fence of the frame currently using each swap chain image
+    // Signaled by the submission rendering to each swap chain image and waited on by its
+    // present. A present holds its semaphore until the image is acquired again, which is
+    // unrelated to the frame slots, so there is one per image rather than per frame in flight
+    VkSemaphore *renderFinishedSemaphores;
+    double lastFrameStartMs;
+    FrameStats frameStats;
+    GpuProfiler gpuProfiler;
+    FrameCapture frameCapture;
+    FrameStream frameStream;
+    Telemetry telemetry;
+    double startupPhaseMs[STARTUP_PHASE_COUNT];
+} App;
+
+AppResult parseArguments(int argc, char **argv, AppConfig *config);
+void printUsage(const char *programName);
 AppResult initGLFW(App *app);
+bool appShouldClose(App *app);
 AppResult initVulkan(App *app);
+AppResult runStartupBenchmark(const AppConfig *config);
+void printStartupBenchmark(const AppConfig *config, const double *samplesMs);
 AppResult checkValidationLayerSupport(void);
 AppResult createSurface(App *app);
 AppResult createVulkanInstance(App *app);
 AppResult selectPhysicalDevice(App *app);
-bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface);
-bool deviceHasSwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface);
-bool deviceHasRequiredExtensions(VkPhysicalDevice device);
-bool deviceHasPresentationQueueFamily(VkPhysicalDevice device, VkSurfaceKHR surface);
-bool deviceHasGraphicsQueueFamily(VkPhysicalDevice device);
-uint32_t computeDeviceScore(VkPhysicalDevice device);
+bool queryDeviceCapabilities(VkPhysicalDevice device, VkSurfaceKHR surface, DeviceCapabilities *capabilities);
+bool extensionListContains(const VkExtensionProperties *extensions, uint32_t extensionCount, const char *extensionName);
+void printDeviceCapabilities(uint32_t index, const DeviceCapabilities *capabilities);
+bool deviceCacheMatches(const VkPhysicalDeviceProperties *deviceProperties, const DeviceCacheRecord *cached);
+bool loadDeviceCache(const char *path, DeviceCacheRecord *record);
+void saveDeviceCache(const char *path, const DeviceCacheRecord *record);
+bool isDeviceSuitable(const DeviceCapabilities *capabilities);
+bool deviceHasSwapChainSupport(const DeviceCapabilities *capabilities);
+bool deviceHasPresentationQueueFamily(const DeviceCapabilities *capabilities);
+bool deviceHasGraphicsQueueFamily(const DeviceCapabilities *capabilities);
+uint32_t computeDeviceScore(const DeviceCapabilities *capabilities, const DeviceBenchmark *benchmark);
+bool benchmarkDevice(App *app, const DeviceCapabilities *capabilities, DeviceBenchmark *benchmark);
+bool createDeviceBenchmarkContext(App *app, const DeviceCapabilities *capabilities, DeviceBenchmarkContext *context);
+bool allocateBenchmarkMemory(VkDevice device, const VkPhysicalDeviceMemoryProperties *memoryProperties, const VkMemoryRequirements *requirements, VkDeviceMemory *memory);
+bool runDeviceBenchmark(DeviceBenchmarkContext *context, DeviceBenchmark *benchmark);
+void destroyDeviceBenchmarkContext(DeviceBenchmarkContext *context);
+bool loadDeviceBenchmark(const char *path, const VkPhysicalDeviceProperties *deviceProperties, DeviceBenchmark *benchmark);
+void saveDeviceBenchmark(const char *path, const VkPhysicalDeviceProperties *deviceProperties, const DeviceBenchmark *benchmark);
+void formatUuid(const uint8_t uuid[VK_UUID_SIZE], char text[VK_UUID_SIZE * 2 + 1]);
 AppResult createLogicalDevice(App *app);
+AppResult createUploader(App *app);
+AppResult uploadToBuffer(App *app, VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data, VkDeviceSize size, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask);
+AppResult uploaderReleaseRange(App *app, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size);
+void uploaderForgetBuffer(App *app, VkBuffer buffer);
+AppResult uploaderBeginImage(App *app, VkImage image);
+AppResult uploadToImage(App *app, VkImage dstImage, uint32_t mipLevel, uint32_t firstRow, VkExtent2D extent, const void *data, VkDeviceSize size);
+AppResult uploaderCopyImageLevel(App *app, VkImage srcImage, uint32_t srcMipLevel, VkImage dstImage, uint32_t dstMipLevel, VkExtent2D extent);
+AppResult uploaderFinishImage(App *app, VkImage image);
+AppResult uploaderStage(App *app, const void *data, VkDeviceSize size, VkDeviceSize *srcOffset);
+bool uploadBatchIsEmpty(const UploadBatch *batch);
+AppResult uploaderFlush(App *app);
+AppResult uploaderRetire(App *app, bool waitForOldest);
+void printUploaderStats(const App *app);
+void destroyUploader(App *app);
+AppResult createMemoryAllocator(App *app);
+void destroyMemoryAllocator(App *app);
+uint32_t findMemoryType(const MemoryAllocator *allocator, uint32_t memoryTypeBits, VkMemoryPropertyFlags properties);
+VkMemoryPropertyFlags readbackMemoryProperties(const MemoryAllocator *allocator);
+uint32_t getAllocationOrder(const VkMemoryRequirements *requirements, VkDeviceSize *chunkSize);
+VkDeviceSize getAllocationSize(const App *app, const VkMemoryRequirements *requirements, VkMemoryPropertyFlags properties, MemoryResourceKind kind);
+AppResult allocateMemory(App *app, const VkMemoryRequirements *requirements, VkMemoryPropertyFlags properties, MemoryResourceKind kind, MemoryAllocation *allocation);
+void freeMemory(App *app, MemoryAllocation *allocation);
+AppResult allocateDeviceMemory(App *app, uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory *memory, void **mapped);
+void freeDeviceMemory(App *app, VkDeviceMemory memory);
+AppResult createMemoryBlock(App *app, uint32_t memoryTypeIndex, VkDeviceSize blockSize, MemoryBlock **block);
+void destroyMemoryBlock(App *app, MemoryBlock *block);
+bool memoryBlockAllocate(MemoryBlock *block, uint32_t order, uint32_t *node);
+void memoryBlockFree(MemoryBlock *block, uint32_t order, uint32_t node);
+bool memoryBlockIsFree(const MemoryBlock *block, uint32_t order, uint32_t node);
+void memoryBlockSetFree(MemoryBlock *block, uint32_t order, uint32_t node, bool isFree);
+AppResult createBuffer(App *app, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *buffer, MemoryAllocation *allocation);
+void destroyBuffer(App *app, VkBuffer *buffer, MemoryAllocation *allocation);
+AppResult createImage(App *app, const VkImageCreateInfo *imageCreateInfo, VkMemoryPropertyFlags properties, VkImage *image, MemoryAllocation *allocation);
+void destroyImage(App *app, VkImage *image, MemoryAllocation *allocation);
+void printMemoryStats(const App *app);
 AppResult getDeviceQueues(App *app);
-AppResult createSwapChain(App *app);
+AppResult createSwapChain(App *app, VkSwapchainKHR oldSwapChain);
 AppResult setOptimalSwapChainParameters(App *app);
+const char *presentModeName(VkPresentModeKHR presentMode);
+AppResult updateSwapChainExtent(App *app);
+AppResult recreateSwapChain(App *app);
+AppResult waitForAllFrames(App *app);
+void destroyRetiredSwapChain(App *app);
+void framebufferResizeCallback(GLFWwindow *window, int width, int height);
 AppResult createImageViews(App *app);
 AppResult createGraphicsPipeline(App *app);
-AppResult loadShader(const char *filename, VkShaderModule *shaderModule, App *app);
+AppResult specializeGraphicsPipeline(App *app, PipelineBuild *build);
+uint32_t hashPipelineFeatures(uint32_t features);
+AppResult insertPipelineVariant(PipelineVariants *variants, uint32_t features, uint32_t index);
+VkPipeline findPipelineVariant(const PipelineVariants *variants, uint32_t features);
+uint32_t getPipelineFeatures(const App *app);
+void destroyPipelineVariants(App *app);
+AppResult beginPipelineBuild(App *app, const char *name, VkPipeline *pipeline, PipelineBuild **build);
+AppResult submitPipelineBuild(App *app, PipelineBuild *build);
+AppResult compilePipeline(void *argument);
+AppResult waitForPipelineBuilds(App *app);
+void destroyPipelineBuilds(App *app);
+AppResult createJobPool(App *app);
+void *jobPoolWorkerMain(void *argument);
+AppResult submitJob(JobPool *jobPool, Job *job, JobFunction function, void *argument);
+AppResult waitForJob(JobPool *jobPool, Job *job);
+bool isJobDone(JobPool *jobPool, Job *job);
+void destroyJobPool(App *app);
+AppResult createPipelineCache(App *app);
+bool loadPipelineCacheData(const char *path, const VkPhysicalDeviceProperties *deviceProperties, void **data, size_t *dataSize);
+void savePipelineCache(App *app);
+AppResult loadShader(VkDevice device, const char *name, VkShaderModule *shaderModule, App *app);
+AppResult loadEmbeddedShader(VkDevice device, const char *name, VkShaderModule *shaderModule);
+AppResult loadMappedShader(VkDevice device, const char *path, VkShaderModule *shaderModule);
+AppResult loadReadShader(VkDevice device, const char *path, VkShaderModule *shaderModule);
+AppResult createShaderModule(VkDevice device, const void *code, size_t codeSize, VkShaderModule *shaderModule);
 AppResult createRenderPass(App *app);
 AppResult createGraphicsPipeline(App *app);
+AppResult createComputePipeline(App *app);
+AppResult createUniformRing(App *app);
+void updateCamera(App *app);
+void updateFrameUniforms(App *app);
+void destroyUniformRing(App *app);
+AppResult createBindlessTable(App *app);
+AppResult bindlessAddStorageBuffer(App *app, VkBuffer buffer, uint32_t *slot);
+AppResult bindlessAddSampledImage(App *app, VkImageView imageView, uint32_t *slot);
+void bindlessWriteSampledImage(App *app, uint32_t setIndex, uint32_t slot, VkImageView imageView);
+AppResult createMaterials(App *app);
+void destroyBindlessTable(App *app);
+AppResult createTextureStreamer(App *app);
+bool parseTextureHeader(const char *header, uint32_t *width, uint32_t *height, uint32_t *channelCount, size_t *dataOffset);
+void getTextureImageCreateInfo(const App *app, VkExtent2D extent, uint32_t mipCount, const uint32_t queueFamilyIndices[2], VkImageCreateInfo *imageCreateInfo);
+AppResult getTextureImageSize(App *app, Texture *texture, uint32_t residentMip, VkDeviceSize *size);
+AppResult createTextureImage(App *app, VkExtent2D extent, uint32_t mipCount, VkImage *image, VkImageView *imageView, MemoryAllocation *allocation);
+AppResult decodeTexture(void *argument);
+void downsampleMip(const uint8_t *src, VkExtent2D srcExtent, uint8_t *dst);
+VkExtent2D getTextureMipExtent(const Texture *texture, uint32_t mip);
+VkDeviceSize getTextureSize(const Texture *texture, uint32_t firstMip);
+void computeTextureCoverage(App *app);
+AppResult setTextureResidency(App *app, Texture *texture, uint32_t residentMip);
+AppResult uploadTextureMip(App *app, Texture *texture, uint32_t mip, VkImage image, uint32_t imageMip);
+AppResult textureStreamerUpdate(App *app);
+bool textureFitsBudget(App *app, Texture *texture, uint32_t residentMip, bool *retiring, AppResult *appResult);
+bool evictTextureMip(App *app, const Texture *candidate, AppResult *appResult);
+void releaseTexturePixels(App *app, Texture *texture);
+void destroyRetiredTexture(App *app, Texture *texture);
+void printTextureStreamerStats(const App *app);
+void destroyTextureStreamer(App *app);
+InstanceLayout getInstanceLayout(const App *app);
+void getInstanceData(const InstanceLayout *layout, uint32_t instance, InstanceData *data);
+uint32_t getInstanceMaterial(const App *app, uint32_t instance);
+uint32_t getMaterialTexture(const App *app, uint32_t material);
+AppResult createVertexBuffers(App *app);
+AppResult createCullingPipeline(App *app);
 AppResult createFramebuffers(App *app);
+AppResult createFrameResources(App *app);
+AppResult createSwapChainSyncObjects(App *app);
+AppResult recordCommandBuffer(App *app, VkCommandBuffer commandBuffer, uint32_t imageIndex);
+void beginMainPass(App *app, VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaryCommandBuffers);
+void endMainPass(App *app, VkCommandBuffer commandBuffer, uint32_t imageIndex);
+uint32_t getDrawCount(const App *app);
+void recordDraws(App *app, VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t lastDraw);
+AppResult createRecordWorkers(App *app);
+void *recordWorkerMain(void *argument);
+AppResult recordSecondaryCommandBuffer(App *app, RecordWorker *worker, uint32_t frameIndex, uint32_t imageIndex);
+AppResult recordInParallel(App *app, uint32_t imageIndex, VkCommandBuffer *secondaryCommandBuffers, uint32_t *secondaryCommandBufferCount);
+void destroyRecordWorkers(App *app);
+AppResult recordComputeCommandBuffer(App *app, VkCommandBuffer commandBuffer, float deltaTime);
+void recordCullingPass(App *app, VkCommandBuffer commandBuffer);
+AppResult drawFrame(App *app);
+void printFrameStats(const App *app);
+AppResult createGpuProfiler(App *app);
+void gpuProfilerCollect(App *app, uint32_t frameIndex);
+void gpuProfilerBeginFrame(App *app, VkCommandBuffer commandBuffer, uint32_t frameIndex);
+uint32_t gpuProfilerBeginScope(App *app, VkCommandBuffer commandBuffer, const char *name);
+void gpuProfilerEndScope(App *app, VkCommandBuffer commandBuffer, uint32_t query);
+void gpuProfilerScopeStats(const GpuProfilerScope *scope, double *minMs, double *avgMs, double *p99Ms);
+void printGpuProfilerStats(const App *app);
+AppResult createFrameCapture(App *app);
+AppResult frameCaptureCollect(App *app, uint32_t frameIndex);
+AppResult submitFrameCaptureJob(App *app, FrameCaptureReadback *readback);
+AppResult processFrameCapture(void *argument);
+AppResult finishFrameCaptureJob(App *app, FrameCaptureReadback *readback);
+AppResult flushFrameCaptures(App *app);
+bool frameCaptureAcquireBuffer(App *app, VkBuffer *buffer);
+void recordSwapChainReadback(App *app, VkCommandBuffer commandBuffer, uint32_t imageIndex);
+bool swapChainFormatIsRgba8(VkFormat format, bool *swapRedBlue);
+AppResult writeGoldenImage(const char *path, const uint8_t *pixels, VkExtent2D extent, bool swapRedBlue);
+GoldenComparison compareWithGoldenImage(const char *path, const uint8_t *pixels, VkExtent2D extent, bool swapRedBlue, uint8_t tolerance, ImageDiff *diff);
+void compareImages(const uint8_t *captured, const uint8_t *golden, size_t pixelCount, bool swapRedBlue, uint8_t tolerance, ImageDiff *diff);
+double imagePsnrDb(const ImageDiff *diff, size_t pixelCount);
+void printFrameCaptureStats(const App *app);
+void destroyFrameCapture(App *app);
+AppResult openFrameStream(App *app);
+AppResult createFrameStream(App *app);
+void *frameStreamWriterMain(void *argument);
+bool frameStreamAcquireBuffer(App *app, VkBuffer *buffer);
+AppResult frameStreamCollect(App *app, uint32_t frameIndex);
+AppResult flushFrameStream(App *app);
+bool writeStreamFrame(FrameStream *stream, StreamFormat format, const uint8_t *pixels, size_t *writtenBytes);
+void convertToYuv420(const uint8_t *pixels, VkExtent2D extent, bool swapRedBlue, uint8_t *planes);
+bool writeToFd(int fd, const void *data, size_t size);
+void printFrameStreamStats(const App *app);
+void destroyFrameStream(App *app);
+int compareDoubles(const void *a, const void *b);
+int compareStrings(const void *a, const void *b);
+void telemetryRecord(Telemetry *telemetry, const double valuesMs[TELEMETRY_METRIC_COUNT]);
+double telemetryPercentile(const TelemetryHistogram *histogram, double percentile);
+double telemetryBucketUpperBoundMs(uint32_t bucket);
+AppResult dumpTelemetry(const App *app);
+void writeTelemetryCsv(const Telemetry *telemetry, FILE *file);
+void writeTelemetryJson(const Telemetry *telemetry, FILE *file);
+void telemetrySignalHandler(int signalNumber);
+double getTimeMs(void);
 AppResult cleanup(App *app, AppResult result);
 
-int main(void)
+int main(int argc, char **argv)
 {
     if (debug)
         printf("Running in debug mode\n");
@@ -158,727 +1453,7455 @@ int main(void)
 
     App app = {0};
 
-    AppResult result = {0};
+    AppResult result = parseArguments(argc, argv, &app.config);
+    if (result != APP_SUCCESS)
+        return (int)result;
+
+    if (app.config.benchStartupRuns > 0)
+        return (int)runStartupBenchmark(&app.config);
 
-    result = initGLFW(&app);
+    // The stream is opened before anything is flushed to stdout, which it may have to keep for itself
+    result = openFrameStream(&app);
     if (result != APP_SUCCESS)
         return cleanup(&app, result);
 
-    if (verbose)
+    // In headless mode there is no window at all, the frames are presented to a headless
+    // surface instead
+    if (!app.config.headless)
     {
-        printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#             GLFW INITIALIZED          #\n");
-        printf("#########################################\n");
+        double glfwStartMs = getTimeMs();
+        result = initGLFW(&app);
+        if (result != APP_SUCCESS)
+            return cleanup(&app, result);
+        app.startupPhaseMs[STARTUP_PHASE_GLFW] = getTimeMs() - glfwStartMs;
+
+        if (verbose)
+        {
+            printf("=========================================\n");
+            printf("#########################################\n");
+            printf("#             GLFW INITIALIZED          #\n");
+            printf("#########################################\n");
+        }
     }
 
     result = initVulkan(&app);
     if (result != APP_SUCCESS)
         return cleanup(&app, result);
 
+    signal(SIGUSR1, telemetrySignalHandler);
+
     // Main loop
-    while (!glfwWindowShouldClose(app.window))
+    while (!appShouldClose(&app))
     {
-        glfwPollEvents();
-        if (glfwGetKey(app.window, GLFW_KEY_SPACE) == GLFW_PRESS)
-            glfwSetWindowShouldClose(app.window, GLFW_TRUE);
+        result = drawFrame(&app);
+        if (result != APP_SUCCESS)
+            break;
+
+        if (telemetryDumpRequested)
+        {
+            telemetryDumpRequested = 0;
+            dumpTelemetry(&app);
+        }
     }
 
-    return (int)cleanup(&app, APP_SUCCESS);
+    // The captures of the last frames in flight are still waiting in their readback buffers
+    if (result == APP_SUCCESS)
+        result = flushFrameCaptures(&app);
+    if (result == APP_SUCCESS)
+        result = flushFrameStream(&app);
+
+    printFrameStats(&app);
+    printGpuProfilerStats(&app);
+    printFrameCaptureStats(&app);
+    printFrameStreamStats(&app);
+    printTextureStreamerStats(&app);
+    printUploaderStats(&app);
+    printMemoryStats(&app);
+    if (app.config.telemetryPath != NULL)
+        dumpTelemetry(&app);
+
+    // A golden run fails as a whole when a single frame did not match, so that scripts only
+    // have to check the exit code
+    if (result == APP_SUCCESS && (app.frameCapture.stats.mismatchCount > 0 || app.frameCapture.stats.missingCount > 0))
+        result = APP_ERROR_GOLDEN_MISMATCH;
+
+    return (int)cleanup(&app, result);
 } // main
 
-AppResult initVulkan(App *app)
+AppResult runStartupBenchmark(const AppConfig *config)
 {
-    AppResult appResult = {0};
+    uint32_t runCount = config->benchStartupRuns;
 
-    // The first thing we need to do is to create the Vulkan instance
-    appResult = createVulkanInstance(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+    // One row of STARTUP_PHASE_COUNT samples per run
+    double *samplesMs = malloc(sizeof(double) * runCount * STARTUP_PHASE_COUNT);
+    if (samplesMs == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for the startup samples\n");
+        return APP_ERROR_ALLOC_STARTUP_SAMPLES;
+    }
 
-    if (verbose)
+    // The App is too large for the stack to hold a second one next to main's
+    App *app = malloc(sizeof(App));
+    if (app == NULL)
     {
-        printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#        VULKAN INSTANCE CREATED        #\n");
-        printf("#########################################\n");
+        fprintf(stderr, "Failed to allocate memory for the startup benchmark\n");
+        free(samplesMs);
+        return APP_ERROR_ALLOC_STARTUP_SAMPLES;
     }
 
-    // Then we need to create the surface
-    appResult = createSurface(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+    AppResult result = APP_SUCCESS;
+    for (uint32_t run = 0; run < runCount; ++run)
+    {
+        // Every run starts from scratch exactly like a new process would, except for the
+        // pipeline cache file which is written by the previous run's cleanup
+        memset(app, 0, sizeof(App));
+        app->config = *config;
 
-    // Then we need to select the physical device
-    appResult = selectPhysicalDevice(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+        if (!app->config.headless)
+        {
+            double glfwStartMs = getTimeMs();
+            result = initGLFW(app);
+            if (result != APP_SUCCESS)
+            {
+                cleanup(app, result);
+                break;
+            }
+            app->startupPhaseMs[STARTUP_PHASE_GLFW] = getTimeMs() - glfwStartMs;
+        }
 
-    if (verbose)
-    {
-        printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#       PHYSICAL DEVICE SELECTED        #\n");
-        printf("#########################################\n");
-    }
+        result = initVulkan(app);
+        if (result != APP_SUCCESS)
+        {
+            cleanup(app, result);
+            break;
+        }
 
-    // Now we can create the logical device
-    appResult = createLogicalDevice(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+        double cleanupStartMs = getTimeMs();
+        cleanup(app, APP_SUCCESS);
+        app->startupPhaseMs[STARTUP_PHASE_CLEANUP] = getTimeMs() - cleanupStartMs;
 
-    if (verbose)
-    {
-        printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#        LOGICAL DEVICE CREATED         #\n");
-        printf("#########################################\n");
+        memcpy(&samplesMs[run * STARTUP_PHASE_COUNT], app->startupPhaseMs, sizeof(app->startupPhaseMs));
     }
 
-    // Then we wand to choose the right swap chain settings
-    appResult = createSwapChain(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+    if (result == APP_SUCCESS)
+        printStartupBenchmark(config, samplesMs);
 
-    if (verbose)
-    {
-        printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#         SWAP CHAIN CREATED            #\n");
-        printf("#########################################\n");
-    }
+    free(app);
+    free(samplesMs);
+    return result;
+} // runStartupBenchmark
 
-    // The next step is to setup the image views
-    appResult = createImageViews(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+void printStartupBenchmark(const AppConfig *config, const double *samplesMs)
+{
+    uint32_t runCount = config->benchStartupRuns;
 
-    if (verbose)
-    {
-        printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#        IMAGE VIEWS CREATED            #\n");
-        printf("#########################################\n");
-    }
+    // VLA is ok here for simplicity
+    double sortedMs[runCount];
+    double totalMs[runCount];
+    memset(totalMs, 0, sizeof(totalMs));
 
-    // Then the render pass is necessary for the graphics pipeline
-    appResult = createRenderPass(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+    printf("=========================================\n");
+    printf("Startup benchmark over %u runs (validation layers %s, pipeline cache %s):\n", runCount,
+           enableValidationLayers ? "enabled" : "disabled", config->pipelineCachePath != NULL ? "warm after the first run" : "disabled");
+    printf("\t%-20s %10s %10s %10s %10s\n", "phase (ms)", "min", "median", "mean", "max");
 
-    if (verbose)
+    for (uint32_t phase = 0; phase <= STARTUP_PHASE_COUNT; ++phase)
     {
-        printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#         RENDER PASS CREATED           #\n");
-        printf("#########################################\n");
+        const char *name = phase < STARTUP_PHASE_COUNT ? startupPhaseNames[phase] : "total";
+        double sumMs = 0.0;
+        for (uint32_t run = 0; run < runCount; ++run)
+        {
+            if (phase < STARTUP_PHASE_COUNT)
+            {
+                sortedMs[run] = samplesMs[run * STARTUP_PHASE_COUNT + phase];
+                totalMs[run] += sortedMs[run];
+            }
+            else
+                sortedMs[run] = totalMs[run];
+            sumMs += sortedMs[run];
+        }
+        qsort(sortedMs, runCount, sizeof(double), compareDoubles);
+
+        double medianMs = runCount % 2 == 1 ? sortedMs[runCount / 2] : (sortedMs[runCount / 2 - 1] + sortedMs[runCount / 2]) / 2.0;
+        printf("\t%-20s %10.3f %10.3f %10.3f %10.3f\n", name, sortedMs[0], medianMs, sumMs / runCount, sortedMs[runCount - 1]);
     }
+} // printStartupBenchmark
 
-    // And then it's time to create the graphics pipeline
-    appResult = createGraphicsPipeline(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+bool appShouldClose(App *app)
+{
+    if (app->config.maxFrameCount > 0 && app->frameStats.frameCount >= app->config.maxFrameCount)
+        return true;
 
-    if (verbose)
-    {
-        printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#       GRAPHICS PIPELINE CREATED        #\n");
-        printf("#########################################\n");
-    }
+    if (app->config.headless)
+        return false;
 
-    // Now we can create the framebuffers
-    appResult = createFramebuffers(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+    glfwPollEvents();
+    if (glfwGetKey(app->window, GLFW_KEY_SPACE) == GLFW_PRESS)
+        glfwSetWindowShouldClose(app->window, GLFW_TRUE);
 
-    if (verbose)
+    return glfwWindowShouldClose(app->window);
+} // appShouldClose
+
+AppResult parseArguments(int argc, char **argv, AppConfig *config)
+{
+    config->framesInFlight = DEFAULT_FRAMES_IN_FLIGHT;
+    config->gpuProfiler = true;
+    config->compute = true;
+    config->instanceCount = 1;
+    config->drawCallCount = 1;
+    long onlineCpuCount = sysconf(_SC_NPROCESSORS_ONLN);
+    config->compileThreadCount = onlineCpuCount < 1 ? 1 : onlineCpuCount > MAX_JOB_THREADS ? MAX_JOB_THREADS : (uint32_t)onlineCpuCount;
+    config->pipelineCachePath = DEFAULT_PIPELINE_CACHE_PATH;
+    config->deviceCachePath = DEFAULT_DEVICE_CACHE_PATH;
+    config->deviceBenchmarkPath = DEFAULT_DEVICE_BENCHMARK_PATH;
+    config->shaderSource = SHADER_SOURCE_EMBEDDED;
+    config->shaderDirectory = DEFAULT_SHADER_DIRECTORY;
+    config->goldenTolerance = DEFAULT_GOLDEN_TOLERANCE;
+    config->captureInterval = 1;
+    config->streamFps = DEFAULT_STREAM_FPS;
+    config->textureBudgetMB = DEFAULT_TEXTURE_BUDGET_MB;
+    bool maxFrameCountSet = false;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0)
+        {
+            printUsage(argv[0]);
+            exit(EXIT_SUCCESS);
+        }
+        else if (strcmp(argv[i], "--frames-in-flight") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 1 || value > MAX_FRAMES_IN_FLIGHT)
+            {
+                fprintf(stderr, "--frames-in-flight must be between 1 and %d\n", MAX_FRAMES_IN_FLIGHT);
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->framesInFlight = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--pipeline-cache") == 0 && i + 1 < argc)
+        {
+            config->pipelineCachePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-pipeline-cache") == 0)
+        {
+            config->pipelineCachePath = NULL;
+        }
+        else if (strcmp(argv[i], "--device-cache") == 0 && i + 1 < argc)
+        {
+            config->deviceCachePath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-device-cache") == 0)
+        {
+            config->deviceCachePath = NULL;
+            config->deviceBenchmarkPath = NULL;
+        }
+        else if (strcmp(argv[i], "--benchmark-devices") == 0)
+        {
+            config->benchmarkDevices = true;
+        }
+        else if (strcmp(argv[i], "--shader-source") == 0 && i + 1 < argc)
+        {
+            const char *source = argv[++i];
+            if (strcmp(source, "embedded") == 0)
+                config->shaderSource = SHADER_SOURCE_EMBEDDED;
+            else if (strcmp(source, "mmap") == 0)
+                config->shaderSource = SHADER_SOURCE_MMAP;
+            else if (strcmp(source, "read") == 0)
+                config->shaderSource = SHADER_SOURCE_READ;
+            else
+            {
+                fprintf(stderr, "--shader-source must be embedded, mmap or read\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+        }
+        else if (strcmp(argv[i], "--present-policy") == 0 && i + 1 < argc)
+        {
+            const char *policy = argv[++i];
+            bool found = false;
+            for (uint32_t j = 0; j < PRESENT_POLICY_COUNT; ++j)
+            {
+                if (strcmp(policy, presentPolicies[j].name) == 0)
+                {
+                    config->presentPolicy = (PresentPolicy)j;
+                    found = true;
+                }
+            }
+            if (!found)
+            {
+                fprintf(stderr, "--present-policy must be default, latency, throughput or power\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+        }
+        else if (strcmp(argv[i], "--swapchain-images") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 1 || value > MAX_SWAPCHAIN_IMAGES)
+            {
+                fprintf(stderr, "--swapchain-images must be between 1 and %d\n", MAX_SWAPCHAIN_IMAGES);
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->swapChainImageCount = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--capture-golden") == 0 && i + 1 < argc)
+        {
+            config->captureMode = CAPTURE_MODE_WRITE_GOLDEN;
+            config->goldenDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--compare-golden") == 0 && i + 1 < argc)
+        {
+            config->captureMode = CAPTURE_MODE_COMPARE_GOLDEN;
+            config->goldenDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--golden-tolerance") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 0 || value > 255)
+            {
+                fprintf(stderr, "--golden-tolerance must be between 0 and 255\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->goldenTolerance = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--capture-interval") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 1)
+            {
+                fprintf(stderr, "--capture-interval must be at least 1\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->captureInterval = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--stream") == 0 && i + 1 < argc)
+        {
+            config->streamPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--stream-format") == 0 && i + 1 < argc)
+        {
+            const char *format = argv[++i];
+            if (strcmp(format, "y4m") == 0)
+                config->streamFormat = STREAM_FORMAT_Y4M;
+            else if (strcmp(format, "pam") == 0)
+                config->streamFormat = STREAM_FORMAT_PAM;
+            else
+            {
+                fprintf(stderr, "--stream-format must be y4m or pam\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+        }
+        else if (strcmp(argv[i], "--stream-fps") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 1 || value > 1000)
+            {
+                fprintf(stderr, "--stream-fps must be between 1 and 1000\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->streamFps = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--shader-dir") == 0 && i + 1 < argc)
+        {
+            config->shaderDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--no-gpu-profiler") == 0)
+        {
+            config->gpuProfiler = false;
+        }
+        else if (strcmp(argv[i], "--instances") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 1 || value > MAX_INSTANCE_COUNT)
+            {
+                fprintf(stderr, "--instances must be between 1 and %d\n", MAX_INSTANCE_COUNT);
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->instanceCount = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--draw-calls") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 1 || value > MAX_INSTANCE_COUNT)
+            {
+                fprintf(stderr, "--draw-calls must be between 1 and %d\n", MAX_INSTANCE_COUNT);
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->drawCallCount = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--record-threads") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 0 || value > MAX_RECORD_THREADS)
+            {
+                fprintf(stderr, "--record-threads must be between 0 and %d\n", MAX_RECORD_THREADS);
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->recordThreadCount = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--compile-threads") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 0 || value > MAX_JOB_THREADS)
+            {
+                fprintf(stderr, "--compile-threads must be between 0 and %d\n", MAX_JOB_THREADS);
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->compileThreadCount = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--gpu-driven") == 0)
+        {
+            config->gpuDriven = true;
+        }
+        else if (strcmp(argv[i], "--animate-camera") == 0)
+        {
+            config->animateCamera = true;
+        }
+        else if (strcmp(argv[i], "--dynamic-rendering") == 0)
+        {
+            config->dynamicRendering = true;
+        }
+        else if (strcmp(argv[i], "--bindless") == 0)
+        {
+            config->bindless = true;
+        }
+        else if (strcmp(argv[i], "--textures") == 0 && i + 1 < argc)
+        {
+            // The textures are only reachable through the bindless set
+            config->textureDirectory = argv[++i];
+            config->bindless = true;
+        }
+        else if (strcmp(argv[i], "--texture-budget") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 1 || value > 65536)
+            {
+                fprintf(stderr, "--texture-budget must be between 1 and 65536 MB\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->textureBudgetMB = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--no-compute") == 0)
+        {
+            config->compute = false;
+        }
+        else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc)
+        {
+            config->telemetryPath = argv[++i];
+        }
+        else if (strcmp(argv[i], "--telemetry-format") == 0 && i + 1 < argc)
+        {
+            const char *format = argv[++i];
+            if (strcmp(format, "csv") == 0)
+                config->telemetryJson = false;
+            else if (strcmp(format, "json") == 0)
+                config->telemetryJson = true;
+            else
+            {
+                fprintf(stderr, "--telemetry-format must be csv or json\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+        }
+        else if (strcmp(argv[i], "--bench-startup") == 0 && i + 1 < argc)
+        {
+            long value = strtol(argv[++i], NULL, 10);
+            if (value < 1)
+            {
+                fprintf(stderr, "--bench-startup must be at least 1\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->benchStartupRuns = (uint32_t)value;
+        }
+        else if (strcmp(argv[i], "--headless") == 0)
+        {
+            config->headless = true;
+        }
+        else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+        {
+            // strtoull silently wraps negative values and stops at the first non digit
+            const char *text = argv[++i];
+            char *end = NULL;
+            errno = 0;
+            unsigned long long value = strtoull(text, &end, 10);
+            if (text[0] < '0' || text[0] > '9' || *end != '\0' || errno == ERANGE)
+            {
+                fprintf(stderr, "--frames must be a non-negative integer, 0 runs until the window is closed\n");
+                return APP_ERROR_INVALID_ARGUMENT;
+            }
+            config->maxFrameCount = (uint64_t)value;
+            maxFrameCountSet = true;
+        }
+        else
+        {
+            fprintf(stderr, "Unknown or incomplete argument: %s\n", argv[i]);
+            printUsage(argv[0]);
+            return APP_ERROR_INVALID_ARGUMENT;
+        }
+    }
+
+    // Every draw call draws at least one instance
+    if (config->drawCallCount > config->instanceCount)
+    {
+        fprintf(stderr, "--draw-calls cannot be larger than --instances\n");
+        return APP_ERROR_INVALID_ARGUMENT;
+    }
+
+    // GPU driven mode draws everything with a single indirect draw, there is nothing to split
+    if (config->gpuDriven && config->drawCallCount > 1)
+    {
+        fprintf(stderr, "--draw-calls cannot be used with --gpu-driven\n");
+        return APP_ERROR_INVALID_ARGUMENT;
+    }
+
+    // Without a window there is nothing to close, so a headless run has to stop on its own
+    if (config->headless && !maxFrameCountSet)
+        config->maxFrameCount = DEFAULT_HEADLESS_FRAME_COUNT;
+
+    return APP_SUCCESS;
+} // parseArguments
+
+void printUsage(const char *programName)
+{
+    printf("Usage: %s [options]\n", programName);
+    printf("\t--frames-in-flight <n>\tNumber of frames the CPU may record ahead of the GPU (1-%d, default %u)\n", MAX_FRAMES_IN_FLIGHT, DEFAULT_FRAMES_IN_FLIGHT);
+    printf("\t--shader-source <src>\tWhere the SPIR-V comes from: embedded (default), mmap or read\n");
+    printf("\t--present-policy <p>\tdefault, latency (mailbox or immediate, fewest images), throughput (immediate) or power (FIFO)\n");
+    printf("\t--swapchain-images <n>\tNumber of swap chain images, clamped to what the surface supports (default: set by the present policy)\n");
+    printf("\t--shader-dir <dir>\tDirectory of the .spv files for mmap and read (default %s)\n", DEFAULT_SHADER_DIRECTORY);
+    printf("\t--no-gpu-profiler\tDo not time the GPU passes with timestamp queries\n");
+    printf("\t--no-compute\t\tDo not run the particle simulation on the compute queue\n");
+    printf("\t--instances <n>\t\tNumber of triangles drawn every frame (1-%d, default 1)\n", MAX_INSTANCE_COUNT);
+    printf("\t--draw-calls <n>\tNumber of draw calls the instances are split into (default 1)\n");
+    printf("\t--compile-threads <n>\tCompile the pipelines on n threads, 0 for the main thread (default: number of CPUs)\n");
+    printf("\t--record-threads <n>\tRecord the draw calls into secondary command buffers on n worker threads (default 0)\n");
+    printf("\t--gpu-driven\t\tCull the instances in a compute pass and draw them with one indirect count draw\n");
+    printf("\t--animate-camera\tPan and zoom the camera around the world every frame\n");
+    printf("\t--dynamic-rendering\tRender with VK_KHR_dynamic_rendering instead of a render pass and framebuffers\n");
+    printf("\t--bindless\t\tShade the instances with materials read from a bindless descriptor set\n");
+    printf("\t--textures <dir>\tStream the .pam and .ppm images of dir as the material textures (implies --bindless)\n");
+    printf("\t--texture-budget <MB>\tDevice memory the streamed textures may take (default %d)\n", DEFAULT_TEXTURE_BUDGET_MB);
+    printf("\t--telemetry <path>\tWrite the frame time telemetry to path on exit and on SIGUSR1\n");
+    printf("\t--telemetry-format <f>\tcsv (default) or json\n");
+    printf("\t--bench-startup <k>\tRun the init/cleanup cycle k times and print the time of each phase\n");
+    printf("\t--capture-golden <dir>\tSave the captured frames to dir as the golden images of later runs\n");
+    printf("\t--compare-golden <dir>\tCompare the captured frames with the golden images of dir, the exit code tells if they all matched\n");
+    printf("\t--golden-tolerance <n>\tLargest difference of a color channel still considered a match (0-255, default %u)\n", DEFAULT_GOLDEN_TOLERANCE);
+    printf("\t--capture-interval <n>\tCapture every n-th frame (default 1)\n");
+    printf("\t--stream <path>\t\tStream the raw frames to path, a file or a named pipe, - for stdout\n");
+    printf("\t--stream-format <f>\ty4m (default, YUV 4:2:0) or pam (RGBA)\n");
+    printf("\t--stream-fps <n>\tFrame rate written in the y4m header (default %u)\n", DEFAULT_STREAM_FPS);
+    printf("\t--headless\t\tRender to a VK_EXT_headless_surface swap chain without creating a window\n");
+    printf("\t--frames <n>\t\tStop after n frames (0 = until the window is closed, default %llu when headless)\n", (unsigned long long)DEFAULT_HEADLESS_FRAME_COUNT);
+    printf("\t--pipeline-cache <path>\tFile the pipeline cache is loaded from and saved to (default %s)\n", DEFAULT_PIPELINE_CACHE_PATH);
+    printf("\t--no-pipeline-cache\tDo not load or save the pipeline cache\n");
+    printf("\t--device-cache <path>\tFile the selected device and its score are cached in (default %s)\n", DEFAULT_DEVICE_CACHE_PATH);
+    printf("\t--no-device-cache\tQuery every device at startup and do not save the selected one, nor the benchmark results\n");
+    printf("\t--benchmark-devices\tRank the devices by a short compute and fill-rate benchmark, the results are kept in %s\n", DEFAULT_DEVICE_BENCHMARK_PATH);
+    printf("\t--help\t\t\tShow this message\n");
+} // printUsage
+
+AppResult initVulkan(App *app)
+{
+    AppResult appResult = {0};
+    double phaseStartMs = 0.0;
+
+    // The first thing we need to do is to create the Vulkan instance
+    phaseStartMs = getTimeMs();
+    appResult = createVulkanInstance(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_VULKAN_INSTANCE] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#        VULKAN INSTANCE CREATED        #\n");
+        printf("#########################################\n");
+    }
+
+    // Then we need to create the surface
+    phaseStartMs = getTimeMs();
+    appResult = createSurface(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_SURFACE] = getTimeMs() - phaseStartMs;
+
+    // Then we need to select the physical device
+    phaseStartMs = getTimeMs();
+    appResult = selectPhysicalDevice(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_PHYSICAL_DEVICE] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#       PHYSICAL DEVICE SELECTED        #\n");
+        printf("#########################################\n");
+    }
+
+    // Now we can create the logical device
+    phaseStartMs = getTimeMs();
+    appResult = createLogicalDevice(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_LOGICAL_DEVICE] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#        LOGICAL DEVICE CREATED         #\n");
+        printf("#########################################\n");
+    }
+
+    // The uploader streams data through the transfer queue for everything created next
+    phaseStartMs = getTimeMs();
+    appResult = createUploader(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_UPLOADER] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#           UPLOADER CREATED            #\n");
+        printf("#########################################\n");
+    }
+
+    // Then we wand to choose the right swap chain settings
+    phaseStartMs = getTimeMs();
+    appResult = createSwapChain(app, VK_NULL_HANDLE);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_SWAP_CHAIN] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#         SWAP CHAIN CREATED            #\n");
+        printf("#########################################\n");
+    }
+
+    // The next step is to setup the image views
+    phaseStartMs = getTimeMs();
+    appResult = createImageViews(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_IMAGE_VIEWS] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#        IMAGE VIEWS CREATED            #\n");
+        printf("#########################################\n");
+    }
+
+    // Then the render pass is necessary for the graphics pipeline
+    phaseStartMs = getTimeMs();
+    appResult = createRenderPass(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_RENDER_PASS] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#         RENDER PASS CREATED           #\n");
+        printf("#########################################\n");
+    }
+
+    // The pipeline cache lets the driver skip the shader compilation it already did in a
+    // previous run
+    phaseStartMs = getTimeMs();
+    appResult = createPipelineCache(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_PIPELINE_CACHE] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#        PIPELINE CACHE CREATED         #\n");
+        printf("#########################################\n");
+    }
+
+    // The pipelines are compiled by the job pool while the rest of the startup goes on
+    phaseStartMs = getTimeMs();
+    appResult = createJobPool(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_JOB_POOL] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#           JOB POOL CREATED            #\n");
+        printf("#########################################\n");
+    }
+
+    // And then it's time to create the graphics pipeline
+    phaseStartMs = getTimeMs();
+    appResult = createGraphicsPipeline(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_GRAPHICS_PIPELINE] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#       GRAPHICS PIPELINE CREATED        #\n");
+        printf("#########################################\n");
+    }
+
+    // The simulation runs next to the rendering on the compute queue
+    phaseStartMs = getTimeMs();
+    appResult = createComputePipeline(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_COMPUTE_PIPELINE] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#       COMPUTE PIPELINE CREATED        #\n");
+        printf("#########################################\n");
+    }
+
+    // The textures only have their headers read here, they are decoded and streamed in
+    // while the frames are rendered
+    phaseStartMs = getTimeMs();
+    appResult = createTextureStreamer(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_TEXTURE_STREAMER] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#        TEXTURE STREAMER CREATED       #\n");
+        printf("#########################################\n");
+    }
+
+    // The geometry is streamed through the uploader, the first frame waits for it
+    phaseStartMs = getTimeMs();
+    appResult = createVertexBuffers(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_VERTEX_BUFFERS] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#        VERTEX BUFFERS CREATED         #\n");
+        printf("#########################################\n");
+    }
+
+    // In GPU driven mode the draws are generated by a culling compute pass
+    phaseStartMs = getTimeMs();
+    appResult = createCullingPipeline(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_CULLING_PIPELINE] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#       CULLING PIPELINE CREATED        #\n");
+        printf("#########################################\n");
+    }
+
+    // Only the part of the compilation that did not overlap with the phases above is left
+    phaseStartMs = getTimeMs();
+    appResult = waitForPipelineBuilds(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_PIPELINE_COMPILATION] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#         PIPELINES COMPILED            #\n");
+        printf("#########################################\n");
+    }
+
+    // Now we can create the framebuffers
+    phaseStartMs = getTimeMs();
+    appResult = createFramebuffers(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_FRAMEBUFFERS] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#        FRAMEBUFFERS CREATED           #\n");
+        printf("#########################################\n");
+    }
+
+    // Finally the command buffers and synchronization objects of every frame in flight
+    phaseStartMs = getTimeMs();
+    appResult = createFrameResources(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_FRAME_RESOURCES] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#       FRAME RESOURCES CREATED         #\n");
+        printf("#########################################\n");
+    }
+
+    // And the timestamp queries used to time the GPU work
+    phaseStartMs = getTimeMs();
+    appResult = createGpuProfiler(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->startupPhaseMs[STARTUP_PHASE_GPU_PROFILER] = getTimeMs() - phaseStartMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("#########################################\n");
+        printf("#         GPU PROFILER CREATED          #\n");
+        printf("#########################################\n");
+    }
+
+    // // Print the app Struct
+    // if (verbose)
+    // {
+    //     printf("=========================================\n");
+    //     printf("App Struct:\n");
+    //     printf("\tWindow: %p\n", (void *)app->window);
+    //     printf("\tInstance: %p\n", (void *)app->instance);
+    //     printf("\tPhysical Device: %p\n", (void *)app->physicalDevice);
+    //     printf("\tSurface: %p\n", (void *)app->surface);
+    //     printf("\tGraphics Queue: %p\n", (void *)app->graphicsQueue);
+    //     printf("\tGraphics Queue Family Index: %u\n", app->graphicsQueueFamilyIndex);
+    //     printf("\tGraphics Queue Priority: %f\n", app->graphicsQueuePriority);
+    //     printf("\tPresentation Queue: %p\n", (void *)app->presentationQueue);
+    //     printf("\tPresentation Queue Family Index: %u\n", app->presentationQueueFamilyIndex);
+    //     printf("\tPresentation Queue Priority: %f\n", app->presentationQueuePriority);
+    //     printf("\tLogical Device: %p\n", (void *)app->logicalDevice);
+    // }
+
+    return APP_SUCCESS;
+} // initVulkan
+
+AppResult drawFrame(App *app)
+{
+    FrameData *frame = &app->frames[app->currentFrame];
+    double frameStartMs = getTimeMs();
+
+    // Wait until the GPU is done with the last submission that used this frame's resources,
+    // with N frames in flight this is the frame submitted N frames ago so the CPU only
+    // blocks when it gets more than N frames ahead of the GPU
+    VkResult vkResult = vkWaitForFences(app->logicalDevice, 1, &frame->inFlightFence, VK_TRUE, UINT64_MAX);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to wait for in flight fence: %d\n", vkResult);
+        return APP_ERROR_VULKAN_WAIT_FOR_FENCE;
+    }
+    double fenceWaitMs = getTimeMs() - frameStartMs;
+
+    // The frame last submitted from this slot is done on the GPU, the time since it started
+    // goes from the CPU starting it to the GPU finishing it. It is exact when the wait blocked
+    // and an upper bound when the fence had already signaled. It is not the present latency,
+    // the time from there to the display is up to the presentation engine and can't be
+    // measured with core Vulkan
+    if (frame->submittedFrameStartMs > 0.0)
+    {
+        double gpuCompletionMs = getTimeMs() - frame->submittedFrameStartMs;
+        app->frameStats.gpuCompletionSampleCount++;
+        app->frameStats.totalGpuCompletionMs += gpuCompletionMs;
+        if (gpuCompletionMs > app->frameStats.maxGpuCompletionMs)
+            app->frameStats.maxGpuCompletionMs = gpuCompletionMs;
+        frame->submittedFrameStartMs = 0.0;
+    }
+
+    // The fences only cover the rendering, not the presents. The last present to the old swap
+    // chain was queued before the first frame submitted after its recreation, so once the fence
+    // of that frame has signaled the old swap chain resources can go, without any stall
+    if (app->retiredSwapChain.swapChain != VK_NULL_HANDLE && app->frameStats.frameCount >= app->retiredSwapChainFrame + app->config.framesInFlight)
+        destroyRetiredSwapChain(app);
+
+    // The queries this frame slot wrote last time are complete now that its fence signaled
+    gpuProfilerCollect(app, app->currentFrame);
+
+    // And so are the copies of its image for the capture and the stream
+    AppResult appResult = frameCaptureCollect(app, app->currentFrame);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = frameStreamCollect(app, app->currentFrame);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // Give the staging space of the finished uploads back, without waiting for the others
+    appResult = uploaderRetire(app, false);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The camera moves first, the texture coverage and the culling see where it is this frame
+    updateCamera(app);
+
+    // Point this frame's descriptors to the latest texture images, then queue the next mips
+    appResult = textureStreamerUpdate(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The uniform slot of this frame is free too
+    updateFrameUniforms(app);
+
+    uint32_t imageIndex = 0;
+    double acquireStartMs = getTimeMs();
+    vkResult = vkAcquireNextImageKHR(app->logicalDevice, app->swapChain, UINT64_MAX, frame->imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    double acquireWaitMs = getTimeMs() - acquireStartMs;
+    if (vkResult == VK_ERROR_OUT_OF_DATE_KHR)
+    {
+        // Nothing was acquired so the semaphore and the fence are untouched and this frame
+        // can simply be skipped
+        return recreateSwapChain(app);
+    }
+    if (vkResult != VK_SUCCESS && vkResult != VK_SUBOPTIMAL_KHR)
+    {
+        fprintf(stderr, "Failed to acquire swap chain image: %d\n", vkResult);
+        return APP_ERROR_VULKAN_ACQUIRE_NEXT_IMAGE;
+    }
+
+    // The swap chain can hand back an image that an older frame is still rendering to when
+    // there are more frames in flight than images
+    if (app->imagesInFlight[imageIndex] != VK_NULL_HANDLE && app->imagesInFlight[imageIndex] != frame->inFlightFence)
+    {
+        double imageWaitStartMs = getTimeMs();
+        vkResult = vkWaitForFences(app->logicalDevice, 1, &app->imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to wait for swap chain image fence: %d\n", vkResult);
+            return APP_ERROR_VULKAN_WAIT_FOR_FENCE;
+        }
+        fenceWaitMs += getTimeMs() - imageWaitStartMs;
+    }
+    app->imagesInFlight[imageIndex] = frame->inFlightFence;
+
+    double cpuWorkStartMs = getTimeMs();
+
+    // The simulation is submitted first so that the compute queue can start on it while the
+    // graphics queue is still busy with the previous frames. The graphics queue does not wait
+    // for it, nothing reads the particles. Its command pool is free once the dispatch of
+    // framesInFlight frames ago is done, which it nearly always is by now
+    if (app->computePipeline != VK_NULL_HANDLE)
+    {
+        double computeWaitStartMs = getTimeMs();
+        vkResult = vkWaitForFences(app->logicalDevice, 1, &frame->computeFence, VK_TRUE, UINT64_MAX);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to wait for compute fence: %d\n", vkResult);
+            return APP_ERROR_VULKAN_WAIT_FOR_FENCE;
+        }
+        fenceWaitMs += getTimeMs() - computeWaitStartMs;
+
+        vkResult = vkResetFences(app->logicalDevice, 1, &frame->computeFence);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to reset compute fence: %d\n", vkResult);
+            return APP_ERROR_VULKAN_QUEUE_SUBMIT;
+        }
+
+        vkResult = vkResetCommandPool(app->logicalDevice, frame->computeCommandPool, 0);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to reset compute command pool: %d\n", vkResult);
+            return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+        }
+
+        float deltaTime = app->frameStats.frameCount > 0 ? (float)((frameStartMs - app->lastFrameStartMs) / 1000.0) : 0.0f;
+        appResult = recordComputeCommandBuffer(app, frame->computeCommandBuffer, deltaTime);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+
+        VkSubmitInfo computeSubmitInfo = {0};
+        computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        computeSubmitInfo.commandBufferCount = 1;
+        computeSubmitInfo.pCommandBuffers = &frame->computeCommandBuffer;
+
+        vkResult = vkQueueSubmit(app->computeQueue, 1, &computeSubmitInfo, frame->computeFence);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to submit compute command buffer: %d\n", vkResult);
+            return APP_ERROR_VULKAN_QUEUE_SUBMIT;
+        }
+    }
+
+    // The pool only holds this frame's command buffer so resetting the whole pool is the
+    // cheapest way to recycle it
+    vkResult = vkResetCommandPool(app->logicalDevice, frame->commandPool, 0);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to reset command pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    double recordStartMs = getTimeMs();
+    appResult = recordCommandBuffer(app, frame->commandBuffer, imageIndex);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    app->frameStats.totalRecordMs += getTimeMs() - recordStartMs;
+
+    // The uploads queued since the last frame are submitted ahead of it so that it sees them
+    appResult = uploaderFlush(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    vkResult = vkResetFences(app->logicalDevice, 1, &frame->inFlightFence);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to reset in flight fence: %d\n", vkResult);
+        return APP_ERROR_VULKAN_QUEUE_SUBMIT;
+    }
+
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkSubmitInfo submitInfo = {0};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &frame->imageAvailableSemaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &frame->commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &app->renderFinishedSemaphores[imageIndex];
+
+    vkResult = vkQueueSubmit(app->graphicsQueue, 1, &submitInfo, frame->inFlightFence);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to submit draw command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_QUEUE_SUBMIT;
+    }
+    frame->submittedFrameStartMs = frameStartMs;
+
+    VkPresentInfoKHR presentInfo = {0};
+    presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+    presentInfo.waitSemaphoreCount = 1;
+    presentInfo.pWaitSemaphores = &app->renderFinishedSemaphores[imageIndex];
+    presentInfo.swapchainCount = 1;
+    presentInfo.pSwapchains = &app->swapChain;
+    presentInfo.pImageIndices = &imageIndex;
+
+    double presentStartMs = getTimeMs();
+    vkResult = vkQueuePresentKHR(app->presentationQueue, &presentInfo);
+    double frameEndMs = getTimeMs();
+    // A pending resize must not hide a real present error, only an out of date or suboptimal
+    // swap chain is expected here
+    if (vkResult != VK_SUCCESS && vkResult != VK_ERROR_OUT_OF_DATE_KHR && vkResult != VK_SUBOPTIMAL_KHR)
+    {
+        fprintf(stderr, "Failed to present swap chain image: %d\n", vkResult);
+        return APP_ERROR_VULKAN_QUEUE_PRESENT;
+    }
+    bool swapChainOutdated = vkResult != VK_SUCCESS || app->framebufferResized;
+
+    // The frame time is measured from one frame start to the next so that it also accounts
+    // for the time spent outside drawFrame (event polling...)
+    if (app->frameStats.frameCount > 0)
+    {
+        app->frameStats.totalFrameTimeMs += frameStartMs - app->lastFrameStartMs;
+
+        double telemetryValuesMs[TELEMETRY_METRIC_COUNT] = {
+            [TELEMETRY_FRAME_INTERVAL] = frameStartMs - app->lastFrameStartMs,
+            [TELEMETRY_ACQUIRE_WAIT] = acquireWaitMs,
+            [TELEMETRY_PRESENT_TIME] = frameEndMs - presentStartMs,
+        };
+        telemetryRecord(&app->telemetry, telemetryValuesMs);
+    }
+    app->frameStats.totalFenceWaitMs += fenceWaitMs;
+    app->frameStats.totalCpuWorkMs += frameEndMs - cpuWorkStartMs;
+    app->frameStats.frameCount++;
+    app->lastFrameStartMs = frameStartMs;
+
+    app->currentFrame = (app->currentFrame + 1) % app->config.framesInFlight;
+
+    if (swapChainOutdated)
+        return recreateSwapChain(app);
+
+    return APP_SUCCESS;
+} // drawFrame
+
+AppResult recreateSwapChain(App *app)
+{
+    // A minimized window has a zero sized framebuffer, no swap chain can be created until it
+    // is restored
+    if (!app->config.headless)
+    {
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(app->window, &width, &height);
+        while ((width == 0 || height == 0) && !glfwWindowShouldClose(app->window))
+        {
+            glfwWaitEvents();
+            glfwGetFramebufferSize(app->window, &width, &height);
+        }
+        if (width == 0 || height == 0)
+            return APP_SUCCESS;
+    }
+
+    double recreationStartMs = getTimeMs();
+
+    // Only one generation of old resources is kept around, if a second resize comes before
+    // they were released we have no choice but to wait for the frames using them
+    if (app->retiredSwapChain.swapChain != VK_NULL_HANDLE)
+    {
+        AppResult appResult = waitForAllFrames(app);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+        destroyRetiredSwapChain(app);
+    }
+
+    // The current resources may still be used by frames in flight, instead of waiting for the
+    // device to be idle they are retired and destroyed framesInFlight frames later
+    app->retiredSwapChain.swapChain = app->swapChain;
+    app->retiredSwapChain.images = app->swapChainImages;
+    app->retiredSwapChain.imageViews = app->swapChainImageViews;
+    app->retiredSwapChain.framebuffers = app->swapChainFramebuffers;
+    app->retiredSwapChain.renderFinishedSemaphores = app->renderFinishedSemaphores;
+    app->retiredSwapChain.imageCount = app->swapChainImageCount;
+    app->retiredSwapChainFrame = app->frameStats.frameCount;
+
+    app->swapChain = VK_NULL_HANDLE;
+    app->swapChainImages = NULL;
+    app->swapChainImageViews = NULL;
+    app->swapChainFramebuffers = NULL;
+    app->renderFinishedSemaphores = NULL;
+    app->swapChainImageCount = 0;
+
+    // Passing the old swap chain lets the driver recycle its images. The render pass and the
+    // pipeline do not depend on the extent (viewport and scissor are dynamic) so only the
+    // swap chain, its image views and the framebuffers are rebuilt
+    AppResult appResult = createSwapChain(app, app->retiredSwapChain.swapChain);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = createImageViews(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = createFramebuffers(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = createSwapChainSyncObjects(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    app->framebufferResized = false;
+
+    double recreationMs = getTimeMs() - recreationStartMs;
+    app->frameStats.swapChainRecreationCount++;
+    app->frameStats.totalSwapChainRecreationMs += recreationMs;
+    if (recreationMs > app->frameStats.maxSwapChainRecreationMs)
+        app->frameStats.maxSwapChainRecreationMs = recreationMs;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Swap chain recreated (%ux%u) in %.3f ms\n", app->swapChainExtent.width, app->swapChainExtent.height, recreationMs);
+    }
+
+    return APP_SUCCESS;
+} // recreateSwapChain
+
+AppResult waitForAllFrames(App *app)
+{
+    VkFence fences[MAX_FRAMES_IN_FLIGHT];
+    for (uint32_t i = 0; i < app->config.framesInFlight; ++i)
+    {
+        fences[i] = app->frames[i].inFlightFence;
+    }
+
+    VkResult vkResult = vkWaitForFences(app->logicalDevice, app->config.framesInFlight, fences, VK_TRUE, UINT64_MAX);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to wait for the frames in flight: %d\n", vkResult);
+        return APP_ERROR_VULKAN_WAIT_FOR_FENCE;
+    }
+
+    return APP_SUCCESS;
+} // waitForAllFrames
+
+void destroyRetiredSwapChain(App *app)
+{
+    SwapChainResources *retired = &app->retiredSwapChain;
+
+    if (retired->framebuffers != NULL)
+    {
+        for (uint32_t i = 0; i < retired->imageCount; ++i)
+        {
+            vkDestroyFramebuffer(app->logicalDevice, retired->framebuffers[i], NULL);
+        }
+        free(retired->framebuffers);
+    }
+
+    if (retired->imageViews != NULL)
+    {
+        for (uint32_t i = 0; i < retired->imageCount; ++i)
+        {
+            vkDestroyImageView(app->logicalDevice, retired->imageViews[i], NULL);
+        }
+        free(retired->imageViews);
+    }
+
+    if (retired->renderFinishedSemaphores != NULL)
+    {
+        for (uint32_t i = 0; i < retired->imageCount; ++i)
+        {
+            if (retired->renderFinishedSemaphores[i] != VK_NULL_HANDLE)
+                vkDestroySemaphore(app->logicalDevice, retired->renderFinishedSemaphores[i], NULL);
+        }
+        free(retired->renderFinishedSemaphores);
+    }
+
+    // The images belong to the swap chain
+    free(retired->images);
+
+    if (retired->swapChain != VK_NULL_HANDLE)
+        vkDestroySwapchainKHR(app->logicalDevice, retired->swapChain, NULL);
+
+    *retired = (SwapChainResources){0};
+} // destroyRetiredSwapChain
+
+void recordCullingPass(App *app, VkCommandBuffer commandBuffer)
+{
+    // The previous frame's indirect draw has to be done reading the commands and their count
+    // before they are overwritten, which is a pure execution dependency
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, NULL, 0, NULL, 0, NULL);
+
+    vkCmdFillBuffer(commandBuffer, app->drawCountBuffer, 0, sizeof(uint32_t), 0);
+
+    // Without the count, every command is executed, the ones past the surviving objects have to
+    // be empty draws
+    if (app->vkCmdDrawIndexedIndirectCount == NULL)
+        vkCmdFillBuffer(commandBuffer, app->drawCommandBuffer, 0, VK_WHOLE_SIZE, 0);
+
+    VkMemoryBarrier clearBarrier = {0};
+    clearBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    clearBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    clearBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &clearBarrier, 0, NULL, 0, NULL);
+
+    // The objects are culled against the view of the frame uniforms, the indirect draw does
+    // not move them
+    CullingPushConstants pushConstants = {0};
+    memcpy(pushConstants.viewOffset, app->frameUniforms.viewOffset, sizeof(pushConstants.viewOffset));
+    memcpy(pushConstants.viewScale, app->frameUniforms.viewScale, sizeof(pushConstants.viewScale));
+    pushConstants.objectCount = app->config.instanceCount;
+    pushConstants.indexCount = TRIANGLE_INDEX_COUNT;
+    pushConstants.boundingRadius = TRIANGLE_BOUNDING_RADIUS;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, app->cullingPipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, app->cullingPipelineLayout, 0, 1, &app->cullingDescriptorSet, 0, NULL);
+    vkCmdPushConstants(commandBuffer, app->cullingPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(CullingPushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (app->config.instanceCount + CULLING_WORKGROUP_SIZE - 1) / CULLING_WORKGROUP_SIZE, 1, 1);
+
+    VkMemoryBarrier cullingBarrier = {0};
+    cullingBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    cullingBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    cullingBarrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 1, &cullingBarrier, 0, NULL, 0, NULL);
+} // recordCullingPass
+
+AppResult recordComputeCommandBuffer(App *app, VkCommandBuffer commandBuffer, float deltaTime)
+{
+    VkCommandBufferBeginInfo beginInfo = {0};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkResult vkResult = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin recording compute command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    // The particles are updated in place so every dispatch has to see the writes of the
+    // previous frame's dispatch, which was submitted earlier on the same queue
+    VkMemoryBarrier memoryBarrier = {0};
+    memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    memoryBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    memoryBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &memoryBarrier, 0, NULL, 0, NULL);
+
+    SimulationPushConstants pushConstants = {0};
+    pushConstants.deltaTime = deltaTime;
+    pushConstants.particleCount = SIMULATION_PARTICLE_COUNT;
+    pushConstants.initialize = app->particlesInitialized ? 0 : 1;
+    app->particlesInitialized = true;
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, app->computePipeline);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, app->computePipelineLayout, 0, 1, &app->computeDescriptorSet, 0, NULL);
+    vkCmdPushConstants(commandBuffer, app->computePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(SimulationPushConstants), &pushConstants);
+    vkCmdDispatch(commandBuffer, (SIMULATION_PARTICLE_COUNT + SIMULATION_WORKGROUP_SIZE - 1) / SIMULATION_WORKGROUP_SIZE, 1, 1);
+
+    vkResult = vkEndCommandBuffer(commandBuffer);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to record compute command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    return APP_SUCCESS;
+} // recordComputeCommandBuffer
+
+uint32_t getDrawCount(const App *app)
+{
+    // GPU driven mode has a single indirect draw whatever the number of objects
+    return app->cullingPipeline != VK_NULL_HANDLE ? 1 : app->config.drawCallCount;
+} // getDrawCount
+
+void recordDraws(App *app, VkCommandBuffer commandBuffer, uint32_t firstDraw, uint32_t lastDraw)
+{
+    // Secondary command buffers inherit no state, every slice of the draw list binds everything
+    // it needs. The variant is looked up every time, the features it depends on may change
+    // from one frame to the next
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, findPipelineVariant(&app->graphicsVariants, getPipelineFeatures(app)));
+
+    // Every draw reaches its resources through the uniform slot and the bindless set of the
+    // frame, nothing is bound per draw
+    uint32_t uniformOffset = (uint32_t)(app->uniformRing.slotSize * app->currentFrame);
+    vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app->pipelineLayout, 0, 1, &app->uniformRing.set, 1, &uniformOffset);
+    if (app->bindless.setCount > 0)
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, app->pipelineLayout, 1, 1, &app->bindless.sets[app->currentFrame], 0, NULL);
+
+    // Viewport and scissor are dynamic states of the pipeline
+    VkViewport viewport = {0};
+    viewport.x = 0.0f;
+    viewport.y = 0.0f;
+    viewport.width = (float)app->swapChainExtent.width;
+    viewport.height = (float)app->swapChainExtent.height;
+    viewport.minDepth = 0.0f;
+    viewport.maxDepth = 1.0f;
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+
+    VkRect2D scissor = {0};
+    scissor.offset = (VkOffset2D){0, 0};
+    scissor.extent = app->swapChainExtent;
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    VkBuffer vertexBuffers[2] = {app->vertexBuffer, app->instanceBuffer};
+    VkDeviceSize vertexBufferOffsets[2] = {0, 0};
+    vkCmdBindVertexBuffers(commandBuffer, 0, 2, vertexBuffers, vertexBufferOffsets);
+    vkCmdBindIndexBuffer(commandBuffer, app->indexBuffer, 0, VK_INDEX_TYPE_UINT16);
+
+    // All the draws place their instances as they are in the world, the placement is pushed
+    // once for the slice and every draw of it keeps it
+    DrawPushConstants pushConstants = {0};
+    pushConstants.offset[0] = 0.0f;
+    pushConstants.offset[1] = 0.0f;
+    pushConstants.scale = 1.0f;
+    vkCmdPushConstants(commandBuffer, app->pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(DrawPushConstants), &pushConstants);
+
+    uint32_t instanceCount = app->config.instanceCount;
+    if (app->cullingPipeline != VK_NULL_HANDLE)
+    {
+        // A single draw whatever the number of objects, the count written by the culling pass
+        // says how many of the commands to execute. Without the extension, the whole buffer is
+        // drawn and the culled slots are zeroed commands
+        if (app->vkCmdDrawIndexedIndirectCount != NULL)
+            app->vkCmdDrawIndexedIndirectCount(commandBuffer, app->drawCommandBuffer, 0, app->drawCountBuffer, 0, instanceCount, sizeof(VkDrawIndexedIndirectCommand));
+        else
+            vkCmdDrawIndexedIndirect(commandBuffer, app->drawCommandBuffer, 0, instanceCount, sizeof(VkDrawIndexedIndirectCommand));
+    }
+    else
+    {
+        // The instances are split evenly between the draw calls, which only differ by their
+        // range of instances
+        uint32_t drawCallCount = app->config.drawCallCount;
+        for (uint32_t i = firstDraw; i < lastDraw; ++i)
+        {
+            uint32_t firstInstance = (uint32_t)((uint64_t)instanceCount * i / drawCallCount);
+            uint32_t lastInstance = (uint32_t)((uint64_t)instanceCount * (i + 1) / drawCallCount);
+            vkCmdDrawIndexed(commandBuffer, TRIANGLE_INDEX_COUNT, lastInstance - firstInstance, 0, 0, firstInstance);
+        }
+    }
+} // recordDraws
+
+AppResult recordCommandBuffer(App *app, VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    VkCommandBufferBeginInfo beginInfo = {0};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    VkResult vkResult = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin recording command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    gpuProfilerBeginFrame(app, commandBuffer, app->currentFrame);
+    uint32_t frameScope = gpuProfilerBeginScope(app, commandBuffer, "frame");
+
+    if (app->cullingPipeline != VK_NULL_HANDLE)
+    {
+        uint32_t cullingScope = gpuProfilerBeginScope(app, commandBuffer, "culling");
+        recordCullingPass(app, commandBuffer);
+        gpuProfilerEndScope(app, commandBuffer, cullingScope);
+    }
+
+    uint32_t mainPassScope = gpuProfilerBeginScope(app, commandBuffer, "main pass");
+    if (app->recordWorkers.workerCount > 0)
+    {
+        // The workers record the draw list into secondary command buffers while this thread
+        // waits, the render pass then only has to execute them
+        VkCommandBuffer secondaryCommandBuffers[MAX_RECORD_THREADS];
+        uint32_t secondaryCommandBufferCount = 0;
+        AppResult appResult = recordInParallel(app, imageIndex, secondaryCommandBuffers, &secondaryCommandBufferCount);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+
+        beginMainPass(app, commandBuffer, imageIndex, true);
+        vkCmdExecuteCommands(commandBuffer, secondaryCommandBufferCount, secondaryCommandBuffers);
+    }
+    else
+    {
+        beginMainPass(app, commandBuffer, imageIndex, false);
+        recordDraws(app, commandBuffer, 0, getDrawCount(app));
+    }
+
+    endMainPass(app, commandBuffer, imageIndex);
+    gpuProfilerEndScope(app, commandBuffer, mainPassScope);
+
+    recordSwapChainReadback(app, commandBuffer, imageIndex);
+
+    gpuProfilerEndScope(app, commandBuffer, frameScope);
+
+    vkResult = vkEndCommandBuffer(commandBuffer);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to record command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    return APP_SUCCESS;
+} // recordCommandBuffer
+
+void beginMainPass(App *app, VkCommandBuffer commandBuffer, uint32_t imageIndex, bool secondaryCommandBuffers)
+{
+    VkClearValue clearColor = {.color = {.float32 = {0.0f, 0.0f, 0.0f, 1.0f}}};
+    VkRect2D renderArea = {.offset = {0, 0}, .extent = app->swapChainExtent};
+
+    if (!app->dynamicRendering)
+    {
+        VkRenderPassBeginInfo renderPassBeginInfo = {0};
+        renderPassBeginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassBeginInfo.renderPass = app->renderPass;
+        renderPassBeginInfo.framebuffer = app->swapChainFramebuffers[imageIndex];
+        renderPassBeginInfo.renderArea = renderArea;
+        renderPassBeginInfo.clearValueCount = 1;
+        renderPassBeginInfo.pClearValues = &clearColor;
+        vkCmdBeginRenderPass(commandBuffer, &renderPassBeginInfo, secondaryCommandBuffers ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE);
+        return;
+    }
+
+    // The layout transition the render pass did on its own, with the same dependency on the
+    // image available semaphore waited on at the color attachment output stage
+    VkImageMemoryBarrier imageBarrier = {0};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = app->swapChainImages[imageIndex];
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+
+    VkRenderingAttachmentInfoKHR colorAttachment = {0};
+    colorAttachment.sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO_KHR;
+    colorAttachment.imageView = app->swapChainImageViews[imageIndex];
+    colorAttachment.imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    colorAttachment.resolveMode = VK_RESOLVE_MODE_NONE;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.clearValue = clearColor;
+
+    VkRenderingInfoKHR renderingInfo = {0};
+    renderingInfo.sType = VK_STRUCTURE_TYPE_RENDERING_INFO_KHR;
+    renderingInfo.flags = secondaryCommandBuffers ? VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT_KHR : 0;
+    renderingInfo.renderArea = renderArea;
+    renderingInfo.layerCount = 1;
+    renderingInfo.colorAttachmentCount = 1;
+    renderingInfo.pColorAttachments = &colorAttachment;
+    app->vkCmdBeginRendering(commandBuffer, &renderingInfo);
+} // beginMainPass
+
+void endMainPass(App *app, VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    if (!app->dynamicRendering)
+    {
+        vkCmdEndRenderPass(commandBuffer);
+        return;
+    }
+
+    app->vkCmdEndRendering(commandBuffer);
+
+    // The image leaves the pass ready to be presented, like the final layout of the render
+    // pass, which is what the readback and the present expect. The second scope stays at the
+    // color attachment output stage so that the readback barrier, which starts from there,
+    // comes after this transition
+    VkImageMemoryBarrier imageBarrier = {0};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarrier.dstAccessMask = 0;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = app->swapChainImages[imageIndex];
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+} // endMainPass
+
+AppResult createFrameResources(App *app)
+{
+    // Each frame in flight gets its own command pool so that it can be reset as a whole
+    // without touching the command buffers the GPU may still be executing for other frames
+    for (uint32_t i = 0; i < app->config.framesInFlight; ++i)
+    {
+        FrameData *frame = &app->frames[i];
+
+        VkCommandPoolCreateInfo commandPoolCreateInfo = {0};
+        commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+        commandPoolCreateInfo.queueFamilyIndex = app->graphicsQueueFamilyIndex;
+
+        VkResult vkResult = vkCreateCommandPool(app->logicalDevice, &commandPoolCreateInfo, NULL, &frame->commandPool);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create command pool: %d\n", vkResult);
+            return APP_ERROR_VULKAN_CREATE_COMMAND_POOL;
+        }
+
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {0};
+        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferAllocateInfo.commandPool = frame->commandPool;
+        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        commandBufferAllocateInfo.commandBufferCount = 1;
+
+        vkResult = vkAllocateCommandBuffers(app->logicalDevice, &commandBufferAllocateInfo, &frame->commandBuffer);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate command buffer: %d\n", vkResult);
+            return APP_ERROR_VULKAN_ALLOC_COMMAND_BUFFER;
+        }
+
+        VkSemaphoreCreateInfo semaphoreCreateInfo = {0};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        // The fence starts signaled so that the first wait on it in drawFrame returns immediately
+        VkFenceCreateInfo fenceCreateInfo = {0};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+        fenceCreateInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+        if (vkCreateSemaphore(app->logicalDevice, &semaphoreCreateInfo, NULL, &frame->imageAvailableSemaphore) != VK_SUCCESS ||
+            vkCreateFence(app->logicalDevice, &fenceCreateInfo, NULL, &frame->inFlightFence) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create synchronization objects for frame %u\n", i);
+            return APP_ERROR_VULKAN_CREATE_SYNC_OBJECTS;
+        }
+
+        if (app->computePipeline == VK_NULL_HANDLE)
+            continue;
+
+        // The compute command buffers come from a pool of the compute queue family
+        commandPoolCreateInfo.queueFamilyIndex = app->computeQueueFamilyIndex;
+        vkResult = vkCreateCommandPool(app->logicalDevice, &commandPoolCreateInfo, NULL, &frame->computeCommandPool);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create compute command pool: %d\n", vkResult);
+            return APP_ERROR_VULKAN_CREATE_COMMAND_POOL;
+        }
+
+        commandBufferAllocateInfo.commandPool = frame->computeCommandPool;
+        vkResult = vkAllocateCommandBuffers(app->logicalDevice, &commandBufferAllocateInfo, &frame->computeCommandBuffer);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate compute command buffer: %d\n", vkResult);
+            return APP_ERROR_VULKAN_ALLOC_COMMAND_BUFFER;
+        }
+
+        if (vkCreateFence(app->logicalDevice, &fenceCreateInfo, NULL, &frame->computeFence) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create synchronization objects for frame %u\n", i);
+            return APP_ERROR_VULKAN_CREATE_SYNC_OBJECTS;
+        }
+    }
+
+    AppResult appResult = createSwapChainSyncObjects(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Frames in flight: %u\n", app->config.framesInFlight);
+    }
+
+    // The captured frames are read back through per-frame buffers
+    appResult = createFrameCapture(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // And the streamed ones through a pool drained by the writer thread
+    appResult = createFrameStream(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The workers record from per-frame pools too
+    return createRecordWorkers(app);
+} // createFrameResources
+
+AppResult createSwapChainSyncObjects(App *app)
+{
+    // No swap chain image is in use yet, the previous arrays went with the retired swap chain
+    free(app->imagesInFlight);
+    app->imagesInFlight = calloc(app->swapChainImageCount, sizeof(VkFence));
+    app->renderFinishedSemaphores = calloc(app->swapChainImageCount, sizeof(VkSemaphore));
+    if (app->imagesInFlight == NULL || app->renderFinishedSemaphores == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for images in flight\n");
+        return APP_ERROR_ALLOC_IMAGES_IN_FLIGHT;
+    }
+
+    VkSemaphoreCreateInfo semaphoreCreateInfo = {0};
+    semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (uint32_t i = 0; i < app->swapChainImageCount; ++i)
+    {
+        if (vkCreateSemaphore(app->logicalDevice, &semaphoreCreateInfo, NULL, &app->renderFinishedSemaphores[i]) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create synchronization objects for swap chain image %u\n", i);
+            return APP_ERROR_VULKAN_CREATE_SYNC_OBJECTS;
+        }
+    }
+
+    return APP_SUCCESS;
+} // createSwapChainSyncObjects
+
+AppResult createRecordWorkers(App *app)
+{
+    RecordWorkers *recordWorkers = &app->recordWorkers;
+    if (app->config.recordThreadCount == 0)
+        return APP_SUCCESS;
+
+    if (pthread_mutex_init(&recordWorkers->mutex, NULL) != 0 || pthread_cond_init(&recordWorkers->workReady, NULL) != 0 ||
+        pthread_cond_init(&recordWorkers->workDone, NULL) != 0)
+    {
+        fprintf(stderr, "Failed to create the record workers synchronization objects\n");
+        return APP_ERROR_CREATE_THREAD;
+    }
+    recordWorkers->synchronizationCreated = true;
+
+    for (uint32_t i = 0; i < app->config.recordThreadCount; ++i)
+    {
+        RecordWorker *worker = &recordWorkers->workers[i];
+        worker->app = app;
+        worker->index = i;
+
+        // Command pools are externally synchronized, every worker records from pools of its own
+        // so that no lock is needed, one per frame in flight to reset them as a whole like the
+        // primary command pools
+        for (uint32_t j = 0; j < app->config.framesInFlight; ++j)
+        {
+            VkCommandPoolCreateInfo commandPoolCreateInfo = {0};
+            commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            commandPoolCreateInfo.queueFamilyIndex = app->graphicsQueueFamilyIndex;
+
+            VkResult vkResult = vkCreateCommandPool(app->logicalDevice, &commandPoolCreateInfo, NULL, &worker->commandPools[j]);
+            if (vkResult != VK_SUCCESS)
+            {
+                fprintf(stderr, "Failed to create record worker command pool: %d\n", vkResult);
+                return APP_ERROR_VULKAN_CREATE_COMMAND_POOL;
+            }
+
+            VkCommandBufferAllocateInfo commandBufferAllocateInfo = {0};
+            commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            commandBufferAllocateInfo.commandPool = worker->commandPools[j];
+            commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            commandBufferAllocateInfo.commandBufferCount = 1;
+
+            vkResult = vkAllocateCommandBuffers(app->logicalDevice, &commandBufferAllocateInfo, &worker->commandBuffers[j]);
+            if (vkResult != VK_SUCCESS)
+            {
+                fprintf(stderr, "Failed to allocate record worker command buffer: %d\n", vkResult);
+                return APP_ERROR_VULKAN_ALLOC_COMMAND_BUFFER;
+            }
+        }
+
+        if (pthread_create(&worker->thread, NULL, recordWorkerMain, worker) != 0)
+        {
+            fprintf(stderr, "Failed to create record worker thread %u\n", i);
+            return APP_ERROR_CREATE_THREAD;
+        }
+        worker->started = true;
+        recordWorkers->workerCount++;
+    }
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Recording secondary command buffers on %u worker threads\n", recordWorkers->workerCount);
+    }
+
+    return APP_SUCCESS;
+} // createRecordWorkers
+
+void *recordWorkerMain(void *argument)
+{
+    RecordWorker *worker = argument;
+    RecordWorkers *recordWorkers = &worker->app->recordWorkers;
+
+    pthread_mutex_lock(&recordWorkers->mutex);
+    uint64_t generation = recordWorkers->generation;
+    for (;;)
+    {
+        while (!recordWorkers->quit && recordWorkers->generation == generation)
+            pthread_cond_wait(&recordWorkers->workReady, &recordWorkers->mutex);
+        if (recordWorkers->quit)
+            break;
+
+        generation = recordWorkers->generation;
+        uint32_t frameIndex = recordWorkers->frameIndex;
+        uint32_t imageIndex = recordWorkers->imageIndex;
+        pthread_mutex_unlock(&recordWorkers->mutex);
+
+        AppResult result = recordSecondaryCommandBuffer(worker->app, worker, frameIndex, imageIndex);
+
+        pthread_mutex_lock(&recordWorkers->mutex);
+        worker->failed = result != APP_SUCCESS;
+        if (--recordWorkers->pendingCount == 0)
+            pthread_cond_signal(&recordWorkers->workDone);
+    }
+    pthread_mutex_unlock(&recordWorkers->mutex);
+
+    return NULL;
+} // recordWorkerMain
+
+AppResult recordSecondaryCommandBuffer(App *app, RecordWorker *worker, uint32_t frameIndex, uint32_t imageIndex)
+{
+    // The draw list is split in contiguous slices, the workers past the end of a short list
+    // have nothing to record
+    uint32_t drawCount = getDrawCount(app);
+    uint32_t workerCount = app->recordWorkers.workerCount;
+    uint32_t firstDraw = (uint32_t)((uint64_t)drawCount * worker->index / workerCount);
+    uint32_t lastDraw = (uint32_t)((uint64_t)drawCount * (worker->index + 1) / workerCount);
+    worker->recorded = false;
+    if (firstDraw == lastDraw)
+        return APP_SUCCESS;
+
+    // The main thread waited on the frame's fence before handing it out, nothing the pool
+    // allocated is in use anymore
+    VkResult vkResult = vkResetCommandPool(app->logicalDevice, worker->commandPools[frameIndex], 0);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to reset record worker command pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    VkFormat colorAttachmentFormat = app->selectedDeviceSurfaceFormat.format;
+    VkCommandBufferInheritanceRenderingInfoKHR inheritanceRenderingInfo = {0};
+    inheritanceRenderingInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO_KHR;
+    inheritanceRenderingInfo.colorAttachmentCount = 1;
+    inheritanceRenderingInfo.pColorAttachmentFormats = &colorAttachmentFormat;
+    inheritanceRenderingInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+    // With dynamic rendering the secondary command buffers inherit the attachment formats
+    // rather than a render pass and framebuffer, which must then both be null
+    VkCommandBufferInheritanceInfo inheritanceInfo = {0};
+    inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inheritanceInfo.pNext = app->dynamicRendering ? &inheritanceRenderingInfo : NULL;
+    inheritanceInfo.renderPass = app->dynamicRendering ? VK_NULL_HANDLE : app->renderPass;
+    inheritanceInfo.subpass = 0;
+    inheritanceInfo.framebuffer = app->dynamicRendering ? VK_NULL_HANDLE : app->swapChainFramebuffers[imageIndex];
+
+    VkCommandBufferBeginInfo beginInfo = {0};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+    beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+    VkCommandBuffer commandBuffer = worker->commandBuffers[frameIndex];
+    vkResult = vkBeginCommandBuffer(commandBuffer, &beginInfo);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin recording secondary command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    recordDraws(app, commandBuffer, firstDraw, lastDraw);
+
+    vkResult = vkEndCommandBuffer(commandBuffer);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to record secondary command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    worker->recorded = true;
+    return APP_SUCCESS;
+} // recordSecondaryCommandBuffer
+
+AppResult recordInParallel(App *app, uint32_t imageIndex, VkCommandBuffer *secondaryCommandBuffers, uint32_t *secondaryCommandBufferCount)
+{
+    RecordWorkers *recordWorkers = &app->recordWorkers;
+
+    pthread_mutex_lock(&recordWorkers->mutex);
+    recordWorkers->frameIndex = app->currentFrame;
+    recordWorkers->imageIndex = imageIndex;
+    recordWorkers->pendingCount = recordWorkers->workerCount;
+    recordWorkers->generation++;
+    pthread_cond_broadcast(&recordWorkers->workReady);
+    while (recordWorkers->pendingCount > 0)
+        pthread_cond_wait(&recordWorkers->workDone, &recordWorkers->mutex);
+    pthread_mutex_unlock(&recordWorkers->mutex);
+
+    // Executed in worker order, which is the order of the draw list
+    *secondaryCommandBufferCount = 0;
+    for (uint32_t i = 0; i < recordWorkers->workerCount; ++i)
+    {
+        RecordWorker *worker = &recordWorkers->workers[i];
+        if (worker->failed)
+            return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+        if (worker->recorded)
+            secondaryCommandBuffers[(*secondaryCommandBufferCount)++] = worker->commandBuffers[app->currentFrame];
+    }
+
+    return APP_SUCCESS;
+} // recordInParallel
+
+void destroyRecordWorkers(App *app)
+{
+    RecordWorkers *recordWorkers = &app->recordWorkers;
+
+    if (recordWorkers->synchronizationCreated)
+    {
+        pthread_mutex_lock(&recordWorkers->mutex);
+        recordWorkers->quit = true;
+        pthread_cond_broadcast(&recordWorkers->workReady);
+        pthread_mutex_unlock(&recordWorkers->mutex);
+    }
+
+    for (uint32_t i = 0; i < MAX_RECORD_THREADS; ++i)
+    {
+        RecordWorker *worker = &recordWorkers->workers[i];
+        if (worker->started)
+            pthread_join(worker->thread, NULL);
+
+        // Destroying the pool also frees its command buffer
+        for (uint32_t j = 0; j < MAX_FRAMES_IN_FLIGHT; ++j)
+        {
+            if (worker->commandPools[j] != VK_NULL_HANDLE)
+                vkDestroyCommandPool(app->logicalDevice, worker->commandPools[j], NULL);
+        }
+    }
+
+    if (recordWorkers->synchronizationCreated)
+    {
+        pthread_cond_destroy(&recordWorkers->workDone);
+        pthread_cond_destroy(&recordWorkers->workReady);
+        pthread_mutex_destroy(&recordWorkers->mutex);
+    }
+
+    memset(recordWorkers, 0, sizeof(RecordWorkers));
+} // destroyRecordWorkers
+
+AppResult createGpuProfiler(App *app)
+{
+    GpuProfiler *profiler = &app->gpuProfiler;
+    if (!app->config.gpuProfiler)
+        return APP_SUCCESS;
+
+    // A queue family without valid timestamp bits does not support timestamps at all
+    if (app->graphicsQueueTimestampValidBits == 0)
+    {
+        if (verbose)
+            printf("The graphics queue does not support timestamps, GPU profiler disabled\n");
+        return APP_SUCCESS;
+    }
+
+    profiler->timestampPeriodNs = (double)app->physicalDeviceProperties.limits.timestampPeriod;
+    profiler->timestampMask = app->graphicsQueueTimestampValidBits >= 64 ? UINT64_MAX : (1ULL << app->graphicsQueueTimestampValidBits) - 1;
+
+    // Two queries (begin and end) per scope for every frame in flight
+    VkQueryPoolCreateInfo queryPoolCreateInfo = {0};
+    queryPoolCreateInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    queryPoolCreateInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    queryPoolCreateInfo.queryCount = app->config.framesInFlight * MAX_GPU_PROFILER_SCOPES * 2;
+
+    VkResult vkResult = vkCreateQueryPool(app->logicalDevice, &queryPoolCreateInfo, NULL, &profiler->queryPool);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create timestamp query pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_QUERY_POOL;
+    }
+
+    profiler->enabled = true;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("GPU profiler: %u timestamp bits, %.3f ns per tick\n", app->graphicsQueueTimestampValidBits, profiler->timestampPeriodNs);
+    }
+
+    return APP_SUCCESS;
+} // createGpuProfiler
+
+void gpuProfilerCollect(App *app, uint32_t frameIndex)
+{
+    GpuProfiler *profiler = &app->gpuProfiler;
+    uint32_t pairCount = profiler->frameQueryPairCount[frameIndex];
+    if (!profiler->enabled || pairCount == 0)
+        return;
+
+    // No VK_QUERY_RESULT_WAIT_BIT, the fence of the frame guarantees the results are there
+    // and if they are not we would rather lose a sample than stall
+    uint64_t timestamps[MAX_GPU_PROFILER_SCOPES * 2];
+    VkResult vkResult = vkGetQueryPoolResults(app->logicalDevice, profiler->queryPool, frameIndex * MAX_GPU_PROFILER_SCOPES * 2, pairCount * 2,
+                                              sizeof(timestamps), timestamps, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    profiler->frameQueryPairCount[frameIndex] = 0;
+    if (vkResult != VK_SUCCESS)
+        return;
+
+    for (uint32_t i = 0; i < pairCount; ++i)
+    {
+        GpuProfilerScope *scope = &profiler->scopes[profiler->frameScopeIndices[frameIndex][i]];
+        uint64_t ticks = (timestamps[i * 2 + 1] - timestamps[i * 2]) & profiler->timestampMask;
+        scope->samplesMs[scope->nextSample] = (double)ticks * profiler->timestampPeriodNs / 1000000.0;
+        scope->nextSample = (scope->nextSample + 1) % GPU_PROFILER_HISTORY;
+        if (scope->sampleCount < GPU_PROFILER_HISTORY)
+            scope->sampleCount++;
+    }
+} // gpuProfilerCollect
+
+void gpuProfilerBeginFrame(App *app, VkCommandBuffer commandBuffer, uint32_t frameIndex)
+{
+    GpuProfiler *profiler = &app->gpuProfiler;
+    if (!profiler->enabled)
+        return;
+
+    // Queries must be reset before being written again, this has to happen outside of a
+    // render pass so it is done once for the whole slice of the frame
+    vkCmdResetQueryPool(commandBuffer, profiler->queryPool, frameIndex * MAX_GPU_PROFILER_SCOPES * 2, MAX_GPU_PROFILER_SCOPES * 2);
+    profiler->frameQueryPairCount[frameIndex] = 0;
+} // gpuProfilerBeginFrame
+
+uint32_t gpuProfilerBeginScope(App *app, VkCommandBuffer commandBuffer, const char *name)
+{
+    GpuProfiler *profiler = &app->gpuProfiler;
+    uint32_t frameIndex = app->currentFrame;
+    if (!profiler->enabled || profiler->frameQueryPairCount[frameIndex] == MAX_GPU_PROFILER_SCOPES)
+        return UINT32_MAX;
+
+    // Scopes are identified by name, there are only a handful of them so a linear search
+    // is fine
+    uint32_t scopeIndex = 0;
+    while (scopeIndex < profiler->scopeCount && strcmp(profiler->scopes[scopeIndex].name, name) != 0)
+        scopeIndex++;
+    if (scopeIndex == profiler->scopeCount)
+    {
+        if (profiler->scopeCount == MAX_GPU_PROFILER_SCOPES)
+            return UINT32_MAX;
+        profiler->scopes[profiler->scopeCount++].name = name;
+    }
+
+    uint32_t pair = profiler->frameQueryPairCount[frameIndex]++;
+    profiler->frameScopeIndices[frameIndex][pair] = scopeIndex;
+
+    uint32_t query = (frameIndex * MAX_GPU_PROFILER_SCOPES + pair) * 2;
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, profiler->queryPool, query);
+
+    return query;
+} // gpuProfilerBeginScope
+
+void gpuProfilerEndScope(App *app, VkCommandBuffer commandBuffer, uint32_t query)
+{
+    if (!app->gpuProfiler.enabled || query == UINT32_MAX)
+        return;
+
+    vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, app->gpuProfiler.queryPool, query + 1);
+} // gpuProfilerEndScope
+
+void gpuProfilerScopeStats(const GpuProfilerScope *scope, double *minMs, double *avgMs, double *p99Ms)
+{
+    *minMs = *avgMs = *p99Ms = 0.0;
+    if (scope->sampleCount == 0)
+        return;
+
+    double sorted[GPU_PROFILER_HISTORY];
+    double sum = 0.0;
+    for (uint32_t i = 0; i < scope->sampleCount; ++i)
+    {
+        sorted[i] = scope->samplesMs[i];
+        sum += sorted[i];
+    }
+    qsort(sorted, scope->sampleCount, sizeof(double), compareDoubles);
+
+    *minMs = sorted[0];
+    *avgMs = sum / (double)scope->sampleCount;
+    *p99Ms = sorted[(uint32_t)ceil(0.99 * scope->sampleCount) - 1];
+} // gpuProfilerScopeStats
+
+void printGpuProfilerStats(const App *app)
+{
+    const GpuProfiler *profiler = &app->gpuProfiler;
+    if (!profiler->enabled || profiler->scopeCount == 0)
+        return;
+
+    printf("=========================================\n");
+    printf("GPU timings over the last %u frames:\n", GPU_PROFILER_HISTORY);
+    for (uint32_t i = 0; i < profiler->scopeCount; ++i)
+    {
+        double minMs, avgMs, p99Ms;
+        gpuProfilerScopeStats(&profiler->scopes[i], &minMs, &avgMs, &p99Ms);
+        printf("\t%-16s min %.3f ms, avg %.3f ms, p99 %.3f ms\n", profiler->scopes[i].name, minMs, avgMs, p99Ms);
+    }
+} // printGpuProfilerStats
+
+int compareDoubles(const void *a, const void *b)
+{
+    double left = *(const double *)a;
+    double right = *(const double *)b;
+    return (left > right) - (left < right);
+} // compareDoubles
+
+int compareStrings(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+} // compareStrings
+
+void telemetryRecord(Telemetry *telemetry, const double valuesMs[TELEMETRY_METRIC_COUNT])
+{
+    for (uint32_t metric = 0; metric < TELEMETRY_METRIC_COUNT; ++metric)
+    {
+        double valueMs = valuesMs[metric];
+        telemetry->ringMs[telemetry->ringNext][metric] = valueMs;
+
+        // Values below the first bucket land in it and values above the last one in the last
+        TelemetryHistogram *histogram = &telemetry->histograms[metric];
+        double position = valueMs > TELEMETRY_HISTOGRAM_MIN_MS ? log10(valueMs / TELEMETRY_HISTOGRAM_MIN_MS) * TELEMETRY_BUCKETS_PER_DECADE : 0.0;
+        uint32_t bucket = position < TELEMETRY_HISTOGRAM_BUCKETS - 1 ? (uint32_t)position : TELEMETRY_HISTOGRAM_BUCKETS - 1;
+        histogram->buckets[bucket]++;
+        histogram->count++;
+        histogram->sumMs += valueMs;
+        if (valueMs > histogram->maxMs)
+            histogram->maxMs = valueMs;
+    }
+
+    telemetry->ringNext = (telemetry->ringNext + 1) % TELEMETRY_RING_SIZE;
+    if (telemetry->ringCount < TELEMETRY_RING_SIZE)
+        telemetry->ringCount++;
+} // telemetryRecord
+
+double telemetryBucketUpperBoundMs(uint32_t bucket)
+{
+    return TELEMETRY_HISTOGRAM_MIN_MS * pow(10.0, (double)(bucket + 1) / TELEMETRY_BUCKETS_PER_DECADE);
+} // telemetryBucketUpperBoundMs
+
+double telemetryPercentile(const TelemetryHistogram *histogram, double percentile)
+{
+    if (histogram->count == 0)
+        return 0.0;
+
+    // The upper bound of the bucket holding the percentile, which overestimates it by less
+    // than the width of a bucket (~12%), capped by the exact maximum
+    uint64_t target = (uint64_t)ceil(percentile * (double)histogram->count);
+    uint64_t cumulated = 0;
+    for (uint32_t bucket = 0; bucket < TELEMETRY_HISTOGRAM_BUCKETS; ++bucket)
+    {
+        cumulated += histogram->buckets[bucket];
+        if (cumulated >= target)
+            return fmin(telemetryBucketUpperBoundMs(bucket), histogram->maxMs);
+    }
+
+    return histogram->maxMs;
+} // telemetryPercentile
+
+AppResult dumpTelemetry(const App *app)
+{
+    const char *path = app->config.telemetryPath;
+    FILE *file = path != NULL ? fopen(path, "w") : stdout;
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open %s to write the telemetry\n", path);
+        return APP_ERROR_WRITE_TELEMETRY;
+    }
+
+    if (app->config.telemetryJson)
+        writeTelemetryJson(&app->telemetry, file);
+    else
+        writeTelemetryCsv(&app->telemetry, file);
+
+    if (path == NULL)
+    {
+        fflush(file);
+        return APP_SUCCESS;
+    }
+
+    if (fclose(file) != 0)
+    {
+        fprintf(stderr, "Failed to write the telemetry to %s\n", path);
+        return APP_ERROR_WRITE_TELEMETRY;
+    }
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Telemetry written to %s\n", path);
+    }
+
+    return APP_SUCCESS;
+} // dumpTelemetry
+
+void writeTelemetryCsv(const Telemetry *telemetry, FILE *file)
+{
+    // Long format so that the summary, the histograms and the raw samples fit in one table
+    fprintf(file, "metric,kind,key,value\n");
+    for (uint32_t metric = 0; metric < TELEMETRY_METRIC_COUNT; ++metric)
+    {
+        const TelemetryHistogram *histogram = &telemetry->histograms[metric];
+        const char *name = telemetryMetricNames[metric];
+        double meanMs = histogram->count > 0 ? histogram->sumMs / (double)histogram->count : 0.0;
+
+        fprintf(file, "%s,summary,count,%llu\n", name, (unsigned long long)histogram->count);
+        fprintf(file, "%s,summary,mean,%.6f\n", name, meanMs);
+        fprintf(file, "%s,summary,p50,%.6f\n", name, telemetryPercentile(histogram, 0.50));
+        fprintf(file, "%s,summary,p95,%.6f\n", name, telemetryPercentile(histogram, 0.95));
+        fprintf(file, "%s,summary,p99,%.6f\n", name, telemetryPercentile(histogram, 0.99));
+        fprintf(file, "%s,summary,max,%.6f\n", name, histogram->maxMs);
+
+        for (uint32_t bucket = 0; bucket < TELEMETRY_HISTOGRAM_BUCKETS; ++bucket)
+        {
+            if (histogram->buckets[bucket] > 0)
+                fprintf(file, "%s,histogram,%.6f,%llu\n", name, telemetryBucketUpperBoundMs(bucket), (unsigned long long)histogram->buckets[bucket]);
+        }
+
+        // The ring is written from the oldest to the most recent frame
+        uint32_t first = (telemetry->ringNext + TELEMETRY_RING_SIZE - telemetry->ringCount) % TELEMETRY_RING_SIZE;
+        for (uint32_t i = 0; i < telemetry->ringCount; ++i)
+        {
+            fprintf(file, "%s,sample,%u,%.6f\n", name, i, telemetry->ringMs[(first + i) % TELEMETRY_RING_SIZE][metric]);
+        }
+    }
+} // writeTelemetryCsv
+
+void writeTelemetryJson(const Telemetry *telemetry, FILE *file)
+{
+    fprintf(file, "{\n  \"metrics\": {\n");
+    for (uint32_t metric = 0; metric < TELEMETRY_METRIC_COUNT; ++metric)
+    {
+        const TelemetryHistogram *histogram = &telemetry->histograms[metric];
+        double meanMs = histogram->count > 0 ? histogram->sumMs / (double)histogram->count : 0.0;
+
+        fprintf(file, "    \"%s\": {\n", telemetryMetricNames[metric]);
+        fprintf(file, "      \"count\": %llu,\n", (unsigned long long)histogram->count);
+        fprintf(file, "      \"mean\": %.6f,\n", meanMs);
+        fprintf(file, "      \"p50\": %.6f,\n", telemetryPercentile(histogram, 0.50));
+        fprintf(file, "      \"p95\": %.6f,\n", telemetryPercentile(histogram, 0.95));
+        fprintf(file, "      \"p99\": %.6f,\n", telemetryPercentile(histogram, 0.99));
+        fprintf(file, "      \"max\": %.6f,\n", histogram->maxMs);
+
+        // Only the non empty buckets, as [upper bound in ms, count] pairs
+        fprintf(file, "      \"histogram\": [");
+        bool first = true;
+        for (uint32_t bucket = 0; bucket < TELEMETRY_HISTOGRAM_BUCKETS; ++bucket)
+        {
+            if (histogram->buckets[bucket] == 0)
+                continue;
+            fprintf(file, "%s[%.6f, %llu]", first ? "" : ", ", telemetryBucketUpperBoundMs(bucket), (unsigned long long)histogram->buckets[bucket]);
+            first = false;
+        }
+        fprintf(file, "],\n");
+
+        fprintf(file, "      \"recent\": [");
+        uint32_t firstSample = (telemetry->ringNext + TELEMETRY_RING_SIZE - telemetry->ringCount) % TELEMETRY_RING_SIZE;
+        for (uint32_t i = 0; i < telemetry->ringCount; ++i)
+        {
+            fprintf(file, "%s%.6f", i == 0 ? "" : ", ", telemetry->ringMs[(firstSample + i) % TELEMETRY_RING_SIZE][metric]);
+        }
+        fprintf(file, "]\n");
+
+        fprintf(file, "    }%s\n", metric + 1 < TELEMETRY_METRIC_COUNT ? "," : "");
+    }
+    fprintf(file, "  }\n}\n");
+} // writeTelemetryJson
+
+void telemetrySignalHandler(int signalNumber)
+{
+    (void)signalNumber;
+    telemetryDumpRequested = 1;
+} // telemetrySignalHandler
+
+AppResult createFrameCapture(App *app)
+{
+    FrameCapture *capture = &app->frameCapture;
+    if (app->config.captureMode == CAPTURE_MODE_NONE)
+        return APP_SUCCESS;
+
+    // The golden images are RGBA with 8 bits per channel, the swap chain has to be stored the
+    // same way up to the order of red and blue
+    if (!swapChainFormatIsRgba8(app->selectedDeviceSurfaceFormat.format, &capture->swapRedBlue))
+    {
+        fprintf(stderr, "Failed to set up the frame capture: swap chain format %u is not 8 bit RGBA or BGRA\n", app->selectedDeviceSurfaceFormat.format);
+        return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
+    }
+
+    if (app->config.captureMode == CAPTURE_MODE_WRITE_GOLDEN && mkdir(app->config.goldenDirectory, 0755) != 0 && errno != EEXIST)
+    {
+        fprintf(stderr, "Failed to create the golden image directory %s\n", app->config.goldenDirectory);
+        return APP_ERROR_WRITE_GOLDEN_IMAGE;
+    }
+
+    // The readback buffers themselves are created by frameCaptureCollect, which also resizes
+    // them with the swap chain
+    capture->memoryProperties = readbackMemoryProperties(&app->memoryAllocator);
+    capture->stats.minPsnrDb = INFINITY;
+    capture->enabled = true;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Frame capture: every %u frames %s %s, readback memory 0x%x\n", app->config.captureInterval,
+               app->config.captureMode == CAPTURE_MODE_WRITE_GOLDEN ? "written to" : "compared with", app->config.goldenDirectory,
+               capture->memoryProperties);
+    }
+
+    return APP_SUCCESS;
+} // createFrameCapture
+
+AppResult frameCaptureCollect(App *app, uint32_t frameIndex)
+{
+    FrameCapture *capture = &app->frameCapture;
+    if (!capture->enabled)
+        return APP_SUCCESS;
+
+    // The copy recorded framesInFlight frames ago is complete, a job takes it and the slot
+    // switches to its other buffer
+    FrameCaptureReadback *readback = &capture->readbacks[frameIndex][capture->currentReadbacks[frameIndex]];
+    if (readback->pending)
+    {
+        AppResult appResult = submitFrameCaptureJob(app, readback);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+        capture->currentReadbacks[frameIndex] ^= 1;
+        readback = &capture->readbacks[frameIndex][capture->currentReadbacks[frameIndex]];
+    }
+
+    // Its job was submitted framesInFlight frames ago and is normally done by now
+    AppResult appResult = finishFrameCaptureJob(app, readback);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The buffer is free until the next copy is recorded into it, which is the only time it can
+    // be replaced when the swap chain grew
+    VkDeviceSize size = (VkDeviceSize)app->swapChainExtent.width * app->swapChainExtent.height * 4;
+    if (readback->size >= size)
+        return APP_SUCCESS;
+
+    destroyBuffer(app, &readback->buffer, &readback->allocation);
+    readback->size = 0;
+
+    appResult = createBuffer(app, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, capture->memoryProperties, &readback->buffer, &readback->allocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    readback->size = size;
+
+    return APP_SUCCESS;
+} // frameCaptureCollect
+
+AppResult submitFrameCaptureJob(App *app, FrameCaptureReadback *readback)
+{
+    readback->pending = false;
+    readback->processing = true;
+    snprintf(readback->path, sizeof(readback->path), "%s/frame_%06llu.pam", app->config.goldenDirectory, (unsigned long long)readback->frameNumber);
+    readback->writeGolden = app->config.captureMode == CAPTURE_MODE_WRITE_GOLDEN;
+    readback->swapRedBlue = app->frameCapture.swapRedBlue;
+    readback->tolerance = (uint8_t)app->config.goldenTolerance;
+    memset(&readback->result, 0, sizeof(FrameCaptureResult));
+
+    return submitJob(&app->jobPool, &readback->job, processFrameCapture, readback);
+} // submitFrameCaptureJob
+
+AppResult processFrameCapture(void *argument)
+{
+    // Runs on the job pool, only reads the readback and only writes its result
+    FrameCaptureReadback *readback = argument;
+    FrameCaptureResult *result = &readback->result;
+    double processStartMs = getTimeMs();
+    const uint8_t *pixels = readback->allocation.mapped;
+
+    if (readback->writeGolden)
+    {
+        AppResult appResult = writeGoldenImage(readback->path, pixels, readback->extent, readback->swapRedBlue);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+    else
+        result->comparison = compareWithGoldenImage(readback->path, pixels, readback->extent, readback->swapRedBlue, readback->tolerance, &result->diff);
+
+    result->processMs = getTimeMs() - processStartMs;
+    return APP_SUCCESS;
+} // processFrameCapture
+
+AppResult finishFrameCaptureJob(App *app, FrameCaptureReadback *readback)
+{
+    if (!readback->processing)
+        return APP_SUCCESS;
+
+    AppResult appResult = waitForJob(&app->jobPool, &readback->job);
+    readback->processing = false;
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The jobs do not finish in frame order, the first frames are the smallest numbers
+    FrameCaptureStats *stats = &app->frameCapture.stats;
+    const FrameCaptureResult *result = &readback->result;
+    uint64_t frameNumber = readback->frameNumber;
+    if (!readback->writeGolden)
+    {
+        if (result->comparison == GOLDEN_MISSING)
+        {
+            if (stats->missingCount++ == 0 || frameNumber < stats->firstMissingFrame)
+                stats->firstMissingFrame = frameNumber;
+            if (verbose)
+                printf("Frame %llu: no usable golden image %s\n", (unsigned long long)frameNumber, readback->path);
+        }
+        else
+        {
+            double psnrDb = imagePsnrDb(&result->diff, (size_t)readback->extent.width * readback->extent.height);
+            if (result->diff.squaredErrorSum == 0)
+                stats->identicalCount++;
+            else
+                stats->totalPsnrDb += psnrDb;
+            if (psnrDb < stats->minPsnrDb)
+                stats->minPsnrDb = psnrDb;
+            if (result->diff.maxChannelDiff > stats->maxChannelDiff)
+                stats->maxChannelDiff = result->diff.maxChannelDiff;
+
+            if (result->comparison == GOLDEN_MISMATCH)
+            {
+                if (stats->mismatchCount++ == 0 || frameNumber < stats->firstMismatchFrame)
+                    stats->firstMismatchFrame = frameNumber;
+                if (verbose)
+                    printf("Frame %llu: %llu channels off by more than %u (max %u), PSNR %.2f dB\n", (unsigned long long)frameNumber,
+                           (unsigned long long)result->diff.exceedingChannelCount, readback->tolerance, result->diff.maxChannelDiff, psnrDb);
+            }
+        }
+    }
+
+    stats->captureCount++;
+    stats->totalProcessMs += result->processMs;
+    if (result->processMs > stats->maxProcessMs)
+        stats->maxProcessMs = result->processMs;
+
+    return APP_SUCCESS;
+} // finishFrameCaptureJob
+
+AppResult flushFrameCaptures(App *app)
+{
+    FrameCapture *capture = &app->frameCapture;
+    if (!capture->enabled)
+        return APP_SUCCESS;
+
+    AppResult appResult = waitForAllFrames(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The copies of the last frames go to jobs too, then every job is waited for
+    for (uint32_t i = 0; i < app->config.framesInFlight; ++i)
+    {
+        for (uint32_t j = 0; j < 2; ++j)
+        {
+            FrameCaptureReadback *readback = &capture->readbacks[i][j];
+            if (readback->pending)
+            {
+                appResult = submitFrameCaptureJob(app, readback);
+                if (appResult != APP_SUCCESS)
+                    return appResult;
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < app->config.framesInFlight; ++i)
+    {
+        for (uint32_t j = 0; j < 2; ++j)
+        {
+            appResult = finishFrameCaptureJob(app, &capture->readbacks[i][j]);
+            if (appResult != APP_SUCCESS)
+                return appResult;
+        }
+    }
+
+    return APP_SUCCESS;
+} // flushFrameCaptures
+
+bool frameCaptureAcquireBuffer(App *app, VkBuffer *buffer)
+{
+    FrameCapture *capture = &app->frameCapture;
+    uint64_t frameNumber = app->frameStats.frameCount;
+    uint32_t frameIndex = app->currentFrame;
+    if (!capture->enabled || frameNumber % app->config.captureInterval != 0)
+        return false;
+
+    // frameCaptureCollect made sure no job reads this one anymore
+    FrameCaptureReadback *readback = &capture->readbacks[frameIndex][capture->currentReadbacks[frameIndex]];
+    readback->pending = true;
+    readback->frameNumber = frameNumber;
+    readback->extent = app->swapChainExtent;
+    *buffer = readback->buffer;
+    return true;
+} // frameCaptureAcquireBuffer
+
+void recordSwapChainReadback(App *app, VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+    // The frame capture and the frame stream each get their own copy of the image
+    VkBuffer buffers[2];
+    uint32_t bufferCount = 0;
+    if (frameCaptureAcquireBuffer(app, &buffers[bufferCount]))
+        bufferCount++;
+    if (frameStreamAcquireBuffer(app, &buffers[bufferCount]))
+        bufferCount++;
+    if (bufferCount == 0)
+        return;
+
+    uint32_t readbackScope = gpuProfilerBeginScope(app, commandBuffer, "readback");
+
+    // The render pass left the image ready to be presented, it has to be a transfer source for
+    // the duration of the copies
+    VkImageMemoryBarrier imageBarrier = {0};
+    imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    imageBarrier.srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+    imageBarrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    imageBarrier.image = app->swapChainImages[imageIndex];
+    imageBarrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageBarrier.subresourceRange.baseMipLevel = 0;
+    imageBarrier.subresourceRange.levelCount = 1;
+    imageBarrier.subresourceRange.baseArrayLayer = 0;
+    imageBarrier.subresourceRange.layerCount = 1;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &imageBarrier);
+
+    // Tightly packed rows, which is what the golden images, the stream and the comparator expect
+    VkBufferImageCopy region = {0};
+    region.bufferOffset = 0;
+    region.bufferRowLength = 0;
+    region.bufferImageHeight = 0;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.mipLevel = 0;
+    region.imageSubresource.baseArrayLayer = 0;
+    region.imageSubresource.layerCount = 1;
+    region.imageOffset = (VkOffset3D){0, 0, 0};
+    region.imageExtent = (VkExtent3D){app->swapChainExtent.width, app->swapChainExtent.height, 1};
+
+    VkBufferMemoryBarrier bufferBarriers[2];
+    for (uint32_t i = 0; i < bufferCount; ++i)
+    {
+        vkCmdCopyImageToBuffer(commandBuffer, imageBarrier.image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffers[i], 1, &region);
+
+        bufferBarriers[i] = (VkBufferMemoryBarrier){0};
+        bufferBarriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        bufferBarriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        bufferBarriers[i].dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        bufferBarriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        bufferBarriers[i].buffer = buffers[i];
+        bufferBarriers[i].offset = 0;
+        bufferBarriers[i].size = VK_WHOLE_SIZE;
+    }
+
+    // Back to the presentation layout, and the copies made visible to the host once the fence
+    // of the frame signals. Reading the image needs no availability operation before the
+    // presentation engine gets it
+    imageBarrier.srcAccessMask = 0;
+    imageBarrier.dstAccessMask = 0;
+    imageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+    imageBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT | VK_PIPELINE_STAGE_HOST_BIT, 0, 0, NULL, bufferCount,
+                         bufferBarriers, 1, &imageBarrier);
+
+    gpuProfilerEndScope(app, commandBuffer, readbackScope);
+} // recordSwapChainReadback
+
+bool swapChainFormatIsRgba8(VkFormat format, bool *swapRedBlue)
+{
+    switch (format)
+    {
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_R8G8B8A8_SRGB:
+        *swapRedBlue = false;
+        return true;
+    case VK_FORMAT_B8G8R8A8_UNORM:
+    case VK_FORMAT_B8G8R8A8_SRGB:
+        *swapRedBlue = true;
+        return true;
+    default:
+        return false;
+    }
+} // swapChainFormatIsRgba8
+
+AppResult writeGoldenImage(const char *path, const uint8_t *pixels, VkExtent2D extent, bool swapRedBlue)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open %s to write the golden image\n", path);
+        return APP_ERROR_WRITE_GOLDEN_IMAGE;
+    }
+
+    // PAM is the RGBA flavour of the netpbm formats, a short text header followed by the raw
+    // pixels, which lets the comparison map the file and read them in place
+    fprintf(file, "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", extent.width, extent.height);
+
+    // VLA is ok here for simplicity
+    size_t rowSize = (size_t)extent.width * 4;
+    uint8_t swappedRow[rowSize];
+    bool written = true;
+    for (uint32_t y = 0; y < extent.height && written; ++y)
+    {
+        const uint8_t *row = pixels + y * rowSize;
+        if (swapRedBlue)
+        {
+            for (size_t x = 0; x < rowSize; x += 4)
+            {
+                swappedRow[x + 0] = row[x + 2];
+                swappedRow[x + 1] = row[x + 1];
+                swappedRow[x + 2] = row[x + 0];
+                swappedRow[x + 3] = row[x + 3];
+            }
+            row = swappedRow;
+        }
+        written = fwrite(row, 1, rowSize, file) == rowSize;
+    }
+
+    if (fclose(file) != 0 || !written)
+    {
+        fprintf(stderr, "Failed to write the golden image %s\n", path);
+        return APP_ERROR_WRITE_GOLDEN_IMAGE;
+    }
+
+    return APP_SUCCESS;
+} // writeGoldenImage
+
+GoldenComparison compareWithGoldenImage(const char *path, const uint8_t *pixels, VkExtent2D extent, bool swapRedBlue, uint8_t tolerance, ImageDiff *diff)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return GOLDEN_MISSING;
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+    {
+        close(fd);
+        return GOLDEN_MISSING;
+    }
+    size_t fileSize = (size_t)fileStat.st_size;
+
+    // The golden image is compared straight from the page cache, without copying it first
+    const uint8_t *file = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+        return GOLDEN_MISSING;
+
+    // The header is parsed from a NUL terminated copy since the mapping is not terminated
+    char header[256];
+    size_t headerCopySize = fileSize < sizeof(header) - 1 ? fileSize : sizeof(header) - 1;
+    memcpy(header, file, headerCopySize);
+    header[headerCopySize] = '\0';
+
+    uint32_t width = 0, height = 0, depth = 0, maxValue = 0;
+    const char *headerEnd = strstr(header, "ENDHDR\n");
+    size_t pixelCount = (size_t)extent.width * extent.height;
+    GoldenComparison comparison = GOLDEN_MISSING;
+    if (headerEnd != NULL && sscanf(header, "P7 WIDTH %u HEIGHT %u DEPTH %u MAXVAL %u", &width, &height, &depth, &maxValue) == 4 &&
+        width == extent.width && height == extent.height && depth == 4 && maxValue == 255)
+    {
+        size_t dataOffset = (size_t)(headerEnd - header) + strlen("ENDHDR\n");
+        if (fileSize >= dataOffset + pixelCount * 4)
+        {
+            compareImages(pixels, file + dataOffset, pixelCount, swapRedBlue, tolerance, diff);
+            comparison = diff->exceedingChannelCount > 0 ? GOLDEN_MISMATCH : GOLDEN_MATCH;
+        }
+    }
+
+    munmap((void *)file, fileSize);
+    return comparison;
+} // compareWithGoldenImage
+
+void compareImages(const uint8_t *captured, const uint8_t *golden, size_t pixelCount, bool swapRedBlue, uint8_t tolerance, ImageDiff *diff)
+{
+    uint64_t squaredErrorSum = 0;
+    uint64_t exceedingChannelCount = 0;
+    uint32_t maxChannelDiff = 0;
+    size_t pixel = 0;
+
+#if defined(__SSE2__)
+    // 4 pixels per iteration, the alpha channel is masked out of the differences. The squared
+    // errors are summed in 32 bit lanes, which take up to 2 * 2 * 255^2 per iteration, so they
+    // are widened every 4096 iterations before they can overflow
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i colorMask = _mm_set1_epi32(0x00ffffff);
+    const __m128i greenAlphaMask = _mm_set1_epi32((int)0xff00ff00);
+    const __m128i lowByteMask = _mm_set1_epi32(0x000000ff);
+    const __m128i thirdByteMask = _mm_set1_epi32(0x00ff0000);
+    const __m128i toleranceVector = _mm_set1_epi8((char)tolerance);
+    __m128i maxVector = zero;
+    while (pixel + 4 <= pixelCount)
+    {
+        size_t blockEnd = pixel + 4 * 4096 < pixelCount ? pixel + 4 * 4096 : pixelCount;
+        __m128i squaredSums = zero;
+        for (; pixel + 4 <= blockEnd; pixel += 4)
+        {
+            __m128i capturedVector = _mm_loadu_si128((const __m128i *)(captured + pixel * 4));
+            __m128i goldenVector = _mm_loadu_si128((const __m128i *)(golden + pixel * 4));
+            if (swapRedBlue)
+            {
+                // Bytes 0 and 2 of every pixel trade places, SSE2 has no byte shuffle
+                goldenVector = _mm_or_si128(_mm_and_si128(goldenVector, greenAlphaMask),
+                                            _mm_or_si128(_mm_and_si128(_mm_srli_epi32(goldenVector, 16), lowByteMask),
+                                                         _mm_and_si128(_mm_slli_epi32(goldenVector, 16), thirdByteMask)));
+            }
+
+            __m128i difference = _mm_or_si128(_mm_subs_epu8(capturedVector, goldenVector), _mm_subs_epu8(goldenVector, capturedVector));
+            difference = _mm_and_si128(difference, colorMask);
+            maxVector = _mm_max_epu8(maxVector, difference);
+
+            // A channel is within the tolerance when subtracting it saturates to zero
+            int withinMask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_subs_epu8(difference, toleranceVector), zero));
+            exceedingChannelCount += (uint64_t)(16 - __builtin_popcount((unsigned int)withinMask));
+
+            __m128i differenceLow = _mm_unpacklo_epi8(difference, zero);
+            __m128i differenceHigh = _mm_unpackhi_epi8(difference, zero);
+            squaredSums = _mm_add_epi32(squaredSums, _mm_add_epi32(_mm_madd_epi16(differenceLow, differenceLow), _mm_madd_epi16(differenceHigh, differenceHigh)));
+        }
+
+        uint32_t lanes[4];
+        _mm_storeu_si128((__m128i *)lanes, squaredSums);
+        squaredErrorSum += (uint64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+
+    uint8_t maxLanes[16];
+    _mm_storeu_si128((__m128i *)maxLanes, maxVector);
+    for (uint32_t i = 0; i < 16; ++i)
+    {
+        if (maxLanes[i] > maxChannelDiff)
+            maxChannelDiff = maxLanes[i];
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    // 4 pixels per iteration, the alpha channel is masked out of the differences and the
+    // squared errors are widened to 64 bits every iteration
+    static const uint8_t redBlueSwap[16] = {2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15};
+    const uint8x16_t swapIndices = vld1q_u8(redBlueSwap);
+    const uint8x16_t colorMask = vreinterpretq_u8_u32(vdupq_n_u32(0x00ffffff));
+    const uint8x16_t toleranceVector = vdupq_n_u8(tolerance);
+    uint8x16_t maxVector = vdupq_n_u8(0);
+    uint64x2_t squaredSums = vdupq_n_u64(0);
+    for (; pixel + 4 <= pixelCount; pixel += 4)
+    {
+        uint8x16_t capturedVector = vld1q_u8(captured + pixel * 4);
+        uint8x16_t goldenVector = vld1q_u8(golden + pixel * 4);
+        if (swapRedBlue)
+            goldenVector = vqtbl1q_u8(goldenVector, swapIndices);
+
+        uint8x16_t difference = vandq_u8(vabdq_u8(capturedVector, goldenVector), colorMask);
+        maxVector = vmaxq_u8(maxVector, difference);
+        exceedingChannelCount += vaddlvq_u8(vshrq_n_u8(vcgtq_u8(difference, toleranceVector), 7));
+
+        uint16x8_t squaresLow = vmull_u8(vget_low_u8(difference), vget_low_u8(difference));
+        uint16x8_t squaresHigh = vmull_high_u8(difference, difference);
+        squaredSums = vpadalq_u32(squaredSums, vaddq_u32(vpaddlq_u16(squaresLow), vpaddlq_u16(squaresHigh)));
+    }
+    squaredErrorSum += vaddvq_u64(squaredSums);
+    maxChannelDiff = vmaxvq_u8(maxVector);
+#endif
+
+    // The pixels left over by the vector loop, or all of them without SIMD
+    for (; pixel < pixelCount; ++pixel)
+    {
+        const uint8_t *capturedPixel = captured + pixel * 4;
+        const uint8_t *goldenPixel = golden + pixel * 4;
+        for (uint32_t channel = 0; channel < 3; ++channel)
+        {
+            uint32_t goldenChannel = swapRedBlue ? 2 - channel : channel;
+            uint32_t difference = (uint32_t)abs((int)capturedPixel[channel] - (int)goldenPixel[goldenChannel]);
+            squaredErrorSum += difference * difference;
+            if (difference > tolerance)
+                exceedingChannelCount++;
+            if (difference > maxChannelDiff)
+                maxChannelDiff = difference;
+        }
+    }
+
+    diff->squaredErrorSum = squaredErrorSum;
+    diff->exceedingChannelCount = exceedingChannelCount;
+    diff->maxChannelDiff = maxChannelDiff;
+} // compareImages
+
+double imagePsnrDb(const ImageDiff *diff, size_t pixelCount)
+{
+    if (diff->squaredErrorSum == 0 || pixelCount == 0)
+        return INFINITY;
+
+    double meanSquaredError = (double)diff->squaredErrorSum / ((double)pixelCount * 3.0);
+    return 10.0 * log10(255.0 * 255.0 / meanSquaredError);
+} // imagePsnrDb
+
+void printFrameCaptureStats(const App *app)
+{
+    const FrameCapture *capture = &app->frameCapture;
+    const FrameCaptureStats *stats = &capture->stats;
+    if (!capture->enabled || stats->captureCount == 0)
+        return;
+
+    printf("=========================================\n");
+    if (app->config.captureMode == CAPTURE_MODE_WRITE_GOLDEN)
+    {
+        printf("Frame capture: %llu golden images written to %s\n", (unsigned long long)stats->captureCount, app->config.goldenDirectory);
+    }
+    else
+    {
+        uint64_t comparedCount = stats->captureCount - stats->missingCount;
+        uint64_t differentCount = comparedCount - stats->identicalCount;
+        printf("Frame capture: %llu frames compared with %s (tolerance %u)\n", (unsigned long long)comparedCount, app->config.goldenDirectory,
+               app->config.goldenTolerance);
+        printf("\t%llu identical, %llu within the tolerance, %llu mismatched\n", (unsigned long long)stats->identicalCount,
+               (unsigned long long)(differentCount - stats->mismatchCount), (unsigned long long)stats->mismatchCount);
+        if (differentCount > 0)
+            printf("\tmax channel difference %u, PSNR min %.2f dB, average %.2f dB over the frames that differ\n", stats->maxChannelDiff,
+                   stats->minPsnrDb, stats->totalPsnrDb / (double)differentCount);
+        if (stats->mismatchCount > 0)
+            printf("\tfirst mismatch at frame %llu\n", (unsigned long long)stats->firstMismatchFrame);
+        if (stats->missingCount > 0)
+            printf("\t%llu frames without a usable golden image, the first one is frame %llu\n", (unsigned long long)stats->missingCount,
+                   (unsigned long long)stats->firstMissingFrame);
+    }
+    printf("\tJob pool time per capture: average %.3f ms, max %.3f ms (%s readback memory)\n", stats->totalProcessMs / (double)stats->captureCount,
+           stats->maxProcessMs, (capture->memoryProperties & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? "cached" : "uncached");
+} // printFrameCaptureStats
+
+void destroyFrameCapture(App *app)
+{
+    // The job pool is gone already, no job reads the buffers anymore
+    FrameCapture *capture = &app->frameCapture;
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    {
+        for (uint32_t j = 0; j < 2; ++j)
+        {
+            FrameCaptureReadback *readback = &capture->readbacks[i][j];
+            if (readback->buffer != VK_NULL_HANDLE)
+                destroyBuffer(app, &readback->buffer, &readback->allocation);
+            readback->size = 0;
+        }
+    }
+} // destroyFrameCapture
+
+AppResult openFrameStream(App *app)
+{
+    FrameStream *stream = &app->frameStream;
+    const char *path = app->config.streamPath;
+    if (path == NULL)
+        return APP_SUCCESS;
+
+    // A reader going away has to fail the write instead of killing the process
+    signal(SIGPIPE, SIG_IGN);
+
+    if (strcmp(path, "-") == 0)
+    {
+        // The stream keeps the real stdout to itself and everything printed goes to stderr
+        // instead, including what is still sitting in the stdout buffer
+        stream->fd = dup(STDOUT_FILENO);
+        if (stream->fd < 0 || dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+        {
+            fprintf(stderr, "Failed to redirect stdout to stream the frames to it\n");
+            if (stream->fd >= 0)
+                close(stream->fd);
+            return APP_ERROR_OPEN_FRAME_STREAM;
+        }
+    }
+    else
+    {
+        // Opening a named pipe blocks until its reader opens it too
+        stream->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (stream->fd < 0)
+        {
+            fprintf(stderr, "Failed to open %s to stream the frames to it\n", path);
+            return APP_ERROR_OPEN_FRAME_STREAM;
+        }
+    }
+    stream->outputOpen = true;
+
+    return APP_SUCCESS;
+} // openFrameStream
+
+AppResult createFrameStream(App *app)
+{
+    FrameStream *stream = &app->frameStream;
+    if (!stream->outputOpen)
+        return APP_SUCCESS;
+
+    if (!swapChainFormatIsRgba8(app->selectedDeviceSurfaceFormat.format, &stream->swapRedBlue))
+    {
+        fprintf(stderr, "Failed to set up the frame stream: swap chain format %u is not 8 bit RGBA or BGRA\n", app->selectedDeviceSurfaceFormat.format);
+        return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
+    }
+
+    // The conversion output of a y4m frame is smaller than the RGBA frame, the same scratch
+    // buffer fits both formats
+    stream->extent = app->swapChainExtent;
+    VkDeviceSize frameSize = (VkDeviceSize)stream->extent.width * stream->extent.height * 4;
+    stream->scratch = malloc((size_t)frameSize);
+    if (stream->scratch == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for the frame stream\n");
+        return APP_ERROR_ALLOC_FRAME_STREAM;
+    }
+
+    // Every frame in flight can hold a buffer for its copy while FRAME_STREAM_QUEUE_DEPTH more
+    // wait for the writer, with a 1080p stream that is about 100 MB of host memory
+    VkMemoryPropertyFlags memoryProperties = readbackMemoryProperties(&app->memoryAllocator);
+    stream->bufferCount = app->config.framesInFlight + FRAME_STREAM_QUEUE_DEPTH;
+    for (uint32_t i = 0; i < stream->bufferCount; ++i)
+    {
+        AppResult appResult = createBuffer(app, frameSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT, memoryProperties, &stream->buffers[i], &stream->allocations[i]);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+        stream->freeBuffers[i] = i;
+    }
+    stream->freeCount = stream->bufferCount;
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    {
+        stream->frameBuffers[i] = -1;
+    }
+
+    // The y4m header describes every frame that follows, a PAM stream has one per frame
+    if (app->config.streamFormat == STREAM_FORMAT_Y4M)
+    {
+        char header[128];
+        int headerSize = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg\n", stream->extent.width, stream->extent.height,
+                                  app->config.streamFps);
+        if (!writeToFd(stream->fd, header, (size_t)headerSize))
+        {
+            fprintf(stderr, "Failed to write the frame stream header\n");
+            return APP_ERROR_WRITE_FRAME_STREAM;
+        }
+    }
+
+    if (pthread_mutex_init(&stream->mutex, NULL) != 0 || pthread_cond_init(&stream->workReady, NULL) != 0)
+    {
+        fprintf(stderr, "Failed to create the frame stream synchronization objects\n");
+        return APP_ERROR_CREATE_THREAD;
+    }
+    stream->synchronizationCreated = true;
+
+    if (pthread_create(&stream->thread, NULL, frameStreamWriterMain, app) != 0)
+    {
+        fprintf(stderr, "Failed to create the frame stream writer thread\n");
+        return APP_ERROR_CREATE_THREAD;
+    }
+    stream->threadStarted = true;
+    stream->enabled = true;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Streaming %ux%u %s frames to %s through %u readback buffers (%s memory)\n", stream->extent.width, stream->extent.height,
+               app->config.streamFormat == STREAM_FORMAT_Y4M ? "y4m" : "PAM", app->config.streamPath, stream->bufferCount,
+               (memoryProperties & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) ? "cached" : "uncached");
+    }
+
+    return APP_SUCCESS;
+} // createFrameStream
+
+void *frameStreamWriterMain(void *argument)
+{
+    App *app = argument;
+    FrameStream *stream = &app->frameStream;
+    StreamFormat format = app->config.streamFormat;
+
+    pthread_mutex_lock(&stream->mutex);
+    for (;;)
+    {
+        while (!stream->quit && stream->queueCount == 0)
+            pthread_cond_wait(&stream->workReady, &stream->mutex);
+        if (stream->queueCount == 0)
+            break;
+
+        uint32_t bufferIndex = stream->queue[stream->queueHead];
+        stream->queueHead = (stream->queueHead + 1) % FRAME_STREAM_MAX_BUFFERS;
+        stream->queueCount--;
+        bool failed = stream->failed;
+        pthread_mutex_unlock(&stream->mutex);
+
+        // Once a write failed the buffers are only recycled, the main thread stops on the error
+        double writeStartMs = getTimeMs();
+        size_t writtenBytes = 0;
+        bool written = !failed && writeStreamFrame(stream, format, stream->allocations[bufferIndex].mapped, &writtenBytes);
+        double writeMs = getTimeMs() - writeStartMs;
+
+        pthread_mutex_lock(&stream->mutex);
+        if (written)
+        {
+            stream->stats.writtenCount++;
+            stream->stats.writtenBytes += writtenBytes;
+            stream->stats.totalWriteMs += writeMs;
+            if (writeMs > stream->stats.maxWriteMs)
+                stream->stats.maxWriteMs = writeMs;
+        }
+        else if (!failed)
+        {
+            fprintf(stderr, "Failed to write to the frame stream: %s\n", strerror(errno));
+            stream->failed = true;
+        }
+        stream->freeBuffers[stream->freeCount++] = bufferIndex;
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return NULL;
+} // frameStreamWriterMain
+
+bool frameStreamAcquireBuffer(App *app, VkBuffer *buffer)
+{
+    FrameStream *stream = &app->frameStream;
+    if (!stream->enabled)
+        return false;
+
+    // y4m cannot change the frame size midway, the frames of a resized swap chain are left out
+    bool sameExtent = app->swapChainExtent.width == stream->extent.width && app->swapChainExtent.height == stream->extent.height;
+    int32_t bufferIndex = -1;
+
+    pthread_mutex_lock(&stream->mutex);
+    if (!sameExtent)
+        stream->stats.skippedCount++;
+    else if (stream->freeCount == 0)
+        stream->stats.droppedCount++;
+    else
+        bufferIndex = (int32_t)stream->freeBuffers[--stream->freeCount];
+    pthread_mutex_unlock(&stream->mutex);
+
+    stream->frameBuffers[app->currentFrame] = bufferIndex;
+    if (bufferIndex < 0)
+        return false;
+
+    *buffer = stream->buffers[bufferIndex];
+    return true;
+} // frameStreamAcquireBuffer
+
+AppResult frameStreamCollect(App *app, uint32_t frameIndex)
+{
+    FrameStream *stream = &app->frameStream;
+    if (!stream->enabled)
+        return APP_SUCCESS;
+
+    int32_t bufferIndex = stream->frameBuffers[frameIndex];
+    stream->frameBuffers[frameIndex] = -1;
+
+    // The queue can hold every buffer of the pool, it never overflows
+    pthread_mutex_lock(&stream->mutex);
+    bool failed = stream->failed;
+    if (bufferIndex >= 0)
+    {
+        stream->queue[(stream->queueHead + stream->queueCount) % FRAME_STREAM_MAX_BUFFERS] = (uint32_t)bufferIndex;
+        stream->queueCount++;
+        pthread_cond_signal(&stream->workReady);
+    }
+    pthread_mutex_unlock(&stream->mutex);
+
+    return failed ? APP_ERROR_WRITE_FRAME_STREAM : APP_SUCCESS;
+} // frameStreamCollect
+
+AppResult flushFrameStream(App *app)
+{
+    FrameStream *stream = &app->frameStream;
+    if (!stream->enabled)
+        return APP_SUCCESS;
+
+    AppResult appResult = waitForAllFrames(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // Oldest frame first so that the stream stays in order
+    for (uint32_t i = 0; i < app->config.framesInFlight; ++i)
+    {
+        appResult = frameStreamCollect(app, (app->currentFrame + i) % app->config.framesInFlight);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    // The writer drains the queue before it exits
+    pthread_mutex_lock(&stream->mutex);
+    stream->quit = true;
+    pthread_cond_signal(&stream->workReady);
+    pthread_mutex_unlock(&stream->mutex);
+    pthread_join(stream->thread, NULL);
+    stream->threadStarted = false;
+
+    return stream->failed ? APP_ERROR_WRITE_FRAME_STREAM : APP_SUCCESS;
+} // flushFrameStream
+
+bool writeStreamFrame(FrameStream *stream, StreamFormat format, const uint8_t *pixels, size_t *writtenBytes)
+{
+    VkExtent2D extent = stream->extent;
+    size_t pixelCount = (size_t)extent.width * extent.height;
+    const uint8_t *data = pixels;
+    size_t dataSize = pixelCount * 4;
+    char header[128];
+    int headerSize = 0;
+
+    if (format == STREAM_FORMAT_Y4M)
+    {
+        headerSize = snprintf(header, sizeof(header), "FRAME\n");
+        convertToYuv420(pixels, extent, stream->swapRedBlue, stream->scratch);
+        data = stream->scratch;
+        dataSize = pixelCount + 2 * (size_t)((extent.width + 1) / 2) * ((extent.height + 1) / 2);
+    }
+    else
+    {
+        headerSize = snprintf(header, sizeof(header), "P7\nWIDTH %u\nHEIGHT %u\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n", extent.width, extent.height);
+        if (stream->swapRedBlue)
+        {
+            // A whole pixel at a time, which the compiler vectorizes
+            for (size_t i = 0; i < dataSize; i += 4)
+            {
+                uint32_t pixel;
+                memcpy(&pixel, pixels + i, sizeof(pixel));
+                pixel = (pixel & 0xff00ff00u) | ((pixel >> 16) & 0xffu) | ((pixel & 0xffu) << 16);
+                memcpy(stream->scratch + i, &pixel, sizeof(pixel));
+            }
+            data = stream->scratch;
+        }
+    }
+
+    if (!writeToFd(stream->fd, header, (size_t)headerSize) || !writeToFd(stream->fd, data, dataSize))
+        return false;
+
+    *writtenBytes = (size_t)headerSize + dataSize;
+    return true;
+} // writeStreamFrame
+
+void convertToYuv420(const uint8_t *pixels, VkExtent2D extent, bool swapRedBlue, uint8_t *planes)
+{
+    uint32_t width = extent.width;
+    uint32_t height = extent.height;
+    uint32_t chromaWidth = (width + 1) / 2;
+    uint32_t chromaHeight = (height + 1) / 2;
+    uint8_t *lumaPlane = planes;
+    uint8_t *blueDifferencePlane = lumaPlane + (size_t)width * height;
+    uint8_t *redDifferencePlane = blueDifferencePlane + (size_t)chromaWidth * chromaHeight;
+    uint32_t redOffset = swapRedBlue ? 2 : 0;
+    uint32_t blueOffset = swapRedBlue ? 0 : 2;
+
+    // Full range BT.601 (JPEG) in fixed point, the coefficients are scaled by 256. The chroma
+    // of every 2x2 block is computed from the sum of its 4 pixels, the last row and column are
+    // repeated when the size is odd
+    for (uint32_t chromaY = 0; chromaY < chromaHeight; ++chromaY)
+    {
+        uint32_t rows[2] = {chromaY * 2, chromaY * 2 + 1 < height ? chromaY * 2 + 1 : chromaY * 2};
+        for (uint32_t chromaX = 0; chromaX < chromaWidth; ++chromaX)
+        {
+            uint32_t columns[2] = {chromaX * 2, chromaX * 2 + 1 < width ? chromaX * 2 + 1 : chromaX * 2};
+            int32_t redSum = 0, greenSum = 0, blueSum = 0;
+            for (uint32_t i = 0; i < 4; ++i)
+            {
+                size_t index = (size_t)rows[i / 2] * width + columns[i % 2];
+                const uint8_t *pixel = pixels + index * 4;
+                int32_t red = pixel[redOffset];
+                int32_t green = pixel[1];
+                int32_t blue = pixel[blueOffset];
+                lumaPlane[index] = (uint8_t)((77 * red + 150 * green + 29 * blue + 128) >> 8);
+                redSum += red;
+                greenSum += green;
+                blueSum += blue;
+            }
+
+            // Offset by 128 << 10 before the shift so that it never shifts a negative value
+            int32_t blueDifference = (-43 * redSum - 85 * greenSum + 128 * blueSum + (128 << 10) + 512) >> 10;
+            int32_t redDifference = (128 * redSum - 107 * greenSum - 21 * blueSum + (128 << 10) + 512) >> 10;
+            size_t chromaIndex = (size_t)chromaY * chromaWidth + chromaX;
+            blueDifferencePlane[chromaIndex] = (uint8_t)(blueDifference > 255 ? 255 : blueDifference);
+            redDifferencePlane[chromaIndex] = (uint8_t)(redDifference > 255 ? 255 : redDifference);
+        }
+    }
+} // convertToYuv420
+
+bool writeToFd(int fd, const void *data, size_t size)
+{
+    // Pipes take at most their buffer size per write, the rest is written as the reader
+    // makes room
+    const uint8_t *bytes = data;
+    while (size > 0)
+    {
+        ssize_t written = write(fd, bytes, size);
+        if (written < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        bytes += written;
+        size -= (size_t)written;
+    }
+
+    return true;
+} // writeToFd
+
+void printFrameStreamStats(const App *app)
+{
+    const FrameStream *stream = &app->frameStream;
+    const FrameStreamStats *stats = &stream->stats;
+    if (!stream->enabled)
+        return;
+
+    printf("=========================================\n");
+    printf("Frame stream: %llu %ux%u frames written to %s (%.1f MB), %llu dropped by a slow reader, %llu skipped after a resize\n",
+           (unsigned long long)stats->writtenCount, stream->extent.width, stream->extent.height, app->config.streamPath,
+           (double)stats->writtenBytes / (1024.0 * 1024.0), (unsigned long long)stats->droppedCount, (unsigned long long)stats->skippedCount);
+    if (stats->writtenCount > 0)
+    {
+        double averageWriteMs = stats->totalWriteMs / (double)stats->writtenCount;
+        printf("\tWriter thread: average %.3f ms per frame (up to %.0f frames/s), max %.3f ms\n", averageWriteMs,
+               averageWriteMs > 0.0 ? 1000.0 / averageWriteMs : 0.0, stats->maxWriteMs);
+    }
+} // printFrameStreamStats
+
+void destroyFrameStream(App *app)
+{
+    FrameStream *stream = &app->frameStream;
+
+    // Only reached with the writer still running when the run failed, whatever is queued is
+    // still written
+    if (stream->threadStarted)
+    {
+        pthread_mutex_lock(&stream->mutex);
+        stream->quit = true;
+        pthread_cond_signal(&stream->workReady);
+        pthread_mutex_unlock(&stream->mutex);
+        pthread_join(stream->thread, NULL);
+    }
+
+    if (stream->synchronizationCreated)
+    {
+        pthread_cond_destroy(&stream->workReady);
+        pthread_mutex_destroy(&stream->mutex);
+    }
+
+    for (uint32_t i = 0; i < FRAME_STREAM_MAX_BUFFERS; ++i)
+    {
+        if (stream->buffers[i] != VK_NULL_HANDLE)
+            destroyBuffer(app, &stream->buffers[i], &stream->allocations[i]);
+    }
+
+    free(stream->scratch);
+
+    if (stream->outputOpen)
+        close(stream->fd);
+
+    memset(stream, 0, sizeof(FrameStream));
+} // destroyFrameStream
+
+void printFrameStats(const App *app)
+{
+    const FrameStats *stats = &app->frameStats;
+    if (stats->frameCount < 2)
+        return;
+
+    // The first frame has no previous frame start to measure its duration from
+    uint64_t measuredFrames = stats->frameCount - 1;
+    double avgFrameTimeMs = stats->totalFrameTimeMs / (double)measuredFrames;
+    double avgFenceWaitMs = stats->totalFenceWaitMs / (double)stats->frameCount;
+    double avgCpuWorkMs = stats->totalCpuWorkMs / (double)stats->frameCount;
+    double avgRecordMs = stats->totalRecordMs / (double)stats->frameCount;
+
+    // The part of the frame the CPU does not spend blocked on a fence, whether the GPU is busy
+    // meanwhile is not known from the CPU side
+    double cpuUnblocked = avgFrameTimeMs > 0.0 ? 1.0 - avgFenceWaitMs / avgFrameTimeMs : 0.0;
+    if (cpuUnblocked < 0.0)
+        cpuUnblocked = 0.0;
+
+    // With the GPU profiler, the frame scope gives the share of the frame interval the GPU is
+    // busy. Both shares can only fit in one interval by overlapping, by at least their excess
+    // over 100%
+    const GpuProfiler *profiler = &app->gpuProfiler;
+    double gpuBusy = -1.0;
+    for (uint32_t i = 0; i < profiler->scopeCount; ++i)
+    {
+        if (strcmp(profiler->scopes[i].name, "frame") != 0 || profiler->scopes[i].sampleCount == 0 || avgFrameTimeMs <= 0.0)
+            continue;
+        double minMs, avgMs, p99Ms;
+        gpuProfilerScopeStats(&profiler->scopes[i], &minMs, &avgMs, &p99Ms);
+        gpuBusy = avgMs / avgFrameTimeMs;
+    }
+
+    printf("=========================================\n");
+    printf("Frame statistics (%u frames in flight):\n", app->config.framesInFlight);
+    printf("\tFrames rendered: %llu\n", (unsigned long long)stats->frameCount);
+    printf("\tAverage frame time: %.3f ms (%.1f FPS)\n", avgFrameTimeMs, avgFrameTimeMs > 0.0 ? 1000.0 / avgFrameTimeMs : 0.0);
+    printf("\tAverage CPU work: %.3f ms\n", avgCpuWorkMs);
+    printf("\tAverage command recording: %.3f ms (%s)\n", avgRecordMs,
+           app->recordWorkers.workerCount > 0 ? "secondary command buffers on worker threads" : "main thread");
+    printf("\tAverage fence wait: %.3f ms\n", avgFenceWaitMs);
+    printf("\tCPU not blocked on a fence: %.1f%% of the frame interval\n", cpuUnblocked * 100.0);
+    if (gpuBusy >= 0.0)
+    {
+        double minOverlap = cpuUnblocked + gpuBusy - 1.0;
+        printf("\tGPU busy: %.1f%% of the frame interval, CPU/GPU overlap at least %.1f%%\n", gpuBusy * 100.0,
+               (minOverlap > 0.0 ? minOverlap : 0.0) * 100.0);
+    }
+
+    // One triangle per instance, before culling in GPU driven mode where a single indirect
+    // draw covers all of them
+    double framesPerSecond = avgFrameTimeMs > 0.0 ? 1000.0 / avgFrameTimeMs : 0.0;
+    uint32_t drawCallCount = getDrawCount(app);
+    printf("\tThroughput: %.2f M triangles/s, %.0f draw calls/s (%u instances in %u draw calls per frame)\n",
+           framesPerSecond * app->config.instanceCount / 1e6, framesPerSecond * drawCallCount,
+           app->config.instanceCount, drawCallCount);
+    if (stats->gpuCompletionSampleCount > 0)
+    {
+        printf("\tPresent policy %s (%s, %u swap chain images): frame start to GPU completion average %.3f ms, max %.3f ms\n",
+               presentPolicies[app->config.presentPolicy].name, presentModeName(app->selectedDevicePresentMode), app->swapChainImageCount,
+               stats->totalGpuCompletionMs / (double)stats->gpuCompletionSampleCount, stats->maxGpuCompletionMs);
+    }
+    if (stats->swapChainRecreationCount > 0)
+    {
+        printf("\tSwap chain recreations: %u (average %.3f ms, max %.3f ms)\n", stats->swapChainRecreationCount,
+               stats->totalSwapChainRecreationMs / (double)stats->swapChainRecreationCount, stats->maxSwapChainRecreationMs);
+    }
+} // printFrameStats
+
+double getTimeMs(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+} // getTimeMs
+
+AppResult createFramebuffers(App *app)
+{
+    // Dynamic rendering renders to the image views directly, nothing has to be rebuilt along
+    // with the swap chain
+    if (app->dynamicRendering)
+        return APP_SUCCESS;
+
+    // first we need to allocate memory for the framebuffers
+    app->swapChainFramebuffers = malloc(app->swapChainImageCount * sizeof(VkFramebuffer));
+    if (app->swapChainFramebuffers == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for framebuffers\n");
+        return APP_ERROR_VULKAN_ALLOC_SWAP_CHAIN_FRAMEBUFFERS;
+    }
+
+    for (uint32_t i = 0; i < app->swapChainImageCount; ++i)
+    {
+        VkImageView attachments[] = {
+            app->swapChainImageViews[i],
+        };
+
+        VkFramebufferCreateInfo framebufferCreateInfo = {0};
+        framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferCreateInfo.renderPass = app->renderPass;
+        framebufferCreateInfo.attachmentCount = 1;
+        framebufferCreateInfo.pAttachments = attachments;
+        framebufferCreateInfo.width = app->swapChainExtent.width;
+        framebufferCreateInfo.height = app->swapChainExtent.height;
+        framebufferCreateInfo.layers = 1;
+
+        VkResult vkResult = vkCreateFramebuffer(app->logicalDevice, &framebufferCreateInfo, NULL, &app->swapChainFramebuffers[i]);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create framebuffer: %d\n", vkResult);
+            return APP_ERROR_VULKAN_CREATE_FRAMEBUFFER;
+        }
+    }
+
+    return APP_SUCCESS;
+}
+
+AppResult createCullingPipeline(App *app)
+{
+    if (!app->config.gpuDriven)
+        return APP_SUCCESS;
+
+    // One indirect command per object in the worst case where nothing is culled
+    uint32_t objectCount = app->config.instanceCount;
+    AppResult appResult = createBuffer(app, (VkDeviceSize)objectCount * sizeof(VkDrawIndexedIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &app->drawCommandBuffer, &app->drawCommandAllocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = createBuffer(app, sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &app->drawCountBuffer, &app->drawCountAllocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // Binding 0 is the instance buffer, 1 the indirect commands and 2 their count
+    VkDescriptorSetLayoutBinding bindings[3] = {0};
+    for (uint32_t i = 0; i < ARRAY_LEN(bindings); ++i)
+    {
+        bindings[i].binding = i;
+        bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        bindings[i].descriptorCount = 1;
+        bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {0};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = ARRAY_LEN(bindings);
+    descriptorSetLayoutCreateInfo.pBindings = bindings;
+
+    VkResult vkResult = vkCreateDescriptorSetLayout(app->logicalDevice, &descriptorSetLayoutCreateInfo, NULL, &app->cullingDescriptorSetLayout);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create culling descriptor set layout: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_DESCRIPTOR_SET_LAYOUT;
+    }
+
+    VkDescriptorPoolSize poolSize = {0};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = ARRAY_LEN(bindings);
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {0};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.maxSets = 1;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &poolSize;
+
+    vkResult = vkCreateDescriptorPool(app->logicalDevice, &descriptorPoolCreateInfo, NULL, &app->cullingDescriptorPool);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create culling descriptor pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_DESCRIPTOR_POOL;
+    }
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {0};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = app->cullingDescriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &app->cullingDescriptorSetLayout;
+
+    vkResult = vkAllocateDescriptorSets(app->logicalDevice, &descriptorSetAllocateInfo, &app->cullingDescriptorSet);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate culling descriptor set: %d\n", vkResult);
+        return APP_ERROR_VULKAN_ALLOC_DESCRIPTOR_SET;
+    }
+
+    VkDescriptorBufferInfo bufferInfos[3] = {0};
+    bufferInfos[0].buffer = app->instanceBuffer;
+    bufferInfos[1].buffer = app->drawCommandBuffer;
+    bufferInfos[2].buffer = app->drawCountBuffer;
+
+    VkWriteDescriptorSet descriptorWrites[3] = {0};
+    for (uint32_t i = 0; i < ARRAY_LEN(descriptorWrites); ++i)
+    {
+        bufferInfos[i].offset = 0;
+        bufferInfos[i].range = VK_WHOLE_SIZE;
+
+        descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[i].dstSet = app->cullingDescriptorSet;
+        descriptorWrites[i].dstBinding = i;
+        descriptorWrites[i].descriptorCount = 1;
+        descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[i].pBufferInfo = &bufferInfos[i];
+    }
+    vkUpdateDescriptorSets(app->logicalDevice, ARRAY_LEN(descriptorWrites), descriptorWrites, 0, NULL);
+
+    VkPushConstantRange pushConstantRange = {0};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(CullingPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {0};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &app->cullingDescriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    vkResult = vkCreatePipelineLayout(app->logicalDevice, &pipelineLayoutCreateInfo, NULL, &app->cullingPipelineLayout);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create culling pipeline layout: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_PIPELINE_LAYOUT;
+    }
+
+    PipelineBuild *build = NULL;
+    appResult = beginPipelineBuild(app, "culling", &app->cullingPipeline, &build);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = loadShader(app->logicalDevice, "cull.spv", &build->shaderModules[0], app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    build->compute = true;
+    VkComputePipelineCreateInfo *pipelineCreateInfo = &build->computeCreateInfo;
+    pipelineCreateInfo->sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo->stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo->stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo->stage.module = build->shaderModules[0];
+    pipelineCreateInfo->stage.pName = "main";
+    pipelineCreateInfo->layout = app->cullingPipelineLayout;
+    pipelineCreateInfo->basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreateInfo->basePipelineIndex = -1;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("GPU driven rendering of %u objects with %s\n", objectCount,
+               app->vkCmdDrawIndexedIndirectCount != NULL ? "vkCmdDrawIndexedIndirectCountKHR" : "vkCmdDrawIndexedIndirect (no draw indirect count support)");
+    }
+
+    return submitPipelineBuild(app, build);
+} // createCullingPipeline
+
+InstanceLayout getInstanceLayout(const App *app)
+{
+    // The instances are laid out on a square grid covering the world, which is the viewport
+    // unless the culling pass has objects outside of it to cull
+    InstanceLayout layout = {0};
+    layout.instanceCount = app->config.instanceCount;
+    layout.gridSize = (uint32_t)ceil(sqrt((double)layout.instanceCount));
+    layout.worldScale = app->config.gpuDriven ? GPU_DRIVEN_WORLD_SCALE : 1.0f;
+    layout.cellSize = 2.0f * layout.worldScale / (float)layout.gridSize;
+    return layout;
+} // getInstanceLayout
+
+void getInstanceData(const InstanceLayout *layout, uint32_t instance, InstanceData *data)
+{
+    // A single instance is the original triangle
+    if (layout->instanceCount == 1)
+    {
+        data->offset[0] = 0.0f;
+        data->offset[1] = 0.0f;
+        data->scale = 1.0f;
+        data->rotation = 0.0f;
+        return;
+    }
+
+    data->offset[0] = -layout->worldScale + layout->cellSize * ((float)(instance % layout->gridSize) + 0.5f);
+    data->offset[1] = -layout->worldScale + layout->cellSize * ((float)(instance / layout->gridSize) + 0.5f);
+    data->scale = layout->cellSize;
+    data->rotation = (float)instance * 0.1f;
+} // getInstanceData
+
+uint32_t getInstanceMaterial(const App *app, uint32_t instance)
+{
+    return instance % app->materialCount;
+} // getInstanceMaterial
+
+uint32_t getMaterialTexture(const App *app, uint32_t material)
+{
+    // Index in the streamer's textures, the materials cycle through them
+    return material % app->textureStreamer.textureCount;
+} // getMaterialTexture
+
+AppResult createVertexBuffers(App *app)
+{
+    const Vertex vertices[3] = {
+        {{0.0f, -0.5f}, {1.0f, 0.0f, 0.0f}},
+        {{0.5f, 0.5f}, {0.0f, 1.0f, 0.0f}},
+        {{-0.5f, 0.5f}, {0.0f, 0.0f, 1.0f}},
+    };
+
+    AppResult appResult = createBuffer(app, sizeof(vertices), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                       &app->vertexBuffer, &app->vertexAllocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = uploadToBuffer(app, app->vertexBuffer, 0, vertices, sizeof(vertices), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    const uint16_t indices[TRIANGLE_INDEX_COUNT] = {0, 1, 2};
+    appResult = createBuffer(app, sizeof(indices), VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                             &app->indexBuffer, &app->indexAllocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = uploadToBuffer(app, app->indexBuffer, 0, indices, sizeof(indices), VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_INDEX_READ_BIT);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    uint32_t instanceCount = app->config.instanceCount;
+    // The culling pass reads the instances as the bounds of the objects
+    appResult = createBuffer(app, (VkDeviceSize)instanceCount * sizeof(InstanceData), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &app->instanceBuffer, &app->instanceAllocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The data is generated and streamed one chunk at a time so that millions of instances never
+    // need to be held in host memory at once
+    InstanceData *chunk = malloc(sizeof(InstanceData) * INSTANCE_UPLOAD_CHUNK);
+    if (chunk == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for the instance data\n");
+        return APP_ERROR_ALLOC_INSTANCE_DATA;
+    }
+
+    InstanceLayout layout = getInstanceLayout(app);
+    for (uint32_t first = 0; first < instanceCount; first += INSTANCE_UPLOAD_CHUNK)
+    {
+        uint32_t count = instanceCount - first < INSTANCE_UPLOAD_CHUNK ? instanceCount - first : INSTANCE_UPLOAD_CHUNK;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            getInstanceData(&layout, first + i, &chunk[i]);
+        }
+
+        appResult = uploadToBuffer(app, app->instanceBuffer, (VkDeviceSize)first * sizeof(InstanceData), chunk, (VkDeviceSize)count * sizeof(InstanceData),
+                                   VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT);
+        if (appResult != APP_SUCCESS)
+        {
+            free(chunk);
+            return appResult;
+        }
+    }
+    free(chunk);
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Vertex buffers: %u instances (%.2f MB) drawn in %u draw calls\n", instanceCount,
+               (double)instanceCount * sizeof(InstanceData) / (1024.0 * 1024.0), app->config.drawCallCount);
+    }
+
+    // With --bindless every instance is also given a material
+    return createMaterials(app);
+} // createVertexBuffers
+
+AppResult createComputePipeline(App *app)
+{
+    if (!app->config.compute)
+        return APP_SUCCESS;
+
+    // The particles never leave the GPU, they are initialized by the first dispatch
+    AppResult appResult = createBuffer(app, sizeof(float) * 4 * SIMULATION_PARTICLE_COUNT, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                       &app->particleBuffer, &app->particleAllocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    VkDescriptorSetLayoutBinding particlesBinding = {0};
+    particlesBinding.binding = 0;
+    particlesBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    particlesBinding.descriptorCount = 1;
+    particlesBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {0};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = 1;
+    descriptorSetLayoutCreateInfo.pBindings = &particlesBinding;
+
+    VkResult vkResult = vkCreateDescriptorSetLayout(app->logicalDevice, &descriptorSetLayoutCreateInfo, NULL, &app->computeDescriptorSetLayout);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create compute descriptor set layout: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_DESCRIPTOR_SET_LAYOUT;
+    }
+
+    VkDescriptorPoolSize poolSize = {0};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {0};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.maxSets = 1;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &poolSize;
+
+    vkResult = vkCreateDescriptorPool(app->logicalDevice, &descriptorPoolCreateInfo, NULL, &app->computeDescriptorPool);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create compute descriptor pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_DESCRIPTOR_POOL;
+    }
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {0};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = app->computeDescriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &app->computeDescriptorSetLayout;
+
+    vkResult = vkAllocateDescriptorSets(app->logicalDevice, &descriptorSetAllocateInfo, &app->computeDescriptorSet);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate compute descriptor set: %d\n", vkResult);
+        return APP_ERROR_VULKAN_ALLOC_DESCRIPTOR_SET;
+    }
+
+    VkDescriptorBufferInfo particlesBufferInfo = {0};
+    particlesBufferInfo.buffer = app->particleBuffer;
+    particlesBufferInfo.offset = 0;
+    particlesBufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet descriptorWrite = {0};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = app->computeDescriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrite.pBufferInfo = &particlesBufferInfo;
+    vkUpdateDescriptorSets(app->logicalDevice, 1, &descriptorWrite, 0, NULL);
+
+    VkPushConstantRange pushConstantRange = {0};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(SimulationPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {0};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &app->computeDescriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    vkResult = vkCreatePipelineLayout(app->logicalDevice, &pipelineLayoutCreateInfo, NULL, &app->computePipelineLayout);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create compute pipeline layout: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_PIPELINE_LAYOUT;
+    }
+
+    PipelineBuild *build = NULL;
+    appResult = beginPipelineBuild(app, "simulation", &app->computePipeline, &build);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = loadShader(app->logicalDevice, "simulate.spv", &build->shaderModules[0], app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    build->compute = true;
+    VkComputePipelineCreateInfo *pipelineCreateInfo = &build->computeCreateInfo;
+    pipelineCreateInfo->sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo->stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo->stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo->stage.module = build->shaderModules[0];
+    pipelineCreateInfo->stage.pName = "main";
+    pipelineCreateInfo->layout = app->computePipelineLayout;
+    pipelineCreateInfo->basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreateInfo->basePipelineIndex = -1;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Simulating %d particles\n", SIMULATION_PARTICLE_COUNT);
+    }
+
+    return submitPipelineBuild(app, build);
+} // createComputePipeline
+
+AppResult createUniformRing(App *app)
+{
+    UniformRing *ring = &app->uniformRing;
+
+    // Dynamic offsets have to be multiples of the device alignment, which is a power of two
+    VkDeviceSize alignment = app->physicalDeviceProperties.limits.minUniformBufferOffsetAlignment;
+    ring->slotSize = (sizeof(FrameUniforms) + alignment - 1) & ~(alignment - 1);
+    ring->slotCount = app->config.framesInFlight;
+
+    // Host visible memory stays mapped for the lifetime of its allocation, the slots are
+    // written in place and coherent memory needs no flush
+    AppResult appResult = createBuffer(app, ring->slotSize * ring->slotCount, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, &ring->buffer, &ring->allocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    VkDescriptorSetLayoutBinding binding = {0};
+    binding.binding = 0;
+    binding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    binding.descriptorCount = 1;
+    binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {0};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = 1;
+    descriptorSetLayoutCreateInfo.pBindings = &binding;
+
+    VkResult vkResult = vkCreateDescriptorSetLayout(app->logicalDevice, &descriptorSetLayoutCreateInfo, NULL, &ring->setLayout);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create uniform ring descriptor set layout: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_DESCRIPTOR_SET_LAYOUT;
+    }
+
+    VkDescriptorPoolSize poolSize = {0};
+    poolSize.type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    poolSize.descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {0};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.maxSets = 1;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &poolSize;
+
+    vkResult = vkCreateDescriptorPool(app->logicalDevice, &descriptorPoolCreateInfo, NULL, &ring->pool);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create uniform ring descriptor pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_DESCRIPTOR_POOL;
+    }
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {0};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = ring->pool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &ring->setLayout;
+
+    vkResult = vkAllocateDescriptorSets(app->logicalDevice, &descriptorSetAllocateInfo, &ring->set);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate uniform ring descriptor set: %d\n", vkResult);
+        return APP_ERROR_VULKAN_ALLOC_DESCRIPTOR_SET;
+    }
+
+    // Written once, the dynamic offset given when binding the set picks the slot of the frame
+    VkDescriptorBufferInfo bufferInfo = {0};
+    bufferInfo.buffer = ring->buffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = sizeof(FrameUniforms);
+
+    VkWriteDescriptorSet descriptorWrite = {0};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = ring->set;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
+    descriptorWrite.pBufferInfo = &bufferInfo;
+    vkUpdateDescriptorSets(app->logicalDevice, 1, &descriptorWrite, 0, NULL);
+
+    // The camera starts out showing the clip space square, as the scene did before it had one
+    app->frameUniforms.viewOffset[0] = 0.0f;
+    app->frameUniforms.viewOffset[1] = 0.0f;
+    app->frameUniforms.viewScale[0] = 1.0f;
+    app->frameUniforms.viewScale[1] = 1.0f;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Uniform ring: %u slots of %llu bytes, persistently mapped\n", ring->slotCount, (unsigned long long)ring->slotSize);
+    }
+
+    return APP_SUCCESS;
+} // createUniformRing
+
+void updateCamera(App *app)
+{
+    if (!app->config.animateCamera)
+        return;
+
+    double angle = 2.0 * 3.14159265358979 * (double)(app->frameStats.frameCount % CAMERA_ORBIT_FRAMES) / CAMERA_ORBIT_FRAMES;
+    float zoom = 1.0f + CAMERA_ZOOM_AMPLITUDE * (float)sin(2.0 * angle);
+    app->frameUniforms.viewOffset[0] = CAMERA_ORBIT_RADIUS * (float)cos(angle);
+    app->frameUniforms.viewOffset[1] = CAMERA_ORBIT_RADIUS * (float)sin(angle);
+    app->frameUniforms.viewScale[0] = zoom;
+    app->frameUniforms.viewScale[1] = zoom;
+} // updateCamera
+
+void updateFrameUniforms(App *app)
+{
+    // The GPU is done with the slot of this frame since its fence signaled
+    UniformRing *ring = &app->uniformRing;
+    memcpy((char *)ring->allocation.mapped + ring->slotSize * app->currentFrame, &app->frameUniforms, sizeof(FrameUniforms));
+} // updateFrameUniforms
+
+void destroyUniformRing(App *app)
+{
+    UniformRing *ring = &app->uniformRing;
+
+    // Destroying the pool also frees its descriptor set
+    if (ring->pool != VK_NULL_HANDLE)
+        vkDestroyDescriptorPool(app->logicalDevice, ring->pool, NULL);
+    if (ring->setLayout != VK_NULL_HANDLE)
+        vkDestroyDescriptorSetLayout(app->logicalDevice, ring->setLayout, NULL);
+    if (ring->buffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &ring->buffer, &ring->allocation);
+
+    memset(ring, 0, sizeof(UniformRing));
+} // destroyUniformRing
+
+AppResult createBindlessTable(App *app)
+{
+    BindlessTable *table = &app->bindless;
+
+    // The arrays are as large as the device allows every stage to reach with update after bind
+    // descriptors, up to the MAX_BINDLESS_* bounds
+    VkPhysicalDeviceDescriptorIndexingPropertiesEXT indexingProperties = {0};
+    indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES_EXT;
+    VkPhysicalDeviceProperties2 properties2 = {0};
+    properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+    properties2.pNext = &indexingProperties;
+    vkGetPhysicalDeviceProperties2(app->physicalDevice, &properties2);
+
+    table->maxStorageBuffers = MAX_BINDLESS_STORAGE_BUFFERS;
+    if (table->maxStorageBuffers > indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers)
+        table->maxStorageBuffers = indexingProperties.maxDescriptorSetUpdateAfterBindStorageBuffers;
+    if (table->maxStorageBuffers > indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers)
+        table->maxStorageBuffers = indexingProperties.maxPerStageDescriptorUpdateAfterBindStorageBuffers;
+    table->maxSampledImages = MAX_BINDLESS_SAMPLED_IMAGES;
+    if (table->maxSampledImages > indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages)
+        table->maxSampledImages = indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages;
+    if (table->maxSampledImages > indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages)
+        table->maxSampledImages = indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages;
+
+    // The sampler counts as a resource too
+    uint32_t maxResources = indexingProperties.maxPerStageUpdateAfterBindResources - 1;
+    if (table->maxStorageBuffers > maxResources / 2)
+        table->maxStorageBuffers = maxResources / 2;
+    if (table->maxSampledImages > maxResources - table->maxStorageBuffers)
+        table->maxSampledImages = maxResources - table->maxStorageBuffers;
+    if (table->maxStorageBuffers < 2 || table->maxSampledImages < 1)
+    {
+        fprintf(stderr, "Failed to create the bindless descriptor set: the device allows only %u storage buffers and %u sampled images\n",
+                table->maxStorageBuffers, table->maxSampledImages);
+        return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
+    }
+
+    // Every image is sampled the same way, linearly across mips, so one immutable sampler
+    // covers them all
+    VkSamplerCreateInfo samplerCreateInfo = {0};
+    samplerCreateInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerCreateInfo.magFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.minFilter = VK_FILTER_LINEAR;
+    samplerCreateInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerCreateInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerCreateInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerCreateInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+    samplerCreateInfo.anisotropyEnable = VK_FALSE;
+    samplerCreateInfo.minLod = 0.0f;
+    samplerCreateInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+    VkResult vkResult = vkCreateSampler(app->logicalDevice, &samplerCreateInfo, NULL, &table->sampler);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create the bindless sampler: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_SAMPLER;
+    }
+
+    // Binding 0 is the storage buffer array, 1 the sampled image array and 2 the sampler
+    VkDescriptorSetLayoutBinding bindings[3] = {0};
+    bindings[0].binding = 0;
+    bindings[0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    bindings[0].descriptorCount = table->maxStorageBuffers;
+    bindings[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[1].binding = 1;
+    bindings[1].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    bindings[1].descriptorCount = table->maxSampledImages;
+    bindings[1].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[2].binding = 2;
+    bindings[2].descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER;
+    bindings[2].descriptorCount = 1;
+    bindings[2].stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    bindings[2].pImmutableSamplers = &table->sampler;
+
+    // The slots past the last added resource are never written, which partially bound allows
+    // as long as the shaders do not read them
+    VkDescriptorBindingFlagsEXT bindingFlags[3] = {
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT,
+        VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT_EXT | VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT,
+        0,
+    };
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfoEXT bindingFlagsCreateInfo = {0};
+    bindingFlagsCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+    bindingFlagsCreateInfo.bindingCount = ARRAY_LEN(bindingFlags);
+    bindingFlagsCreateInfo.pBindingFlags = bindingFlags;
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {0};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.pNext = &bindingFlagsCreateInfo;
+    descriptorSetLayoutCreateInfo.flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT_EXT;
+    descriptorSetLayoutCreateInfo.bindingCount = ARRAY_LEN(bindings);
+    descriptorSetLayoutCreateInfo.pBindings = bindings;
+
+    vkResult = vkCreateDescriptorSetLayout(app->logicalDevice, &descriptorSetLayoutCreateInfo, NULL, &table->setLayout);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create bindless descriptor set layout: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_DESCRIPTOR_SET_LAYOUT;
+    }
+
+    uint32_t setCount = app->config.framesInFlight;
+    VkDescriptorPoolSize poolSizes[3] = {0};
+    poolSizes[0].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[0].descriptorCount = table->maxStorageBuffers * setCount;
+    poolSizes[1].type = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    poolSizes[1].descriptorCount = table->maxSampledImages * setCount;
+    poolSizes[2].type = VK_DESCRIPTOR_TYPE_SAMPLER;
+    poolSizes[2].descriptorCount = setCount;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {0};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT_EXT;
+    descriptorPoolCreateInfo.maxSets = setCount;
+    descriptorPoolCreateInfo.poolSizeCount = ARRAY_LEN(poolSizes);
+    descriptorPoolCreateInfo.pPoolSizes = poolSizes;
+
+    vkResult = vkCreateDescriptorPool(app->logicalDevice, &descriptorPoolCreateInfo, NULL, &table->pool);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create bindless descriptor pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_DESCRIPTOR_POOL;
+    }
+
+    VkDescriptorSetLayout setLayouts[MAX_FRAMES_IN_FLIGHT];
+    for (uint32_t i = 0; i < setCount; ++i)
+    {
+        setLayouts[i] = table->setLayout;
+    }
+
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {0};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = table->pool;
+    descriptorSetAllocateInfo.descriptorSetCount = setCount;
+    descriptorSetAllocateInfo.pSetLayouts = setLayouts;
+
+    vkResult = vkAllocateDescriptorSets(app->logicalDevice, &descriptorSetAllocateInfo, table->sets);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to allocate bindless descriptor sets: %d\n", vkResult);
+        return APP_ERROR_VULKAN_ALLOC_DESCRIPTOR_SET;
+    }
+    table->setCount = setCount;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Bindless descriptor sets: %u storage buffers, %u sampled images, one set per frame in flight\n", table->maxStorageBuffers, table->maxSampledImages);
+    }
+
+    return APP_SUCCESS;
+} // createBindlessTable
+
+AppResult bindlessAddStorageBuffer(App *app, VkBuffer buffer, uint32_t *slot)
+{
+    BindlessTable *table = &app->bindless;
+    if (table->storageBufferCount >= table->maxStorageBuffers)
+    {
+        fprintf(stderr, "Failed to add a storage buffer to the bindless set: all %u slots are used\n", table->maxStorageBuffers);
+        return APP_ERROR_BINDLESS_TABLE_FULL;
+    }
+
+    VkDescriptorBufferInfo bufferInfo = {0};
+    bufferInfo.buffer = buffer;
+    bufferInfo.offset = 0;
+    bufferInfo.range = VK_WHOLE_SIZE;
+
+    // Update after bind lets the slot be written while command buffers using the set are
+    // pending, as long as none of them reads that slot
+    for (uint32_t i = 0; i < table->setCount; ++i)
+    {
+        VkWriteDescriptorSet descriptorWrite = {0};
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = table->sets[i];
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = table->storageBufferCount;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrite.pBufferInfo = &bufferInfo;
+        vkUpdateDescriptorSets(app->logicalDevice, 1, &descriptorWrite, 0, NULL);
+    }
+
+    *slot = table->storageBufferCount++;
+    return APP_SUCCESS;
+} // bindlessAddStorageBuffer
+
+AppResult bindlessAddSampledImage(App *app, VkImageView imageView, uint32_t *slot)
+{
+    BindlessTable *table = &app->bindless;
+    if (table->sampledImageCount >= table->maxSampledImages)
+    {
+        fprintf(stderr, "Failed to add an image to the bindless set: all %u slots are used\n", table->maxSampledImages);
+        return APP_ERROR_BINDLESS_TABLE_FULL;
+    }
+
+    for (uint32_t i = 0; i < table->setCount; ++i)
+    {
+        bindlessWriteSampledImage(app, i, table->sampledImageCount, imageView);
+    }
+
+    *slot = table->sampledImageCount++;
+    return APP_SUCCESS;
+} // bindlessAddSampledImage
+
+void bindlessWriteSampledImage(App *app, uint32_t setIndex, uint32_t slot, VkImageView imageView)
+{
+    // Pointing a used slot to another image is only safe in the set of a frame in flight whose
+    // fence was just waited on
+    VkDescriptorImageInfo imageInfo = {0};
+    imageInfo.sampler = VK_NULL_HANDLE;
+    imageInfo.imageView = imageView;
+    imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkWriteDescriptorSet descriptorWrite = {0};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = app->bindless.sets[setIndex];
+    descriptorWrite.dstBinding = 1;
+    descriptorWrite.dstArrayElement = slot;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE;
+    descriptorWrite.pImageInfo = &imageInfo;
+    vkUpdateDescriptorSets(app->logicalDevice, 1, &descriptorWrite, 0, NULL);
+} // bindlessWriteSampledImage
+
+AppResult createMaterials(App *app)
+{
+    if (app->bindless.setCount == 0)
+        return APP_SUCCESS;
+
+    // A small palette of tints, with as many materials as streamed textures when there are more
+    // of them so that every texture is used
+    const TextureStreamer *streamer = &app->textureStreamer;
+    app->materialCount = streamer->textureCount > BINDLESS_MATERIAL_COUNT ? streamer->textureCount : BINDLESS_MATERIAL_COUNT;
+    size_t materialsSize = sizeof(Material) * app->materialCount;
+    Material *materials = calloc(app->materialCount, sizeof(Material));
+    if (materials == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for the materials\n");
+        return APP_ERROR_ALLOC_MATERIALS;
+    }
+
+    for (uint32_t i = 0; i < app->materialCount; ++i)
+    {
+        uint32_t tint = i % BINDLESS_MATERIAL_COUNT;
+        materials[i].color[0] = (tint & 1) ? 0.5f : 1.0f;
+        materials[i].color[1] = (tint & 2) ? 0.5f : 1.0f;
+        materials[i].color[2] = (tint & 4) ? 0.5f : 1.0f;
+        materials[i].color[3] = 1.0f;
+        materials[i].textureIndex = streamer->textureCount > 0 ? streamer->textures[getMaterialTexture(app, i)].slot : BINDLESS_NO_TEXTURE;
+    }
+
+    uint32_t instanceCount = app->config.instanceCount;
+    AppResult appResult = createBuffer(app, (VkDeviceSize)instanceCount * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &app->objectMaterialBuffer, &app->objectMaterialAllocation);
+    if (appResult == APP_SUCCESS)
+        appResult = createBuffer(app, materialsSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                                 &app->materialBuffer, &app->materialAllocation);
+    if (appResult == APP_SUCCESS)
+        appResult = uploadToBuffer(app, app->materialBuffer, 0, materials, materialsSize, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+    free(materials);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The material IDs are streamed in chunks like the instances
+    uint32_t *chunk = malloc(sizeof(uint32_t) * INSTANCE_UPLOAD_CHUNK);
+    if (chunk == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for the material IDs\n");
+        return APP_ERROR_ALLOC_MATERIALS;
+    }
+
+    for (uint32_t first = 0; first < instanceCount; first += INSTANCE_UPLOAD_CHUNK)
+    {
+        uint32_t count = instanceCount - first < INSTANCE_UPLOAD_CHUNK ? instanceCount - first : INSTANCE_UPLOAD_CHUNK;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            chunk[i] = getInstanceMaterial(app, first + i);
+        }
+
+        appResult = uploadToBuffer(app, app->objectMaterialBuffer, (VkDeviceSize)first * sizeof(uint32_t), chunk, (VkDeviceSize)count * sizeof(uint32_t),
+                                   VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT);
+        if (appResult != APP_SUCCESS)
+        {
+            free(chunk);
+            return appResult;
+        }
+    }
+    free(chunk);
+
+    // They are the first storage buffers of the set, in the slots bindless.frag expects
+    uint32_t objectMaterialSlot = 0;
+    appResult = bindlessAddStorageBuffer(app, app->objectMaterialBuffer, &objectMaterialSlot);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    uint32_t materialSlot = 0;
+    appResult = bindlessAddStorageBuffer(app, app->materialBuffer, &materialSlot);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    if (objectMaterialSlot != BINDLESS_OBJECT_MATERIALS_SLOT || materialSlot != BINDLESS_MATERIALS_SLOT)
+    {
+        fprintf(stderr, "Failed to add the materials to the bindless set: slots %u and %u are already taken\n", BINDLESS_OBJECT_MATERIALS_SLOT, BINDLESS_MATERIALS_SLOT);
+        return APP_ERROR_BINDLESS_TABLE_FULL;
+    }
+
+    return APP_SUCCESS;
+} // createMaterials
+
+void destroyBindlessTable(App *app)
+{
+    BindlessTable *table = &app->bindless;
+
+    // Destroying the pool also frees its descriptor sets
+    if (table->pool != VK_NULL_HANDLE)
+        vkDestroyDescriptorPool(app->logicalDevice, table->pool, NULL);
+    if (table->setLayout != VK_NULL_HANDLE)
+        vkDestroyDescriptorSetLayout(app->logicalDevice, table->setLayout, NULL);
+    if (table->sampler != VK_NULL_HANDLE)
+        vkDestroySampler(app->logicalDevice, table->sampler, NULL);
+    if (app->objectMaterialBuffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &app->objectMaterialBuffer, &app->objectMaterialAllocation);
+    if (app->materialBuffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &app->materialBuffer, &app->materialAllocation);
+
+    memset(table, 0, sizeof(BindlessTable));
+} // destroyBindlessTable
+
+AppResult createTextureStreamer(App *app)
+{
+    TextureStreamer *streamer = &app->textureStreamer;
+    if (app->config.textureDirectory == NULL)
+        return APP_SUCCESS;
+
+    DIR *directory = opendir(app->config.textureDirectory);
+    if (directory == NULL)
+    {
+        fprintf(stderr, "Failed to open the texture directory %s: %s\n", app->config.textureDirectory, strerror(errno));
+        return APP_ERROR_LOAD_TEXTURE;
+    }
+
+    // Only binary netpbm images are streamed, sorted so that a texture keeps its slot and its
+    // materials from one run to the next
+    char **names = NULL;
+    uint32_t nameCount = 0;
+    uint32_t nameCapacity = 0;
+    AppResult appResult = APP_SUCCESS;
+    struct dirent *entry = NULL;
+    while (appResult == APP_SUCCESS && (entry = readdir(directory)) != NULL)
+    {
+        size_t length = strlen(entry->d_name);
+        if (length <= 4 || (strcmp(entry->d_name + length - 4, ".pam") != 0 && strcmp(entry->d_name + length - 4, ".ppm") != 0))
+            continue;
+
+        if (nameCount == nameCapacity)
+        {
+            nameCapacity = nameCapacity == 0 ? 64 : nameCapacity * 2;
+            char **grownNames = realloc(names, sizeof(char *) * nameCapacity);
+            if (grownNames == NULL)
+            {
+                appResult = APP_ERROR_ALLOC_TEXTURE;
+                break;
+            }
+            names = grownNames;
+        }
+
+        names[nameCount] = strdup(entry->d_name);
+        if (names[nameCount] == NULL)
+            appResult = APP_ERROR_ALLOC_TEXTURE;
+        else
+            nameCount++;
+    }
+    closedir(directory);
+
+    if (appResult == APP_SUCCESS)
+    {
+        qsort(names, nameCount, sizeof(char *), compareStrings);
+        if (nameCount > MAX_TEXTURES)
+        {
+            fprintf(stderr, "Only the first %d of the %u textures of %s are streamed\n", MAX_TEXTURES, nameCount, app->config.textureDirectory);
+            nameCount = MAX_TEXTURES;
+        }
+
+        streamer->textures = nameCount > 0 ? calloc(nameCount, sizeof(Texture)) : NULL;
+        if (nameCount > 0 && streamer->textures == NULL)
+            appResult = APP_ERROR_ALLOC_TEXTURE;
+        else
+            streamer->textureCount = nameCount;
+    }
+
+    // Only the headers are read now, the pixels are decoded once the frames run
+    uint32_t maxSize = app->physicalDeviceProperties.limits.maxImageDimension2D < MAX_TEXTURE_SIZE ? app->physicalDeviceProperties.limits.maxImageDimension2D : MAX_TEXTURE_SIZE;
+    for (uint32_t i = 0; appResult == APP_SUCCESS && i < streamer->textureCount; ++i)
+    {
+        Texture *texture = &streamer->textures[i];
+        size_t pathSize = strlen(app->config.textureDirectory) + strlen(names[i]) + 2;
+        texture->path = malloc(pathSize);
+        if (texture->path == NULL)
+        {
+            appResult = APP_ERROR_ALLOC_TEXTURE;
+            break;
+        }
+        snprintf(texture->path, pathSize, "%s/%s", app->config.textureDirectory, names[i]);
+
+        char header[256] = {0};
+        FILE *file = fopen(texture->path, "rb");
+        size_t headerSize = file != NULL ? fread(header, 1, sizeof(header) - 1, file) : 0;
+        if (file != NULL)
+            fclose(file);
+        header[headerSize] = '\0';
+
+        uint32_t channelCount = 0;
+        size_t dataOffset = 0;
+        if (!parseTextureHeader(header, &texture->width, &texture->height, &channelCount, &dataOffset))
+        {
+            fprintf(stderr, "Failed to load texture %s: not an 8 bit RGB or RGBA PAM, nor a binary PPM\n", texture->path);
+            appResult = APP_ERROR_LOAD_TEXTURE;
+            break;
+        }
+        if (texture->width > maxSize || texture->height > maxSize)
+        {
+            fprintf(stderr, "Failed to load texture %s: %ux%u is larger than %ux%u\n", texture->path, texture->width, texture->height, maxSize, maxSize);
+            appResult = APP_ERROR_LOAD_TEXTURE;
+            break;
+        }
+
+        uint32_t largestSide = texture->width > texture->height ? texture->width : texture->height;
+        texture->mipCount = 1;
+        while ((largestSide >> texture->mipCount) > 0)
+        {
+            texture->mipCount++;
+        }
+        texture->tailMip = 0;
+        while ((largestSide >> texture->tailMip) > TEXTURE_TAIL_SIZE)
+        {
+            texture->tailMip++;
+        }
+
+        // Without partial image copies a mip has to fit in the staging ring at once
+        texture->finestMip = 0;
+        if (app->uploader.imageRowGranularity == 0)
+        {
+            while (texture->finestMip < texture->tailMip && getTextureSize(texture, texture->finestMip) - getTextureSize(texture, texture->finestMip + 1) > UPLOAD_RING_SIZE)
+            {
+                texture->finestMip++;
+            }
+        }
+
+        texture->desiredMip = texture->tailMip;
+        texture->residentMip = texture->mipCount;
+    }
+
+    for (uint32_t i = 0; i < nameCount; ++i)
+    {
+        free(names[i]);
+    }
+    free(names);
+    if (appResult == APP_ERROR_ALLOC_TEXTURE)
+        fprintf(stderr, "Failed to allocate memory for the textures\n");
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // Every slot shows a white texel until the tail of its texture is resident, so no slot
+    // a material points to is ever left unwritten
+    appResult = createTextureImage(app, (VkExtent2D){1, 1}, 1, &streamer->placeholderImage, &streamer->placeholderImageView, &streamer->placeholderAllocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    const uint8_t white[4] = {255, 255, 255, 255};
+    appResult = uploaderBeginImage(app, streamer->placeholderImage);
+    if (appResult == APP_SUCCESS)
+        appResult = uploadToImage(app, streamer->placeholderImage, 0, 0, (VkExtent2D){1, 1}, white, sizeof(white));
+    if (appResult == APP_SUCCESS)
+        appResult = uploaderFinishImage(app, streamer->placeholderImage);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        appResult = bindlessAddSampledImage(app, streamer->placeholderImageView, &streamer->textures[i].slot);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    streamer->budget = (VkDeviceSize)app->config.textureBudgetMB * 1024 * 1024;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Texture streamer: %u textures in %s, %u MB budget, mips uploaded %s\n", streamer->textureCount, app->config.textureDirectory, app->config.textureBudgetMB,
+               app->uploader.imageRowGranularity > 0 ? "in strips of rows" : "whole");
+    }
+
+    return APP_SUCCESS;
+} // createTextureStreamer
+
+bool parseTextureHeader(const char *header, uint32_t *width, uint32_t *height, uint32_t *channelCount, size_t *dataOffset)
+{
+    uint32_t depth = 0;
+    uint32_t maxValue = 0;
+    int headerLength = 0;
+    if (strncmp(header, "P7", 2) == 0)
+    {
+        // PAM with the fields in the order the frame capture writes them, RGB or RGB_ALPHA
+        const char *headerEnd = strstr(header, "ENDHDR\n");
+        if (headerEnd == NULL || sscanf(header, "P7 WIDTH %u HEIGHT %u DEPTH %u MAXVAL %u", width, height, &depth, &maxValue) != 4)
+            return false;
+        *dataOffset = (size_t)(headerEnd - header) + strlen("ENDHDR\n");
+    }
+    else if (sscanf(header, "P6 %u %u %u%n", width, height, &maxValue, &headerLength) == 3)
+    {
+        // Binary PPM without comments, a single whitespace separates the header from the pixels
+        depth = 3;
+        *dataOffset = (size_t)headerLength + 1;
+    }
+    else
+        return false;
+
+    *channelCount = depth;
+    return (depth == 3 || depth == 4) && maxValue == 255 && *width > 0 && *height > 0;
+} // parseTextureHeader
+
+void getTextureImageCreateInfo(const App *app, VkExtent2D extent, uint32_t mipCount, const uint32_t queueFamilyIndices[2], VkImageCreateInfo *imageCreateInfo)
+{
+    *imageCreateInfo = (VkImageCreateInfo){0};
+    imageCreateInfo->sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo->imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo->format = VK_FORMAT_R8G8B8A8_SRGB;
+    imageCreateInfo->extent = (VkExtent3D){extent.width, extent.height, 1};
+    imageCreateInfo->mipLevels = mipCount;
+    imageCreateInfo->arrayLayers = 1;
+    imageCreateInfo->samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo->tiling = VK_IMAGE_TILING_OPTIMAL;
+    // Transfer source too, the mips of an image are copied to the next image of its texture
+    imageCreateInfo->usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    // The transfer queue writes the image and the graphics queue samples it, sharing it between
+    // both families saves the ownership transfers of every mip
+    if (app->transferQueueFamilyIndex != app->graphicsQueueFamilyIndex)
+    {
+        imageCreateInfo->sharingMode = VK_SHARING_MODE_CONCURRENT;
+        imageCreateInfo->queueFamilyIndexCount = 2;
+        imageCreateInfo->pQueueFamilyIndices = queueFamilyIndices;
+    }
+    else
+        imageCreateInfo->sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo->initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+} // getTextureImageCreateInfo
+
+AppResult getTextureImageSize(App *app, Texture *texture, uint32_t residentMip, VkDeviceSize *size)
+{
+    // What an image of the texture from residentMip on takes out of the budget. Only an image
+    // tells its memory requirements, a throwaway one is created the first time
+    if (texture->imageSizes[residentMip] == 0)
+    {
+        uint32_t queueFamilyIndices[2] = {app->transferQueueFamilyIndex, app->graphicsQueueFamilyIndex};
+        VkImageCreateInfo imageCreateInfo;
+        getTextureImageCreateInfo(app, getTextureMipExtent(texture, residentMip), texture->mipCount - residentMip, queueFamilyIndices, &imageCreateInfo);
+
+        VkImage image = VK_NULL_HANDLE;
+        VkResult vkResult = vkCreateImage(app->logicalDevice, &imageCreateInfo, NULL, &image);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create image: %d\n", vkResult);
+            return APP_ERROR_VULKAN_CREATE_IMAGE;
+        }
+
+        VkMemoryRequirements memoryRequirements;
+        vkGetImageMemoryRequirements(app->logicalDevice, image, &memoryRequirements);
+        vkDestroyImage(app->logicalDevice, image, NULL);
+        texture->imageSizes[residentMip] = getAllocationSize(app, &memoryRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MEMORY_RESOURCE_OPTIMAL);
+    }
+
+    *size = texture->imageSizes[residentMip];
+    return APP_SUCCESS;
+} // getTextureImageSize
+
+AppResult createTextureImage(App *app, VkExtent2D extent, uint32_t mipCount, VkImage *image, VkImageView *imageView, MemoryAllocation *allocation)
+{
+    uint32_t queueFamilyIndices[2] = {app->transferQueueFamilyIndex, app->graphicsQueueFamilyIndex};
+    VkImageCreateInfo imageCreateInfo;
+    getTextureImageCreateInfo(app, extent, mipCount, queueFamilyIndices, &imageCreateInfo);
+
+    AppResult appResult = createImage(app, &imageCreateInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, image, allocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    VkImageViewCreateInfo imageViewCreateInfo = {0};
+    imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    imageViewCreateInfo.image = *image;
+    imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    imageViewCreateInfo.format = imageCreateInfo.format;
+    imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+    imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+    imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+    imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+    imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+    imageViewCreateInfo.subresourceRange.levelCount = mipCount;
+    imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+    imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+    VkResult vkResult = vkCreateImageView(app->logicalDevice, &imageViewCreateInfo, NULL, imageView);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create texture image view: %d\n", vkResult);
+        destroyImage(app, image, allocation);
+        return APP_ERROR_VULKAN_CREATE_IMAGE_VIEW;
+    }
+
+    return APP_SUCCESS;
+} // createTextureImage
+
+AppResult decodeTexture(void *argument)
+{
+    // Only the fields the main thread leaves alone while the job runs are read, and only the
+    // decode result is written
+    const Texture *texture = argument;
+    TextureDecodeResult *result = &((Texture *)argument)->decodeResult;
+    double decodeStartMs = getTimeMs();
+
+    int fd = open(texture->path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open texture %s: %s\n", texture->path, strerror(errno));
+        return APP_ERROR_LOAD_TEXTURE;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+    {
+        fprintf(stderr, "Failed to read texture %s\n", texture->path);
+        close(fd);
+        return APP_ERROR_LOAD_TEXTURE;
+    }
+    size_t fileSize = (size_t)fileStat.st_size;
+
+    // The pixels are converted straight from the page cache
+    const uint8_t *file = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (file == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map texture %s: %s\n", texture->path, strerror(errno));
+        return APP_ERROR_LOAD_TEXTURE;
+    }
+
+    char header[256];
+    size_t headerCopySize = fileSize < sizeof(header) - 1 ? fileSize : sizeof(header) - 1;
+    memcpy(header, file, headerCopySize);
+    header[headerCopySize] = '\0';
+
+    uint32_t width = 0, height = 0, channelCount = 0;
+    size_t dataOffset = 0;
+    size_t pixelCount = (size_t)texture->width * texture->height;
+    if (!parseTextureHeader(header, &width, &height, &channelCount, &dataOffset) || width != texture->width || height != texture->height ||
+        fileSize < dataOffset + pixelCount * channelCount)
+    {
+        fprintf(stderr, "Failed to decode texture %s: the file changed since the startup or is truncated\n", texture->path);
+        munmap((void *)file, fileSize);
+        return APP_ERROR_LOAD_TEXTURE;
+    }
+
+    uint8_t *mip = malloc(pixelCount * 4);
+    if (mip == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for texture %s\n", texture->path);
+        munmap((void *)file, fileSize);
+        return APP_ERROR_ALLOC_TEXTURE;
+    }
+
+    const uint8_t *src = file + dataOffset;
+    if (channelCount == 4)
+        memcpy(mip, src, pixelCount * 4);
+    else
+    {
+        for (size_t i = 0; i < pixelCount; ++i)
+        {
+            mip[i * 4 + 0] = src[i * 3 + 0];
+            mip[i * 4 + 1] = src[i * 3 + 1];
+            mip[i * 4 + 2] = src[i * 3 + 2];
+            mip[i * 4 + 3] = 255;
+        }
+    }
+    munmap((void *)file, fileSize);
+
+    // The mips finer than pixelsFirstMip are not needed, they are reduced in place
+    for (uint32_t level = 0; level < texture->pixelsFirstMip; ++level)
+    {
+        downsampleMip(mip, getTextureMipExtent(texture, level), mip);
+    }
+
+    uint8_t *pixels = malloc(getTextureSize(texture, texture->pixelsFirstMip));
+    if (pixels == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for texture %s\n", texture->path);
+        free(mip);
+        return APP_ERROR_ALLOC_TEXTURE;
+    }
+
+    VkDeviceSize offset = 0;
+    for (uint32_t level = texture->pixelsFirstMip; level < texture->mipCount; ++level)
+    {
+        VkExtent2D extent = getTextureMipExtent(texture, level);
+        result->mipOffsets[level] = offset;
+        if (level == texture->pixelsFirstMip)
+            memcpy(pixels, mip, (size_t)extent.width * extent.height * 4);
+        else
+            downsampleMip(pixels + result->mipOffsets[level - 1], getTextureMipExtent(texture, level - 1), pixels + offset);
+        offset += (VkDeviceSize)extent.width * extent.height * 4;
+    }
+    free(mip);
+
+    result->pixels = pixels;
+    result->decodeMs = getTimeMs() - decodeStartMs;
+    return APP_SUCCESS;
+} // decodeTexture
+
+void downsampleMip(const uint8_t *src, VkExtent2D srcExtent, uint8_t *dst)
+{
+    // 2x2 box filter, the last row and column are repeated for odd sizes. dst can be src since
+    // every texel is written after the source texels it and the following texels are made of
+    uint32_t dstWidth = srcExtent.width > 1 ? srcExtent.width / 2 : 1;
+    uint32_t dstHeight = srcExtent.height > 1 ? srcExtent.height / 2 : 1;
+    for (uint32_t y = 0; y < dstHeight; ++y)
+    {
+        size_t row0 = (size_t)(2 * y < srcExtent.height ? 2 * y : srcExtent.height - 1) * srcExtent.width;
+        size_t row1 = (size_t)(2 * y + 1 < srcExtent.height ? 2 * y + 1 : srcExtent.height - 1) * srcExtent.width;
+        for (uint32_t x = 0; x < dstWidth; ++x)
+        {
+            size_t column0 = 2 * x < srcExtent.width ? 2 * x : srcExtent.width - 1;
+            size_t column1 = 2 * x + 1 < srcExtent.width ? 2 * x + 1 : srcExtent.width - 1;
+            uint8_t texel[4];
+            for (uint32_t channel = 0; channel < 4; ++channel)
+            {
+                uint32_t sum = (uint32_t)src[(row0 + column0) * 4 + channel] + src[(row0 + column1) * 4 + channel] + src[(row1 + column0) * 4 + channel] +
+                               src[(row1 + column1) * 4 + channel];
+                texel[channel] = (uint8_t)((sum + 2) / 4);
+            }
+            memcpy(&dst[((size_t)y * dstWidth + x) * 4], texel, sizeof(texel));
+        }
+    }
+} // downsampleMip
+
+VkExtent2D getTextureMipExtent(const Texture *texture, uint32_t mip)
+{
+    VkExtent2D extent = {texture->width >> mip, texture->height >> mip};
+    extent.width = extent.width > 0 ? extent.width : 1;
+    extent.height = extent.height > 0 ? extent.height : 1;
+    return extent;
+} // getTextureMipExtent
+
+VkDeviceSize getTextureSize(const Texture *texture, uint32_t firstMip)
+{
+    // Size of the RGBA texels of the mips from firstMip to the last one
+    VkDeviceSize size = 0;
+    for (uint32_t mip = firstMip; mip < texture->mipCount; ++mip)
+    {
+        VkExtent2D extent = getTextureMipExtent(texture, mip);
+        size += (VkDeviceSize)extent.width * extent.height * 4;
+    }
+    return size;
+} // getTextureSize
+
+void computeTextureCoverage(App *app)
+{
+    TextureStreamer *streamer = &app->textureStreamer;
+    streamer->coverageExtent = app->swapChainExtent;
+    streamer->coverageView = app->frameUniforms;
+    streamer->coverageFrame = app->frameStats.frameCount;
+
+    // VLA is ok here for simplicity, the pixels the unit square of texture coordinates covers
+    // on the largest visible instance of every texture
+    double footprintPixels[streamer->textureCount];
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        streamer->textures[i].coveragePixels = 0.0;
+        footprintPixels[i] = 0.0;
+    }
+
+    // The instances as the instance buffer holds them, seen through the camera of the frame
+    // uniforms the same way vert.vert and the culling pass see them
+    InstanceLayout layout = getInstanceLayout(app);
+    const FrameUniforms *view = &app->frameUniforms;
+    double halfWidth = (double)app->swapChainExtent.width / 2.0;
+    double halfHeight = (double)app->swapChainExtent.height / 2.0;
+    for (uint32_t instance = 0; instance < layout.instanceCount; ++instance)
+    {
+        InstanceData data;
+        getInstanceData(&layout, instance, &data);
+        float centerX = (data.offset[0] - view->viewOffset[0]) * view->viewScale[0];
+        float centerY = (data.offset[1] - view->viewOffset[1]) * view->viewScale[1];
+        float scaleX = data.scale * fabsf(view->viewScale[0]);
+        float scaleY = data.scale * fabsf(view->viewScale[1]);
+        if (fabsf(centerX) - TRIANGLE_BOUNDING_RADIUS * scaleX > 1.0f || fabsf(centerY) - TRIANGLE_BOUNDING_RADIUS * scaleY > 1.0f)
+            continue;
+
+        // The triangle covers half of its unit square
+        uint32_t textureIndex = getMaterialTexture(app, getInstanceMaterial(app, instance));
+        double squarePixels = (double)scaleX * scaleY * halfWidth * halfHeight;
+        streamer->textures[textureIndex].coveragePixels += squarePixels / 2.0;
+        if (squarePixels > footprintPixels[textureIndex])
+            footprintPixels[textureIndex] = squarePixels;
+    }
+
+    // The finest mip that still has at most one texel per pixel, the tail when the texture is
+    // not visible at all
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        Texture *texture = &streamer->textures[i];
+        uint32_t desiredMip = texture->tailMip;
+        if (footprintPixels[i] > 0.0)
+        {
+            double texelsPerPixel = (double)texture->width * texture->height / footprintPixels[i];
+            double mip = texelsPerPixel > 1.0 ? ceil(0.5 * log2(texelsPerPixel)) : 0.0;
+            if (mip < (double)desiredMip)
+                desiredMip = (uint32_t)mip;
+        }
+        texture->desiredMip = desiredMip > texture->finestMip ? desiredMip : texture->finestMip;
+        texture->stalled = false;
+    }
+} // computeTextureCoverage
+
+AppResult setTextureResidency(App *app, Texture *texture, uint32_t residentMip)
+{
+    TextureStreamer *streamer = &app->textureStreamer;
+
+    // The current image becomes the retired one until the frames in flight are done with it,
+    // the mips both images have are copied from it and the others from the decoded pixels
+    uint32_t previousResidentMip = texture->residentMip;
+    if (texture->image != VK_NULL_HANDLE)
+    {
+        texture->retiredImage = texture->image;
+        texture->retiredImageView = texture->imageView;
+        texture->retiredAllocation = texture->allocation;
+        texture->retiredFrame = app->frameStats.frameCount;
+        texture->image = VK_NULL_HANDLE;
+        texture->imageView = VK_NULL_HANDLE;
+        memset(&texture->allocation, 0, sizeof(MemoryAllocation));
+    }
+    texture->residentMip = texture->mipCount;
+
+    AppResult appResult = createTextureImage(app, getTextureMipExtent(texture, residentMip), texture->mipCount - residentMip, &texture->image, &texture->imageView, &texture->allocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+    texture->residentMip = residentMip;
+    streamer->usedSize += texture->allocation.size;
+    if (streamer->usedSize > streamer->peakUsedSize)
+        streamer->peakUsedSize = streamer->usedSize;
+
+    appResult = uploaderBeginImage(app, texture->image);
+    for (uint32_t mip = residentMip; mip < texture->mipCount && appResult == APP_SUCCESS; ++mip)
+    {
+        if (texture->retiredImage != VK_NULL_HANDLE && mip >= previousResidentMip)
+            appResult = uploaderCopyImageLevel(app, texture->retiredImage, mip - previousResidentMip, texture->image, mip - residentMip, getTextureMipExtent(texture, mip));
+        else
+            appResult = uploadTextureMip(app, texture, mip, texture->image, mip - residentMip);
+    }
+    if (appResult == APP_SUCCESS)
+        appResult = uploaderFinishImage(app, texture->image);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The set of this frame slot is not used by the GPU anymore, the other slots switch to the
+    // new image when their frame comes
+    bindlessWriteSampledImage(app, app->currentFrame, texture->slot, texture->imageView);
+    texture->staleSets = ((1u << app->bindless.setCount) - 1) & ~(1u << app->currentFrame);
+
+    return APP_SUCCESS;
+} // setTextureResidency
+
+AppResult uploadTextureMip(App *app, Texture *texture, uint32_t mip, VkImage image, uint32_t imageMip)
+{
+    TextureStreamer *streamer = &app->textureStreamer;
+    VkExtent2D extent = getTextureMipExtent(texture, mip);
+    VkDeviceSize rowSize = (VkDeviceSize)extent.width * 4;
+    const uint8_t *pixels = texture->pixels + texture->mipOffsets[mip];
+
+    // Large mips go in strips of whole rows so that one of them never takes the whole ring
+    uint32_t granularity = app->uploader.imageRowGranularity;
+    uint32_t stripRows = extent.height;
+    if (granularity > 0)
+    {
+        stripRows = (uint32_t)(TEXTURE_UPLOAD_STRIP / rowSize);
+        stripRows = stripRows > granularity ? stripRows - stripRows % granularity : granularity;
+        if (stripRows > extent.height)
+            stripRows = extent.height;
+    }
+
+    for (uint32_t firstRow = 0; firstRow < extent.height; firstRow += stripRows)
+    {
+        uint32_t rowCount = extent.height - firstRow < stripRows ? extent.height - firstRow : stripRows;
+        AppResult appResult = uploadToImage(app, image, imageMip, firstRow, (VkExtent2D){extent.width, rowCount}, pixels + firstRow * rowSize, rowCount * rowSize);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    streamer->stats.uploadedMipCount++;
+    streamer->stats.uploadedBytes += rowSize * extent.height;
+
+    return APP_SUCCESS;
+} // uploadTextureMip
+
+AppResult textureStreamerUpdate(App *app)
+{
+    TextureStreamer *streamer = &app->textureStreamer;
+    if (streamer->textureCount == 0)
+        return APP_SUCCESS;
+
+    // Walking every instance is not free, a moving camera updates the coverage a few times a
+    // second only
+    bool viewMoved = memcmp(&streamer->coverageView, &app->frameUniforms, sizeof(FrameUniforms)) != 0;
+    if (streamer->coverageExtent.width != app->swapChainExtent.width || streamer->coverageExtent.height != app->swapChainExtent.height ||
+        (viewMoved && app->frameStats.frameCount >= streamer->coverageFrame + TEXTURE_COVERAGE_INTERVAL))
+        computeTextureCoverage(app);
+
+    // This frame slot is done with the views it used and switches to the current ones, and the
+    // images retired framesInFlight frames ago are not used by any frame anymore
+    uint64_t frame = app->frameStats.frameCount;
+    uint32_t frameBit = 1u << app->currentFrame;
+    bool retiring = false;
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        Texture *texture = &streamer->textures[i];
+        if (texture->staleSets & frameBit)
+        {
+            bindlessWriteSampledImage(app, app->currentFrame, texture->slot, texture->imageView);
+            texture->staleSets &= ~frameBit;
+        }
+
+        if (texture->retiredImage != VK_NULL_HANDLE && frame >= texture->retiredFrame + app->config.framesInFlight)
+            destroyRetiredTexture(app, texture);
+        retiring |= texture->retiredImage != VK_NULL_HANDLE;
+
+        if (texture->image != VK_NULL_HANDLE && texture->residentMip >= texture->desiredMip)
+            texture->finestMipUsedFrame = frame;
+
+        // The pixels of a decoding texture stay NULL until the job is done, every other loop
+        // can only see a finished decode
+        if (texture->decoding && isJobDone(&app->jobPool, &texture->decodeJob))
+        {
+            texture->decoding = false;
+            if (texture->decodeJob.result != APP_SUCCESS)
+                return texture->decodeJob.result;
+            texture->pixels = texture->decodeResult.pixels;
+            memcpy(texture->mipOffsets, texture->decodeResult.mipOffsets, sizeof(texture->mipOffsets));
+            streamer->stats.decodeCount++;
+            streamer->stats.totalDecodeMs += texture->decodeResult.decodeMs;
+            memset(&texture->decodeResult, 0, sizeof(TextureDecodeResult));
+        }
+    }
+
+    // The coarse tails go first, as soon as they are decoded
+    AppResult appResult = APP_SUCCESS;
+    uint64_t uploadedBytes = streamer->stats.uploadedBytes;
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        Texture *texture = &streamer->textures[i];
+        if (texture->image != VK_NULL_HANDLE || texture->pixels == NULL)
+            continue;
+
+        if (!textureFitsBudget(app, texture, texture->tailMip, &retiring, &appResult))
+        {
+            if (appResult != APP_SUCCESS)
+                return appResult;
+            if (texture->stalled)
+                continue;
+            break;
+        }
+
+        appResult = setTextureResidency(app, texture, texture->tailMip);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    // Then one finer mip at a time for the texture covering the most pixels with a mip coarser
+    // than it needs, a texture changing its residency once per framesInFlight frames at most
+    while (streamer->stats.uploadedBytes - uploadedBytes < TEXTURE_FRAME_UPLOAD_SIZE)
+    {
+        Texture *candidate = NULL;
+        for (uint32_t i = 0; i < streamer->textureCount; ++i)
+        {
+            Texture *texture = &streamer->textures[i];
+            if (texture->image == VK_NULL_HANDLE || texture->retiredImage != VK_NULL_HANDLE || texture->pixels == NULL || texture->stalled ||
+                texture->residentMip <= texture->desiredMip || texture->residentMip <= texture->pixelsFirstMip)
+                continue;
+            if (candidate == NULL || texture->coveragePixels > candidate->coveragePixels)
+                candidate = texture;
+        }
+        if (candidate == NULL)
+            break;
+
+        if (!textureFitsBudget(app, candidate, candidate->residentMip - 1, &retiring, &appResult))
+        {
+            if (appResult != APP_SUCCESS)
+                return appResult;
+            if (candidate->stalled)
+                continue;
+            break;
+        }
+
+        appResult = setTextureResidency(app, candidate, candidate->residentMip - 1);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+        retiring = true;
+    }
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The decoded pixels are only kept while they have mips to give
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        Texture *texture = &streamer->textures[i];
+        if (texture->pixels != NULL && texture->image != VK_NULL_HANDLE && (texture->residentMip <= texture->desiredMip || texture->residentMip <= texture->pixelsFirstMip))
+            releaseTexturePixels(app, texture);
+    }
+
+    // And the next textures are decoded on the job pool, the ones without a tail first, then
+    // by coverage. Only the mips from the one they need on are kept
+    while (streamer->decodedCount < MAX_DECODED_TEXTURES)
+    {
+        Texture *next = NULL;
+        for (uint32_t i = 0; i < streamer->textureCount; ++i)
+        {
+            Texture *texture = &streamer->textures[i];
+            if (texture->decoding || texture->pixels != NULL || texture->stalled || (texture->image != VK_NULL_HANDLE && texture->residentMip <= texture->desiredMip))
+                continue;
+
+            bool hasTail = texture->image != VK_NULL_HANDLE;
+            bool nextHasTail = next != NULL && next->image != VK_NULL_HANDLE;
+            if (next == NULL || (!hasTail && nextHasTail) || (hasTail == nextHasTail && texture->coveragePixels > next->coveragePixels))
+                next = texture;
+        }
+        if (next == NULL)
+            break;
+
+        next->pixelsFirstMip = next->desiredMip;
+        memset(&next->decodeResult, 0, sizeof(TextureDecodeResult));
+        next->decoding = true;
+        streamer->decodedCount++;
+        appResult = submitJob(&app->jobPool, &next->decodeJob, decodeTexture, next);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    return APP_SUCCESS;
+} // textureStreamerUpdate
+
+bool textureFitsBudget(App *app, Texture *texture, uint32_t residentMip, bool *retiring, AppResult *appResult)
+{
+    TextureStreamer *streamer = &app->textureStreamer;
+    VkDeviceSize size = 0;
+    *appResult = getTextureImageSize(app, texture, residentMip, &size);
+    if (*appResult != APP_SUCCESS)
+        return false;
+
+    // The retired images count until they are destroyed
+    if (streamer->usedSize + size <= streamer->budget)
+        return true;
+
+    // The memory of an evicted mip is free once its image retires
+    if (evictTextureMip(app, texture, appResult))
+    {
+        *retiring = true;
+        return false;
+    }
+    if (*appResult != APP_SUCCESS || *retiring)
+        return false;
+
+    // Nothing can go and nothing is about to be freed, the texture stays as it is until the
+    // coverage changes
+    texture->stalled = true;
+    streamer->stats.stallCount++;
+    releaseTexturePixels(app, texture);
+    return false;
+} // textureFitsBudget
+
+bool evictTextureMip(App *app, const Texture *candidate, AppResult *appResult)
+{
+    TextureStreamer *streamer = &app->textureStreamer;
+    uint64_t frame = app->frameStats.frameCount;
+
+    // The least recently used finest mip goes first, among the ones still in use the one of the
+    // texture covering the fewest pixels. A mip in use is only evicted for a texture covering
+    // more pixels, and the tails are never evicted. The smaller image of the victim has to fit
+    // in the budget next to the one it replaces until that one retires
+    Texture *victim = NULL;
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        Texture *texture = &streamer->textures[i];
+        if (texture == candidate || texture->image == VK_NULL_HANDLE || texture->retiredImage != VK_NULL_HANDLE || texture->residentMip >= texture->tailMip)
+            continue;
+        if (texture->finestMipUsedFrame == frame && texture->coveragePixels >= candidate->coveragePixels)
+            continue;
+
+        VkDeviceSize size = 0;
+        *appResult = getTextureImageSize(app, texture, texture->residentMip + 1, &size);
+        if (*appResult != APP_SUCCESS)
+            return false;
+        if (streamer->usedSize + size > streamer->budget)
+            continue;
+        if (victim == NULL || texture->finestMipUsedFrame < victim->finestMipUsedFrame ||
+            (texture->finestMipUsedFrame == victim->finestMipUsedFrame && texture->coveragePixels < victim->coveragePixels))
+            victim = texture;
+    }
+    if (victim == NULL)
+        return false;
+
+    *appResult = setTextureResidency(app, victim, victim->residentMip + 1);
+    streamer->stats.evictedMipCount++;
+    return true;
+} // evictTextureMip
+
+void releaseTexturePixels(App *app, Texture *texture)
+{
+    free(texture->pixels);
+    texture->pixels = NULL;
+    app->textureStreamer.decodedCount--;
+} // releaseTexturePixels
+
+void destroyRetiredTexture(App *app, Texture *texture)
+{
+    app->textureStreamer.usedSize -= texture->retiredAllocation.size;
+    if (texture->retiredImageView != VK_NULL_HANDLE)
+        vkDestroyImageView(app->logicalDevice, texture->retiredImageView, NULL);
+    texture->retiredImageView = VK_NULL_HANDLE;
+    destroyImage(app, &texture->retiredImage, &texture->retiredAllocation);
+} // destroyRetiredTexture
+
+void printTextureStreamerStats(const App *app)
+{
+    const TextureStreamer *streamer = &app->textureStreamer;
+    const TextureStreamerStats *stats = &streamer->stats;
+    if (streamer->textureCount == 0)
+        return;
+
+    uint32_t tailCount = 0;
+    uint32_t desiredCount = 0;
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        const Texture *texture = &streamer->textures[i];
+        tailCount += texture->image != VK_NULL_HANDLE ? 1 : 0;
+        desiredCount += texture->image != VK_NULL_HANDLE && texture->residentMip <= texture->desiredMip ? 1 : 0;
+    }
+
+    printf("=========================================\n");
+    printf("Texture streaming: %u textures, %u with their tail resident, %u at the mip their coverage needs\n", streamer->textureCount, tailCount, desiredCount);
+    printf("\t%llu decodes (average %.3f ms), %llu mips uploaded (%.1f MB), %llu evicted, %llu textures stalled on the budget\n", (unsigned long long)stats->decodeCount,
+           stats->decodeCount > 0 ? stats->totalDecodeMs / (double)stats->decodeCount : 0.0, (unsigned long long)stats->uploadedMipCount,
+           (double)stats->uploadedBytes / (1024.0 * 1024.0), (unsigned long long)stats->evictedMipCount, (unsigned long long)stats->stallCount);
+    printf("\tPeak texture memory: %.1f MB of the %u MB budget\n", (double)streamer->peakUsedSize / (1024.0 * 1024.0), app->config.textureBudgetMB);
+} // printTextureStreamerStats
+
+void destroyTextureStreamer(App *app)
+{
+    TextureStreamer *streamer = &app->textureStreamer;
+
+    // The job pool is destroyed first, no decoding job can still be running. A decode result
+    // may not have been taken yet
+    for (uint32_t i = 0; i < streamer->textureCount; ++i)
+    {
+        Texture *texture = &streamer->textures[i];
+        free(texture->path);
+        free(texture->pixels);
+        free(texture->decodeResult.pixels);
+        if (texture->retiredImage != VK_NULL_HANDLE)
+            destroyRetiredTexture(app, texture);
+        if (texture->imageView != VK_NULL_HANDLE)
+            vkDestroyImageView(app->logicalDevice, texture->imageView, NULL);
+        destroyImage(app, &texture->image, &texture->allocation);
+    }
+    free(streamer->textures);
+
+    if (streamer->placeholderImageView != VK_NULL_HANDLE)
+        vkDestroyImageView(app->logicalDevice, streamer->placeholderImageView, NULL);
+    destroyImage(app, &streamer->placeholderImage, &streamer->placeholderAllocation);
+
+    memset(streamer, 0, sizeof(TextureStreamer));
+} // destroyTextureStreamer
+
+AppResult createGraphicsPipeline(App *app)
+{
+    // Set 0 is the uniform ring, set 1 the bindless set
+    AppResult appResult = createUniformRing(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    if (app->config.bindless)
+    {
+        appResult = createBindlessTable(app);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    PipelineBuild *build = NULL;
+    appResult = beginPipelineBuild(app, "graphics", app->graphicsVariants.pipelines, &build);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = loadShader(app->logicalDevice, "vert.spv", &build->shaderModules[0], app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    appResult = loadShader(app->logicalDevice, app->config.bindless ? "bindless.spv" : "frag.spv", &build->shaderModules[1], app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The create info points into the build, which stays alive until the compilation is done
+    GraphicsPipelineState *state = &build->graphicsState;
+
+    state->shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    state->shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+    state->shaderStages[0].module = build->shaderModules[0];
+    state->shaderStages[0].pName = "main";
+
+    state->shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    state->shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+    state->shaderStages[1].module = build->shaderModules[1];
+    state->shaderStages[1].pName = "main";
+
+    // Dynamic state of the Pipeline
+    state->dynamicStates[0] = VK_DYNAMIC_STATE_VIEWPORT;
+    state->dynamicStates[1] = VK_DYNAMIC_STATE_SCISSOR;
+
+    state->dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+    state->dynamicState.dynamicStateCount = ARRAY_LEN(state->dynamicStates);
+    state->dynamicState.pDynamicStates = state->dynamicStates;
+
+    // Vertex input, binding 0 advances per vertex and binding 1 per instance
+    state->bindingDescriptions[0].binding = 0;
+    state->bindingDescriptions[0].stride = sizeof(Vertex);
+    state->bindingDescriptions[0].inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+    state->bindingDescriptions[1].binding = 1;
+    state->bindingDescriptions[1].stride = sizeof(InstanceData);
+    state->bindingDescriptions[1].inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+    state->attributeDescriptions[0].location = 0;
+    state->attributeDescriptions[0].binding = 0;
+    state->attributeDescriptions[0].format = VK_FORMAT_R32G32_SFLOAT;
+    state->attributeDescriptions[0].offset = offsetof(Vertex, position);
+    state->attributeDescriptions[1].location = 1;
+    state->attributeDescriptions[1].binding = 0;
+    state->attributeDescriptions[1].format = VK_FORMAT_R32G32B32_SFLOAT;
+    state->attributeDescriptions[1].offset = offsetof(Vertex, color);
+    state->attributeDescriptions[2].location = 2;
+    state->attributeDescriptions[2].binding = 1;
+    state->attributeDescriptions[2].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+    state->attributeDescriptions[2].offset = 0;
+
+    state->vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+    state->vertexInput.vertexBindingDescriptionCount = ARRAY_LEN(state->bindingDescriptions);
+    state->vertexInput.pVertexBindingDescriptions = state->bindingDescriptions;
+    state->vertexInput.vertexAttributeDescriptionCount = ARRAY_LEN(state->attributeDescriptions);
+    state->vertexInput.pVertexAttributeDescriptions = state->attributeDescriptions;
+
+    // Input assembly
+    state->inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+    state->inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    state->inputAssembly.primitiveRestartEnable = VK_FALSE;
+
+    // Viewport and scissor, we want to draw the entire frame buffer
+    state->viewport.x = 0.0f;
+    state->viewport.y = 0.0f;
+    state->viewport.width = (float)app->swapChainExtent.width;
+    state->viewport.height = (float)app->swapChainExtent.height;
+    state->viewport.minDepth = 0.0f;
+    state->viewport.maxDepth = 1.0f;
+
+    state->scissor.offset = (VkOffset2D){0, 0};
+    state->scissor.extent = app->swapChainExtent;
+
+    state->viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+    state->viewportState.viewportCount = 1;
+    state->viewportState.pViewports = &state->viewport;
+    state->viewportState.scissorCount = 1;
+    state->viewportState.pScissors = &state->scissor;
+
+    // Rasterizer
+    state->rasterization.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+    state->rasterization.depthClampEnable = VK_FALSE;
+    state->rasterization.rasterizerDiscardEnable = VK_FALSE;
+    state->rasterization.polygonMode = VK_POLYGON_MODE_FILL;
+    state->rasterization.lineWidth = 1.0f;
+    state->rasterization.cullMode = VK_CULL_MODE_BACK_BIT;
+    state->rasterization.frontFace = VK_FRONT_FACE_CLOCKWISE;
+    state->rasterization.depthBiasEnable = VK_FALSE;
+    state->rasterization.depthBiasConstantFactor = 0.0f;
+    state->rasterization.depthBiasClamp = 0.0f;
+    state->rasterization.depthBiasSlopeFactor = 0.0f;
+
+    // Multisampling
+    state->multisample.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+    state->multisample.sampleShadingEnable = VK_FALSE;
+    state->multisample.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+    state->multisample.minSampleShading = 1.0f;
+    state->multisample.pSampleMask = NULL;
+    state->multisample.alphaToCoverageEnable = VK_FALSE;
+    state->multisample.alphaToOneEnable = VK_FALSE;
+
+    // For now we don´t need depth and stencil testing
+
+    // Color blending
+    state->colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+    state->colorBlendAttachment.blendEnable = VK_FALSE;
+    state->colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
+    state->colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
+    state->colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+    state->colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+    state->colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
+    state->colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+
+    state->colorBlend.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+    state->colorBlend.logicOpEnable = VK_FALSE;
+    state->colorBlend.logicOp = VK_LOGIC_OP_COPY;
+    state->colorBlend.attachmentCount = 1;
+    state->colorBlend.pAttachments = &state->colorBlendAttachment;
+    state->colorBlend.blendConstants[0] = 0.0f;
+    state->colorBlend.blendConstants[1] = 0.0f;
+    state->colorBlend.blendConstants[2] = 0.0f;
+    state->colorBlend.blendConstants[3] = 0.0f;
+
+    // Pipeline layout: the per frame data comes from the uniform ring, the per draw data from
+    // push constants
+    VkDescriptorSetLayout setLayouts[2] = {app->uniformRing.setLayout, app->bindless.setLayout};
+
+    VkPushConstantRange pushConstantRange = {0};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(DrawPushConstants);
+
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {0};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = app->bindless.setLayout != VK_NULL_HANDLE ? 2 : 1;
+    pipelineLayoutCreateInfo.pSetLayouts = setLayouts;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    VkResult vkResult = vkCreatePipelineLayout(app->logicalDevice, &pipelineLayoutCreateInfo, NULL, &app->pipelineLayout);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create pipeline layout: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_PIPELINE_LAYOUT;
+    }
+
+    // Finally we can create the graphics pipeline
+    VkGraphicsPipelineCreateInfo *pipelineCreateInfo = &build->graphicsCreateInfo;
+    pipelineCreateInfo->sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo->stageCount = ARRAY_LEN(state->shaderStages);
+    pipelineCreateInfo->pStages = state->shaderStages;
+    pipelineCreateInfo->pVertexInputState = &state->vertexInput;
+    pipelineCreateInfo->pInputAssemblyState = &state->inputAssembly;
+    pipelineCreateInfo->pViewportState = &state->viewportState;
+    pipelineCreateInfo->pRasterizationState = &state->rasterization;
+    pipelineCreateInfo->pMultisampleState = &state->multisample;
+    pipelineCreateInfo->pDepthStencilState = NULL;
+    pipelineCreateInfo->pColorBlendState = &state->colorBlend;
+    pipelineCreateInfo->pDynamicState = &state->dynamicState;
+    pipelineCreateInfo->layout = app->pipelineLayout;
+    pipelineCreateInfo->renderPass = app->renderPass;
+    pipelineCreateInfo->subpass = 0;
+
+    // Without a render pass the pipeline is told the formats of the attachments it renders to
+    if (app->dynamicRendering)
+    {
+        state->colorAttachmentFormat = app->selectedDeviceSurfaceFormat.format;
+        state->rendering.sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO_KHR;
+        state->rendering.colorAttachmentCount = 1;
+        state->rendering.pColorAttachmentFormats = &state->colorAttachmentFormat;
+        state->rendering.depthAttachmentFormat = VK_FORMAT_UNDEFINED;
+        state->rendering.stencilAttachmentFormat = VK_FORMAT_UNDEFINED;
+        pipelineCreateInfo->pNext = &state->rendering;
+    }
+    pipelineCreateInfo->basePipelineHandle = VK_NULL_HANDLE;
+    pipelineCreateInfo->basePipelineIndex = -1;
+
+    appResult = specializeGraphicsPipeline(app, build);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    return submitPipelineBuild(app, build);
+} // createGraphicsPipeline
+
+AppResult specializeGraphicsPipeline(App *app, PipelineBuild *build)
+{
+    PipelineVariants *variants = &app->graphicsVariants;
+
+    // The features a run needs or not from start to end are set in every variant, one variant
+    // is compiled per combination of the features that change from frame to frame
+    variants->staticFeatures = 0;
+    if (app->config.instanceCount > 1)
+        variants->staticFeatures |= PIPELINE_FEATURE_ROTATION;
+    if (app->config.textureDirectory != NULL)
+        variants->staticFeatures |= PIPELINE_FEATURE_TEXTURES;
+    uint32_t dynamicFeatures = PIPELINE_FEATURE_CAMERA;
+
+    // Enumerating the subsets of the dynamic features from the full set down makes the first
+    // variant the one with every feature, which draws correctly whatever the state
+    variants->count = 0;
+    uint32_t subset = dynamicFeatures;
+    for (;;)
+    {
+        uint32_t features = variants->staticFeatures | subset;
+        uint32_t index = variants->count++;
+        PipelineVariantBuild *variant = &build->variants[index];
+
+        // Both stages share the constants, a stage ignores the ones its module does not declare
+        for (uint32_t i = 0; i < PIPELINE_FEATURE_COUNT; ++i)
+        {
+            variant->constants[i] = (features & (1u << i)) ? VK_TRUE : VK_FALSE;
+            variant->mapEntries[i].constantID = i;
+            variant->mapEntries[i].offset = i * sizeof(VkBool32);
+            variant->mapEntries[i].size = sizeof(VkBool32);
+        }
+        variant->specializationInfo.mapEntryCount = PIPELINE_FEATURE_COUNT;
+        variant->specializationInfo.pMapEntries = variant->mapEntries;
+        variant->specializationInfo.dataSize = sizeof(variant->constants);
+        variant->specializationInfo.pData = variant->constants;
+
+        for (uint32_t i = 0; i < ARRAY_LEN(variant->shaderStages); ++i)
+        {
+            variant->shaderStages[i] = build->graphicsState.shaderStages[i];
+            variant->shaderStages[i].pSpecializationInfo = &variant->specializationInfo;
+        }
+
+        // The variants only differ by their constants, the base one gives the driver a
+        // pipeline to derive the others from. Drivers without a use for derivatives ignore them
+        VkGraphicsPipelineCreateInfo *createInfo = &build->variantCreateInfos[index];
+        *createInfo = build->graphicsCreateInfo;
+        createInfo->pStages = variant->shaderStages;
+        if (index == 0)
+            createInfo->flags |= VK_PIPELINE_CREATE_ALLOW_DERIVATIVES_BIT;
+        else
+        {
+            createInfo->flags |= VK_PIPELINE_CREATE_DERIVATIVE_BIT;
+            createInfo->basePipelineHandle = VK_NULL_HANDLE;
+            createInfo->basePipelineIndex = 0;
+        }
+
+        variants->features[index] = features;
+        AppResult appResult = insertPipelineVariant(variants, features, index);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+
+        if (subset == 0)
+            break;
+        subset = (subset - 1) & dynamicFeatures;
+    }
+    build->pipelineCount = variants->count;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Graphics pipeline variants:");
+        for (uint32_t i = 0; i < variants->count; ++i)
+        {
+            printf(" 0x%x%s", variants->features[i], i == 0 ? " (base)" : "");
+        }
+        printf("\n");
+    }
+
+    return APP_SUCCESS;
+} // specializeGraphicsPipeline
+
+uint32_t hashPipelineFeatures(uint32_t features)
+{
+    // Fibonacci hashing, the top bits of the product are the best mixed
+    return (features * 2654435761u) >> (32 - PIPELINE_VARIANT_TABLE_BITS);
+} // hashPipelineFeatures
+
+AppResult insertPipelineVariant(PipelineVariants *variants, uint32_t features, uint32_t index)
+{
+    // Open addressing with linear probing, the table is never more than half full
+    uint32_t mask = (1u << PIPELINE_VARIANT_TABLE_BITS) - 1;
+    for (uint32_t slot = hashPipelineFeatures(features), probe = 0; probe <= mask; slot = (slot + 1) & mask, ++probe)
+    {
+        if (variants->table[slot] == 0)
+        {
+            variants->table[slot] = (uint8_t)(index + 1);
+            return APP_SUCCESS;
+        }
+    }
+
+    fprintf(stderr, "Too many pipeline variants, at most %d can be compiled\n", MAX_PIPELINE_VARIANTS);
+    return APP_ERROR_TOO_MANY_PIPELINES;
+} // insertPipelineVariant
+
+VkPipeline findPipelineVariant(const PipelineVariants *variants, uint32_t features)
+{
+    uint32_t mask = (1u << PIPELINE_VARIANT_TABLE_BITS) - 1;
+    for (uint32_t slot = hashPipelineFeatures(features); variants->table[slot] != 0; slot = (slot + 1) & mask)
+    {
+        uint32_t index = variants->table[slot] - 1;
+        if (variants->features[index] == features)
+            return variants->pipelines[index];
+    }
+
+    // Every combination a run can reach is compiled, the base variant covers any other anyway
+    return variants->pipelines[0];
+} // findPipelineVariant
+
+uint32_t getPipelineFeatures(const App *app)
+{
+    // Skip the view transform while the camera is where it starts
+    uint32_t features = app->graphicsVariants.staticFeatures;
+    const FrameUniforms *uniforms = &app->frameUniforms;
+    if (uniforms->viewOffset[0] != 0.0f || uniforms->viewOffset[1] != 0.0f || uniforms->viewScale[0] != 1.0f || uniforms->viewScale[1] != 1.0f)
+        features |= PIPELINE_FEATURE_CAMERA;
+    return features;
+} // getPipelineFeatures
+
+void destroyPipelineVariants(App *app)
+{
+    PipelineVariants *variants = &app->graphicsVariants;
+    for (uint32_t i = 0; i < variants->count; ++i)
+    {
+        if (variants->pipelines[i] != VK_NULL_HANDLE)
+            vkDestroyPipeline(app->logicalDevice, variants->pipelines[i], NULL);
+    }
+    memset(variants, 0, sizeof(PipelineVariants));
+} // destroyPipelineVariants
+
+AppResult beginPipelineBuild(App *app, const char *name, VkPipeline *pipeline, PipelineBuild **build)
+{
+    if (app->pipelineBuildCount >= MAX_PIPELINE_BUILDS)
+    {
+        fprintf(stderr, "Too many pipelines, at most %d can be compiled\n", MAX_PIPELINE_BUILDS);
+        return APP_ERROR_TOO_MANY_PIPELINES;
+    }
+
+    // The builds are heap allocated so that the create infos pointing into them do not move
+    // while a worker reads them
+    PipelineBuild *newBuild = calloc(1, sizeof(PipelineBuild));
+    if (newBuild == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for the %s pipeline build\n", name);
+        return APP_ERROR_ALLOC_PIPELINE_BUILD;
+    }
+
+    newBuild->app = app;
+    newBuild->name = name;
+    newBuild->pipeline = pipeline;
+    newBuild->pipelineCount = 1;
+    app->pipelineBuilds[app->pipelineBuildCount++] = newBuild;
+
+    *build = newBuild;
+    return APP_SUCCESS;
+} // beginPipelineBuild
+
+AppResult submitPipelineBuild(App *app, PipelineBuild *build)
+{
+    return submitJob(&app->jobPool, &build->job, compilePipeline, build);
+} // submitPipelineBuild
+
+AppResult compilePipeline(void *argument)
+{
+    PipelineBuild *build = argument;
+    App *app = build->app;
+
+    // The pipeline cache is internally synchronized, every worker compiles into the same one
+    double compileStartMs = getTimeMs();
+    VkResult vkResult;
+    if (build->compute)
+        vkResult = vkCreateComputePipelines(app->logicalDevice, app->pipelineCache, 1, &build->computeCreateInfo, NULL, build->pipeline);
+    else
+        vkResult = vkCreateGraphicsPipelines(app->logicalDevice, app->pipelineCache, build->pipelineCount, build->variantCreateInfos, NULL, build->pipeline);
+    build->compileMs = getTimeMs() - compileStartMs;
+
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create %s pipeline: %d\n", build->name, vkResult);
+        return build->compute ? APP_ERROR_VULKAN_CREATE_COMPUTE_PIPELINE : APP_ERROR_VULKAN_CREATE_GRAPHICS_PIPELINE;
+    }
+
+    return APP_SUCCESS;
+} // compilePipeline
+
+AppResult waitForPipelineBuilds(App *app)
+{
+    // Every build is waited for even after a failure so that none is left running
+    AppResult result = APP_SUCCESS;
+    for (uint32_t i = 0; i < app->pipelineBuildCount; ++i)
+    {
+        AppResult buildResult = waitForJob(&app->jobPool, &app->pipelineBuilds[i]->job);
+        if (result == APP_SUCCESS)
+            result = buildResult;
+    }
+
+    if (verbose && result == APP_SUCCESS)
+    {
+        printf("=========================================\n");
+        printf("Pipelines compiled on %u threads:\n", app->jobPool.threadCount);
+        for (uint32_t i = 0; i < app->pipelineBuildCount; ++i)
+        {
+            printf("\t%-12s %8.3f ms\n", app->pipelineBuilds[i]->name, app->pipelineBuilds[i]->compileMs);
+        }
+    }
+
+    destroyPipelineBuilds(app);
+    return result;
+} // waitForPipelineBuilds
+
+void destroyPipelineBuilds(App *app)
+{
+    // The modules are only needed while the pipelines are being created
+    for (uint32_t i = 0; i < app->pipelineBuildCount; ++i)
+    {
+        PipelineBuild *build = app->pipelineBuilds[i];
+        for (uint32_t j = 0; j < ARRAY_LEN(build->shaderModules); ++j)
+        {
+            if (build->shaderModules[j] != VK_NULL_HANDLE)
+                vkDestroyShaderModule(app->logicalDevice, build->shaderModules[j], NULL);
+        }
+        free(build);
+        app->pipelineBuilds[i] = NULL;
+    }
+    app->pipelineBuildCount = 0;
+} // destroyPipelineBuilds
+
+AppResult createJobPool(App *app)
+{
+    JobPool *jobPool = &app->jobPool;
+
+    if (pthread_mutex_init(&jobPool->mutex, NULL) != 0 || pthread_cond_init(&jobPool->jobAvailable, NULL) != 0 ||
+        pthread_cond_init(&jobPool->jobFinished, NULL) != 0)
+    {
+        fprintf(stderr, "Failed to create the job pool synchronization objects\n");
+        return APP_ERROR_CREATE_THREAD;
+    }
+    jobPool->synchronizationCreated = true;
+
+    // Without threads the jobs run on the submitting thread
+    for (uint32_t i = 0; i < app->config.compileThreadCount; ++i)
+    {
+        if (pthread_create(&jobPool->threads[i], NULL, jobPoolWorkerMain, jobPool) != 0)
+        {
+            fprintf(stderr, "Failed to create job pool thread %u\n", i);
+            return APP_ERROR_CREATE_THREAD;
+        }
+        jobPool->threadCount++;
+    }
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Job pool with %u threads\n", jobPool->threadCount);
+    }
+
+    return APP_SUCCESS;
+} // createJobPool
+
+void *jobPoolWorkerMain(void *argument)
+{
+    JobPool *jobPool = argument;
+
+    pthread_mutex_lock(&jobPool->mutex);
+    for (;;)
+    {
+        while (!jobPool->quit && jobPool->head == NULL)
+            pthread_cond_wait(&jobPool->jobAvailable, &jobPool->mutex);
+        if (jobPool->quit)
+            break;
+
+        Job *job = jobPool->head;
+        jobPool->head = job->next;
+        if (jobPool->head == NULL)
+            jobPool->tail = NULL;
+        pthread_mutex_unlock(&jobPool->mutex);
+
+        AppResult result = job->function(job->argument);
+
+        pthread_mutex_lock(&jobPool->mutex);
+        job->result = result;
+        job->done = true;
+        pthread_cond_broadcast(&jobPool->jobFinished);
+    }
+    pthread_mutex_unlock(&jobPool->mutex);
+
+    return NULL;
+} // jobPoolWorkerMain
+
+AppResult submitJob(JobPool *jobPool, Job *job, JobFunction function, void *argument)
+{
+    job->function = function;
+    job->argument = argument;
+    job->next = NULL;
+    job->done = false;
+    job->submitted = true;
+
+    if (jobPool->threadCount == 0)
+    {
+        job->result = function(argument);
+        job->done = true;
+        return APP_SUCCESS;
+    }
+
+    pthread_mutex_lock(&jobPool->mutex);
+    if (jobPool->tail != NULL)
+        jobPool->tail->next = job;
+    else
+        jobPool->head = job;
+    jobPool->tail = job;
+    pthread_cond_signal(&jobPool->jobAvailable);
+    pthread_mutex_unlock(&jobPool->mutex);
+
+    return APP_SUCCESS;
+} // submitJob
+
+AppResult waitForJob(JobPool *jobPool, Job *job)
+{
+    // A job that never made it to the queue has nothing to wait for
+    if (!job->submitted)
+        return APP_SUCCESS;
+
+    if (jobPool->threadCount > 0)
+    {
+        pthread_mutex_lock(&jobPool->mutex);
+        while (!job->done)
+            pthread_cond_wait(&jobPool->jobFinished, &jobPool->mutex);
+        pthread_mutex_unlock(&jobPool->mutex);
+    }
+
+    return job->result;
+} // waitForJob
+
+bool isJobDone(JobPool *jobPool, Job *job)
+{
+    if (!job->submitted || jobPool->threadCount == 0)
+        return true;
+
+    pthread_mutex_lock(&jobPool->mutex);
+    bool done = job->done;
+    pthread_mutex_unlock(&jobPool->mutex);
+
+    return done;
+} // isJobDone
+
+void destroyJobPool(App *app)
+{
+    JobPool *jobPool = &app->jobPool;
+    if (!jobPool->synchronizationCreated)
+        return;
+
+    // The jobs still in the queue are dropped, the running ones are finished first
+    pthread_mutex_lock(&jobPool->mutex);
+    jobPool->quit = true;
+    pthread_cond_broadcast(&jobPool->jobAvailable);
+    pthread_mutex_unlock(&jobPool->mutex);
+
+    for (uint32_t i = 0; i < jobPool->threadCount; ++i)
+    {
+        pthread_join(jobPool->threads[i], NULL);
+    }
+
+    pthread_cond_destroy(&jobPool->jobFinished);
+    pthread_cond_destroy(&jobPool->jobAvailable);
+    pthread_mutex_destroy(&jobPool->mutex);
+
+    memset(jobPool, 0, sizeof(JobPool));
+} // destroyJobPool
+
+AppResult createPipelineCache(App *app)
+{
+    void *initialData = NULL;
+    size_t initialDataSize = 0;
+    if (app->config.pipelineCachePath != NULL)
+        loadPipelineCacheData(app->config.pipelineCachePath, &app->physicalDeviceProperties, &initialData, &initialDataSize);
+
+    VkPipelineCacheCreateInfo pipelineCacheCreateInfo = {0};
+    pipelineCacheCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    pipelineCacheCreateInfo.initialDataSize = initialDataSize;
+    pipelineCacheCreateInfo.pInitialData = initialData;
+
+    VkResult vkResult = vkCreatePipelineCache(app->logicalDevice, &pipelineCacheCreateInfo, NULL, &app->pipelineCache);
+    free(initialData);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create pipeline cache: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_PIPELINE_CACHE;
+    }
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        if (initialDataSize > 0)
+            printf("Pipeline cache loaded from %s (%zu bytes)\n", app->config.pipelineCachePath, initialDataSize);
+        else
+            printf("Starting with an empty pipeline cache\n");
+    }
+
+    return APP_SUCCESS;
+} // createPipelineCache
+
+bool loadPipelineCacheData(const char *path, const VkPhysicalDeviceProperties *deviceProperties, void **data, size_t *dataSize)
+{
+    // A missing cache file is the normal case on the first run
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    rewind(file);
+
+    // The header is made of headerSize, headerVersion, vendorID and deviceID as 32 bits
+    // little endian values followed by the pipelineCacheUUID
+    const size_t headerSize = 16 + VK_UUID_SIZE;
+    if (fileSize < (long)headerSize)
+    {
+        fclose(file);
+        return false;
+    }
+
+    uint8_t *buffer = malloc((size_t)fileSize);
+    if (buffer == NULL)
+    {
+        fclose(file);
+        return false;
+    }
+
+    size_t bytesRead = fread(buffer, 1, (size_t)fileSize, file);
+    fclose(file);
+    if (bytesRead != (size_t)fileSize)
+    {
+        free(buffer);
+        return false;
+    }
+
+    uint32_t header[4];
+    for (uint32_t i = 0; i < 4; ++i)
+    {
+        header[i] = (uint32_t)buffer[i * 4] | (uint32_t)buffer[i * 4 + 1] << 8 | (uint32_t)buffer[i * 4 + 2] << 16 | (uint32_t)buffer[i * 4 + 3] << 24;
+    }
+
+    // The driver would silently ignore data from another device or driver version, but we
+    // want to know about it and not feed it garbage in the first place
+    bool valid = header[0] >= headerSize && header[0] <= (uint32_t)fileSize &&
+                 header[1] == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                 header[2] == deviceProperties->vendorID &&
+                 header[3] == deviceProperties->deviceID &&
+                 memcmp(buffer + 16, deviceProperties->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+    if (!valid)
+    {
+        if (verbose)
+            printf("Ignoring pipeline cache %s, it was created by another device or driver\n", path);
+        free(buffer);
+        return false;
+    }
+
+    *data = buffer;
+    *dataSize = (size_t)fileSize;
+    return true;
+} // loadPipelineCacheData
+
+void savePipelineCache(App *app)
+{
+    if (app->pipelineCache == VK_NULL_HANDLE || app->config.pipelineCachePath == NULL)
+        return;
+
+    size_t dataSize = 0;
+    VkResult vkResult = vkGetPipelineCacheData(app->logicalDevice, app->pipelineCache, &dataSize, NULL);
+    if (vkResult != VK_SUCCESS || dataSize == 0)
+        return;
+
+    void *data = malloc(dataSize);
+    if (data == NULL)
+        return;
+
+    vkResult = vkGetPipelineCacheData(app->logicalDevice, app->pipelineCache, &dataSize, data);
+    if (vkResult != VK_SUCCESS)
+    {
+        free(data);
+        return;
+    }
+
+    // The cache is written next to its final location and then renamed over it so that a
+    // crash or a concurrent run never leaves a truncated cache behind
+    char tmpPath[4096];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", app->config.pipelineCachePath, (long)getpid());
+
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open %s to save the pipeline cache\n", tmpPath);
+        free(data);
+        return;
+    }
+
+    bool written = fwrite(data, 1, dataSize, file) == dataSize && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+    free(data);
+
+    if (!written || rename(tmpPath, app->config.pipelineCachePath) != 0)
+    {
+        fprintf(stderr, "Failed to save the pipeline cache to %s\n", app->config.pipelineCachePath);
+        remove(tmpPath);
+        return;
+    }
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Pipeline cache saved to %s (%zu bytes)\n", app->config.pipelineCachePath, dataSize);
+    }
+} // savePipelineCache
+
+AppResult createRenderPass(App *app)
+{
+    // Dynamic rendering describes the attachments when the pass begins instead
+    if (app->dynamicRendering)
+        return APP_SUCCESS;
+
+    // Firs we need to create the color attachment
+    VkAttachmentDescription colorAttachment = {0};
+    colorAttachment.format = app->selectedDeviceSurfaceFormat.format;
+    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+    // Then the attachment reference for the subpass
+    VkAttachmentReference colorAttachmentRef = {0};
+    colorAttachmentRef.attachment = 0;
+    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+    // Now we can create the subpass
+    VkSubpassDescription subpass = {0};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 1;
+    subpass.pColorAttachments = &colorAttachmentRef;
+
+    // The image available semaphore is waited on at the color attachment output stage, so
+    // the layout transition at the start of the render pass has to wait for that stage too
+    VkSubpassDependency dependency = {0};
+    dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependency.dstSubpass = 0;
+    dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.srcAccessMask = 0;
+    dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+    // Finally we can create the render pass
+    VkRenderPassCreateInfo renderPassCreateInfo = {0};
+    renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassCreateInfo.attachmentCount = 1;
+    renderPassCreateInfo.pAttachments = &colorAttachment;
+    renderPassCreateInfo.subpassCount = 1;
+    renderPassCreateInfo.pSubpasses = &subpass;
+    renderPassCreateInfo.dependencyCount = 1;
+    renderPassCreateInfo.pDependencies = &dependency;
+
+    VkResult vkResult = vkCreateRenderPass(app->logicalDevice, &renderPassCreateInfo, NULL, &app->renderPass);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create render pass: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_RENDER_PASS;
+    }
+
+    return APP_SUCCESS;
+}
+
+AppResult loadShader(VkDevice device, const char *name, VkShaderModule *shaderModule, App *app)
+{
+    // The module is created on the given device, the device benchmark loads its shader before
+    // app->logicalDevice exists
+    double loadStartMs = getTimeMs();
+    AppResult appResult = APP_SUCCESS;
+
+    if (app->config.shaderSource == SHADER_SOURCE_EMBEDDED)
+    {
+        appResult = loadEmbeddedShader(device, name, shaderModule);
+    }
+    else
+    {
+        char path[4096];
+        snprintf(path, sizeof(path), "%s/%s", app->config.shaderDirectory, name);
+        if (app->config.shaderSource == SHADER_SOURCE_MMAP)
+            appResult = loadMappedShader(device, path, shaderModule);
+        else
+            appResult = loadReadShader(device, path, shaderModule);
+    }
+
+    if (verbose && appResult == APP_SUCCESS)
+    {
+        const char *sourceNames[] = {"embedded", "mmap", "read"};
+        printf("=========================================\n");
+        printf("Shader %s loaded (%s) in %.3f ms\n", name, sourceNames[app->config.shaderSource], getTimeMs() - loadStartMs);
+    }
+
+    return appResult;
+} // loadShader
+
+AppResult loadEmbeddedShader(VkDevice device, const char *name, VkShaderModule *shaderModule)
+{
+    for (uint32_t i = 0; i < ARRAY_LEN(embeddedShaders); ++i)
+    {
+        if (strcmp(embeddedShaders[i].name, name) == 0)
+            return createShaderModule(device, embeddedShaders[i].code, embeddedShaders[i].codeSize, shaderModule);
+    }
+
+    fprintf(stderr, "Shader %s is not embedded in the binary\n", name);
+    return APP_ERROR_EMBEDDED_SHADER_NOT_FOUND;
+} // loadEmbeddedShader
+
+AppResult loadMappedShader(VkDevice device, const char *path, VkShaderModule *shaderModule)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open file: %s\n", path);
+        return APP_ERROR_FAILED_TO_OPEN_FILE;
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size <= 0)
+    {
+        fprintf(stderr, "Failed to read file: %s\n", path);
+        close(fd);
+        return APP_ERROR_READ_SHADER_FILE;
+    }
+    size_t fileSize = (size_t)fileStat.st_size;
+
+    // The mapping is page aligned so it satisfies the uint32_t alignment of pCode and the
+    // driver reads the SPIR-V straight from the page cache
+    void *code = mmap(NULL, fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (code == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map file: %s\n", path);
+        return APP_ERROR_MAP_SHADER_FILE;
+    }
+
+    AppResult appResult = createShaderModule(device, code, fileSize, shaderModule);
+    munmap(code, fileSize);
+
+    return appResult;
+} // loadMappedShader
+
+AppResult loadReadShader(VkDevice device, const char *path, VkShaderModule *shaderModule)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open file: %s\n", path);
+        return APP_ERROR_FAILED_TO_OPEN_FILE;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long fileSize = ftell(file);
+    rewind(file);
+    if (fileSize <= 0)
+    {
+        fprintf(stderr, "Failed to read file: %s\n", path);
+        fclose(file);
+        return APP_ERROR_READ_SHADER_FILE;
+    }
+
+    // malloc returns memory suitably aligned for the uint32_t words of pCode
+    char *buffer = malloc((size_t)fileSize);
+    if (buffer == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for shader: %s\n", path);
+        fclose(file);
+        return APP_ERROR_ALLOC_SHADER_BUFFER;
+    }
+
+    size_t bytesRead = fread(buffer, 1, (size_t)fileSize, file);
+    fclose(file);
+    if (bytesRead != (size_t)fileSize)
+    {
+        fprintf(stderr, "Failed to read file: %s\n", path);
+        free(buffer);
+        return APP_ERROR_READ_SHADER_FILE;
+    }
+
+    AppResult appResult = createShaderModule(device, buffer, (size_t)fileSize, shaderModule);
+    free(buffer);
+
+    return appResult;
+} // loadReadShader
+
+AppResult createShaderModule(VkDevice device, const void *code, size_t codeSize, VkShaderModule *shaderModule)
+{
+    // SPIR-V is a stream of 32 bits words
+    if (codeSize % sizeof(uint32_t) != 0)
+    {
+        fprintf(stderr, "Invalid SPIR-V size: %zu\n", codeSize);
+        return APP_ERROR_READ_SHADER_FILE;
+    }
+
+    VkShaderModuleCreateInfo shaderModuleCreateInfo = {0};
+    shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+    shaderModuleCreateInfo.codeSize = codeSize;
+    shaderModuleCreateInfo.pCode = (const uint32_t *)code;
+
+    VkResult vkResult = vkCreateShaderModule(device, &shaderModuleCreateInfo, NULL, shaderModule);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create shader module: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_SHADER_MODULE;
+    }
+
+    return APP_SUCCESS;
+} // createShaderModule
+
+AppResult createImageViews(App *app)
+{
+    // First we need to create the image views
+    // Destroyed in the cleanup function
+    app->swapChainImageViews = malloc(app->swapChainImageCount * sizeof(VkImageView));
+    if (app->swapChainImageViews == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for swap chain image views\n");
+        return APP_ERROR_VULKAN_ALLOC_SWAP_CHAIN_IMAGE_VIEWS;
+    }
+
+    for (uint32_t i = 0; i < app->swapChainImageCount; ++i)
+    {
+        VkImageViewCreateInfo imageViewCreateInfo = {0};
+        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        imageViewCreateInfo.image = app->swapChainImages[i];
+        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        imageViewCreateInfo.format = app->selectedDeviceSurfaceFormat.format;
+        imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
+        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
+        imageViewCreateInfo.subresourceRange.levelCount = 1;
+        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
+        imageViewCreateInfo.subresourceRange.layerCount = 1;
+
+        VkResult vkResult = vkCreateImageView(app->logicalDevice, &imageViewCreateInfo, NULL, &app->swapChainImageViews[i]);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create image view: %d\n", vkResult);
+            return APP_ERROR_VULKAN_CREATE_IMAGE_VIEW;
+        }
+    }
+
+    return APP_SUCCESS;
+}
+
+AppResult createSwapChain(App *app, VkSwapchainKHR oldSwapChain)
+{
+    // First we need to set the optimal swap chain parameters, the format and the present
+    // mode do not change when the swap chain is recreated, only the extent does
+    AppResult appResult = APP_SUCCESS;
+    if (oldSwapChain == VK_NULL_HANDLE)
+        appResult = setOptimalSwapChainParameters(app);
+    else
+        appResult = updateSwapChainExtent(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // Then we have to decide how many images we want in the swap chain, the present policy
+    // asks for the minimum or one more unless the count was given explicitly, either way it
+    // has to stay within the surface limits. 0 in maxImageCount means that there is no maximum
+    uint32_t minImageCount = app->selectedDeviceSurfaceCapabilities.minImageCount;
+    uint32_t maxImageCount = app->selectedDeviceSurfaceCapabilities.maxImageCount;
+    uint32_t imageCount = minImageCount + presentPolicies[app->config.presentPolicy].extraImageCount;
+    if (app->config.swapChainImageCount > 0)
+        imageCount = app->config.swapChainImageCount;
+    if (imageCount < minImageCount)
+        imageCount = minImageCount;
+    if (maxImageCount > 0 && imageCount > maxImageCount)
+        imageCount = maxImageCount;
+
+    if (verbose && oldSwapChain == VK_NULL_HANDLE && app->config.swapChainImageCount > 0 && imageCount != app->config.swapChainImageCount)
+        printf("%u swap chain images requested, the surface supports %u to %u\n", app->config.swapChainImageCount, minImageCount, maxImageCount);
+
+    // Now we can create the swap chain create info struct
+    VkSwapchainCreateInfoKHR swapChainCreateInfo = {0};
+    swapChainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
+    swapChainCreateInfo.surface = app->surface;
+    swapChainCreateInfo.minImageCount = imageCount;
+    swapChainCreateInfo.imageFormat = app->selectedDeviceSurfaceFormat.format;
+    swapChainCreateInfo.imageColorSpace = app->selectedDeviceSurfaceFormat.colorSpace;
+    swapChainCreateInfo.imageExtent = app->swapChainExtent;
+    swapChainCreateInfo.imageArrayLayers = 1;
+    swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+
+    // The frame capture and the frame stream copy the rendered images out of the swap chain
+    if (app->config.captureMode != CAPTURE_MODE_NONE || app->config.streamPath != NULL)
+    {
+        if ((app->selectedDeviceSurfaceCapabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT) == 0)
+        {
+            fprintf(stderr, "Failed to create swap chain: the surface images cannot be copied from, the frame readback needs it\n");
+            return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
+        }
+        swapChainCreateInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+    }
+
+    /*
+    From the vulkan tutorial:
+    https://vulkan-tutorial.com/Drawing_a_triangle/Presentation/Swap_chain
+    "we need to specify how to handle swap chain images that will be used across multiple queue families. That will be the case in our application if the graphics queue family is different from the presentation queue. We'll be drawing on the images in the swap chain from the graphics queue and then submitting them on the presentation queue. There are two ways to handle images that are accessed from multiple queues:
+
+    - VK_SHARING_MODE_EXCLUSIVE: An image is owned by one queue family at a time and ownership must be explicitly transferred before using it in another queue family. This option offers the best performance.
+    - VK_SHARING_MODE_CONCURRENT: Images can be used across multiple queue families without explicit ownership transfers.
+
+    If the queue families differ, then we'll be using the concurrent mode in this tutorial to avoid having to do the ownership chapters, because these involve some concepts that are better explained at a later time. Concurrent mode requires you to specify in advance between which queue families ownership will be shared using the queueFamilyIndexCount and pQueueFamilyIndices parameters. If the graphics queue family and presentation queue family are the same, which will be the case on most hardware, then we should stick to exclusive mode, because concurrent mode requires you to specify at least two distinct queue families"
+    */
+    uint32_t queueFamilyIndices[] = {app->graphicsQueueFamilyIndex, app->presentationQueueFamilyIndex};
+    if (app->graphicsQueueFamilyIndex != app->presentationQueueFamilyIndex)
+    {
+        swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
+        swapChainCreateInfo.queueFamilyIndexCount = 2;
+        swapChainCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+    }
+    else
+    {
+        swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        swapChainCreateInfo.queueFamilyIndexCount = 0;
+        swapChainCreateInfo.pQueueFamilyIndices = NULL;
+    }
+
+    swapChainCreateInfo.preTransform = app->selectedDeviceSurfaceCapabilities.currentTransform;
+    swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
+    swapChainCreateInfo.presentMode = app->selectedDevicePresentMode;
+    swapChainCreateInfo.clipped = VK_TRUE;
+    swapChainCreateInfo.oldSwapchain = oldSwapChain;
+
+    VkResult vkResult = vkCreateSwapchainKHR(app->logicalDevice, &swapChainCreateInfo, NULL, &app->swapChain);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create swap chain: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_SWAP_CHAIN;
+    }
+
+    // Now we can get the swap chain images
+    vkResult = vkGetSwapchainImagesKHR(app->logicalDevice, app->swapChain, &app->swapChainImageCount, NULL);
+    if (vkResult != VK_SUCCESS || app->swapChainImageCount == 0)
+    {
+        fprintf(stderr, "Failed to get swap chain images: %d\n", vkResult);
+        return APP_ERROR_VULKAN_GET_SWAP_CHAIN_IMAGES;
+    }
+
+    // Images are destroyed when the swap chain is destroyed
+    app->swapChainImages = malloc(app->swapChainImageCount * sizeof(VkImage));
+    if (app->swapChainImages == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for swap chain images\n");
+        return APP_ERROR_ALLOC_SWAP_CHAIN_IMAGES;
+    }
+    vkResult = vkGetSwapchainImagesKHR(app->logicalDevice, app->swapChain, &app->swapChainImageCount, app->swapChainImages);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to get swap chain images: %d\n", vkResult);
+        return APP_ERROR_VULKAN_GET_SWAP_CHAIN_IMAGES;
+    }
+
+    return APP_SUCCESS;
+} // createSwapChain
+
+AppResult setOptimalSwapChainParameters(App *app)
+{
+    // The formats and present modes were queried along with the rest of the device
+    // capabilities, first chose the ideal format
+    uint32_t surfaceFormatCount = app->deviceCapabilities.surfaceFormatCount;
+    const VkSurfaceFormatKHR *surfaceFormatsArr = app->deviceCapabilities.surfaceFormats;
+    if (surfaceFormatCount == 0)
+    {
+        fprintf(stderr, "Failed to get physical device surface formats\n");
+        return APP_ERROR_VULKAN_GET_PHYS_DEV_SURFACE_FORMATS;
+    }
+
+    // Ideally we want a SRGB color format and color space
+    bool foundIdealFormat = false;
+    for (uint32_t i = 0; i < surfaceFormatCount; ++i)
+    {
+        if (surfaceFormatsArr[i].format == VK_FORMAT_B8G8R8A8_SRGB && surfaceFormatsArr[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
+        {
+            app->selectedDeviceSurfaceFormat = surfaceFormatsArr[i];
+            foundIdealFormat = true;
+            break;
+        }
+    }
+
+    if (!foundIdealFormat)
+    {
+        // If we didn't find the ideal format we just take the first one
+        app->selectedDeviceSurfaceFormat = surfaceFormatsArr[0];
+    }
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        if (foundIdealFormat)
+        {
+            printf("Ideal format found:\n");
+            printf("\tFormat: VK_FORMAT_B8G8R8A8_SRGB\n");
+            printf("\tColor space: VK_COLOR_SPACE_SRGB_NONLINEAR_KHR\n");
+        }
+        else
+        {
+            printf("Ideal format not found, taking the first one:\n");
+            printf("\tFormat: %u\n", surfaceFormatsArr[0].format);
+            printf("\tColor space: %u\n", surfaceFormatsArr[0].colorSpace);
+        }
+    }
+
+    // Then we want to chose the presentation mode
+    uint32_t presentModeCount = app->deviceCapabilities.presentModeCount;
+    const VkPresentModeKHR *presentModesArr = app->deviceCapabilities.presentModes;
+    if (presentModeCount == 0)
+    {
+        fprintf(stderr, "Failed to get physical device surface present modes\n");
+        return APP_ERROR_VULKAN_GET_PHYS_DEV_PRESENT_MODES;
+    }
+
+    // The first present mode of the policy the surface supports, if we didn't find any we just
+    // take the FIFO one that is guaranteed to be available
+    const PresentPolicyInfo *policy = &presentPolicies[app->config.presentPolicy];
+    bool foundIdealPresentMode = false;
+    for (uint32_t i = 0; i < policy->presentModeCount && !foundIdealPresentMode; ++i)
+    {
+        for (uint32_t j = 0; j < presentModeCount; ++j)
+        {
+            if (presentModesArr[j] == policy->presentModes[i])
+            {
+                foundIdealPresentMode = true;
+                app->selectedDevicePresentMode = presentModesArr[j];
+                break;
+            }
+        }
+    }
+
+    if (!foundIdealPresentMode)
+        app->selectedDevicePresentMode = VK_PRESENT_MODE_FIFO_KHR;
+
+    if (verbose)
     {
         printf("=========================================\n");
-        printf("#########################################\n");
-        printf("#        FRAMEBUFFERS CREATED           #\n");
-        printf("#########################################\n");
+        printf("Present policy %s, taking %s%s\n", policy->name, presentModeName(app->selectedDevicePresentMode),
+               foundIdealPresentMode ? "" : " (none of the preferred present modes is supported)");
     }
 
-    // // Print the app Struct
-    // if (verbose)
-    // {
-    //     printf("=========================================\n");
-    //     printf("App Struct:\n");
-    //     printf("\tWindow: %p\n", (void *)app->window);
-    //     printf("\tInstance: %p\n", (void *)app->instance);
-    //     printf("\tPhysical Device: %p\n", (void *)app->physicalDevice);
-    //     printf("\tSurface: %p\n", (void *)app->surface);
-    //     printf("\tGraphics Queue: %p\n", (void *)app->graphicsQueue);
-    //     printf("\tGraphics Queue Family Index: %u\n", app->graphicsQueueFamilyIndex);
-    //     printf("\tGraphics Queue Priority: %f\n", app->graphicsQueuePriority);
-    //     printf("\tPresentation Queue: %p\n", (void *)app->presentationQueue);
-    //     printf("\tPresentation Queue Family Index: %u\n", app->presentationQueueFamilyIndex);
-    //     printf("\tPresentation Queue Priority: %f\n", app->presentationQueuePriority);
-    //     printf("\tLogical Device: %p\n", (void *)app->logicalDevice);
-    // }
+    return updateSwapChainExtent(app);
+} // setOptimalSwapChainParameters
+
+const char *presentModeName(VkPresentModeKHR presentMode)
+{
+    switch (presentMode)
+    {
+    case VK_PRESENT_MODE_IMMEDIATE_KHR:
+        return "VK_PRESENT_MODE_IMMEDIATE_KHR";
+    case VK_PRESENT_MODE_MAILBOX_KHR:
+        return "VK_PRESENT_MODE_MAILBOX_KHR";
+    case VK_PRESENT_MODE_FIFO_KHR:
+        return "VK_PRESENT_MODE_FIFO_KHR";
+    case VK_PRESENT_MODE_FIFO_RELAXED_KHR:
+        return "VK_PRESENT_MODE_FIFO_RELAXED_KHR";
+    default:
+        return "unknown present mode";
+    }
+} // presentModeName
+
+AppResult updateSwapChainExtent(App *app)
+{
+    // First we have to setup app surface capabilities, they change with the window size
+    VkResult vkResult = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(app->physicalDevice, app->surface, &app->selectedDeviceSurfaceCapabilities);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to get physical device surface capabilities: %d\n", vkResult);
+        return APP_ERROR_VULKAN_GET_PHYS_DEV_SURFACE_CAPABILITIES;
+    }
+
+    // and set the swap chain extent
+    if (app->selectedDeviceSurfaceCapabilities.currentExtent.width != UINT32_MAX)
+    {
+        app->swapChainExtent = app->selectedDeviceSurfaceCapabilities.currentExtent;
+    }
+    else
+    {
+        // A headless surface lets the application pick the extent, there is no window to
+        // take it from
+        int width = (int)WIDTH, height = (int)HEIGHT;
+        if (!app->config.headless)
+            glfwGetFramebufferSize(app->window, &width, &height);
+        VkExtent2D actualExtent = {
+            .width = (uint32_t)width,
+            .height = (uint32_t)height,
+        };
+        actualExtent.width = fmax(app->selectedDeviceSurfaceCapabilities.minImageExtent.width, fmin(app->selectedDeviceSurfaceCapabilities.maxImageExtent.width, actualExtent.width));
+        actualExtent.height = fmax(app->selectedDeviceSurfaceCapabilities.minImageExtent.height, fmin(app->selectedDeviceSurfaceCapabilities.maxImageExtent.height, actualExtent.height));
+        app->swapChainExtent = actualExtent;
+    }
 
     return APP_SUCCESS;
-} // initVulkan
+} // updateSwapChainExtent
 
-AppResult createFramebuffers(App *app)
+AppResult createUploader(App *app)
 {
-    // first we need to allocate memory for the framebuffers
-    app->swapChainFramebuffers = malloc(app->swapChainImageCount * sizeof(VkFramebuffer));
-    if (app->swapChainFramebuffers == NULL)
+    Uploader *uploader = &app->uploader;
+
+    // The staging ring is written by the CPU through its persistent mapping and only read by
+    // the copies, coherent memory saves flushing every write
+    AppResult appResult = createBuffer(app, UPLOAD_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                                       &uploader->stagingBuffer, &uploader->stagingAllocation);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The copies run on the transfer queue while the graphics queue only executes the
+    // barriers that acquire the results, so both need a command pool
+    VkCommandPoolCreateInfo commandPoolCreateInfo = {0};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    commandPoolCreateInfo.queueFamilyIndex = app->transferQueueFamilyIndex;
+
+    VkResult vkResult = vkCreateCommandPool(app->logicalDevice, &commandPoolCreateInfo, NULL, &uploader->transferCommandPool);
+    if (vkResult != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to allocate memory for framebuffers\n");
-        return APP_ERROR_VULKAN_ALLOC_SWAP_CHAIN_FRAMEBUFFERS;
+        fprintf(stderr, "Failed to create transfer command pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_COMMAND_POOL;
+    }
+
+    commandPoolCreateInfo.queueFamilyIndex = app->graphicsQueueFamilyIndex;
+    vkResult = vkCreateCommandPool(app->logicalDevice, &commandPoolCreateInfo, NULL, &uploader->acquireCommandPool);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to create upload acquire command pool: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_COMMAND_POOL;
+    }
+
+    // Transfer only families can restrict the regions of the image copies. Partial copies of a
+    // mip always span whole rows, so only the height matters, 0 allows whole mips only
+    uploader->imageRowGranularity = app->deviceCapabilities.queueFamilies[app->transferQueueFamilyIndex].minImageTransferGranularity.height;
+
+    for (uint32_t i = 0; i < MAX_UPLOAD_BATCHES; ++i)
+    {
+        UploadBatch *batch = &uploader->batches[i];
+
+        VkCommandBufferAllocateInfo commandBufferAllocateInfo = {0};
+        commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+        commandBufferAllocateInfo.commandPool = uploader->transferCommandPool;
+        commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+        commandBufferAllocateInfo.commandBufferCount = 1;
+
+        if (vkAllocateCommandBuffers(app->logicalDevice, &commandBufferAllocateInfo, &batch->transferCommandBuffer) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate upload command buffers\n");
+            return APP_ERROR_VULKAN_ALLOC_COMMAND_BUFFER;
+        }
+
+        commandBufferAllocateInfo.commandPool = uploader->acquireCommandPool;
+        if (vkAllocateCommandBuffers(app->logicalDevice, &commandBufferAllocateInfo, &batch->acquireCommandBuffer) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to allocate upload command buffers\n");
+            return APP_ERROR_VULKAN_ALLOC_COMMAND_BUFFER;
+        }
+
+        VkSemaphoreCreateInfo semaphoreCreateInfo = {0};
+        semaphoreCreateInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+        VkFenceCreateInfo fenceCreateInfo = {0};
+        fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+        if (vkCreateSemaphore(app->logicalDevice, &semaphoreCreateInfo, NULL, &batch->transferFinishedSemaphore) != VK_SUCCESS ||
+            vkCreateFence(app->logicalDevice, &fenceCreateInfo, NULL, &batch->fence) != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create synchronization objects for upload batch %u\n", i);
+            return APP_ERROR_VULKAN_CREATE_SYNC_OBJECTS;
+        }
+    }
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Uploader: %llu KB staging ring, %d batches, %s\n", (unsigned long long)(UPLOAD_RING_SIZE / 1024), MAX_UPLOAD_BATCHES,
+               app->transferQueueFamilyIndex != app->graphicsQueueFamilyIndex ? "dedicated transfer queue family" : "sharing the graphics queue family");
+    }
+
+    return APP_SUCCESS;
+} // createUploader
+
+AppResult uploadToBuffer(App *app, VkBuffer dstBuffer, VkDeviceSize dstOffset, const void *data, VkDeviceSize size, VkPipelineStageFlags dstStageMask, VkAccessFlags dstAccessMask)
+{
+    // Only the initial content of a range can be uploaded, see uploaderReleaseRange
+    Uploader *uploader = &app->uploader;
+    AppResult appResult = uploaderReleaseRange(app, dstBuffer, dstOffset, size);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    if (uploader->batches[uploader->currentBatch].copyCount == MAX_UPLOAD_COPIES)
+    {
+        appResult = uploaderFlush(app);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    VkDeviceSize srcOffset = 0;
+    appResult = uploaderStage(app, data, size, &srcOffset);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    UploadBatch *batch = &uploader->batches[uploader->currentBatch];
+    batch->dstBuffers[batch->copyCount] = dstBuffer;
+    batch->regions[batch->copyCount].srcOffset = srcOffset;
+    batch->regions[batch->copyCount].dstOffset = dstOffset;
+    batch->regions[batch->copyCount].size = size;
+    batch->copyCount++;
+    batch->dstStageMask |= dstStageMask;
+    batch->dstAccessMask |= dstAccessMask;
+
+    return APP_SUCCESS;
+} // uploadToBuffer
+
+AppResult uploaderReleaseRange(App *app, VkBuffer buffer, VkDeviceSize offset, VkDeviceSize size)
+{
+    // Nothing changes hands when the copies run on the graphics family
+    Uploader *uploader = &app->uploader;
+    if (app->transferQueueFamilyIndex == app->graphicsQueueFamilyIndex)
+        return APP_SUCCESS;
+
+    for (uint32_t i = 0; i < uploader->releasedBufferCount; ++i)
+    {
+        if (uploader->releasedBuffers[i] != buffer)
+            continue;
+
+        // Writing a range the graphics family owns would need a release from it and an
+        // acquire on the transfer queue first, which the uploader does not do
+        if (offset < uploader->releasedEnds[i] && offset + size > uploader->releasedStarts[i])
+        {
+            fprintf(stderr, "Failed to upload to buffer: bytes %llu to %llu were already handed to the graphics queue\n", (unsigned long long)offset,
+                    (unsigned long long)(offset + size));
+            return APP_ERROR_UPLOAD_OWNED_BY_GRAPHICS;
+        }
+        if (offset < uploader->releasedStarts[i])
+            uploader->releasedStarts[i] = offset;
+        if (offset + size > uploader->releasedEnds[i])
+            uploader->releasedEnds[i] = offset + size;
+        return APP_SUCCESS;
+    }
+
+    if (uploader->releasedBufferCount == MAX_UPLOAD_BUFFERS)
+    {
+        fprintf(stderr, "Failed to upload to buffer: more than %d buffers uploaded to\n", MAX_UPLOAD_BUFFERS);
+        return APP_ERROR_UPLOAD_OWNED_BY_GRAPHICS;
+    }
+    uploader->releasedBuffers[uploader->releasedBufferCount] = buffer;
+    uploader->releasedStarts[uploader->releasedBufferCount] = offset;
+    uploader->releasedEnds[uploader->releasedBufferCount] = offset + size;
+    uploader->releasedBufferCount++;
+    return APP_SUCCESS;
+} // uploaderReleaseRange
+
+void uploaderForgetBuffer(App *app, VkBuffer buffer)
+{
+    // A destroyed buffer can see its handle reused by a new one, which starts out unowned
+    Uploader *uploader = &app->uploader;
+    for (uint32_t i = 0; i < uploader->releasedBufferCount; ++i)
+    {
+        if (uploader->releasedBuffers[i] == buffer)
+        {
+            uploader->releasedBufferCount--;
+            uploader->releasedBuffers[i] = uploader->releasedBuffers[uploader->releasedBufferCount];
+            uploader->releasedStarts[i] = uploader->releasedStarts[uploader->releasedBufferCount];
+            uploader->releasedEnds[i] = uploader->releasedEnds[uploader->releasedBufferCount];
+            return;
+        }
+    }
+} // uploaderForgetBuffer
+
+AppResult uploaderBeginImage(App *app, VkImage image)
+{
+    Uploader *uploader = &app->uploader;
+    if (uploader->batches[uploader->currentBatch].beginImageCount == MAX_UPLOAD_COPIES)
+    {
+        AppResult appResult = uploaderFlush(app);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    // Every mip of the image moves to the transfer layout, their previous content is discarded
+    UploadBatch *batch = &uploader->batches[uploader->currentBatch];
+    batch->beginImages[batch->beginImageCount++] = image;
+
+    return APP_SUCCESS;
+} // uploaderBeginImage
+
+AppResult uploadToImage(App *app, VkImage dstImage, uint32_t mipLevel, uint32_t firstRow, VkExtent2D extent, const void *data, VkDeviceSize size)
+{
+    Uploader *uploader = &app->uploader;
+    AppResult appResult = APP_SUCCESS;
+    if (uploader->batches[uploader->currentBatch].imageCopyCount == MAX_UPLOAD_COPIES)
+    {
+        appResult = uploaderFlush(app);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    VkDeviceSize srcOffset = 0;
+    appResult = uploaderStage(app, data, size, &srcOffset);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // The rows are tightly packed in the staging ring
+    UploadBatch *batch = &uploader->batches[uploader->currentBatch];
+    VkBufferImageCopy *region = &batch->imageRegions[batch->imageCopyCount];
+    *region = (VkBufferImageCopy){0};
+    region->bufferOffset = srcOffset;
+    region->bufferRowLength = 0;
+    region->bufferImageHeight = 0;
+    region->imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region->imageSubresource.mipLevel = mipLevel;
+    region->imageSubresource.baseArrayLayer = 0;
+    region->imageSubresource.layerCount = 1;
+    region->imageOffset = (VkOffset3D){0, (int32_t)firstRow, 0};
+    region->imageExtent = (VkExtent3D){extent.width, extent.height, 1};
+    batch->dstImages[batch->imageCopyCount] = dstImage;
+    batch->imageCopyCount++;
+
+    return APP_SUCCESS;
+} // uploadToImage
+
+AppResult uploaderCopyImageLevel(App *app, VkImage srcImage, uint32_t srcMipLevel, VkImage dstImage, uint32_t dstMipLevel, VkExtent2D extent)
+{
+    Uploader *uploader = &app->uploader;
+    if (uploader->batches[uploader->currentBatch].levelCopyCount == MAX_UPLOAD_COPIES)
+    {
+        AppResult appResult = uploaderFlush(app);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    // Nothing goes through the staging ring, the source image has to be in the shader read
+    // layout and is left in the transfer source layout
+    UploadBatch *batch = &uploader->batches[uploader->currentBatch];
+    VkImageCopy *region = &batch->levelRegions[batch->levelCopyCount];
+    *region = (VkImageCopy){0};
+    region->srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region->srcSubresource.mipLevel = srcMipLevel;
+    region->srcSubresource.layerCount = 1;
+    region->dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region->dstSubresource.mipLevel = dstMipLevel;
+    region->dstSubresource.layerCount = 1;
+    region->extent = (VkExtent3D){extent.width, extent.height, 1};
+    batch->levelSrcImages[batch->levelCopyCount] = srcImage;
+    batch->levelDstImages[batch->levelCopyCount] = dstImage;
+    batch->levelCopyCount++;
+
+    return APP_SUCCESS;
+} // uploaderCopyImageLevel
+
+AppResult uploaderFinishImage(App *app, VkImage image)
+{
+    Uploader *uploader = &app->uploader;
+    if (uploader->batches[uploader->currentBatch].finishImageCount == MAX_UPLOAD_COPIES)
+    {
+        AppResult appResult = uploaderFlush(app);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+    }
+
+    // Once the batch is done every mip of the image can be sampled by the fragment shaders
+    UploadBatch *batch = &uploader->batches[uploader->currentBatch];
+    batch->finishImages[batch->finishImageCount++] = image;
+
+    return APP_SUCCESS;
+} // uploaderFinishImage
+
+AppResult uploaderStage(App *app, const void *data, VkDeviceSize size, VkDeviceSize *srcOffset)
+{
+    Uploader *uploader = &app->uploader;
+    if (size > UPLOAD_RING_SIZE)
+    {
+        fprintf(stderr, "Failed to upload %llu bytes: larger than the %llu bytes staging ring\n", (unsigned long long)size, (unsigned long long)UPLOAD_RING_SIZE);
+        return APP_ERROR_UPLOAD_TOO_LARGE;
+    }
+
+    // The ring offsets only ever grow, the position in the buffer is the offset modulo the
+    // ring size. A copy never wraps around the end of the buffer, it starts over at 0 instead
+    VkDeviceSize head = (uploader->head + UPLOAD_ALIGNMENT - 1) & ~(UPLOAD_ALIGNMENT - 1);
+    if (head % UPLOAD_RING_SIZE + size > UPLOAD_RING_SIZE)
+        head += UPLOAD_RING_SIZE - head % UPLOAD_RING_SIZE;
+
+    // Not enough room until the oldest batches are done with their part of the ring
+    AppResult appResult = APP_SUCCESS;
+    while (head + size - uploader->tail > UPLOAD_RING_SIZE)
+    {
+        if (!uploadBatchIsEmpty(&uploader->batches[uploader->currentBatch]))
+        {
+            appResult = uploaderFlush(app);
+            if (appResult != APP_SUCCESS)
+                return appResult;
+        }
+
+        double stallStartMs = getTimeMs();
+        appResult = uploaderRetire(app, true);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+        uploader->stats.stallCount++;
+        uploader->stats.totalStallMs += getTimeMs() - stallStartMs;
+
+        // Once everything is retired the padding skipped to align the copy is free as well
+        if (uploader->tail == uploader->head)
+            uploader->tail = head;
+    }
+
+    *srcOffset = head % UPLOAD_RING_SIZE;
+    memcpy((char *)uploader->stagingAllocation.mapped + *srcOffset, data, size);
+    uploader->head = head + size;
+
+    uploader->stats.copyCount++;
+    uploader->stats.totalBytes += size;
+
+    return APP_SUCCESS;
+} // uploaderStage
+
+bool uploadBatchIsEmpty(const UploadBatch *batch)
+{
+    return batch->copyCount == 0 && batch->beginImageCount == 0 && batch->imageCopyCount == 0 && batch->levelCopyCount == 0 && batch->finishImageCount == 0;
+} // uploadBatchIsEmpty
+
+AppResult uploaderFlush(App *app)
+{
+    Uploader *uploader = &app->uploader;
+    UploadBatch *batch = &uploader->batches[uploader->currentBatch];
+    if (uploadBatchIsEmpty(batch))
+        return APP_SUCCESS;
+
+    // Ownership only has to move when the copies and their users are on different families
+    bool ownershipTransfer = app->transferQueueFamilyIndex != app->graphicsQueueFamilyIndex;
+
+    // VLA is ok here for simplicity, batches of images only have no buffer barrier
+    VkBufferMemoryBarrier barriers[batch->copyCount > 0 ? batch->copyCount : 1];
+    for (uint32_t i = 0; i < batch->copyCount; ++i)
+    {
+        barriers[i] = (VkBufferMemoryBarrier){0};
+        barriers[i].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barriers[i].srcQueueFamilyIndex = app->transferQueueFamilyIndex;
+        barriers[i].dstQueueFamilyIndex = app->graphicsQueueFamilyIndex;
+        barriers[i].buffer = batch->dstBuffers[i];
+        barriers[i].offset = batch->regions[i].dstOffset;
+        barriers[i].size = batch->regions[i].size;
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {0};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    // The transfer side: the layout transitions of the new images, every copy, then the release
+    // half of the ownership transfers. Images are shared by both families instead
+    if (vkBeginCommandBuffer(batch->transferCommandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin upload command buffer\n");
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    if (batch->beginImageCount > 0)
+    {
+        VkImageMemoryBarrier imageBarriers[batch->beginImageCount];
+        for (uint32_t i = 0; i < batch->beginImageCount; ++i)
+        {
+            imageBarriers[i] = (VkImageMemoryBarrier){0};
+            imageBarriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarriers[i].srcAccessMask = 0;
+            imageBarriers[i].dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarriers[i].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            imageBarriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageBarriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarriers[i].image = batch->beginImages[i];
+            imageBarriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            imageBarriers[i].subresourceRange.baseMipLevel = 0;
+            imageBarriers[i].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+            imageBarriers[i].subresourceRange.baseArrayLayer = 0;
+            imageBarriers[i].subresourceRange.layerCount = 1;
+        }
+        vkCmdPipelineBarrier(batch->transferCommandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, batch->beginImageCount, imageBarriers);
+    }
+
+    for (uint32_t i = 0; i < batch->copyCount; ++i)
+    {
+        vkCmdCopyBuffer(batch->transferCommandBuffer, uploader->stagingBuffer, batch->dstBuffers[i], 1, &batch->regions[i]);
+    }
+
+    for (uint32_t i = 0; i < batch->imageCopyCount; ++i)
+    {
+        vkCmdCopyBufferToImage(batch->transferCommandBuffer, uploader->stagingBuffer, batch->dstImages[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &batch->imageRegions[i]);
+    }
+
+    if (ownershipTransfer && batch->copyCount > 0)
+    {
+        for (uint32_t i = 0; i < batch->copyCount; ++i)
+        {
+            barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barriers[i].dstAccessMask = 0;
+        }
+        vkCmdPipelineBarrier(batch->transferCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, NULL, batch->copyCount, barriers, 0, NULL);
+    }
+
+    if (vkEndCommandBuffer(batch->transferCommandBuffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to record upload command buffer\n");
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    // The graphics side: the acquire half of the ownership transfers, or a plain memory
+    // barrier when there is none. Being a separate submission ahead of the frames, every
+    // later command on the graphics queue is ordered after it
+    if (vkBeginCommandBuffer(batch->acquireCommandBuffer, &beginInfo) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to begin upload command buffer\n");
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    if (ownershipTransfer && batch->copyCount > 0)
+    {
+        for (uint32_t i = 0; i < batch->copyCount; ++i)
+        {
+            barriers[i].srcAccessMask = 0;
+            barriers[i].dstAccessMask = batch->dstAccessMask;
+        }
+        vkCmdPipelineBarrier(batch->acquireCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, batch->dstStageMask, 0, 0, NULL, batch->copyCount, barriers, 0, NULL);
+    }
+    else if (batch->copyCount > 0)
+    {
+        VkMemoryBarrier memoryBarrier = {0};
+        memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+        memoryBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        memoryBarrier.dstAccessMask = batch->dstAccessMask;
+        vkCmdPipelineBarrier(batch->acquireCommandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, batch->dstStageMask, 0, 1, &memoryBarrier, 0, NULL, 0, NULL);
+    }
+
+    // The mips kept from a previous image of a texture are copied on the graphics queue, which
+    // is the one sampling it. No frame recorded after this submission samples the source again
+    if (batch->levelCopyCount > 0)
+    {
+        VkImageMemoryBarrier imageBarriers[batch->levelCopyCount];
+        for (uint32_t i = 0; i < batch->levelCopyCount; ++i)
+        {
+            imageBarriers[i] = (VkImageMemoryBarrier){0};
+            imageBarriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarriers[i].srcAccessMask = 0;
+            imageBarriers[i].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+            imageBarriers[i].oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            imageBarriers[i].newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            imageBarriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarriers[i].image = batch->levelSrcImages[i];
+            imageBarriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            imageBarriers[i].subresourceRange.baseMipLevel = batch->levelRegions[i].srcSubresource.mipLevel;
+            imageBarriers[i].subresourceRange.levelCount = 1;
+            imageBarriers[i].subresourceRange.baseArrayLayer = 0;
+            imageBarriers[i].subresourceRange.layerCount = 1;
+        }
+        vkCmdPipelineBarrier(batch->acquireCommandBuffer, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, batch->levelCopyCount, imageBarriers);
+
+        for (uint32_t i = 0; i < batch->levelCopyCount; ++i)
+        {
+            vkCmdCopyImage(batch->acquireCommandBuffer, batch->levelSrcImages[i], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, batch->levelDstImages[i], VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1,
+                           &batch->levelRegions[i]);
+        }
+    }
+
+    // The copies of the transfer queue are visible here thanks to the semaphore wait
+    if (batch->finishImageCount > 0)
+    {
+        VkImageMemoryBarrier imageBarriers[batch->finishImageCount];
+        for (uint32_t i = 0; i < batch->finishImageCount; ++i)
+        {
+            imageBarriers[i] = (VkImageMemoryBarrier){0};
+            imageBarriers[i].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+            imageBarriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            imageBarriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            imageBarriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            imageBarriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            imageBarriers[i].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarriers[i].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            imageBarriers[i].image = batch->finishImages[i];
+            imageBarriers[i].subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            imageBarriers[i].subresourceRange.baseMipLevel = 0;
+            imageBarriers[i].subresourceRange.levelCount = VK_REMAINING_MIP_LEVELS;
+            imageBarriers[i].subresourceRange.baseArrayLayer = 0;
+            imageBarriers[i].subresourceRange.layerCount = 1;
+        }
+        vkCmdPipelineBarrier(batch->acquireCommandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, NULL, 0, NULL, batch->finishImageCount, imageBarriers);
+    }
+
+    if (vkEndCommandBuffer(batch->acquireCommandBuffer) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to record upload command buffer\n");
+        return APP_ERROR_VULKAN_RECORD_COMMAND_BUFFER;
+    }
+
+    VkSubmitInfo transferSubmitInfo = {0};
+    transferSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    transferSubmitInfo.commandBufferCount = 1;
+    transferSubmitInfo.pCommandBuffers = &batch->transferCommandBuffer;
+    transferSubmitInfo.signalSemaphoreCount = 1;
+    transferSubmitInfo.pSignalSemaphores = &batch->transferFinishedSemaphore;
+
+    VkResult vkResult = vkQueueSubmit(app->transferQueue, 1, &transferSubmitInfo, VK_NULL_HANDLE);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to submit upload command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_QUEUE_SUBMIT;
+    }
+
+    // The fence of the acquire submission tells when both halves are done, which is when the
+    // staging space and the semaphore can be reused
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo acquireSubmitInfo = {0};
+    acquireSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    acquireSubmitInfo.waitSemaphoreCount = 1;
+    acquireSubmitInfo.pWaitSemaphores = &batch->transferFinishedSemaphore;
+    acquireSubmitInfo.pWaitDstStageMask = &waitStage;
+    acquireSubmitInfo.commandBufferCount = 1;
+    acquireSubmitInfo.pCommandBuffers = &batch->acquireCommandBuffer;
+
+    vkResult = vkQueueSubmit(app->graphicsQueue, 1, &acquireSubmitInfo, batch->fence);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to submit upload acquire command buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_QUEUE_SUBMIT;
     }
 
-    for (uint32_t i = 0; i < app->swapChainImageCount; ++i)
-    {
-        VkImageView attachments[] = {
-            app->swapChainImageViews[i],
-        };
+    batch->submitted = true;
+    batch->ringEnd = uploader->head;
+    uploader->stats.batchCount++;
+
+    // Move on to the next batch, which has to be done with its previous use first
+    uploader->currentBatch = (uploader->currentBatch + 1) % MAX_UPLOAD_BATCHES;
+    if (uploader->batches[uploader->currentBatch].submitted)
+    {
+        double stallStartMs = getTimeMs();
+        AppResult appResult = uploaderRetire(app, true);
+        if (appResult != APP_SUCCESS)
+            return appResult;
+        uploader->stats.stallCount++;
+        uploader->stats.totalStallMs += getTimeMs() - stallStartMs;
+    }
+
+    return APP_SUCCESS;
+} // uploaderFlush
+
+AppResult uploaderRetire(App *app, bool waitForOldest)
+{
+    Uploader *uploader = &app->uploader;
 
-        VkFramebufferCreateInfo framebufferCreateInfo = {0};
-        framebufferCreateInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
-        framebufferCreateInfo.renderPass = app->renderPass;
-        framebufferCreateInfo.attachmentCount = 1;
-        framebufferCreateInfo.pAttachments = attachments;
-        framebufferCreateInfo.width = app->swapChainExtent.width;
-        framebufferCreateInfo.height = app->swapChainExtent.height;
-        framebufferCreateInfo.layers = 1;
+    // Batches are submitted in order so they are retired in order, starting with the oldest
+    // one which is the current batch itself when it was already submitted
+    for (uint32_t i = 0; i < MAX_UPLOAD_BATCHES; ++i)
+    {
+        UploadBatch *batch = &uploader->batches[(uploader->currentBatch + i) % MAX_UPLOAD_BATCHES];
+        if (!batch->submitted)
+            continue;
+
+        VkResult vkResult = vkGetFenceStatus(app->logicalDevice, batch->fence);
+        if (vkResult == VK_NOT_READY && waitForOldest)
+            vkResult = vkWaitForFences(app->logicalDevice, 1, &batch->fence, VK_TRUE, UINT64_MAX);
+        if (vkResult == VK_NOT_READY)
+            break;
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to wait for upload fence: %d\n", vkResult);
+            return APP_ERROR_VULKAN_WAIT_FOR_FENCE;
+        }
 
-        VkResult vkResult = vkCreateFramebuffer(app->logicalDevice, &framebufferCreateInfo, NULL, &app->swapChainFramebuffers[i]);
+        vkResult = vkResetFences(app->logicalDevice, 1, &batch->fence);
         if (vkResult != VK_SUCCESS)
         {
-            fprintf(stderr, "Failed to create framebuffer: %d\n", vkResult);
-            return APP_ERROR_VULKAN_CREATE_FRAMEBUFFER;
+            fprintf(stderr, "Failed to reset upload fence: %d\n", vkResult);
+            return APP_ERROR_VULKAN_WAIT_FOR_FENCE;
         }
+
+        uploader->tail = batch->ringEnd;
+        batch->submitted = false;
+        batch->copyCount = 0;
+        batch->dstStageMask = 0;
+        batch->dstAccessMask = 0;
+        batch->beginImageCount = 0;
+        batch->imageCopyCount = 0;
+        batch->levelCopyCount = 0;
+        batch->finishImageCount = 0;
+        waitForOldest = false;
     }
 
     return APP_SUCCESS;
-}
+} // uploaderRetire
 
-AppResult createGraphicsPipeline(App *app)
+void printUploaderStats(const App *app)
 {
-    VkShaderModule vertexShaderModule = {0};
-    VkShaderModule fragmentShaderModule = {0};
-    AppResult appResult = loadShader("shaders/vert.spv", &vertexShaderModule, app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
-
-    appResult = loadShader("shaders/frag.spv", &fragmentShaderModule, app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+    const UploaderStats *stats = &app->uploader.stats;
+    if (stats->copyCount == 0)
+        return;
 
-    VkPipelineShaderStageCreateInfo vertexShaderStageCreateInfo = {0};
-    vertexShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    vertexShaderStageCreateInfo.stage = VK_SHADER_STAGE_VERTEX_BIT;
-    vertexShaderStageCreateInfo.module = vertexShaderModule;
-    vertexShaderStageCreateInfo.pName = "main";
+    printf("=========================================\n");
+    printf("Uploads: %.2f MB in %llu copies over %llu batches, %llu stalls on the staging ring (%.3f ms)\n",
+           (double)stats->totalBytes / (1024.0 * 1024.0), (unsigned long long)stats->copyCount, (unsigned long long)stats->batchCount,
+           (unsigned long long)stats->stallCount, stats->totalStallMs);
+} // printUploaderStats
 
-    VkPipelineShaderStageCreateInfo fragmentShaderStageCreateInfo = {0};
-    fragmentShaderStageCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    fragmentShaderStageCreateInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-    fragmentShaderStageCreateInfo.module = fragmentShaderModule;
-    fragmentShaderStageCreateInfo.pName = "main";
+void destroyUploader(App *app)
+{
+    Uploader *uploader = &app->uploader;
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = {vertexShaderStageCreateInfo, fragmentShaderStageCreateInfo};
-    // use shaderStages so the compiler shuts up
-    (void)shaderStages;
+    // Destroying the pools also frees their command buffers
+    for (uint32_t i = 0; i < MAX_UPLOAD_BATCHES; ++i)
+    {
+        if (uploader->batches[i].fence != VK_NULL_HANDLE)
+            vkDestroyFence(app->logicalDevice, uploader->batches[i].fence, NULL);
+        if (uploader->batches[i].transferFinishedSemaphore != VK_NULL_HANDLE)
+            vkDestroySemaphore(app->logicalDevice, uploader->batches[i].transferFinishedSemaphore, NULL);
+    }
 
-    // Dynamic state of the Pipeline
-    VkDynamicState dynamicStates[2] = {
-        VK_DYNAMIC_STATE_VIEWPORT,
-        VK_DYNAMIC_STATE_SCISSOR,
-    };
+    if (uploader->acquireCommandPool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(app->logicalDevice, uploader->acquireCommandPool, NULL);
+    if (uploader->transferCommandPool != VK_NULL_HANDLE)
+        vkDestroyCommandPool(app->logicalDevice, uploader->transferCommandPool, NULL);
 
-    VkPipelineDynamicStateCreateInfo dynamicStateCreateInfo = {0};
-    dynamicStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
-    dynamicStateCreateInfo.dynamicStateCount = ARRAY_LEN(dynamicStates);
-    dynamicStateCreateInfo.pDynamicStates = dynamicStates;
+    destroyBuffer(app, &uploader->stagingBuffer, &uploader->stagingAllocation);
+} // destroyUploader
 
-    // Vertex input
-    VkPipelineVertexInputStateCreateInfo vertexInputCreateInfo = {0};
-    vertexInputCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-    vertexInputCreateInfo.vertexBindingDescriptionCount = 0;
-    vertexInputCreateInfo.pVertexBindingDescriptions = NULL;
-    vertexInputCreateInfo.vertexAttributeDescriptionCount = 0;
-    vertexInputCreateInfo.pVertexAttributeDescriptions = NULL;
+AppResult createMemoryAllocator(App *app)
+{
+    MemoryAllocator *allocator = &app->memoryAllocator;
+    vkGetPhysicalDeviceMemoryProperties(app->physicalDevice, &allocator->memoryProperties);
 
-    // Input assembly
-    VkPipelineInputAssemblyStateCreateInfo inputAssemblyCreateInfo = {0};
-    inputAssemblyCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssemblyCreateInfo.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    inputAssemblyCreateInfo.primitiveRestartEnable = VK_FALSE;
+    // Blocks are capped to an eighth of their heap so that a small heap (like the 256 MB
+    // device local and host visible one of many discrete GPUs) isn't used up by a few
+    // partially filled blocks. The blocks themselves are only allocated on first use
+    for (uint32_t type = 0; type < allocator->memoryProperties.memoryTypeCount; ++type)
+    {
+        uint32_t heapIndex = allocator->memoryProperties.memoryTypes[type].heapIndex;
+        VkDeviceSize heapSize = allocator->memoryProperties.memoryHeaps[heapIndex].size;
+        VkDeviceSize blockSize = MEMORY_BLOCK_SIZE;
+        while (blockSize > MEMORY_MIN_ALLOCATION_SIZE && blockSize > heapSize / 8)
+            blockSize /= 2;
 
-    // Viewport and scissor
-    VkViewport viewport = {0};
-    viewport.x = 0.0f;
-    viewport.y = 0.0f;
-    viewport.width = (float)app->swapChainExtent.width;
-    viewport.height = (float)app->swapChainExtent.height;
-    viewport.minDepth = 0.0f;
-    viewport.maxDepth = 1.0f;
+        for (uint32_t kind = 0; kind < MEMORY_RESOURCE_KIND_COUNT; ++kind)
+        {
+            allocator->pools[type][kind].blockSize = blockSize;
+        }
+    }
 
-    // we want to draw the entire frame buffer
-    VkRect2D scissor = {0};
-    scissor.offset = (VkOffset2D){0, 0};
-    scissor.extent = app->swapChainExtent;
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Memory types:\n");
+        for (uint32_t type = 0; type < allocator->memoryProperties.memoryTypeCount; ++type)
+        {
+            VkMemoryType memoryType = allocator->memoryProperties.memoryTypes[type];
+            printf("\t%u: heap %u, flags 0x%x, block size %llu KB\n", type, memoryType.heapIndex, memoryType.propertyFlags,
+                   (unsigned long long)(allocator->pools[type][0].blockSize / 1024));
+        }
+    }
 
-    VkPipelineViewportStateCreateInfo viewportStateCreateInfo = {0};
-    viewportStateCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
-    viewportStateCreateInfo.viewportCount = 1;
-    viewportStateCreateInfo.pViewports = &viewport;
-    viewportStateCreateInfo.scissorCount = 1;
-    viewportStateCreateInfo.pScissors = &scissor;
+    return APP_SUCCESS;
+} // createMemoryAllocator
 
-    // Rasterizer
-    VkPipelineRasterizationStateCreateInfo rasterizationCreateInfo = {0};
-    rasterizationCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
-    rasterizationCreateInfo.depthClampEnable = VK_FALSE;
-    rasterizationCreateInfo.rasterizerDiscardEnable = VK_FALSE;
-    rasterizationCreateInfo.polygonMode = VK_POLYGON_MODE_FILL;
-    rasterizationCreateInfo.lineWidth = 1.0f;
-    rasterizationCreateInfo.cullMode = VK_CULL_MODE_BACK_BIT;
-    rasterizationCreateInfo.frontFace = VK_FRONT_FACE_CLOCKWISE;
-    rasterizationCreateInfo.depthBiasEnable = VK_FALSE;
-    rasterizationCreateInfo.depthBiasConstantFactor = 0.0f;
-    rasterizationCreateInfo.depthBiasClamp = 0.0f;
-    rasterizationCreateInfo.depthBiasSlopeFactor = 0.0f;
+uint32_t findMemoryType(const MemoryAllocator *allocator, uint32_t memoryTypeBits, VkMemoryPropertyFlags properties)
+{
+    // Memory types are ordered by the driver from the most to the least preferred one
+    for (uint32_t type = 0; type < allocator->memoryProperties.memoryTypeCount; ++type)
+    {
+        if ((memoryTypeBits & (1u << type)) && (allocator->memoryProperties.memoryTypes[type].propertyFlags & properties) == properties)
+            return type;
+    }
 
-    // Multisampling
-    VkPipelineMultisampleStateCreateInfo multisampleCreateInfo = {0};
-    multisampleCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
-    multisampleCreateInfo.sampleShadingEnable = VK_FALSE;
-    multisampleCreateInfo.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
-    multisampleCreateInfo.minSampleShading = 1.0f;
-    multisampleCreateInfo.pSampleMask = NULL;
-    multisampleCreateInfo.alphaToCoverageEnable = VK_FALSE;
-    multisampleCreateInfo.alphaToOneEnable = VK_FALSE;
+    return UINT32_MAX;
+} // findMemoryType
 
-    // For now we don´t need depth and stencil testing
+VkMemoryPropertyFlags readbackMemoryProperties(const MemoryAllocator *allocator)
+{
+    // The CPU reads uncached memory an order of magnitude slower than cached memory, every
+    // desktop driver exposes a host cached type but none is guaranteed to
+    VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+    if (findMemoryType(allocator, UINT32_MAX, properties | VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != UINT32_MAX)
+        properties |= VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
 
-    // Color blending
-    VkPipelineColorBlendAttachmentState colorBlendAttachment = {0};
-    colorBlendAttachment.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
-    colorBlendAttachment.blendEnable = VK_FALSE;
-    colorBlendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ZERO;
-    colorBlendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
-    colorBlendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
-    colorBlendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO;
-    colorBlendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
-
-    VkPipelineColorBlendStateCreateInfo colorBlendCreateInfo = {0};
-    colorBlendCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
-    colorBlendCreateInfo.logicOpEnable = VK_FALSE;
-    colorBlendCreateInfo.logicOp = VK_LOGIC_OP_COPY;
-    colorBlendCreateInfo.attachmentCount = 1;
-    colorBlendCreateInfo.pAttachments = &colorBlendAttachment;
-    colorBlendCreateInfo.blendConstants[0] = 0.0f;
-    colorBlendCreateInfo.blendConstants[1] = 0.0f;
-    colorBlendCreateInfo.blendConstants[2] = 0.0f;
-    colorBlendCreateInfo.blendConstants[3] = 0.0f;
-
-    // Pipeline layout
-    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {0};
-    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutCreateInfo.setLayoutCount = 0;
-    pipelineLayoutCreateInfo.pSetLayouts = NULL;
-    pipelineLayoutCreateInfo.pushConstantRangeCount = 0;
-    pipelineLayoutCreateInfo.pPushConstantRanges = NULL;
+    return properties;
+} // readbackMemoryProperties
 
-    VkResult vkResult = vkCreatePipelineLayout(app->logicalDevice, &pipelineLayoutCreateInfo, NULL, &app->pipelineLayout);
-    if (vkResult != VK_SUCCESS)
+uint32_t getAllocationOrder(const VkMemoryRequirements *requirements, VkDeviceSize *chunkSize)
+{
+    // Chunks of the buddy tree are aligned to their own size, so a chunk at least as large as
+    // the alignment is always correctly aligned
+    VkDeviceSize neededSize = requirements->size > requirements->alignment ? requirements->size : requirements->alignment;
+    *chunkSize = MEMORY_MIN_ALLOCATION_SIZE;
+    uint32_t order = 0;
+    while (*chunkSize < neededSize)
     {
-        fprintf(stderr, "Failed to create pipeline layout: %d\n", vkResult);
-        return APP_ERROR_VULKAN_CREATE_PIPELINE_LAYOUT;
+        *chunkSize *= 2;
+        order++;
     }
+    return order;
+} // getAllocationOrder
 
-    // Finally we can create the graphics pipeline
-    VkGraphicsPipelineCreateInfo pipelineCreateInfo = {0};
-    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineCreateInfo.stageCount = ARRAY_LEN(shaderStages);
-    pipelineCreateInfo.pStages = shaderStages;
-    pipelineCreateInfo.pVertexInputState = &vertexInputCreateInfo;
-    pipelineCreateInfo.pInputAssemblyState = &inputAssemblyCreateInfo;
-    pipelineCreateInfo.pViewportState = &viewportStateCreateInfo;
-    pipelineCreateInfo.pRasterizationState = &rasterizationCreateInfo;
-    pipelineCreateInfo.pMultisampleState = &multisampleCreateInfo;
-    pipelineCreateInfo.pDepthStencilState = NULL;
-    pipelineCreateInfo.pColorBlendState = &colorBlendCreateInfo;
-    pipelineCreateInfo.pDynamicState = &dynamicStateCreateInfo;
-    pipelineCreateInfo.layout = app->pipelineLayout;
-    pipelineCreateInfo.renderPass = app->renderPass;
-    pipelineCreateInfo.subpass = 0;
-    pipelineCreateInfo.basePipelineHandle = VK_NULL_HANDLE;
-    pipelineCreateInfo.basePipelineIndex = -1;
+VkDeviceSize getAllocationSize(const App *app, const VkMemoryRequirements *requirements, VkMemoryPropertyFlags properties, MemoryResourceKind kind)
+{
+    // The size allocateMemory reserves for these requirements, 0 when no memory type fits
+    const MemoryAllocator *allocator = &app->memoryAllocator;
+    uint32_t memoryTypeIndex = findMemoryType(allocator, requirements->memoryTypeBits, properties);
+    if (memoryTypeIndex == UINT32_MAX)
+        return 0;
+
+    VkDeviceSize chunkSize = 0;
+    getAllocationOrder(requirements, &chunkSize);
+    return chunkSize > allocator->pools[memoryTypeIndex][kind].blockSize / 2 ? requirements->size : chunkSize;
+} // getAllocationSize
+
+AppResult allocateMemory(App *app, const VkMemoryRequirements *requirements, VkMemoryPropertyFlags properties, MemoryResourceKind kind, MemoryAllocation *allocation)
+{
+    MemoryAllocator *allocator = &app->memoryAllocator;
+    memset(allocation, 0, sizeof(MemoryAllocation));
 
-    vkResult = vkCreateGraphicsPipelines(app->logicalDevice, VK_NULL_HANDLE, 1, &pipelineCreateInfo, NULL, &app->graphicsPipeline);
-    if (vkResult != VK_SUCCESS)
+    uint32_t memoryTypeIndex = findMemoryType(allocator, requirements->memoryTypeBits, properties);
+    if (memoryTypeIndex == UINT32_MAX)
     {
-        fprintf(stderr, "Failed to create graphics pipeline: %d\n", vkResult);
-        return APP_ERROR_VULKAN_CREATE_GRAPHICS_PIPELINE;
+        fprintf(stderr, "Failed to find a memory type with the properties 0x%x\n", properties);
+        return APP_ERROR_VULKAN_NO_SUITABLE_MEMORY_TYPE;
     }
 
-    vkDestroyShaderModule(app->logicalDevice, vertexShaderModule, NULL);
-    vkDestroyShaderModule(app->logicalDevice, fragmentShaderModule, NULL);
+    VkDeviceSize chunkSize = 0;
+    uint32_t order = getAllocationOrder(requirements, &chunkSize);
 
-    return APP_SUCCESS;
-} // createGraphicsPipeline
+    MemoryPool *pool = &allocator->pools[memoryTypeIndex][kind];
+    allocation->memoryTypeIndex = memoryTypeIndex;
+    allocation->kind = kind;
+    allocation->requestedSize = requirements->size;
 
-AppResult createRenderPass(App *app)
-{
-    // Firs we need to create the color attachment
-    VkAttachmentDescription colorAttachment = {0};
-    colorAttachment.format = app->selectedDeviceSurfaceFormat.format;
-    colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
-    colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    // Anything larger than half a block would waste most of it, so it gets its own allocation
+    if (chunkSize > pool->blockSize / 2)
+    {
+        AppResult appResult = allocateDeviceMemory(app, memoryTypeIndex, requirements->size, &allocation->memory, &allocation->mapped);
+        if (appResult != APP_SUCCESS)
+            return appResult;
 
-    // Then the attachment reference for the subpass
-    VkAttachmentReference colorAttachmentRef = {0};
-    colorAttachmentRef.attachment = 0;
-    colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        allocation->size = requirements->size;
+        allocator->dedicatedAllocationCount++;
+    }
+    else
+    {
+        MemoryBlock *block = NULL;
+        uint32_t node = 0;
+        for (uint32_t i = 0; i < pool->blockCount; ++i)
+        {
+            if (memoryBlockAllocate(pool->blocks[i], order, &node))
+            {
+                block = pool->blocks[i];
+                break;
+            }
+        }
 
-    // Now we can create the subpass
-    VkSubpassDescription subpass = {0};
-    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
-    subpass.colorAttachmentCount = 1;
-    subpass.pColorAttachments = &colorAttachmentRef;
+        if (block == NULL)
+        {
+            if (pool->blockCount == MAX_MEMORY_BLOCKS_PER_POOL)
+            {
+                fprintf(stderr, "Failed to allocate memory: all %d blocks of memory type %u are full\n", MAX_MEMORY_BLOCKS_PER_POOL, memoryTypeIndex);
+                return APP_ERROR_ALLOC_MEMORY_BLOCK;
+            }
 
-    // Finally we can create the render pass
-    VkRenderPassCreateInfo renderPassCreateInfo = {0};
-    renderPassCreateInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
-    renderPassCreateInfo.attachmentCount = 1;
-    renderPassCreateInfo.pAttachments = &colorAttachment;
-    renderPassCreateInfo.subpassCount = 1;
-    renderPassCreateInfo.pSubpasses = &subpass;
+            AppResult appResult = createMemoryBlock(app, memoryTypeIndex, pool->blockSize, &block);
+            if (appResult != APP_SUCCESS)
+                return appResult;
+            pool->blocks[pool->blockCount++] = block;
 
-    VkResult vkResult = vkCreateRenderPass(app->logicalDevice, &renderPassCreateInfo, NULL, &app->renderPass);
-    if (vkResult != VK_SUCCESS)
-    {
-        fprintf(stderr, "Failed to create render pass: %d\n", vkResult);
-        return APP_ERROR_VULKAN_CREATE_RENDER_PASS;
+            // Cannot fail, the chunk is at most half of the new empty block
+            memoryBlockAllocate(block, order, &node);
+        }
+
+        allocation->memory = block->memory;
+        allocation->offset = (VkDeviceSize)node * chunkSize;
+        allocation->size = chunkSize;
+        allocation->mapped = block->mapped != NULL ? (char *)block->mapped + allocation->offset : NULL;
+        allocation->block = block;
+        allocation->order = order;
+        block->usedSize += chunkSize;
+        block->allocationCount++;
     }
 
+    allocator->totalAllocationCount++;
+    allocator->liveAllocationCount++;
+    allocator->liveRequestedSize += allocation->requestedSize;
+    allocator->liveReservedSize += allocation->size;
+
     return APP_SUCCESS;
-}
+} // allocateMemory
 
-AppResult loadShader(const char *filename, VkShaderModule *shaderModule, App *app)
+void freeMemory(App *app, MemoryAllocation *allocation)
 {
-    FILE *file = fopen(filename, "rb");
-    if (file == NULL)
+    if (allocation->memory == VK_NULL_HANDLE)
+        return;
+
+    MemoryAllocator *allocator = &app->memoryAllocator;
+    MemoryBlock *block = allocation->block;
+    if (block == NULL)
     {
-        fprintf(stderr, "Failed to open file: %s\n", filename);
-        return APP_ERROR_FAILED_TO_OPEN_FILE;
+        freeDeviceMemory(app, allocation->memory);
+        allocator->dedicatedAllocationCount--;
     }
-
-    fseek(file, 0, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
-
-    char *buffer = malloc(fileSize);
-    if (buffer == NULL)
+    else
     {
-        fprintf(stderr, "Failed to allocate memory for shader: %s\n", filename);
-        return APP_ERROR_ALLOC_SHADER_BUFFER;
+        memoryBlockFree(block, allocation->order, (uint32_t)(allocation->offset / allocation->size));
+        block->usedSize -= allocation->size;
+        block->allocationCount--;
+
+        // An empty block is only released when the pool has another empty one, so that
+        // allocating and freeing in a loop does not call vkAllocateMemory every time
+        MemoryPool *pool = &allocator->pools[allocation->memoryTypeIndex][allocation->kind];
+        if (block->allocationCount == 0)
+        {
+            bool hasOtherEmptyBlock = false;
+            uint32_t blockIndex = 0;
+            for (uint32_t i = 0; i < pool->blockCount; ++i)
+            {
+                if (pool->blocks[i] == block)
+                    blockIndex = i;
+                else if (pool->blocks[i]->allocationCount == 0)
+                    hasOtherEmptyBlock = true;
+            }
+
+            if (hasOtherEmptyBlock)
+            {
+                destroyMemoryBlock(app, block);
+                pool->blocks[blockIndex] = pool->blocks[--pool->blockCount];
+            }
+        }
     }
 
-    size_t bytesRead = fread(buffer, 1, fileSize, file);
-    if (bytesRead != fileSize)
+    allocator->liveAllocationCount--;
+    allocator->liveRequestedSize -= allocation->requestedSize;
+    allocator->liveReservedSize -= allocation->size;
+    memset(allocation, 0, sizeof(MemoryAllocation));
+} // freeMemory
+
+AppResult allocateDeviceMemory(App *app, uint32_t memoryTypeIndex, VkDeviceSize size, VkDeviceMemory *memory, void **mapped)
+{
+    MemoryAllocator *allocator = &app->memoryAllocator;
+    if (allocator->deviceAllocationCount >= app->physicalDeviceProperties.limits.maxMemoryAllocationCount)
     {
-        fprintf(stderr, "Failed to read file: %s\n", filename);
-        return APP_ERROR_READ_SHADER_FILE;
+        fprintf(stderr, "Failed to allocate device memory: maxMemoryAllocationCount (%u) reached\n", app->physicalDeviceProperties.limits.maxMemoryAllocationCount);
+        return APP_ERROR_VULKAN_ALLOC_DEVICE_MEMORY;
     }
 
-    fclose(file);
-
-    VkShaderModuleCreateInfo shaderModuleCreateInfo = {0};
-    shaderModuleCreateInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-    shaderModuleCreateInfo.codeSize = fileSize;
-    shaderModuleCreateInfo.pCode = (uint32_t *)buffer;
+    VkMemoryAllocateInfo allocateInfo = {0};
+    allocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocateInfo.allocationSize = size;
+    allocateInfo.memoryTypeIndex = memoryTypeIndex;
 
-    VkResult vkResult = vkCreateShaderModule(app->logicalDevice, &shaderModuleCreateInfo, NULL, shaderModule);
+    VkResult vkResult = vkAllocateMemory(app->logicalDevice, &allocateInfo, NULL, memory);
     if (vkResult != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to create shader module: %d\n", vkResult);
-        return APP_ERROR_VULKAN_CREATE_SHADER_MODULE;
+        fprintf(stderr, "Failed to allocate device memory: %d\n", vkResult);
+        return APP_ERROR_VULKAN_ALLOC_DEVICE_MEMORY;
     }
 
-    free(buffer);
+    // Host visible memory stays mapped for its whole lifetime, mapping is far too expensive
+    // to do per allocation
+    *mapped = NULL;
+    if (allocator->memoryProperties.memoryTypes[memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)
+    {
+        vkResult = vkMapMemory(app->logicalDevice, *memory, 0, VK_WHOLE_SIZE, 0, mapped);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to map device memory: %d\n", vkResult);
+            vkFreeMemory(app->logicalDevice, *memory, NULL);
+            *memory = VK_NULL_HANDLE;
+            return APP_ERROR_VULKAN_MAP_MEMORY;
+        }
+    }
 
+    allocator->deviceAllocationCount++;
     return APP_SUCCESS;
-} // loadShader
+} // allocateDeviceMemory
 
-AppResult createImageViews(App *app)
+void freeDeviceMemory(App *app, VkDeviceMemory memory)
 {
-    // First we need to create the image views
-    // Destroyed in the cleanup function
-    app->swapChainImageViews = malloc(app->swapChainImageCount * sizeof(VkImageView));
-    if (app->swapChainImageViews == NULL)
+    // Freeing the memory implicitly unmaps it
+    vkFreeMemory(app->logicalDevice, memory, NULL);
+    app->memoryAllocator.deviceAllocationCount--;
+} // freeDeviceMemory
+
+AppResult createMemoryBlock(App *app, uint32_t memoryTypeIndex, VkDeviceSize blockSize, MemoryBlock **block)
+{
+    MemoryBlock *newBlock = calloc(1, sizeof(MemoryBlock));
+    if (newBlock == NULL)
     {
-        fprintf(stderr, "Failed to allocate memory for swap chain image views\n");
-        return APP_ERROR_VULKAN_ALLOC_SWAP_CHAIN_IMAGE_VIEWS;
+        fprintf(stderr, "Failed to allocate memory for a memory block\n");
+        return APP_ERROR_ALLOC_MEMORY_BLOCK;
     }
 
-    for (uint32_t i = 0; i < app->swapChainImageCount; ++i)
+    newBlock->size = blockSize;
+    newBlock->orderCount = 1;
+    while ((MEMORY_MIN_ALLOCATION_SIZE << (newBlock->orderCount - 1)) < blockSize)
+        newBlock->orderCount++;
+
+    // Order o has 1 << (orderCount - 1 - o) nodes, each one with a bit in its order's range
+    uint32_t wordCount = 0;
+    for (uint32_t order = 0; order < newBlock->orderCount; ++order)
     {
-        VkImageViewCreateInfo imageViewCreateInfo = {0};
-        imageViewCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
-        imageViewCreateInfo.image = app->swapChainImages[i];
-        imageViewCreateInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
-        imageViewCreateInfo.format = app->selectedDeviceSurfaceFormat.format;
-        imageViewCreateInfo.components.r = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.g = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
-        imageViewCreateInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-        imageViewCreateInfo.subresourceRange.baseMipLevel = 0;
-        imageViewCreateInfo.subresourceRange.levelCount = 1;
-        imageViewCreateInfo.subresourceRange.baseArrayLayer = 0;
-        imageViewCreateInfo.subresourceRange.layerCount = 1;
+        uint32_t nodeCount = 1u << (newBlock->orderCount - 1 - order);
+        newBlock->freeBitOffsets[order] = wordCount;
+        wordCount += (nodeCount + 63) / 64;
+    }
 
-        VkResult vkResult = vkCreateImageView(app->logicalDevice, &imageViewCreateInfo, NULL, &app->swapChainImageViews[i]);
-        if (vkResult != VK_SUCCESS)
-        {
-            fprintf(stderr, "Failed to create image view: %d\n", vkResult);
-            return APP_ERROR_VULKAN_CREATE_IMAGE_VIEW;
-        }
+    newBlock->freeBits = calloc(wordCount, sizeof(uint64_t));
+    if (newBlock->freeBits == NULL)
+    {
+        fprintf(stderr, "Failed to allocate memory for a memory block\n");
+        free(newBlock);
+        return APP_ERROR_ALLOC_MEMORY_BLOCK;
+    }
+
+    AppResult appResult = allocateDeviceMemory(app, memoryTypeIndex, blockSize, &newBlock->memory, &newBlock->mapped);
+    if (appResult != APP_SUCCESS)
+    {
+        free(newBlock->freeBits);
+        free(newBlock);
+        return appResult;
     }
 
+    // The whole block starts as a single free node of the highest order
+    memoryBlockSetFree(newBlock, newBlock->orderCount - 1, 0, true);
+
+    *block = newBlock;
     return APP_SUCCESS;
-}
+} // createMemoryBlock
 
-AppResult createSwapChain(App *app)
+void destroyMemoryBlock(App *app, MemoryBlock *block)
 {
-    // First we need to set the optimal swap chain parameters
-    AppResult appResult = setOptimalSwapChainParameters(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+    freeDeviceMemory(app, block->memory);
+    free(block->freeBits);
+    free(block);
+} // destroyMemoryBlock
 
-    // Then we have to decide how many images we want in the swap chain, a good value
-    // is to have at least one more than the minimum while not exceeding the maximum
-    // 0 in maxImageCount means that there is no maximum
-    uint32_t imageCount = 0;
-    if (app->selectedDeviceSurfaceCapabilities.maxImageCount > 0)
-        imageCount = fmin(app->selectedDeviceSurfaceCapabilities.maxImageCount, app->selectedDeviceSurfaceCapabilities.minImageCount + 1);
-    else
-        imageCount = app->selectedDeviceSurfaceCapabilities.minImageCount + 1;
+bool memoryBlockAllocate(MemoryBlock *block, uint32_t order, uint32_t *node)
+{
+    if (order >= block->orderCount)
+        return false;
 
-    // Now we can create the swap chain create info struct
-    VkSwapchainCreateInfoKHR swapChainCreateInfo = {0};
-    swapChainCreateInfo.sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR;
-    swapChainCreateInfo.surface = app->surface;
-    swapChainCreateInfo.minImageCount = imageCount;
-    swapChainCreateInfo.imageFormat = app->selectedDeviceSurfaceFormat.format;
-    swapChainCreateInfo.imageColorSpace = app->selectedDeviceSurfaceFormat.colorSpace;
-    swapChainCreateInfo.imageExtent = app->swapChainExtent;
-    swapChainCreateInfo.imageArrayLayers = 1;
-    swapChainCreateInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+    uint32_t current = order;
+    while (current < block->orderCount && block->freeCounts[current] == 0)
+        current++;
+    if (current == block->orderCount)
+        return false;
 
-    /*
-    From the vulkan tutorial:
-    https://vulkan-tutorial.com/Drawing_a_triangle/Presentation/Swap_chain
-    "we need to specify how to handle swap chain images that will be used across multiple queue families. That will be the case in our application if the graphics queue family is different from the presentation queue. We'll be drawing on the images in the swap chain from the graphics queue and then submitting them on the presentation queue. There are two ways to handle images that are accessed from multiple queues:
+    // Take the first free node of the smallest order that has one
+    const uint64_t *words = &block->freeBits[block->freeBitOffsets[current]];
+    uint32_t word = 0;
+    while (words[word] == 0)
+        word++;
+    uint32_t freeNode = word * 64 + (uint32_t)__builtin_ctzll(words[word]);
+    memoryBlockSetFree(block, current, freeNode, false);
 
-    - VK_SHARING_MODE_EXCLUSIVE: An image is owned by one queue family at a time and ownership must be explicitly transferred before using it in another queue family. This option offers the best performance.
-    - VK_SHARING_MODE_CONCURRENT: Images can be used across multiple queue families without explicit ownership transfers.
+    // Then split it down to the requested order, the second half of every split stays free
+    while (current > order)
+    {
+        current--;
+        freeNode *= 2;
+        memoryBlockSetFree(block, current, freeNode + 1, true);
+    }
 
-    If the queue families differ, then we'll be using the concurrent mode in this tutorial to avoid having to do the ownership chapters, because these involve some concepts that are better explained at a later time. Concurrent mode requires you to specify in advance between which queue families ownership will be shared using the queueFamilyIndexCount and pQueueFamilyIndices parameters. If the graphics queue family and presentation queue family are the same, which will be the case on most hardware, then we should stick to exclusive mode, because concurrent mode requires you to specify at least two distinct queue families"
-    */
-    if (app->graphicsQueueFamilyIndex != app->presentationQueueFamilyIndex)
+    *node = freeNode;
+    return true;
+} // memoryBlockAllocate
+
+void memoryBlockFree(MemoryBlock *block, uint32_t order, uint32_t node)
+{
+    // Merge with the buddy for as long as it is free as well
+    while (order + 1 < block->orderCount && memoryBlockIsFree(block, order, node ^ 1))
     {
-        uint32_t queueFamilyIndices[] = {app->graphicsQueueFamilyIndex, app->presentationQueueFamilyIndex};
-        swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_CONCURRENT;
-        swapChainCreateInfo.queueFamilyIndexCount = 2;
-        swapChainCreateInfo.pQueueFamilyIndices = queueFamilyIndices;
+        memoryBlockSetFree(block, order, node ^ 1, false);
+        node /= 2;
+        order++;
+    }
+
+    memoryBlockSetFree(block, order, node, true);
+} // memoryBlockFree
+
+bool memoryBlockIsFree(const MemoryBlock *block, uint32_t order, uint32_t node)
+{
+    return (block->freeBits[block->freeBitOffsets[order] + node / 64] >> (node % 64)) & 1;
+} // memoryBlockIsFree
+
+void memoryBlockSetFree(MemoryBlock *block, uint32_t order, uint32_t node, bool isFree)
+{
+    uint64_t *word = &block->freeBits[block->freeBitOffsets[order] + node / 64];
+    uint64_t bit = (uint64_t)1 << (node % 64);
+    if (isFree)
+    {
+        *word |= bit;
+        block->freeCounts[order]++;
     }
     else
     {
-        swapChainCreateInfo.imageSharingMode = VK_SHARING_MODE_EXCLUSIVE;
-        swapChainCreateInfo.queueFamilyIndexCount = 0;
-        swapChainCreateInfo.pQueueFamilyIndices = NULL;
+        *word &= ~bit;
+        block->freeCounts[order]--;
     }
+} // memoryBlockSetFree
 
-    swapChainCreateInfo.preTransform = app->selectedDeviceSurfaceCapabilities.currentTransform;
-    swapChainCreateInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
-    swapChainCreateInfo.presentMode = app->selectedDevicePresentMode;
-    swapChainCreateInfo.clipped = VK_TRUE;
-    swapChainCreateInfo.oldSwapchain = VK_NULL_HANDLE;
+AppResult createBuffer(App *app, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer *buffer, MemoryAllocation *allocation)
+{
+    VkBufferCreateInfo bufferCreateInfo = {0};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = size;
+    bufferCreateInfo.usage = usage;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
-    VkResult vkResult = vkCreateSwapchainKHR(app->logicalDevice, &swapChainCreateInfo, NULL, &app->swapChain);
+    VkResult vkResult = vkCreateBuffer(app->logicalDevice, &bufferCreateInfo, NULL, buffer);
     if (vkResult != VK_SUCCESS)
-    {
-        fprintf(stderr, "Failed to create swap chain: %d\n", vkResult);
-        return APP_ERROR_VULKAN_CREATE_SWAP_CHAIN;
+    {
+        fprintf(stderr, "Failed to create buffer: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_BUFFER;
     }
 
-    // Now we can get the swap chain images
-    vkResult = vkGetSwapchainImagesKHR(app->logicalDevice, app->swapChain, &app->swapChainImageCount, NULL);
-    if (vkResult != VK_SUCCESS || app->swapChainImageCount == 0)
+    VkMemoryRequirements memoryRequirements;
+    vkGetBufferMemoryRequirements(app->logicalDevice, *buffer, &memoryRequirements);
+
+    AppResult appResult = allocateMemory(app, &memoryRequirements, properties, MEMORY_RESOURCE_LINEAR, allocation);
+    if (appResult != APP_SUCCESS)
     {
-        fprintf(stderr, "Failed to get swap chain images: %d\n", vkResult);
-        return APP_ERROR_VULKAN_GET_SWAP_CHAIN_IMAGES;
+        vkDestroyBuffer(app->logicalDevice, *buffer, NULL);
+        *buffer = VK_NULL_HANDLE;
+        return appResult;
     }
 
-    // Images are destroyed when the swap chain is destroyed
-    app->swapChainImages = malloc(app->swapChainImageCount * sizeof(VkImage));
-    vkResult = vkGetSwapchainImagesKHR(app->logicalDevice, app->swapChain, &app->swapChainImageCount, app->swapChainImages);
+    vkResult = vkBindBufferMemory(app->logicalDevice, *buffer, allocation->memory, allocation->offset);
     if (vkResult != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to get swap chain images: %d\n", vkResult);
-        return APP_ERROR_VULKAN_GET_SWAP_CHAIN_IMAGES;
+        fprintf(stderr, "Failed to bind buffer memory: %d\n", vkResult);
+        destroyBuffer(app, buffer, allocation);
+        return APP_ERROR_VULKAN_BIND_BUFFER_MEMORY;
     }
 
     return APP_SUCCESS;
-} // createSwapChain
+} // createBuffer
 
-AppResult setOptimalSwapChainParameters(App *app)
+void destroyBuffer(App *app, VkBuffer *buffer, MemoryAllocation *allocation)
 {
-    // First chose the ideal format
-    uint32_t surfaceFormatCount = 0;
-    VkResult vkResult = vkGetPhysicalDeviceSurfaceFormatsKHR(app->physicalDevice, app->surface, &surfaceFormatCount, NULL);
-    if (vkResult != VK_SUCCESS || surfaceFormatCount == 0)
+    if (*buffer != VK_NULL_HANDLE)
     {
-        fprintf(stderr, "Failed to get physical device surface formats: %d\n", vkResult);
-        return APP_ERROR_VULKAN_GET_PHYS_DEV_SURFACE_FORMATS;
+        uploaderForgetBuffer(app, *buffer);
+        vkDestroyBuffer(app->logicalDevice, *buffer, NULL);
     }
-    // VLA is ok here for simplicity.
-    VkSurfaceFormatKHR surfaceFormatsArr[surfaceFormatCount];
-    vkResult = vkGetPhysicalDeviceSurfaceFormatsKHR(app->physicalDevice, app->surface, &surfaceFormatCount, surfaceFormatsArr);
+    *buffer = VK_NULL_HANDLE;
+    freeMemory(app, allocation);
+} // destroyBuffer
 
-    // Ideally we want a SRGB color format and color space
-    bool foundIdealFormat = false;
-    for (uint32_t i = 0; i < surfaceFormatCount; ++i)
+AppResult createImage(App *app, const VkImageCreateInfo *imageCreateInfo, VkMemoryPropertyFlags properties, VkImage *image, MemoryAllocation *allocation)
+{
+    VkResult vkResult = vkCreateImage(app->logicalDevice, imageCreateInfo, NULL, image);
+    if (vkResult != VK_SUCCESS)
     {
-        if (surfaceFormatsArr[i].format == VK_FORMAT_B8G8R8A8_SRGB && surfaceFormatsArr[i].colorSpace == VK_COLOR_SPACE_SRGB_NONLINEAR_KHR)
-        {
-            app->selectedDeviceSurfaceFormat = surfaceFormatsArr[i];
-            foundIdealFormat = true;
-            break;
-        }
+        fprintf(stderr, "Failed to create image: %d\n", vkResult);
+        return APP_ERROR_VULKAN_CREATE_IMAGE;
     }
 
-    if (!foundIdealFormat)
+    VkMemoryRequirements memoryRequirements;
+    vkGetImageMemoryRequirements(app->logicalDevice, *image, &memoryRequirements);
+
+    MemoryResourceKind kind = imageCreateInfo->tiling == VK_IMAGE_TILING_OPTIMAL ? MEMORY_RESOURCE_OPTIMAL : MEMORY_RESOURCE_LINEAR;
+    AppResult appResult = allocateMemory(app, &memoryRequirements, properties, kind, allocation);
+    if (appResult != APP_SUCCESS)
     {
-        // If we didn't find the ideal format we just take the first one
-        app->selectedDeviceSurfaceFormat = surfaceFormatsArr[0];
+        vkDestroyImage(app->logicalDevice, *image, NULL);
+        *image = VK_NULL_HANDLE;
+        return appResult;
     }
 
-    if (verbose)
+    vkResult = vkBindImageMemory(app->logicalDevice, *image, allocation->memory, allocation->offset);
+    if (vkResult != VK_SUCCESS)
     {
-        printf("=========================================\n");
-        if (foundIdealFormat)
-        {
-            printf("Ideal format found:\n");
-            printf("\tFormat: VK_FORMAT_B8G8R8A8_SRGB\n");
-            printf("\tColor space: VK_COLOR_SPACE_SRGB_NONLINEAR_KHR\n");
-        }
-        else
-        {
-            printf("Ideal format not found, taking the first one:\n");
-            printf("\tFormat: %u\n", surfaceFormatsArr[0].format);
-            printf("\tColor space: %u\n", surfaceFormatsArr[0].colorSpace);
-        }
+        fprintf(stderr, "Failed to bind image memory: %d\n", vkResult);
+        destroyImage(app, image, allocation);
+        return APP_ERROR_VULKAN_BIND_IMAGE_MEMORY;
     }
 
-    // Then we want to chose the presentation mode
-    uint32_t presentModeCount = 0;
-    vkResult = vkGetPhysicalDeviceSurfacePresentModesKHR(app->physicalDevice, app->surface, &presentModeCount, NULL);
-    if (vkResult != VK_SUCCESS || presentModeCount == 0)
+    return APP_SUCCESS;
+} // createImage
+
+void destroyImage(App *app, VkImage *image, MemoryAllocation *allocation)
+{
+    if (*image != VK_NULL_HANDLE)
+        vkDestroyImage(app->logicalDevice, *image, NULL);
+    *image = VK_NULL_HANDLE;
+    freeMemory(app, allocation);
+} // destroyImage
+
+void printMemoryStats(const App *app)
+{
+    const MemoryAllocator *allocator = &app->memoryAllocator;
+    if (allocator->totalAllocationCount == 0)
+        return;
+
+    printf("=========================================\n");
+    printf("Device memory: %llu allocations served by %u vkAllocateMemory (%u dedicated), %llu live\n",
+           (unsigned long long)allocator->totalAllocationCount, allocator->deviceAllocationCount, allocator->dedicatedAllocationCount,
+           (unsigned long long)allocator->liveAllocationCount);
+
+    // Internal fragmentation is the space lost by rounding every allocation up to a power of
+    // two, external fragmentation the part of the free space not usable by a single allocation
+    if (allocator->liveReservedSize > 0)
+        printf("\tinternal fragmentation %.1f%%\n", 100.0 * (1.0 - (double)allocator->liveRequestedSize / (double)allocator->liveReservedSize));
+
+    for (uint32_t type = 0; type < allocator->memoryProperties.memoryTypeCount; ++type)
     {
-        fprintf(stderr, "Failed to get physical device surface present modes: %d\n", vkResult);
-        return APP_ERROR_VULKAN_GET_PHYS_DEV_PRESENT_MODES;
+        for (uint32_t kind = 0; kind < MEMORY_RESOURCE_KIND_COUNT; ++kind)
+        {
+            const MemoryPool *pool = &allocator->pools[type][kind];
+            for (uint32_t i = 0; i < pool->blockCount; ++i)
+            {
+                const MemoryBlock *block = pool->blocks[i];
+                VkDeviceSize freeSize = block->size - block->usedSize;
+                VkDeviceSize largestFreeSize = 0;
+                for (uint32_t order = 0; order < block->orderCount; ++order)
+                {
+                    if (block->freeCounts[order] > 0)
+                        largestFreeSize = MEMORY_MIN_ALLOCATION_SIZE << order;
+                }
+                double externalFragmentation = freeSize > 0 ? 1.0 - (double)largestFreeSize / (double)freeSize : 0.0;
+
+                printf("\ttype %u %s block %u: %u allocations, %.2f / %.2f MB used, largest free chunk %.2f MB, external fragmentation %.1f%%\n",
+                       type, kind == MEMORY_RESOURCE_LINEAR ? "linear" : "optimal", i, block->allocationCount,
+                       (double)block->usedSize / (1024.0 * 1024.0), (double)block->size / (1024.0 * 1024.0),
+                       (double)largestFreeSize / (1024.0 * 1024.0), 100.0 * externalFragmentation);
+            }
+        }
     }
-    // VLA is ok here for simplicity.
-    VkPresentModeKHR presentModesArr[presentModeCount];
-    vkResult = vkGetPhysicalDeviceSurfacePresentModesKHR(app->physicalDevice, app->surface, &presentModeCount, presentModesArr);
+} // printMemoryStats
 
-    // Ideally we want a mailbox present mode
-    bool foundIdealPresentMode = false;
-    for (uint32_t i = 0; i < presentModeCount; ++i)
+void destroyMemoryAllocator(App *app)
+{
+    MemoryAllocator *allocator = &app->memoryAllocator;
+    if (allocator->liveAllocationCount > 0)
+        fprintf(stderr, "Warning: %llu device memory allocations still alive at shutdown\n", (unsigned long long)allocator->liveAllocationCount);
+
+    for (uint32_t type = 0; type < VK_MAX_MEMORY_TYPES; ++type)
     {
-        if (presentModesArr[i] == VK_PRESENT_MODE_MAILBOX_KHR)
+        for (uint32_t kind = 0; kind < MEMORY_RESOURCE_KIND_COUNT; ++kind)
         {
-            foundIdealPresentMode = true;
-            app->selectedDevicePresentMode = presentModesArr[i];
-            break;
+            MemoryPool *pool = &allocator->pools[type][kind];
+            for (uint32_t i = 0; i < pool->blockCount; ++i)
+            {
+                destroyMemoryBlock(app, pool->blocks[i]);
+            }
+            pool->blockCount = 0;
         }
     }
+} // destroyMemoryAllocator
 
-    if (!foundIdealPresentMode)
+AppResult createLogicalDevice(App *app)
+{
+    AppResult appResult = {0};
+    appResult = getDeviceQueues(app);
+    if (appResult != APP_SUCCESS)
+        return appResult;
+
+    // Only the features the enabled modes need are turned on
+    const VkPhysicalDeviceFeatures *supportedFeatures = &app->deviceCapabilities.features;
+    VkPhysicalDeviceFeatures deviceFeatures = {0};
+
+    // VLA is ok here for simplicity
+    const char *enabledExtensions[ARRAY_LEN(requiredDeviceExtensions) + 3];
+    uint32_t enabledExtensionCount = 0;
+    for (uint32_t i = 0; i < ARRAY_LEN(requiredDeviceExtensions); ++i)
     {
-        // If we didn't find the ideal present mode we just take the FIFO one that is
-        // guaranteed to be available
-        app->selectedDevicePresentMode = VK_PRESENT_MODE_FIFO_KHR;
+        enabledExtensions[enabledExtensionCount++] = requiredDeviceExtensions[i];
     }
 
-    if (verbose)
+    // GPU driven rendering issues one indirect command per object, each with its own
+    // firstInstance, and reads their count from a buffer when the extension is there
+    bool drawIndirectCountSupported = false;
+    if (app->config.gpuDriven)
     {
-        printf("=========================================\n");
-        if (foundIdealPresentMode)
+        if (!supportedFeatures->multiDrawIndirect || !supportedFeatures->drawIndirectFirstInstance)
         {
-            printf("Ideal present mode found:\n");
-            printf("\tVK_PRESENT_MODE_MAILBOX_KHR\n");
+            fprintf(stderr, "GPU driven rendering needs the multiDrawIndirect and drawIndirectFirstInstance features\n");
+            return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
         }
-        else
+        if (app->config.instanceCount > app->physicalDeviceProperties.limits.maxDrawIndirectCount)
         {
-            printf("Ideal present mode not found, taking VK_PRESENT_MODE_FIFO_KHR\n");
+            fprintf(stderr, "GPU driven rendering supports at most %u objects on this device\n", app->physicalDeviceProperties.limits.maxDrawIndirectCount);
+            return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
         }
-    }
+        deviceFeatures.multiDrawIndirect = VK_TRUE;
+        deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
 
-    // Then we have to setup app surface capabilities
-    vkResult = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(app->physicalDevice, app->surface, &app->selectedDeviceSurfaceCapabilities);
-    if (vkResult != VK_SUCCESS)
-    {
-        fprintf(stderr, "Failed to get physical device surface capabilities: %d\n", vkResult);
-        return APP_ERROR_VULKAN_GET_PHYS_DEV_SURFACE_CAPABILITIES;
+        drawIndirectCountSupported = app->deviceCapabilities.hasDrawIndirectCount;
+        if (drawIndirectCountSupported)
+            enabledExtensions[enabledExtensionCount++] = VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME;
     }
 
-    // and set the swap chain extent
-    if (app->selectedDeviceSurfaceCapabilities.currentExtent.width != UINT32_MAX)
-    {
-        app->swapChainExtent = app->selectedDeviceSurfaceCapabilities.currentExtent;
-    }
-    else
+    // Dynamic rendering is core in 1.3, a 1.2 device can still have the extension, whose other
+    // requirements are core in 1.2. The feature is mandatory wherever either is available
+    uint32_t apiVersion = app->physicalDeviceProperties.apiVersion < app->instanceApiVersion ? app->physicalDeviceProperties.apiVersion : app->instanceApiVersion;
+    bool dynamicRenderingCore = apiVersion >= VK_API_VERSION_1_3;
+    void *deviceCreateNext = NULL;
+    VkPhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures = {0};
+    dynamicRenderingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES_KHR;
+    dynamicRenderingFeatures.dynamicRendering = VK_TRUE;
+    if (app->config.dynamicRendering)
     {
-        int width, height;
-        glfwGetFramebufferSize(app->window, &width, &height);
-        VkExtent2D actualExtent = {
-            .width = (uint32_t)width,
-            .height = (uint32_t)height,
-        };
-        actualExtent.width = fmax(app->selectedDeviceSurfaceCapabilities.minImageExtent.width, fmin(app->selectedDeviceSurfaceCapabilities.maxImageExtent.width, actualExtent.width));
-        actualExtent.height = fmax(app->selectedDeviceSurfaceCapabilities.minImageExtent.height, fmin(app->selectedDeviceSurfaceCapabilities.maxImageExtent.height, actualExtent.height));
-        app->swapChainExtent = actualExtent;
+        if (!dynamicRenderingCore && (apiVersion < VK_API_VERSION_1_2 || !app->deviceCapabilities.hasDynamicRendering))
+        {
+            fprintf(stderr, "Dynamic rendering needs Vulkan 1.3, or Vulkan 1.2 and VK_KHR_dynamic_rendering\n");
+            return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
+        }
+        if (!dynamicRenderingCore)
+            enabledExtensions[enabledExtensionCount++] = VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME;
+        dynamicRenderingFeatures.pNext = deviceCreateNext;
+        deviceCreateNext = &dynamicRenderingFeatures;
     }
 
-    return APP_SUCCESS;
-} // setOptimalSwapChainParameters
-
-AppResult createLogicalDevice(App *app)
-{
-    AppResult appResult = {0};
-    appResult = getDeviceQueues(app);
-    if (appResult != APP_SUCCESS)
-        return appResult;
+    // The bindless set is made of partially bound arrays updated while bound, and the images
+    // are indexed by a value that varies within a draw. Descriptor indexing is core in 1.2,
+    // the extension only needs maintenance3 which is core in 1.1
+    VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures = {0};
+    descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+    if (app->config.bindless)
+    {
+        bool descriptorIndexingCore = apiVersion >= VK_API_VERSION_1_2;
+        if (!descriptorIndexingCore && (apiVersion < VK_API_VERSION_1_1 || !app->deviceCapabilities.hasDescriptorIndexing))
+        {
+            fprintf(stderr, "Bindless rendering needs Vulkan 1.2, or Vulkan 1.1 and VK_EXT_descriptor_indexing\n");
+            return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
+        }
 
-    // No specific features for now
-    VkPhysicalDeviceFeatures deviceFeatures = {0};
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT supportedIndexingFeatures = {0};
+        supportedIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+        VkPhysicalDeviceFeatures2 supportedFeatures2 = {0};
+        supportedFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        supportedFeatures2.pNext = &supportedIndexingFeatures;
+        vkGetPhysicalDeviceFeatures2(app->physicalDevice, &supportedFeatures2);
+        if (!supportedIndexingFeatures.runtimeDescriptorArray || !supportedIndexingFeatures.descriptorBindingPartiallyBound ||
+            !supportedIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind || !supportedIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind ||
+            !supportedIndexingFeatures.shaderSampledImageArrayNonUniformIndexing)
+        {
+            fprintf(stderr, "Bindless rendering needs the runtimeDescriptorArray, descriptorBindingPartiallyBound, update after bind and non uniform indexing features\n");
+            return APP_ERROR_VULKAN_FEATURE_NOT_SUPPORTED;
+        }
+        descriptorIndexingFeatures.runtimeDescriptorArray = VK_TRUE;
+        descriptorIndexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+        descriptorIndexingFeatures.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+        descriptorIndexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+        descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+
+        if (!descriptorIndexingCore)
+            enabledExtensions[enabledExtensionCount++] = VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME;
+        descriptorIndexingFeatures.pNext = deviceCreateNext;
+        deviceCreateNext = &descriptorIndexingFeatures;
+    }
 
     // Now we can create the logical device
     VkDeviceCreateInfo deviceCreateInfo = {0};
     deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-    deviceCreateInfo.pNext = NULL;
+    deviceCreateInfo.pNext = deviceCreateNext;
     deviceCreateInfo.queueCreateInfoCount = app->queueCreateInfoCount;
     deviceCreateInfo.pQueueCreateInfos = app->pQueueCreateInfos;
     deviceCreateInfo.pEnabledFeatures = &deviceFeatures;
-    deviceCreateInfo.enabledExtensionCount = ARRAY_LEN(requiredDeviceExtensions);
-    deviceCreateInfo.ppEnabledExtensionNames = requiredDeviceExtensions;
+    deviceCreateInfo.enabledExtensionCount = enabledExtensionCount;
+    deviceCreateInfo.ppEnabledExtensionNames = enabledExtensions;
 
     VkResult vkResult = vkCreateDevice(app->physicalDevice, &deviceCreateInfo, NULL, &app->logicalDevice);
     if (vkResult != VK_SUCCESS)
@@ -890,14 +8913,35 @@ AppResult createLogicalDevice(App *app)
     // We can finally assign the queues
     vkGetDeviceQueue(app->logicalDevice, app->graphicsQueueFamilyIndex, 0, &app->graphicsQueue);
     vkGetDeviceQueue(app->logicalDevice, app->presentationQueueFamilyIndex, 0, &app->presentationQueue);
+    vkGetDeviceQueue(app->logicalDevice, app->transferQueueFamilyIndex, 0, &app->transferQueue);
+    vkGetDeviceQueue(app->logicalDevice, app->computeQueueFamilyIndex, 0, &app->computeQueue);
 
-    return APP_SUCCESS;
+    if (drawIndirectCountSupported)
+        app->vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(app->logicalDevice, "vkCmdDrawIndexedIndirectCountKHR");
+
+    if (app->config.dynamicRendering)
+    {
+        app->vkCmdBeginRendering = (PFN_vkCmdBeginRenderingKHR)vkGetDeviceProcAddr(app->logicalDevice, dynamicRenderingCore ? "vkCmdBeginRendering" : "vkCmdBeginRenderingKHR");
+        app->vkCmdEndRendering = (PFN_vkCmdEndRenderingKHR)vkGetDeviceProcAddr(app->logicalDevice, dynamicRenderingCore ? "vkCmdEndRendering" : "vkCmdEndRenderingKHR");
+        app->dynamicRendering = true;
+
+        if (verbose)
+        {
+            printf("=========================================\n");
+            printf("Dynamic rendering: %s\n", dynamicRenderingCore ? "core Vulkan 1.3" : VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+        }
+    }
+
+    // Every buffer and image gets its memory from the allocator, which lives as long as the
+    // logical device
+    return createMemoryAllocator(app);
 } // createLogicalDevice
 
 AppResult getDeviceQueues(App *app)
 {
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(app->physicalDevice, &queueFamilyCount, NULL);
+    // The queue families were queried along with the rest of the device capabilities
+    uint32_t queueFamilyCount = app->deviceCapabilities.queueFamilyCount;
+    const VkQueueFamilyProperties *queueFamiliesArr = app->deviceCapabilities.queueFamilies;
 
     if (queueFamilyCount == 0)
     {
@@ -905,10 +8949,6 @@ AppResult getDeviceQueues(App *app)
         return APP_ERROR_VULKAN_ENUM_QUEUE_FAMILY_PROP;
     }
 
-    // VLA is ok here for simplicity.
-    VkQueueFamilyProperties queueFamiliesArr[queueFamilyCount];
-    vkGetPhysicalDeviceQueueFamilyProperties(app->physicalDevice, &queueFamilyCount, queueFamiliesArr);
-
     if (verbose)
     {
         printf("=========================================\n");
@@ -936,15 +8976,7 @@ AppResult getDeviceQueues(App *app)
             graphicsQueueFamilyFound = true;
         }
 
-        VkBool32 presentationSupported = VK_FALSE;
-        VkResult result = vkGetPhysicalDeviceSurfaceSupportKHR(app->physicalDevice, i, app->surface, &presentationSupported);
-        if (result != VK_SUCCESS)
-        {
-            fprintf(stderr, "Failed to check presentation support: %d\n", result);
-            return APP_ERROR_VULKAN_CANNOT_GET_PRESENTATION_SUPPORT;
-        }
-
-        if (!presentationQueueFamilyFound && presentationSupported)
+        if (!presentationQueueFamilyFound && app->deviceCapabilities.presentationSupport[i])
         {
             app->presentationQueueFamilyIndex = i;
             presentationQueueFamilyFound = true;
@@ -968,357 +9000,882 @@ AppResult getDeviceQueues(App *app)
         return APP_ERROR_VULKAN_NO_PRESENTATION_QUEUE_FAMILY;
     }
 
-    // Set the app queue priorities to 1.0f
+    app->graphicsQueueTimestampValidBits = queueFamiliesArr[app->graphicsQueueFamilyIndex].timestampValidBits;
+
+    // Compute work goes to a compute family without graphics support when there is one, its
+    // queue runs asynchronously next to the graphics queue on most hardware. Otherwise the
+    // graphics family, which always supports compute, runs it
+    app->computeQueueFamilyIndex = app->graphicsQueueFamilyIndex;
+    for (uint32_t i = 0; i < queueFamilyCount; ++i)
+    {
+        VkQueueFlags flags = queueFamiliesArr[i].queueFlags;
+        if ((flags & VK_QUEUE_COMPUTE_BIT) && !(flags & VK_QUEUE_GRAPHICS_BIT))
+        {
+            app->computeQueueFamilyIndex = i;
+            break;
+        }
+    }
+
+    // Uploads prefer a transfer only family, usually a DMA engine that copies without taking
+    // any time from rendering, then any non graphics family with transfer support. Without
+    // one, the graphics family does the copies itself since it always supports transfers
+    app->transferQueueFamilyIndex = app->graphicsQueueFamilyIndex;
+    uint32_t transferFamilyScore = 0;
+    for (uint32_t i = 0; i < queueFamilyCount; ++i)
+    {
+        VkQueueFlags flags = queueFamiliesArr[i].queueFlags;
+        if (!(flags & VK_QUEUE_TRANSFER_BIT) || (flags & VK_QUEUE_GRAPHICS_BIT))
+            continue;
+
+        uint32_t score = (flags & VK_QUEUE_COMPUTE_BIT) ? 1 : 2;
+        if (score > transferFamilyScore)
+        {
+            app->transferQueueFamilyIndex = i;
+            transferFamilyScore = score;
+        }
+    }
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        printf("Transfer queue family: %u (%s)\n", app->transferQueueFamilyIndex,
+               transferFamilyScore == 2 ? "transfer only" : transferFamilyScore == 1 ? "async compute" : "graphics");
+        printf("Compute queue family: %u (%s)\n", app->computeQueueFamilyIndex,
+               app->computeQueueFamilyIndex != app->graphicsQueueFamilyIndex ? "async compute" : "graphics");
+    }
+
+    // Set the app queue priorities, the transfer queue is below the others so that bulk
+    // uploads yield to rendering when they share hardware
     app->graphicsQueuePriority = 1.0f;
     app->presentationQueuePriority = 1.0f;
-
-    // Now we can build the VkDeviceQueueCreateInfo but first we need to check if the queue
-    // family indices are different
-    if (app->graphicsQueueFamilyIndex == app->presentationQueueFamilyIndex)
+    app->transferQueuePriority = 0.5f;
+    app->computeQueuePriority = 1.0f;
+
+    // Now we can build the VkDeviceQueueCreateInfo, one per distinct family. Each family gets
+    // a single queue, shared by all the roles it was picked for
+    uint32_t queueFamilyIndices[4] = {app->graphicsQueueFamilyIndex, app->presentationQueueFamilyIndex, app->computeQueueFamilyIndex, app->transferQueueFamilyIndex};
+    const float *queuePriorities[4] = {&app->graphicsQueuePriority, &app->presentationQueuePriority, &app->computeQueuePriority, &app->transferQueuePriority};
+    app->queueCreateInfoCount = 0;
+    for (uint32_t i = 0; i < ARRAY_LEN(queueFamilyIndices); ++i)
     {
-        // In this case we only need to create one queue info
-        app->queueCreateInfoCount = 1;
+        bool alreadyAdded = false;
+        for (uint32_t j = 0; j < app->queueCreateInfoCount; ++j)
+        {
+            if (app->pQueueCreateInfos[j].queueFamilyIndex == queueFamilyIndices[i])
+                alreadyAdded = true;
+        }
+        if (alreadyAdded)
+            continue;
+
         VkDeviceQueueCreateInfo queueCreateInfo = {0};
         queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
         queueCreateInfo.pNext = NULL;
-        queueCreateInfo.queueFamilyIndex = app->graphicsQueueFamilyIndex;
+        queueCreateInfo.queueFamilyIndex = queueFamilyIndices[i];
         queueCreateInfo.queueCount = 1;
-        queueCreateInfo.pQueuePriorities = &app->graphicsQueuePriority;
-        app->pQueueCreateInfos[0] = queueCreateInfo;
+        queueCreateInfo.pQueuePriorities = queuePriorities[i];
+        app->pQueueCreateInfos[app->queueCreateInfoCount++] = queueCreateInfo;
+    }
+
+    return APP_SUCCESS;
+} // getDeviceQueues
+
+AppResult selectPhysicalDevice(App *app)
+{
+    // First we need to get the number of physical devices and enumerate them
+    uint32_t deviceCount = 0;
+    if (vkEnumeratePhysicalDevices(app->instance, &deviceCount, NULL) != VK_SUCCESS || deviceCount == 0)
+    {
+        fprintf(stderr, "Failed to find GPUs with Vulkan support\n");
+        return APP_ERROR_VULKAN_NO_PHYSICAL_DEVICE;
+    }
+    // VLA is ok here for simplicity.
+    VkPhysicalDevice deviceArr[deviceCount];
+    if (vkEnumeratePhysicalDevices(app->instance, &deviceCount, deviceArr) != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to enumerate physical devices\n");
+        return APP_ERROR_VULKAN_ENUM_PHYSICAL_DEVICE;
+    }
+
+    // The device chosen by a previous run is taken right away if it is still there with the
+    // same driver and still suitable, only that device is queried and the others are neither
+    // queried nor benchmarked. Its surface support is queried again as the surface may differ
+    DeviceCapabilities *selected = &app->deviceCapabilities;
+    DeviceCacheRecord record = {0};
+    bool fromCache = false;
+    if (app->config.deviceCachePath != NULL && loadDeviceCache(app->config.deviceCachePath, &record) && record.benchmarkScored == app->config.benchmarkDevices)
+    {
+        for (uint32_t i = 0; i < deviceCount && !fromCache; ++i)
+        {
+            VkPhysicalDeviceProperties deviceProperties;
+            vkGetPhysicalDeviceProperties(deviceArr[i], &deviceProperties);
+            if (deviceCacheMatches(&deviceProperties, &record))
+            {
+                memset(selected, 0, sizeof(DeviceCapabilities));
+                fromCache = queryDeviceCapabilities(deviceArr[i], app->surface, selected) && isDeviceSuitable(selected);
+                if (!fromCache && verbose)
+                    printf("Ignoring device cache %s, the cached device cannot present to this surface\n", app->config.deviceCachePath);
+                break;
+            }
+        }
+    }
+
+    if (!fromCache)
+    {
+        if (verbose)
+        {
+            printf("=========================================\n");
+            printf("Physical devices:\n");
+        }
+
+        // Now we need to select the best physical device, every device is queried once and the
+        // record of the best one is kept
+        memset(selected, 0, sizeof(DeviceCapabilities));
+        uint32_t maxScore = 0;
+        for (uint32_t i = 0; i < deviceCount; ++i)
+        {
+            DeviceCapabilities capabilities = {0};
+            bool queried = queryDeviceCapabilities(deviceArr[i], app->surface, &capabilities);
+
+            if (verbose)
+                printDeviceCapabilities(i, &capabilities);
+
+            if (queried && isDeviceSuitable(&capabilities))
+            {
+                DeviceBenchmark benchmark = {0};
+                if (app->config.benchmarkDevices)
+                    benchmarkDevice(app, &capabilities, &benchmark);
+                uint32_t score = computeDeviceScore(&capabilities, app->config.benchmarkDevices ? &benchmark : NULL);
+                if (score > maxScore)
+                {
+                    maxScore = score;
+                    *selected = capabilities;
+                }
+                if (verbose)
+                {
+                    printf("\t\tScore: %u\n", score);
+                    printf("\t\tDevice is suitable\n");
+                }
+            }
+            else
+            {
+                if (verbose)
+                {
+                    printf("\t\tDevice is not suitable\n");
+                }
+            }
+        }
+
+        if (selected->device == VK_NULL_HANDLE)
+        {
+            fprintf(stderr, "Failed to find a suitable GPU\n");
+            return APP_ERROR_VULKAN_NO_PHYSICAL_DEVICE;
+        }
+        if (app->config.deviceCachePath != NULL)
+        {
+            record.vendorID = selected->properties.vendorID;
+            record.deviceID = selected->properties.deviceID;
+            record.driverVersion = selected->properties.driverVersion;
+            memcpy(record.pipelineCacheUUID, selected->properties.pipelineCacheUUID, VK_UUID_SIZE);
+            record.score = maxScore;
+            record.benchmarkScored = app->config.benchmarkDevices;
+            saveDeviceCache(app->config.deviceCachePath, &record);
+        }
+    }
+
+    app->physicalDevice = selected->device;
+    app->physicalDeviceProperties = selected->properties;
+
+    if (verbose)
+    {
+        printf("=========================================\n");
+        if (fromCache)
+            printf("Selected device: %s (from the device cache, score %u)\n", app->physicalDeviceProperties.deviceName, record.score);
+        else
+            printf("Selected device: %s\n", app->physicalDeviceProperties.deviceName);
+    }
+
+    return APP_SUCCESS;
+} // selectPhysicalDevice
+
+bool queryDeviceCapabilities(VkPhysicalDevice device, VkSurfaceKHR surface, DeviceCapabilities *capabilities)
+{
+    capabilities->device = device;
+    vkGetPhysicalDeviceProperties(device, &capabilities->properties);
+    vkGetPhysicalDeviceFeatures(device, &capabilities->features);
+
+    // Queue families and which of them can present to the surface
+    capabilities->queueFamilyCount = MAX_DEVICE_QUEUE_FAMILIES;
+    vkGetPhysicalDeviceQueueFamilyProperties(device, &capabilities->queueFamilyCount, capabilities->queueFamilies);
+    for (uint32_t i = 0; i < capabilities->queueFamilyCount; ++i)
+    {
+        VkResult vkResult = vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &capabilities->presentationSupport[i]);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to check presentation support: %d\n", vkResult);
+            return false;
+        }
+    }
+
+    // It is the same as for the instance, we need to get the available extensions and compare
+    // them with the required ones
+    uint32_t availableExtensionCount = 0;
+    VkResult vkResult = vkEnumerateDeviceExtensionProperties(device, NULL, &availableExtensionCount, NULL);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to enumerate device extension properties: %d\n", vkResult);
+        return false;
+    }
+
+    // VLA is ok here for simplicity.
+    VkExtensionProperties availableExtensionsArr[availableExtensionCount];
+    vkResult = vkEnumerateDeviceExtensionProperties(device, NULL, &availableExtensionCount, availableExtensionsArr);
+    if (vkResult != VK_SUCCESS)
+    {
+        fprintf(stderr, "Failed to enumerate device extension properties: %d\n", vkResult);
+        return false;
+    }
+
+    capabilities->hasRequiredExtensions = true;
+    for (uint32_t i = 0; i < ARRAY_LEN(requiredDeviceExtensions); ++i)
+    {
+        if (!extensionListContains(availableExtensionsArr, availableExtensionCount, requiredDeviceExtensions[i]))
+        {
+            fprintf(stderr, "Required extension %s is not supported\n", requiredDeviceExtensions[i]);
+            capabilities->hasRequiredExtensions = false;
+        }
     }
-    else
+    capabilities->hasDrawIndirectCount = extensionListContains(availableExtensionsArr, availableExtensionCount, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    capabilities->hasDynamicRendering = extensionListContains(availableExtensionsArr, availableExtensionCount, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+    capabilities->hasDescriptorIndexing = extensionListContains(availableExtensionsArr, availableExtensionCount, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+
+    // The surface queries need the swap chain extension, note that it's important to check
+    // this AFTER having ensured that the device has it
+    if (!capabilities->hasRequiredExtensions)
+        return true;
+
+    capabilities->surfaceFormatCount = MAX_DEVICE_SURFACE_FORMATS;
+    vkResult = vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &capabilities->surfaceFormatCount, capabilities->surfaceFormats);
+    if (vkResult != VK_SUCCESS && vkResult != VK_INCOMPLETE)
     {
-        // In this case we need to create two queue infos
-        app->queueCreateInfoCount = 2;
-        VkDeviceQueueCreateInfo graphicsQueueCreateInfo = {0};
-        graphicsQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        graphicsQueueCreateInfo.pNext = NULL;
-        graphicsQueueCreateInfo.queueFamilyIndex = app->graphicsQueueFamilyIndex;
-        graphicsQueueCreateInfo.queueCount = 1;
-        graphicsQueueCreateInfo.pQueuePriorities = &app->graphicsQueuePriority;
-
-        VkDeviceQueueCreateInfo presentationQueueCreateInfo = {0};
-        presentationQueueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-        presentationQueueCreateInfo.pNext = NULL;
-        presentationQueueCreateInfo.queueFamilyIndex = app->presentationQueueFamilyIndex;
-        presentationQueueCreateInfo.queueCount = 1;
-        presentationQueueCreateInfo.pQueuePriorities = &app->presentationQueuePriority;
+        fprintf(stderr, "Failed to get physical device surface formats: %d\n", vkResult);
+        return false;
+    }
 
-        app->pQueueCreateInfos[0] = graphicsQueueCreateInfo;
-        app->pQueueCreateInfos[1] = presentationQueueCreateInfo;
+    capabilities->presentModeCount = MAX_DEVICE_PRESENT_MODES;
+    vkResult = vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &capabilities->presentModeCount, capabilities->presentModes);
+    if (vkResult != VK_SUCCESS && vkResult != VK_INCOMPLETE)
+    {
+        fprintf(stderr, "Failed to get physical device surface present modes: %d\n", vkResult);
+        return false;
     }
 
-    return APP_SUCCESS;
-} // getDeviceQueues
+    return true;
+} // queryDeviceCapabilities
 
-AppResult selectPhysicalDevice(App *app)
+bool extensionListContains(const VkExtensionProperties *extensions, uint32_t extensionCount, const char *extensionName)
 {
-    // First we need to get the number of physical devices and enumerate them
-    uint32_t deviceCount = 0;
-    if (vkEnumeratePhysicalDevices(app->instance, &deviceCount, NULL) != VK_SUCCESS || deviceCount == 0)
+    for (uint32_t i = 0; i < extensionCount; ++i)
     {
-        fprintf(stderr, "Failed to find GPUs with Vulkan support\n");
-        return APP_ERROR_VULKAN_NO_PHYSICAL_DEVICE;
+        if (strcmp(extensionName, extensions[i].extensionName) == 0)
+            return true;
     }
-    // VLA is ok here for simplicity.
-    VkPhysicalDevice deviceArr[deviceCount];
-    if (vkEnumeratePhysicalDevices(app->instance, &deviceCount, deviceArr) != VK_SUCCESS)
+
+    return false;
+} // extensionListContains
+
+void printDeviceCapabilities(uint32_t index, const DeviceCapabilities *capabilities)
+{
+    const VkPhysicalDeviceProperties *deviceProperties = &capabilities->properties;
+    printf("\tDevice %i: %s\n", index + 1, deviceProperties->deviceName);
+    printf("\t\tAPI version: %u\n", deviceProperties->apiVersion);
+    printf("\t\tDriver version: %u\n", deviceProperties->driverVersion);
+    printf("\t\tVendor ID: %u\n", deviceProperties->vendorID);
+    printf("\t\tDevice ID: %u\n", deviceProperties->deviceID);
+    if (deviceProperties->deviceType == 0)
+        printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_OTHER\n");
+    else if (deviceProperties->deviceType == 1)
+        printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU\n");
+    else if (deviceProperties->deviceType == 2)
+        printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU\n");
+    else if (deviceProperties->deviceType == 3)
+        printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU\n");
+    else if (deviceProperties->deviceType == 4)
+        printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_CPU\n");
+
+    printf("\t\tSurface formats:\n");
+    for (uint32_t i = 0; i < capabilities->surfaceFormatCount; ++i)
     {
-        fprintf(stderr, "Failed to enumerate physical devices\n");
-        return APP_ERROR_VULKAN_ENUM_PHYSICAL_DEVICE;
+        printf("\t\t\tSurface format %i:\n", i);
+        printf("\t\t\t\tFormat: %u\n", capabilities->surfaceFormats[i].format);
+        printf("\t\t\t\tColor space: %u\n", capabilities->surfaceFormats[i].colorSpace);
     }
 
-    if (verbose)
+    printf("\t\tPresent modes:\n");
+    for (uint32_t i = 0; i < capabilities->presentModeCount; ++i)
     {
-        printf("=========================================\n");
-        printf("Physical devices:\n");
+        printf("\t\t\tPresent mode %i: %u\n", i, capabilities->presentModes[i]);
     }
+} // printDeviceCapabilities
+
+bool deviceCacheMatches(const VkPhysicalDeviceProperties *deviceProperties, const DeviceCacheRecord *cached)
+{
+    // The tree targets Vulkan 1.0 which has no deviceUUID, the pipeline cache UUID identifies
+    // the device and driver build just as well and the driver version catches the rest
+    return deviceProperties->vendorID == cached->vendorID &&
+           deviceProperties->deviceID == cached->deviceID &&
+           deviceProperties->driverVersion == cached->driverVersion &&
+           memcmp(deviceProperties->pipelineCacheUUID, cached->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+} // deviceCacheMatches
+
+bool loadDeviceCache(const char *path, DeviceCacheRecord *record)
+{
+    // A missing cache file is the normal case on the first run
+    FILE *file = fopen(path, "rb");
+    if (file == NULL)
+        return false;
 
-    // Now we need to select the best physical device
-    VkPhysicalDevice selectedDevice = VK_NULL_HANDLE;
-    uint32_t maxScore = 0;
-    for (uint32_t i = 0; i < deviceCount; ++i)
+    // The record is stored as is, the header rejects files written by another build
+    DeviceCacheHeader header = {0};
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+                 memcmp(header.magic, DEVICE_CACHE_MAGIC, sizeof(header.magic)) == 0 &&
+                 header.version == DEVICE_CACHE_VERSION &&
+                 header.recordSize == sizeof(DeviceCacheRecord) &&
+                 fread(record, sizeof(DeviceCacheRecord), 1, file) == 1;
+    fclose(file);
+
+    if (!valid)
     {
         if (verbose)
-        {
-
-            VkPhysicalDeviceProperties deviceProperties;
-            vkGetPhysicalDeviceProperties(deviceArr[i], &deviceProperties);
-            printf("\tDevice %i: %s\n", i + 1, deviceProperties.deviceName);
-            printf("\t\tAPI version: %u\n", deviceProperties.apiVersion);
-            printf("\t\tDriver version: %u\n", deviceProperties.driverVersion);
-            printf("\t\tVendor ID: %u\n", deviceProperties.vendorID);
-            printf("\t\tDevice ID: %u\n", deviceProperties.deviceID);
-            if (deviceProperties.deviceType == 0)
-                printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_OTHER\n");
-            else if (deviceProperties.deviceType == 1)
-                printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU\n");
-            else if (deviceProperties.deviceType == 2)
-                printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU\n");
-            else if (deviceProperties.deviceType == 3)
-                printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU\n");
-            else if (deviceProperties.deviceType == 4)
-                printf("\t\tDevice type: VK_PHYSICAL_DEVICE_TYPE_CPU\n");
-        }
-
-        if (isDeviceSuitable(deviceArr[i], app->surface))
-        {
-            uint32_t score = computeDeviceScore(deviceArr[i]);
-            if (score > maxScore)
-            {
-                maxScore = score;
-                selectedDevice = deviceArr[i];
-            }
-            if (verbose)
-            {
-                printf("\t\tScore: %u\n", score);
-                printf("\t\tDevice is suitable\n");
-            }
-        }
-        else
-        {
-            if (verbose)
-            {
-                printf("\t\tDevice is not suitable\n");
-            }
-        }
+            printf("Ignoring device cache %s, it was written by another build\n", path);
+        memset(record, 0, sizeof(DeviceCacheRecord));
+        return false;
     }
 
-    if (selectedDevice == VK_NULL_HANDLE)
+    return true;
+} // loadDeviceCache
+
+void saveDeviceCache(const char *path, const DeviceCacheRecord *record)
+{
+    DeviceCacheHeader header = {0};
+    memcpy(header.magic, DEVICE_CACHE_MAGIC, sizeof(header.magic));
+    header.version = DEVICE_CACHE_VERSION;
+    header.recordSize = sizeof(DeviceCacheRecord);
+
+    // Same as the pipeline cache, written next to its final location and renamed over it
+    char tmpPath[4096];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.%ld.tmp", path, (long)getpid());
+
+    FILE *file = fopen(tmpPath, "wb");
+    if (file == NULL)
     {
-        fprintf(stderr, "Failed to find a suitable GPU\n");
-        return APP_ERROR_VULKAN_NO_PHYSICAL_DEVICE;
+        fprintf(stderr, "Failed to open %s to save the device cache\n", tmpPath);
+        return;
     }
 
-    app->physicalDevice = selectedDevice;
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(record, sizeof(DeviceCacheRecord), 1, file) == 1 && fflush(file) == 0 && fsync(fileno(file)) == 0;
+    written = fclose(file) == 0 && written;
+
+    if (!written || rename(tmpPath, path) != 0)
+    {
+        fprintf(stderr, "Failed to save the device cache to %s\n", path);
+        remove(tmpPath);
+        return;
+    }
 
     if (verbose)
     {
-        VkPhysicalDeviceProperties deviceProperties;
-        vkGetPhysicalDeviceProperties(selectedDevice, &deviceProperties);
         printf("=========================================\n");
-        printf("Selected device: %s\n", deviceProperties.deviceName);
+        printf("Device cache saved to %s\n", path);
     }
+} // saveDeviceCache
 
-    return APP_SUCCESS;
-} // selectPhysicalDevice
-
-uint32_t computeDeviceScore(VkPhysicalDevice device)
+uint32_t computeDeviceScore(const DeviceCapabilities *capabilities, const DeviceBenchmark *benchmark)
 {
+    // With --benchmark-devices the measured throughput decides, the geometric mean keeps one
+    // of the two from dominating. A device whose benchmark failed scores 1 and is only taken
+    // when nothing else is suitable
+    if (benchmark != NULL)
+        return 1 + (uint32_t)(sqrt(benchmark->computeGflops * benchmark->fillGBps) * 100.0);
+
     // For now, we prefer discrete GPUs over integrated GPUs, and we also prefer GPUs over CPUs
     // We also prefer GPUs with a higher maxImageDimension2D
-    VkPhysicalDeviceProperties deviceProperties;
-    vkGetPhysicalDeviceProperties(device, &deviceProperties);
+    const VkPhysicalDeviceProperties *deviceProperties = &capabilities->properties;
     uint32_t deviceScore = 0;
 
-    if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
+    if (deviceProperties->deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU)
     {
         deviceScore += 1000;
     }
-    else if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU)
+    else if (deviceProperties->deviceType == VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU)
     {
         deviceScore += 500;
     }
-    else if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU)
+    else if (deviceProperties->deviceType == VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU)
     {
         deviceScore += 250;
     }
-    else if (deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)
+    else if (deviceProperties->deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU)
     {
         deviceScore += 100;
     }
 
-    deviceScore += deviceProperties.limits.maxImageDimension2D;
+    deviceScore += deviceProperties->limits.maxImageDimension2D;
 
     return deviceScore;
 } // computeDeviceScore
 
-bool isDeviceSuitable(VkPhysicalDevice device, VkSurfaceKHR surface)
+bool benchmarkDevice(App *app, const DeviceCapabilities *capabilities, DeviceBenchmark *benchmark)
 {
-    // With the snippet below we can filter out some devices to test other PhysicalDevice
-    // VkPhysicalDeviceProperties deviceProperties;
-    // vkGetPhysicalDeviceProperties(device, &deviceProperties);
-    // if (strcmp(deviceProperties.deviceName, "NVIDIA GeForce RTX 4090") == 0)
-    // {
-    //     return false;
-    // }
+    memset(benchmark, 0, sizeof(DeviceBenchmark));
 
-    // We need to check if the device has a graphics and presentation queue family
-    if (!deviceHasGraphicsQueueFamily(device))
-        return false;
-    if (!deviceHasPresentationQueueFamily(device, surface))
-        return false;
+    // Measured once per device and driver version
+    const char *cachePath = app->config.deviceBenchmarkPath;
+    if (cachePath != NULL && loadDeviceBenchmark(cachePath, &capabilities->properties, benchmark))
+    {
+        if (verbose)
+            printf("\t\tBenchmark (cached): %.1f GFLOP/s, %.1f GB/s\n", benchmark->computeGflops, benchmark->fillGBps);
+        return true;
+    }
 
-    // If it supports the required extensions
-    if (!deviceHasRequiredExtensions(device))
+    DeviceBenchmarkContext context = {0};
+    bool measured = createDeviceBenchmarkContext(app, capabilities, &context) && runDeviceBenchmark(&context, benchmark);
+    destroyDeviceBenchmarkContext(&context);
+    if (!measured)
+    {
+        fprintf(stderr, "Failed to benchmark %s\n", capabilities->properties.deviceName);
         return false;
+    }
 
-    // And if its swap chain is valid, note that it's important to check this AFTER having
-    // ensured that the device has the Swapchain extension
-    if (!deviceHasSwapChainSupport(device, surface))
-        return false;
+    if (cachePath != NULL)
+        saveDeviceBenchmark(cachePath, &capabilities->properties, benchmark);
+
+    if (verbose)
+        printf("\t\tBenchmark: %.1f GFLOP/s, %.1f GB/s\n", benchmark->computeGflops, benchmark->fillGBps);
 
     return true;
-} // isDeviceSuitable
+} // benchmarkDevice
 
-bool deviceHasSwapChainSupport(VkPhysicalDevice device, VkSurfaceKHR surface)
+bool createDeviceBenchmarkContext(App *app, const DeviceCapabilities *capabilities, DeviceBenchmarkContext *context)
 {
-    // For now the only thing we need to do is to ensure is that the device has at least
-    // one supported surface format and present mode given the surface.
+    // Every graphics family supports compute and transfers, a single queue does it all
+    uint32_t queueFamilyIndex = 0;
+    while (!(capabilities->queueFamilies[queueFamilyIndex].queueFlags & VK_QUEUE_GRAPHICS_BIT))
+        ++queueFamilyIndex;
+
+    float queuePriority = 1.0f;
+    VkDeviceQueueCreateInfo queueCreateInfo = {0};
+    queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueCreateInfo.queueFamilyIndex = queueFamilyIndex;
+    queueCreateInfo.queueCount = 1;
+    queueCreateInfo.pQueuePriorities = &queuePriority;
 
-    // First get the physical device surface capabilities
-    VkSurfaceCapabilitiesKHR surfaceCapabilities = {0};
-    VkResult vkResult = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface, &surfaceCapabilities);
+    VkDeviceCreateInfo deviceCreateInfo = {0};
+    deviceCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+    deviceCreateInfo.queueCreateInfoCount = 1;
+    deviceCreateInfo.pQueueCreateInfos = &queueCreateInfo;
+    deviceCreateInfo.enabledExtensionCount = ARRAY_LEN(requiredDeviceExtensions);
+    deviceCreateInfo.ppEnabledExtensionNames = requiredDeviceExtensions;
+
+    VkResult vkResult = vkCreateDevice(capabilities->device, &deviceCreateInfo, NULL, &context->device);
     if (vkResult != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to get physical device surface capabilities: %d\n", vkResult);
+        fprintf(stderr, "Failed to create benchmark device: %d\n", vkResult);
         return false;
     }
+    vkGetDeviceQueue(context->device, queueFamilyIndex, 0, &context->queue);
 
-    if (verbose)
-    {
-        printf("\t\tSurface capabilities:\n");
-        printf("\t\t\tMin image count: %u\n", surfaceCapabilities.minImageCount);
-        printf("\t\t\tMax image count: %u\n", surfaceCapabilities.maxImageCount);
-        printf("\t\t\tCurrent extent: %u, %u\n", surfaceCapabilities.currentExtent.width, surfaceCapabilities.currentExtent.height);
-        printf("\t\t\tMin image extent: %u, %u\n", surfaceCapabilities.minImageExtent.width, surfaceCapabilities.minImageExtent.height);
-        printf("\t\t\tMax image extent: %u, %u\n", surfaceCapabilities.maxImageExtent.width, surfaceCapabilities.maxImageExtent.height);
-        printf("\t\t\tMax image array layers: %u\n", surfaceCapabilities.maxImageArrayLayers);
-        printf("\t\t\tSupported transforms: %x\n", surfaceCapabilities.supportedTransforms);
-        printf("\t\t\tCurrent transform: %x\n", surfaceCapabilities.currentTransform);
-        printf("\t\t\tSupported composite alpha: %x\n", surfaceCapabilities.supportedCompositeAlpha);
-        printf("\t\t\tSupported usage flags: %x\n", surfaceCapabilities.supportedUsageFlags);
-    }
+    VkCommandPoolCreateInfo commandPoolCreateInfo = {0};
+    commandPoolCreateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    commandPoolCreateInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    commandPoolCreateInfo.queueFamilyIndex = queueFamilyIndex;
+
+    VkCommandBufferAllocateInfo commandBufferAllocateInfo = {0};
+    commandBufferAllocateInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    commandBufferAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    commandBufferAllocateInfo.commandBufferCount = 1;
 
-    // Then get the physical device surface formats
-    uint32_t surfaceFormatCount = 0;
-    vkResult = vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &surfaceFormatCount, NULL);
-    if (vkResult != VK_SUCCESS || surfaceFormatCount == 0)
+    VkFenceCreateInfo fenceCreateInfo = {0};
+    fenceCreateInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    if (vkCreateCommandPool(context->device, &commandPoolCreateInfo, NULL, &context->commandPool) != VK_SUCCESS ||
+        (commandBufferAllocateInfo.commandPool = context->commandPool,
+         vkAllocateCommandBuffers(context->device, &commandBufferAllocateInfo, &context->commandBuffer) != VK_SUCCESS) ||
+        vkCreateFence(context->device, &fenceCreateInfo, NULL, &context->fence) != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to get physical device surface formats: %d\n", vkResult);
+        fprintf(stderr, "Failed to create the benchmark command buffer\n");
         return false;
     }
-    // VLA is ok here for simplicity.
-    VkSurfaceFormatKHR surfaceFormatsArr[surfaceFormatCount];
-    vkResult = vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &surfaceFormatCount, surfaceFormatsArr);
-    if (vkResult != VK_SUCCESS)
+
+    // The compute results and the image cleared by the fill-rate test
+    VkBufferCreateInfo bufferCreateInfo = {0};
+    bufferCreateInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    bufferCreateInfo.size = (VkDeviceSize)BENCHMARK_COMPUTE_INVOCATIONS * sizeof(float) * 4;
+    bufferCreateInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+    bufferCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    VkImageCreateInfo imageCreateInfo = {0};
+    imageCreateInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageCreateInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageCreateInfo.format = VK_FORMAT_R8G8B8A8_UNORM;
+    imageCreateInfo.extent = (VkExtent3D){BENCHMARK_FILL_EXTENT, BENCHMARK_FILL_EXTENT, 1};
+    imageCreateInfo.mipLevels = 1;
+    imageCreateInfo.arrayLayers = 1;
+    imageCreateInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageCreateInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageCreateInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    imageCreateInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    imageCreateInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+    if (vkCreateBuffer(context->device, &bufferCreateInfo, NULL, &context->buffer) != VK_SUCCESS ||
+        vkCreateImage(context->device, &imageCreateInfo, NULL, &context->image) != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to get physical device surface formats: %d\n", vkResult);
+        fprintf(stderr, "Failed to create the benchmark resources\n");
         return false;
     }
 
-    if (verbose)
-    {
-        printf("\t\tSurface formats:\n");
-        for (uint32_t i = 0; i < surfaceFormatCount; ++i)
-        {
-            printf("\t\t\tSurface format %i:\n", i);
-            printf("\t\t\t\tFormat: %u\n", surfaceFormatsArr[i].format);
-            printf("\t\t\t\tColor space: %u\n", surfaceFormatsArr[i].colorSpace);
-        }
-    }
+    // The device has no allocator of its own, both resources get a dedicated allocation
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    vkGetPhysicalDeviceMemoryProperties(capabilities->device, &memoryProperties);
+
+    VkMemoryRequirements bufferRequirements;
+    vkGetBufferMemoryRequirements(context->device, context->buffer, &bufferRequirements);
+    VkMemoryRequirements imageRequirements;
+    vkGetImageMemoryRequirements(context->device, context->image, &imageRequirements);
 
-    // Then get the physical device surface present modes
-    uint32_t presentModeCount = 0;
-    vkResult = vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, NULL);
-    if (vkResult != VK_SUCCESS || presentModeCount == 0)
+    if (!allocateBenchmarkMemory(context->device, &memoryProperties, &bufferRequirements, &context->bufferMemory) ||
+        !allocateBenchmarkMemory(context->device, &memoryProperties, &imageRequirements, &context->imageMemory) ||
+        vkBindBufferMemory(context->device, context->buffer, context->bufferMemory, 0) != VK_SUCCESS ||
+        vkBindImageMemory(context->device, context->image, context->imageMemory, 0) != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to get physical device surface present modes: %d\n", vkResult);
+        fprintf(stderr, "Failed to allocate the benchmark memory\n");
         return false;
     }
-    // VLA is ok here for simplicity.
-    VkPresentModeKHR presentModesArr[presentModeCount];
-    vkResult = vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount, presentModesArr);
-    if (vkResult != VK_SUCCESS)
+
+    VkDescriptorSetLayoutBinding resultsBinding = {0};
+    resultsBinding.binding = 0;
+    resultsBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    resultsBinding.descriptorCount = 1;
+    resultsBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    VkDescriptorSetLayoutCreateInfo descriptorSetLayoutCreateInfo = {0};
+    descriptorSetLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    descriptorSetLayoutCreateInfo.bindingCount = 1;
+    descriptorSetLayoutCreateInfo.pBindings = &resultsBinding;
+
+    VkDescriptorPoolSize poolSize = {0};
+    poolSize.type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSize.descriptorCount = 1;
+
+    VkDescriptorPoolCreateInfo descriptorPoolCreateInfo = {0};
+    descriptorPoolCreateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+    descriptorPoolCreateInfo.maxSets = 1;
+    descriptorPoolCreateInfo.poolSizeCount = 1;
+    descriptorPoolCreateInfo.pPoolSizes = &poolSize;
+
+    if (vkCreateDescriptorSetLayout(context->device, &descriptorSetLayoutCreateInfo, NULL, &context->descriptorSetLayout) != VK_SUCCESS ||
+        vkCreateDescriptorPool(context->device, &descriptorPoolCreateInfo, NULL, &context->descriptorPool) != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to get physical device surface present modes: %d\n", vkResult);
+        fprintf(stderr, "Failed to create the benchmark descriptors\n");
         return false;
     }
 
-    if (verbose)
+    VkDescriptorSetAllocateInfo descriptorSetAllocateInfo = {0};
+    descriptorSetAllocateInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    descriptorSetAllocateInfo.descriptorPool = context->descriptorPool;
+    descriptorSetAllocateInfo.descriptorSetCount = 1;
+    descriptorSetAllocateInfo.pSetLayouts = &context->descriptorSetLayout;
+
+    if (vkAllocateDescriptorSets(context->device, &descriptorSetAllocateInfo, &context->descriptorSet) != VK_SUCCESS)
     {
-        printf("\t\tPresent modes:\n");
-        for (uint32_t i = 0; i < presentModeCount; ++i)
-        {
-            printf("\t\t\tPresent mode %i: %u\n", i, presentModesArr[i]);
-        }
+        fprintf(stderr, "Failed to allocate the benchmark descriptor set\n");
+        return false;
     }
 
-    return true;
-} // deviceHasSwapChainSupport
+    VkDescriptorBufferInfo resultsBufferInfo = {0};
+    resultsBufferInfo.buffer = context->buffer;
+    resultsBufferInfo.offset = 0;
+    resultsBufferInfo.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet descriptorWrite = {0};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = context->descriptorSet;
+    descriptorWrite.dstBinding = 0;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrite.pBufferInfo = &resultsBufferInfo;
+    vkUpdateDescriptorSets(context->device, 1, &descriptorWrite, 0, NULL);
+
+    VkPushConstantRange pushConstantRange = {0};
+    pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pushConstantRange.offset = 0;
+    pushConstantRange.size = sizeof(uint32_t);
 
-bool deviceHasRequiredExtensions(VkPhysicalDevice device)
-{
-    // It is the same as for the instance, we need to get the available extensions and compare them
-    // with the required ones
-    uint32_t availableExtensionCount = 0;
-    VkResult vkResult = vkEnumerateDeviceExtensionProperties(device, NULL, &availableExtensionCount, NULL);
-    if (vkResult != VK_SUCCESS)
+    VkPipelineLayoutCreateInfo pipelineLayoutCreateInfo = {0};
+    pipelineLayoutCreateInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutCreateInfo.setLayoutCount = 1;
+    pipelineLayoutCreateInfo.pSetLayouts = &context->descriptorSetLayout;
+    pipelineLayoutCreateInfo.pushConstantRangeCount = 1;
+    pipelineLayoutCreateInfo.pPushConstantRanges = &pushConstantRange;
+
+    if (vkCreatePipelineLayout(context->device, &pipelineLayoutCreateInfo, NULL, &context->pipelineLayout) != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to enumerate device extension properties: %d\n", vkResult);
+        fprintf(stderr, "Failed to create the benchmark pipeline layout\n");
         return false;
     }
 
-    // VLA is ok here for simplicity.
-    VkExtensionProperties availableExtensionsArr[availableExtensionCount];
-    vkResult = vkEnumerateDeviceExtensionProperties(device, NULL, &availableExtensionCount, availableExtensionsArr);
+    VkShaderModule shaderModule = VK_NULL_HANDLE;
+    AppResult appResult = loadShader(context->device, "benchmark.spv", &shaderModule, app);
+    if (appResult != APP_SUCCESS)
+        return false;
+
+    VkComputePipelineCreateInfo pipelineCreateInfo = {0};
+    pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineCreateInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCreateInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCreateInfo.stage.module = shaderModule;
+    pipelineCreateInfo.stage.pName = "main";
+    pipelineCreateInfo.layout = context->pipelineLayout;
+    pipelineCreateInfo.basePipelineIndex = -1;
+
+    vkResult = vkCreateComputePipelines(context->device, VK_NULL_HANDLE, 1, &pipelineCreateInfo, NULL, &context->pipeline);
+    vkDestroyShaderModule(context->device, shaderModule, NULL);
     if (vkResult != VK_SUCCESS)
     {
-        fprintf(stderr, "Failed to enumerate device extension properties: %d\n", vkResult);
+        fprintf(stderr, "Failed to create the benchmark pipeline: %d\n", vkResult);
         return false;
     }
 
-    // Too many extensions
-    // if (verbose)
-    // {
-    //     for (uint32_t i = 0; i < availableExtensionCount; ++i)
-    //     {
-    //         printf("\t\tExtensions %i.:%s\n", i + 1, availableExtensionsArr[i].extensionName);
-    //     }
-    // }
+    return true;
+} // createDeviceBenchmarkContext
 
-    for (uint32_t i = 0; i < ARRAY_LEN(requiredDeviceExtensions); ++i)
+bool allocateBenchmarkMemory(VkDevice device, const VkPhysicalDeviceMemoryProperties *memoryProperties, const VkMemoryRequirements *requirements, VkDeviceMemory *memory)
+{
+    // Device local memory when there is some, software rasterizers may only have host memory
+    uint32_t memoryTypeIndex = UINT32_MAX;
+    for (uint32_t i = 0; i < memoryProperties->memoryTypeCount; ++i)
     {
-        bool extensionFound = false;
-        for (uint32_t j = 0; j < availableExtensionCount; ++j)
+        if (!(requirements->memoryTypeBits & (1u << i)))
+            continue;
+        if (memoryTypeIndex == UINT32_MAX || (memoryProperties->memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT))
         {
-            if (strcmp(requiredDeviceExtensions[i], availableExtensionsArr[j].extensionName) == 0)
-            {
-                extensionFound = true;
+            memoryTypeIndex = i;
+            if (memoryProperties->memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)
                 break;
-            }
         }
+    }
+    if (memoryTypeIndex == UINT32_MAX)
+        return false;
 
-        if (!extensionFound)
+    VkMemoryAllocateInfo memoryAllocateInfo = {0};
+    memoryAllocateInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    memoryAllocateInfo.allocationSize = requirements->size;
+    memoryAllocateInfo.memoryTypeIndex = memoryTypeIndex;
+
+    return vkAllocateMemory(device, &memoryAllocateInfo, NULL, memory) == VK_SUCCESS;
+} // allocateBenchmarkMemory
+
+bool runDeviceBenchmark(DeviceBenchmarkContext *context, DeviceBenchmark *benchmark)
+{
+    // The first run pays for the lazy allocations of the driver and is not counted, the best
+    // of the others is kept. The runs are short, the point is to tell apart devices that are
+    // far apart, like a discrete GPU, an integrated one and a software rasterizer
+    double bestComputeMs = 0.0;
+    double bestFillMs = 0.0;
+    for (uint32_t run = 0; run <= BENCHMARK_RUNS; ++run)
+    {
+        for (uint32_t test = 0; test < 2; ++test)
         {
-            fprintf(stderr, "Required extension %s is not supported\n", requiredDeviceExtensions[i]);
-            return false;
+            VkCommandBufferBeginInfo beginInfo = {0};
+            beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+            beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+            if (vkBeginCommandBuffer(context->commandBuffer, &beginInfo) != VK_SUCCESS)
+                return false;
+
+            if (test == 0)
+            {
+                uint32_t iterations = BENCHMARK_COMPUTE_ITERATIONS;
+                vkCmdBindPipeline(context->commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, context->pipeline);
+                vkCmdBindDescriptorSets(context->commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, context->pipelineLayout, 0, 1, &context->descriptorSet, 0, NULL);
+                vkCmdPushConstants(context->commandBuffer, context->pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(uint32_t), &iterations);
+                vkCmdDispatch(context->commandBuffer, BENCHMARK_COMPUTE_INVOCATIONS / 256, 1, 1);
+            }
+            else
+            {
+                VkImageMemoryBarrier barrier = {0};
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.srcAccessMask = 0;
+                barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+                barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+                barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.image = context->image;
+                barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                barrier.subresourceRange.levelCount = 1;
+                barrier.subresourceRange.layerCount = 1;
+                vkCmdPipelineBarrier(context->commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &barrier);
+
+                for (uint32_t i = 0; i < BENCHMARK_FILL_PASSES; ++i)
+                {
+                    VkClearColorValue clearColor = {.float32 = {(float)i / BENCHMARK_FILL_PASSES, 0.5f, 0.25f, 1.0f}};
+                    vkCmdClearColorImage(context->commandBuffer, context->image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, &clearColor, 1, &barrier.subresourceRange);
+                }
+            }
+
+            if (vkEndCommandBuffer(context->commandBuffer) != VK_SUCCESS)
+                return false;
+
+            VkSubmitInfo submitInfo = {0};
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &context->commandBuffer;
+
+            double startMs = getTimeMs();
+            if (vkQueueSubmit(context->queue, 1, &submitInfo, context->fence) != VK_SUCCESS ||
+                vkWaitForFences(context->device, 1, &context->fence, VK_TRUE, UINT64_MAX) != VK_SUCCESS)
+                return false;
+            double elapsedMs = getTimeMs() - startMs;
+
+            if (vkResetFences(context->device, 1, &context->fence) != VK_SUCCESS)
+                return false;
+
+            if (run == 0)
+                continue;
+            double *bestMs = test == 0 ? &bestComputeMs : &bestFillMs;
+            if (*bestMs == 0.0 || elapsedMs < *bestMs)
+                *bestMs = elapsedMs;
         }
     }
 
+    double flops = (double)BENCHMARK_COMPUTE_INVOCATIONS * BENCHMARK_COMPUTE_ITERATIONS * 16.0;
+    double bytes = (double)BENCHMARK_FILL_EXTENT * BENCHMARK_FILL_EXTENT * 4.0 * BENCHMARK_FILL_PASSES;
+    benchmark->computeGflops = bestComputeMs > 0.0 ? flops / (bestComputeMs * 1e6) : 0.0;
+    benchmark->fillGBps = bestFillMs > 0.0 ? bytes / (bestFillMs * 1e6) : 0.0;
+
     return true;
-} // deviceHasRequiredExtensions
+} // runDeviceBenchmark
 
-bool deviceHasPresentationQueueFamily(VkPhysicalDevice device, VkSurfaceKHR surface)
+void destroyDeviceBenchmarkContext(DeviceBenchmarkContext *context)
+{
+    if (context->device == VK_NULL_HANDLE)
+        return;
+
+    // Destroying a null handle is a no-op, whatever was not created is skipped
+    vkDestroyPipeline(context->device, context->pipeline, NULL);
+    vkDestroyPipelineLayout(context->device, context->pipelineLayout, NULL);
+    vkDestroyDescriptorPool(context->device, context->descriptorPool, NULL);
+    vkDestroyDescriptorSetLayout(context->device, context->descriptorSetLayout, NULL);
+    vkDestroyImage(context->device, context->image, NULL);
+    vkDestroyBuffer(context->device, context->buffer, NULL);
+    vkFreeMemory(context->device, context->imageMemory, NULL);
+    vkFreeMemory(context->device, context->bufferMemory, NULL);
+    vkDestroyFence(context->device, context->fence, NULL);
+    vkDestroyCommandPool(context->device, context->commandPool, NULL);
+    vkDestroyDevice(context->device, NULL);
+
+    memset(context, 0, sizeof(DeviceBenchmarkContext));
+} // destroyDeviceBenchmarkContext
+
+bool loadDeviceBenchmark(const char *path, const VkPhysicalDeviceProperties *deviceProperties, DeviceBenchmark *benchmark)
 {
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
+    // A missing file is the normal case on the first run
+    FILE *file = fopen(path, "r");
+    if (file == NULL)
+        return false;
 
-    // VLA is ok here for simplicity.
-    VkQueueFamilyProperties queueFamiliesArr[queueFamilyCount];
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamiliesArr);
+    char uuid[VK_UUID_SIZE * 2 + 1];
+    formatUuid(deviceProperties->pipelineCacheUUID, uuid);
 
-    for (uint32_t i = 0; i < queueFamilyCount; ++i)
+    // One line per device and driver version, the last matching line wins
+    bool found = false;
+    char line[256];
+    while (fgets(line, sizeof(line), file) != NULL)
     {
-        VkBool32 presentationSupported = VK_FALSE;
-        VkResult result = vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentationSupported);
-        if (result != VK_SUCCESS)
+        unsigned int vendorID = 0;
+        unsigned int deviceID = 0;
+        unsigned int driverVersion = 0;
+        char lineUuid[VK_UUID_SIZE * 2 + 1] = {0};
+        double computeGflops = 0.0;
+        double fillGBps = 0.0;
+        if (sscanf(line, "%x %x %u %32s %lf %lf", &vendorID, &deviceID, &driverVersion, lineUuid, &computeGflops, &fillGBps) != 6)
+            continue;
+
+        if (vendorID == deviceProperties->vendorID && deviceID == deviceProperties->deviceID &&
+            driverVersion == deviceProperties->driverVersion && strcmp(lineUuid, uuid) == 0)
         {
-            fprintf(stderr, "Failed to check presentation support: %d\n", result);
-            return false;
+            benchmark->computeGflops = computeGflops;
+            benchmark->fillGBps = fillGBps;
+            found = true;
         }
+    }
+    fclose(file);
+
+    return found;
+} // loadDeviceBenchmark
+
+void saveDeviceBenchmark(const char *path, const VkPhysicalDeviceProperties *deviceProperties, const DeviceBenchmark *benchmark)
+{
+    FILE *file = fopen(path, "a");
+    if (file == NULL)
+    {
+        fprintf(stderr, "Failed to open %s to save the device benchmark\n", path);
+        return;
+    }
+
+    char uuid[VK_UUID_SIZE * 2 + 1];
+    formatUuid(deviceProperties->pipelineCacheUUID, uuid);
+    fprintf(file, "%08x %08x %u %s %.3f %.3f\n", deviceProperties->vendorID, deviceProperties->deviceID, deviceProperties->driverVersion, uuid,
+            benchmark->computeGflops, benchmark->fillGBps);
+
+    if (fclose(file) != 0)
+        fprintf(stderr, "Failed to save the device benchmark to %s\n", path);
+} // saveDeviceBenchmark
+
+void formatUuid(const uint8_t uuid[VK_UUID_SIZE], char text[VK_UUID_SIZE * 2 + 1])
+{
+    for (uint32_t i = 0; i < VK_UUID_SIZE; ++i)
+    {
+        snprintf(text + i * 2, 3, "%02x", uuid[i]);
+    }
+} // formatUuid
+
+bool isDeviceSuitable(const DeviceCapabilities *capabilities)
+{
+    // With the snippet below we can filter out some devices to test other PhysicalDevice
+    // if (strcmp(capabilities->properties.deviceName, "NVIDIA GeForce RTX 4090") == 0)
+    // {
+    //     return false;
+    // }
+
+    // We need to check if the device has a graphics and presentation queue family
+    if (!deviceHasGraphicsQueueFamily(capabilities))
+        return false;
+    if (!deviceHasPresentationQueueFamily(capabilities))
+        return false;
+
+    // If it supports the required extensions
+    if (!capabilities->hasRequiredExtensions)
+        return false;
+
+    // And if its swap chain is valid
+    if (!deviceHasSwapChainSupport(capabilities))
+        return false;
+
+    return true;
+} // isDeviceSuitable
+
+bool deviceHasSwapChainSupport(const DeviceCapabilities *capabilities)
+{
+    // For now the only thing we need to do is to ensure is that the device has at least
+    // one supported surface format and present mode given the surface.
+    return capabilities->surfaceFormatCount > 0 && capabilities->presentModeCount > 0;
+} // deviceHasSwapChainSupport
 
-        if (presentationSupported)
+bool deviceHasPresentationQueueFamily(const DeviceCapabilities *capabilities)
+{
+    for (uint32_t i = 0; i < capabilities->queueFamilyCount; ++i)
+    {
+        if (capabilities->presentationSupport[i])
         {
             return true;
         }
@@ -1327,18 +9884,11 @@ bool deviceHasPresentationQueueFamily(VkPhysicalDevice device, VkSurfaceKHR surf
     return false;
 } // deviceHasPresentationQueueFamily
 
-bool deviceHasGraphicsQueueFamily(VkPhysicalDevice device)
+bool deviceHasGraphicsQueueFamily(const DeviceCapabilities *capabilities)
 {
-    uint32_t queueFamilyCount = 0;
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, NULL);
-
-    // VLA is ok here for simplicity.
-    VkQueueFamilyProperties queueFamiliesArr[queueFamilyCount];
-    vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamiliesArr);
-
-    for (uint32_t i = 0; i < queueFamilyCount; ++i)
+    for (uint32_t i = 0; i < capabilities->queueFamilyCount; ++i)
     {
-        if (queueFamiliesArr[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
+        if (capabilities->queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT)
         {
             return true;
         }
@@ -1349,6 +9899,28 @@ bool deviceHasGraphicsQueueFamily(VkPhysicalDevice device)
 
 AppResult createSurface(App *app)
 {
+    if (app->config.headless)
+    {
+        // The headless surface is an extension function so it has to be loaded manually
+        PFN_vkCreateHeadlessSurfaceEXT createHeadlessSurface = (PFN_vkCreateHeadlessSurfaceEXT)vkGetInstanceProcAddr(app->instance, "vkCreateHeadlessSurfaceEXT");
+        if (createHeadlessSurface == NULL)
+        {
+            fprintf(stderr, "vkCreateHeadlessSurfaceEXT is not available\n");
+            return APP_ERROR_VULKAN_HEADLESS_SURFACE_NOT_SUPPORTED;
+        }
+
+        VkHeadlessSurfaceCreateInfoEXT headlessSurfaceCreateInfo = {0};
+        headlessSurfaceCreateInfo.sType = VK_STRUCTURE_TYPE_HEADLESS_SURFACE_CREATE_INFO_EXT;
+
+        VkResult vkResult = createHeadlessSurface(app->instance, &headlessSurfaceCreateInfo, NULL, &app->surface);
+        if (vkResult != VK_SUCCESS)
+        {
+            fprintf(stderr, "Failed to create headless surface: %d\n", vkResult);
+            return APP_ERROR_VULKAN_CREATE_HEADLESS_SURFACE;
+        }
+        return APP_SUCCESS;
+    }
+
     if (glfwCreateWindowSurface(app->instance, app->window, NULL, &app->surface) != VK_SUCCESS)
     {
         fprintf(stderr, "Failed to create window surface\n");
@@ -1359,6 +9931,16 @@ AppResult createSurface(App *app)
 
 AppResult createVulkanInstance(App *app)
 {
+    // The instance asks for the newest version up to 1.3 the loader supports, a 1.0 loader
+    // has no vkEnumerateInstanceVersion and would reject anything newer than 1.0. Each device
+    // is then used up to the lower of this version and its own
+    app->instanceApiVersion = VK_API_VERSION_1_0;
+    PFN_vkEnumerateInstanceVersion enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(NULL, "vkEnumerateInstanceVersion");
+    if (enumerateInstanceVersion != NULL && enumerateInstanceVersion(&app->instanceApiVersion) != VK_SUCCESS)
+        app->instanceApiVersion = VK_API_VERSION_1_0;
+    if (app->instanceApiVersion > VK_API_VERSION_1_3)
+        app->instanceApiVersion = VK_API_VERSION_1_3;
+
     // First we need a VkApplicationInfo
     VkApplicationInfo appInfo = {
         .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO,
@@ -1367,29 +9949,38 @@ AppResult createVulkanInstance(App *app)
         .applicationVersion = VK_MAKE_VERSION(1, 0, 0),
         .pEngineName = "No Engine",
         .engineVersion = VK_MAKE_VERSION(1, 0, 0),
-        .apiVersion = VK_API_VERSION_1_0,
+        .apiVersion = app->instanceApiVersion,
     };
 
-    // Then we need to get the required extensions from GLFW and from the user, this can be
-    // the case for apple users for example. They are defined in the
-    // requiredInstanceExtensions
-    uint32_t glfwRequiredExtensionCount = 0;
-    const char **glfwRequiredExtensions = glfwGetRequiredInstanceExtensions(&glfwRequiredExtensionCount);
+    // Then we need to get the required extensions for the surface, from GLFW or for the
+    // headless surface, and from the user, this can be the case for apple users for
+    // example. They are defined in the requiredInstanceExtensions
+    uint32_t surfaceRequiredExtensionCount = 0;
+    const char **surfaceRequiredExtensions = NULL;
+    if (app->config.headless)
+    {
+        surfaceRequiredExtensionCount = ARRAY_LEN(headlessInstanceExtensions);
+        surfaceRequiredExtensions = headlessInstanceExtensions;
+    }
+    else
+    {
+        surfaceRequiredExtensions = glfwGetRequiredInstanceExtensions(&surfaceRequiredExtensionCount);
+    }
 
     if (verbose)
     {
         printf("=========================================\n");
         printf("Required extension(s) for the Vulkan instance:\n");
-        printf("\tFrom GLFW:\n");
-        if (glfwRequiredExtensionCount == 0)
+        printf(app->config.headless ? "\tFor the headless surface:\n" : "\tFrom GLFW:\n");
+        if (surfaceRequiredExtensionCount == 0)
         {
             printf("\t\tNone\n");
         }
         else
         {
-            for (uint32_t i = 0; i < glfwRequiredExtensionCount; ++i)
+            for (uint32_t i = 0; i < surfaceRequiredExtensionCount; ++i)
             {
-                printf("\t\t%i. %s\n", i + 1, glfwRequiredExtensions[i]);
+                printf("\t\t%i. %s\n", i + 1, surfaceRequiredExtensions[i]);
             }
         }
 
@@ -1412,25 +10003,25 @@ AppResult createVulkanInstance(App *app)
     uint32_t requiredInstanceExtensionsCount = 0;
     if (requiredInstanceExtensions[0] == NULL)
     {
-        requiredInstanceExtensionsCount = glfwRequiredExtensionCount;
+        requiredInstanceExtensionsCount = surfaceRequiredExtensionCount;
     }
     else
     {
-        requiredInstanceExtensionsCount = glfwRequiredExtensionCount + ARRAY_LEN(requiredInstanceExtensions);
+        requiredInstanceExtensionsCount = surfaceRequiredExtensionCount + ARRAY_LEN(requiredInstanceExtensions);
     }
 
     // VLA is ok here for simplicity.
     const char *concatenatedRequiredInstanceExtensions[requiredInstanceExtensionsCount];
     // Now we can concatenate the required extensions together...
-    for (uint32_t i = 0; i < glfwRequiredExtensionCount; ++i)
+    for (uint32_t i = 0; i < surfaceRequiredExtensionCount; ++i)
     {
-        concatenatedRequiredInstanceExtensions[i] = glfwRequiredExtensions[i];
+        concatenatedRequiredInstanceExtensions[i] = surfaceRequiredExtensions[i];
     }
-    if (concatenatedRequiredInstanceExtensions[0] != NULL)
+    if (requiredInstanceExtensions[0] != NULL)
     {
         for (uint32_t i = 0; i < ARRAY_LEN(requiredInstanceExtensions); ++i)
         {
-            concatenatedRequiredInstanceExtensions[glfwRequiredExtensionCount + i] = requiredInstanceExtensions[i];
+            concatenatedRequiredInstanceExtensions[surfaceRequiredExtensionCount + i] = requiredInstanceExtensions[i];
         }
     }
 
@@ -1596,7 +10187,7 @@ AppResult initGLFW(App *app)
     }
 
     glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
-    glfwWindowHint(GLFW_RESIZABLE, GLFW_FALSE);
+    glfwWindowHint(GLFW_RESIZABLE, GLFW_TRUE);
 
     app->window = glfwCreateWindow(WIDTH, HEIGHT, TITLE, NULL, NULL);
     if (!app->window)
@@ -1605,16 +10196,115 @@ AppResult initGLFW(App *app)
         return APP_ERROR_GLFW_WINDOW;
     }
 
+    // Not every platform reports VK_ERROR_OUT_OF_DATE_KHR on resize so we also listen to
+    // the window
+    glfwSetWindowUserPointer(app->window, app);
+    glfwSetFramebufferSizeCallback(app->window, framebufferResizeCallback);
+
     return APP_SUCCESS;
 } // initGLFW
 
+void framebufferResizeCallback(GLFWwindow *window, int width, int height)
+{
+    (void)width;
+    (void)height;
+    App *app = glfwGetWindowUserPointer(window);
+    app->framebufferResized = true;
+} // framebufferResizeCallback
+
 AppResult cleanup(App *app, AppResult result)
 {
-    if (app->graphicsPipeline != VK_NULL_HANDLE)
-        vkDestroyPipeline(app->logicalDevice, app->graphicsPipeline, NULL);
+    // Nothing can be destroyed while the GPU may still be using it
+    if (app->logicalDevice != VK_NULL_HANDLE)
+        vkDeviceWaitIdle(app->logicalDevice);
+
+    destroyRecordWorkers(app);
+    destroyFrameStream(app);
+
+    // A failed startup can leave pipelines compiling, they are finished before anything they
+    // use is destroyed
+    destroyJobPool(app);
+    destroyPipelineBuilds(app);
+
+    for (uint32_t i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i)
+    {
+        FrameData *frame = &app->frames[i];
+        if (frame->inFlightFence != VK_NULL_HANDLE)
+            vkDestroyFence(app->logicalDevice, frame->inFlightFence, NULL);
+        if (frame->imageAvailableSemaphore != VK_NULL_HANDLE)
+            vkDestroySemaphore(app->logicalDevice, frame->imageAvailableSemaphore, NULL);
+        // Destroying the pool also frees its command buffer
+        if (frame->commandPool != VK_NULL_HANDLE)
+            vkDestroyCommandPool(app->logicalDevice, frame->commandPool, NULL);
+        if (frame->computeFence != VK_NULL_HANDLE)
+            vkDestroyFence(app->logicalDevice, frame->computeFence, NULL);
+        if (frame->computeCommandPool != VK_NULL_HANDLE)
+            vkDestroyCommandPool(app->logicalDevice, frame->computeCommandPool, NULL);
+    }
+
+    free(app->imagesInFlight);
+
+    if (app->renderFinishedSemaphores != NULL)
+    {
+        for (uint32_t i = 0; i < app->swapChainImageCount; ++i)
+        {
+            if (app->renderFinishedSemaphores[i] != VK_NULL_HANDLE)
+                vkDestroySemaphore(app->logicalDevice, app->renderFinishedSemaphores[i], NULL);
+        }
+        free(app->renderFinishedSemaphores);
+    }
+
+    if (app->gpuProfiler.queryPool != VK_NULL_HANDLE)
+        vkDestroyQueryPool(app->logicalDevice, app->gpuProfiler.queryPool, NULL);
+
+    destroyRetiredSwapChain(app);
+
+    destroyPipelineVariants(app);
+
+    if (app->computePipeline != VK_NULL_HANDLE)
+        vkDestroyPipeline(app->logicalDevice, app->computePipeline, NULL);
+    if (app->computePipelineLayout != VK_NULL_HANDLE)
+        vkDestroyPipelineLayout(app->logicalDevice, app->computePipelineLayout, NULL);
+    // Destroying the pool also frees its descriptor set
+    if (app->computeDescriptorPool != VK_NULL_HANDLE)
+        vkDestroyDescriptorPool(app->logicalDevice, app->computeDescriptorPool, NULL);
+    if (app->computeDescriptorSetLayout != VK_NULL_HANDLE)
+        vkDestroyDescriptorSetLayout(app->logicalDevice, app->computeDescriptorSetLayout, NULL);
+    if (app->particleBuffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &app->particleBuffer, &app->particleAllocation);
+    if (app->instanceBuffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &app->instanceBuffer, &app->instanceAllocation);
+    if (app->vertexBuffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &app->vertexBuffer, &app->vertexAllocation);
+    if (app->indexBuffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &app->indexBuffer, &app->indexAllocation);
+
+    if (app->cullingPipeline != VK_NULL_HANDLE)
+        vkDestroyPipeline(app->logicalDevice, app->cullingPipeline, NULL);
+    if (app->cullingPipelineLayout != VK_NULL_HANDLE)
+        vkDestroyPipelineLayout(app->logicalDevice, app->cullingPipelineLayout, NULL);
+    if (app->cullingDescriptorPool != VK_NULL_HANDLE)
+        vkDestroyDescriptorPool(app->logicalDevice, app->cullingDescriptorPool, NULL);
+    if (app->cullingDescriptorSetLayout != VK_NULL_HANDLE)
+        vkDestroyDescriptorSetLayout(app->logicalDevice, app->cullingDescriptorSetLayout, NULL);
+    if (app->drawCommandBuffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &app->drawCommandBuffer, &app->drawCommandAllocation);
+    if (app->drawCountBuffer != VK_NULL_HANDLE)
+        destroyBuffer(app, &app->drawCountBuffer, &app->drawCountAllocation);
+
+    destroyFrameCapture(app);
+    destroyTextureStreamer(app);
+
+    if (app->pipelineCache != VK_NULL_HANDLE)
+    {
+        savePipelineCache(app);
+        vkDestroyPipelineCache(app->logicalDevice, app->pipelineCache, NULL);
+    }
 
     if (app->pipelineLayout != VK_NULL_HANDLE)
         vkDestroyPipelineLayout(app->logicalDevice, app->pipelineLayout, NULL);
+    destroyBindlessTable(app);
+    destroyUniformRing(app);
 
     if (app->swapChainFramebuffers != NULL)
     {
@@ -1637,11 +10327,17 @@ AppResult cleanup(App *app, AppResult result)
         free(app->swapChainImageViews);
     }
 
+    free(app->swapChainImages);
+
     if (app->swapChain != VK_NULL_HANDLE)
         vkDestroySwapchainKHR(app->logicalDevice, app->swapChain, NULL);
 
     if (app->logicalDevice != VK_NULL_HANDLE)
+    {
+        destroyUploader(app);
+        destroyMemoryAllocator(app);
         vkDestroyDevice(app->logicalDevice, NULL);
+    }
 
     if (app->surface != VK_NULL_HANDLE)
         vkDestroySurfaceKHR(app->instance, app->surface, NULL);
@@ -1652,7 +10348,8 @@ AppResult cleanup(App *app, AppResult result)
     if (app->window != NULL)
         glfwDestroyWindow(app->window);
 
-    glfwTerminate();
+    if (!app->config.headless)
+        glfwTerminate();
 
     return result;
 } // cleanup
@@ -0,0 +1,49 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) flat in uint instanceIndex;
+layout(location = 2) in vec2 texCoord;
+
+layout(location = 0) out vec4 outColor;
+
+// Slots of the storage buffer array filled by createMaterials, see BINDLESS_* in main.c
+const uint OBJECT_MATERIALS_SLOT = 0;
+const uint MATERIALS_SLOT = 1;
+const uint NO_TEXTURE = 0xffffffffu;
+
+// Specialization constant, see PIPELINE_FEATURE_TEXTURES in main.c
+layout(constant_id = 2) const bool TEXTURES = true;
+
+// Same layout as the Material struct of main.c
+struct Material
+{
+    vec4 color;
+    uint textureIndex;
+};
+
+// Set 0 is the uniform ring of vert.vert. Every storage buffer of the bindless set is declared
+// once per struct it can hold, the descriptors alias each other
+layout(std430, set = 1, binding = 0) readonly buffer ObjectMaterials
+{
+    uint materialIds[];
+} objectMaterialBuffers[];
+
+layout(std430, set = 1, binding = 0) readonly buffer Materials
+{
+    Material materials[];
+} materialBuffers[];
+
+layout(set = 1, binding = 1) uniform texture2D textures[];
+layout(set = 1, binding = 2) uniform sampler textureSampler;
+
+void main() {
+    uint materialId = objectMaterialBuffers[OBJECT_MATERIALS_SLOT].materialIds[instanceIndex];
+    Material material = materialBuffers[MATERIALS_SLOT].materials[materialId];
+
+    // Neighbouring instances of the same draw can have different textures
+    vec4 color = vec4(fragColor, 1.0) * material.color;
+    if (TEXTURES && material.textureIndex != NO_TEXTURE)
+        color *= texture(sampler2D(textures[nonuniformEXT(material.textureIndex)], textureSampler), texCoord);
+    outColor = color;
+}
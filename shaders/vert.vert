@@ -1,20 +1,49 @@
 #version 450
 
+// Per vertex
+layout(location = 0) in vec2 inPosition;
+layout(location = 1) in vec3 inColor;
+
+// Per instance: offset in xy, uniform scale in z and rotation in radians in w
+layout(location = 2) in vec4 inInstanceTransform;
+
 layout(location = 0) out vec3 fragColor;
+// Only read by bindless.frag, the instance index includes firstInstance and is the object index
+layout(location = 1) flat out uint instanceIndex;
+layout(location = 2) out vec2 texCoord;
+
+// Specialization constants, see PIPELINE_FEATURE_* in main.c. The branches they turn off are
+// left out of the compiled pipeline
+layout(constant_id = 0) const bool ROTATION = true;
+layout(constant_id = 1) const bool CAMERA = true;
 
-vec2 positions[3] = vec2[](
-    vec2(0.0, -0.5),
-    vec2(0.5, 0.5),
-    vec2(-0.5, 0.5)
-);
+// Per frame, the slot of the uniform ring picked by the dynamic offset. Same layout as the
+// FrameUniforms struct of main.c
+layout(set = 0, binding = 0) uniform FrameUniforms
+{
+    vec2 viewOffset;
+    vec2 viewScale;
+} frame;
 
-vec3 colors[3] = vec3[](
-    vec3(1.0, 0.0, 0.0),
-    vec3(0.0, 1.0, 0.0),
-    vec3(0.0, 0.0, 1.0)
-);
+// Per draw, same layout as the DrawPushConstants struct of main.c
+layout(push_constant) uniform DrawParameters
+{
+    vec2 offset;
+    float scale;
+} draw;
 
 void main() {
-    gl_Position = vec4(positions[gl_VertexIndex], 0.0, 1.0);
-    fragColor = colors[gl_VertexIndex];
-}
\ No newline at end of file
+    vec2 position = inPosition * inInstanceTransform.z;
+    if (ROTATION) {
+        float s = sin(inInstanceTransform.w);
+        float c = cos(inInstanceTransform.w);
+        position = mat2(c, s, -s, c) * position;
+    }
+    position = (position + inInstanceTransform.xy) * draw.scale + draw.offset;
+    if (CAMERA)
+        position = (position - frame.viewOffset) * frame.viewScale;
+    gl_Position = vec4(position, 0.0, 1.0);
+    fragColor = inColor;
+    instanceIndex = gl_InstanceIndex;
+    texCoord = inPosition + 0.5;
+}